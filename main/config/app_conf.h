@@ -17,26 +17,51 @@
 #define IFETH             "enp109s0"
 #define HTTP_SERVER_PORT  8080
 #define CONFIG_LOG_LEVEL  LOG_DEBUG
+#define CONFIG_LOG_DEBUG  1
 #else
 #define DEFAULT_BASE_PATH "/mnt/data"
 #define IFWIFI            "wlan0"
 #define IFETH             "eth0"
 #define HTTP_SERVER_PORT  80
 #define CONFIG_LOG_LEVEL  LOG_INFO
+#define CONFIG_LOG_DEBUG  0     // log_debug e log_trace non vengono compilati
 #endif
 
-#define CONFIG_DATA_VERSION 1
+#define CONFIG_DATA_VERSION 2
+
+// All'avvio vengono letti solo nomi e numero di step; gli step sono caricati all'apertura del programma
+#define CONFIG_LAZY_PROGRAM_LOADING 1
+
+// Copia dei segmenti di log compressi anche sulla partizione dati, per conservarli tra un riavvio e l'altro
+#define CONFIG_LOG_PERSIST 1
+
+// Compressione degli archivi esportati (STORAGE_COMPRESSION_*); l'importazione riconosce qualsiasi formato
+#define CONFIG_EXPORT_COMPRESSION STORAGE_COMPRESSION_GZIP_FAST
 
 #define DRIVE_MOUNT_PATH               "/tmp/mnt"
 #define INDEX_FILE_NAME                "index.txt"
+#define PROGRAM_DB_FILE_NAME           "programmi.db"
 #define DEFAULT_PARAMS_PATH            DEFAULT_BASE_PATH "/parametri"
 #define DEFAULT_PROGRAMS_PATH          DEFAULT_BASE_PATH "/programmi"
+#define DEFAULT_HISTORY_PATH           DEFAULT_BASE_PATH "/storico"
 #define DEFAULT_PATH_FILE_DATA_VERSION DEFAULT_BASE_PATH "version.txt"
 #define DEFAULT_PATH_FILE_PARMAC       DEFAULT_PARAMS_PATH "/parmac.bin"
 #define DEFAULT_PATH_FILE_PASSWORD     DEFAULT_PARAMS_PATH "/password.txt"
 #define DEFAULT_PATH_FILE_INDEX        DEFAULT_PROGRAMS_PATH "/" INDEX_FILE_NAME
+#define DEFAULT_PATH_FILE_PROGRAM_DB   DEFAULT_PROGRAMS_PATH "/" PROGRAM_DB_FILE_NAME
+#define DEFAULT_PATH_FILE_HISTORY      DEFAULT_HISTORY_PATH "/cicli.db"
+#define DEFAULT_PATH_FILE_ALARMS       DEFAULT_HISTORY_PATH "/allarmi.db"
+#define DEFAULT_PATH_FILE_STATISTICS   DEFAULT_HISTORY_PATH "/statistiche.db"
+#define ALARM_HISTORY_FLUSH_PERIOD     30000UL
+#define STATISTICS_SAMPLE_PERIOD       60000UL
+#define STATISTICS_SAVE_PERIOD         600000UL
 #define LOGFILE                        "/tmp/DS2021_log.txt"
-#define MAX_LOGFILE_SIZE               4000000UL
+#define LOG_SEGMENT_SIZE               512000UL
+#define LOG_SEGMENT_PERIOD             (24UL * 60UL * 60UL * 1000UL)
+#define LOG_SEGMENTS_PATH              "/tmp/log"
+#define LOG_SEGMENTS_RETENTION         4000000UL
+#define LOG_PERSIST_PATH               DEFAULT_BASE_PATH "/log"
+#define LOG_PERSIST_RETENTION          1000000UL
 #define SKELETON_KEY                   "5510726719"
 #define SETTINGS_PASSWORD              "72346"
 #define LANGUAGE_RESET_DELAY           15000UL
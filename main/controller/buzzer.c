@@ -11,7 +11,7 @@
 #include <sys/select.h>
 #include <linux/limits.h>
 
-#include "log.h"
+#include "utils/async_log.h"
 #include "gel/timer/timecheck.h"
 #include "utils/system_time.h"
 
@@ -1,3 +1,6 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <linux/reboot.h>
 #include <sys/reboot.h>
 #include <unistd.h>
@@ -9,10 +12,13 @@
 #include "model/parmac.h"
 #include "storage/disk_op.h"
 #include "storage/storage.h"
+#include "storage/machine_catalog.h"
+#include "storage/cycle_history.h"
 #include "model/parciclo.h"
 #include "controller/network/wifi.h"
 #include "config/app_conf.h"
-#include "log.h"
+#include "utils/boot_timeline.h"
+#include "utils/async_log.h"
 #include "buzzer.h"
 
 
@@ -22,38 +28,66 @@ static void disk_io_callback(model_t *pmodel, void *data, void *arg);
 static void disk_io_error_callback(model_t *pmodel, void *arg);
 static void disk_io_callback_reload(model_t *pmodel, void *data, void *arg);
 static void load_programs_callback(model_t *pmodel, void *data, void *arg);
-static void load_password_callback(model_t *pmodel, void *data, void *arg);
-static void disk_io_refresh_machines_callback(model_t *pmodel, void *data, void *arg);
-
-
-static int pending_change = 0;
-
-
+static void load_program_steps(model_t *pmodel, size_t num, dryer_program_t *p);
+static void program_steps_callback(model_t *pmodel, void *data, void *arg);
+static void program_steps_error_callback(model_t *pmodel, void *arg);
+static void boot_parmac_callback(model_t *pmodel, void *data, void *arg);
+static void boot_parmac_error_callback(model_t *pmodel, void *arg);
+static void boot_programs_callback(model_t *pmodel, void *data, void *arg);
+static void boot_password_callback(model_t *pmodel, void *data, void *arg);
+static void boot_statistics_callback(model_t *pmodel, void *data, void *arg);
+static void boot_load_error_callback(model_t *pmodel, void *arg);
+static void boot_load_done(model_t *pmodel, const char *phase);
+static void cycle_history_callback(model_t *pmodel, void *data, void *arg);
+static void cycle_history_error_callback(model_t *pmodel, void *arg);
+static void learn_cycle_history(model_t *pmodel);
+static void drive_callback(model_t *pmodel, void *data, void *arg);
+static int  refresh_drive_machines(model_t *pmodel);
+static void end_cycle(model_t *pmodel, cycle_stop_reason_t reason);
+static void flush_alarm_events(model_t *pmodel, unsigned long delay);
+static void save_statistics(model_t *pmodel);
+
+
+static int    pending_change     = 0;
+static int    input_stream       = 0;
+static size_t boot_pending_loads = 0;
+static int    statistics_dirty   = 0;
+static int    statistics_flush   = 0;
+static int    resync_pending     = 0;
+
+static machine_catalog_snapshot_t *drive_machines = NULL;
+
+// Cicli gia' letti dallo storico all'avvio, dal piu' recente
+static cycle_record_t *seed_records = NULL;
+static size_t          seed_count   = 0;
+
+
+/*
+ * L'avvio non attende nulla: i caricamenti da disco sono accodati a disk_op e procedono insieme alla connessione a
+ * wpa_supplicant e alla ricerca della porta seriale, mentre la splash e' gia' a schermo. La comunicazione con la
+ * macchina e l'uscita dalla splash aspettano i quattro caricamenti contati in boot_pending_loads: parametri macchina,
+ * programmi, password (la pagina protetta non deve vedere quella di default) e statistiche (i primi cicli non devono
+ * sommarsi a contatori non ancora ripristinati). Vedi boot_load_done.
+ */
 void controller_init(model_t *pmodel) {
     buzzer_init();
-    wifi_init();
+    disk_op_init(drive_callback);
     machine_init();
-    disk_op_init();
+    wifi_init();
+    model_set_program_loader(pmodel, load_program_steps);
+    boot_timeline_mark("thread avviati");
 
-    disk_op_load_parmac(load_parmac_callback, load_parmac_error_callback, NULL);
-    while (disk_op_manage_response(pmodel) == 0) {
-        usleep(1000);
-    }
-    disk_op_load_programs(load_programs_callback, NULL, NULL);
-    while (disk_op_manage_response(pmodel) == 0) {
-        usleep(1000);
-    }
-
-    disk_op_read_file(DEFAULT_PATH_FILE_PASSWORD, load_password_callback, NULL, NULL);
-    while (disk_op_manage_response(pmodel) == 0) {
-        usleep(1000);
-    }
+    boot_pending_loads = 4;
+    disk_op_load_parmac(boot_parmac_callback, boot_parmac_error_callback, NULL);
+    disk_op_load_programs(boot_programs_callback, boot_load_error_callback, "programmi");
+    disk_op_open_stream(DEFAULT_PATH_FILE_PASSWORD, PASSWORD_MAX_SIZE, boot_password_callback,
+                        boot_load_error_callback, "password");
+    disk_op_load_statistics(boot_statistics_callback, boot_load_error_callback, "statistiche");
 
     machine_read_version();
-    machine_send_parmac(&pmodel->configuration.parmac);
     machine_send_command(COMMAND_REGISTER_EXIT_TEST);
-    buzzer_beep(2, 500);
     view_change_page(pmodel, &page_splash);
+    boot_timeline_mark("splash");
 }
 
 
@@ -91,16 +125,25 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
             break;
 
         case VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_CURRENT_MACHINE:
-            disk_op_export_current_machine(pmodel->configuration.parmac.nome, disk_io_refresh_machines_callback,
-                                           disk_io_error_callback, NULL);
+            disk_op_export_current_machine(pmodel->configuration.parmac.nome, disk_io_callback, disk_io_error_callback,
+                                           NULL);
             break;
 
-        case VIEW_CONTROLLER_MESSAGE_CODE_IMPORT_CURRENT_MACHINE:
-            disk_op_import_current_machine(cmsg->name, disk_io_callback_reload, disk_io_error_callback, NULL);
+        case VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_LOGS:
+            disk_op_export_logs(disk_io_callback, disk_io_error_callback, NULL);
             break;
 
-        case VIEW_CONTROLLER_MESSAGE_CODE_READ_LOG_FILE:
-            disk_op_read_file(LOGFILE, disk_io_callback, disk_io_error_callback, (void *)(uintptr_t)cmsg->disk_op_id);
+        case VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_ALARMS:
+            disk_op_export_alarms(disk_io_callback, disk_io_error_callback, NULL);
+            break;
+
+        case VIEW_CONTROLLER_MESSAGE_CODE_READ_ALARM_HISTORY:
+            disk_op_read_alarm_history(cmsg->from, cmsg->to, disk_io_callback, disk_io_error_callback,
+                                       (void *)(uintptr_t)cmsg->history_io_op);
+            break;
+
+        case VIEW_CONTROLLER_MESSAGE_CODE_IMPORT_CURRENT_MACHINE:
+            disk_op_import_current_machine(cmsg->name, disk_io_callback_reload, disk_io_error_callback, NULL);
             break;
 
         case VIEW_CONTROLLER_MESSAGE_CODE_CLEAR_ALARMS:
@@ -109,7 +152,13 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
 
         case VIEW_CONTROLLER_MESSAGE_CODE_START_PROGRAM:
             if (!model_is_program_running(pmodel)) {
+                if (!model_is_program_loaded(pmodel, cmsg->program)) {
+                    log_warn("Programma %zu non ancora caricato", cmsg->program);
+                    break;
+                }
                 model_start_program(pmodel, cmsg->program);
+                // Lettura di riferimento per le statistiche del ciclo
+                machine_read_statistics();
                 machine_send_step(pmodel, model_get_current_step(pmodel), model_get_current_program_number(pmodel),
                                   model_get_current_step_number(pmodel), 1);
                 pending_change = 1;
@@ -120,6 +169,7 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
 
         case VIEW_CONTROLLER_MESSAGE_CODE_STOP_MACHINE:
             pending_change = 1;
+            end_cycle(pmodel, CYCLE_STOP_REASON_USER);
             model_stop_program(pmodel);
             machine_send_command(COMMAND_REGISTER_STOP);
             break;
@@ -133,6 +183,10 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
             break;
 
         case VIEW_CONTROLLER_MESSAGE_CODE_EXIT_TEST:
+            if (input_stream) {
+                machine_stop_input_stream();
+                input_stream = 0;
+            }
             machine_send_command(COMMAND_REGISTER_EXIT_TEST);
             break;
 
@@ -165,25 +219,11 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
             break;
 
         case VIEW_CONTROLLER_MESSAGE_CODE_SAVE_ALL:
-            if (cmsg->password) {
-                disk_op_save_password((char *)model_get_password(pmodel), disk_io_callback, disk_io_error_callback,
-                                      (void *)(uintptr_t)cmsg->save_all_io_op);
-            }
             if (cmsg->parmac) {
                 machine_send_parmac(&pmodel->configuration.parmac);
-                disk_op_save_parmac(&pmodel->configuration.parmac, disk_io_callback, disk_io_error_callback,
-                                    (void *)(uintptr_t)cmsg->save_all_io_op);
-            }
-            if (cmsg->index) {
-                disk_op_save_program_index(pmodel, disk_io_callback, disk_io_error_callback,
-                                           (void *)(uintptr_t)cmsg->save_all_io_op);
-            }
-            for (size_t i = 0; i < MAX_PROGRAMS; i++) {
-                if (cmsg->programs & (1 << i)) {
-                    disk_op_save_program(model_get_program(pmodel, i), disk_io_callback, disk_io_error_callback,
-                                         (void *)(uintptr_t)cmsg->save_all_io_op);
-                }
             }
+            disk_op_save_all(pmodel, cmsg->password, cmsg->parmac, cmsg->index, cmsg->programs, disk_io_callback,
+                             disk_io_error_callback, (void *)(uintptr_t)cmsg->save_all_io_op);
             break;
 
         case VIEW_CONTROLLER_MESSAGE_CODE_CONNECT_TO_WIFI_NETWORK:
@@ -203,6 +243,21 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
             disk_op_firmware_update(disk_io_callback, disk_io_error_callback, NULL);
             break;
         }
+
+        case VIEW_CONTROLLER_MESSAGE_CODE_CANCEL_IO:
+            disk_op_cancel(DISK_OP_LANE_BULK);
+            break;
+
+        case VIEW_CONTROLLER_MESSAGE_CODE_START_INPUT_STREAM:
+            model_clear_input_edges(pmodel);
+            machine_start_input_stream();
+            input_stream = 1;
+            break;
+
+        case VIEW_CONTROLLER_MESSAGE_CODE_STOP_INPUT_STREAM:
+            machine_stop_input_stream();
+            input_stream = 0;
+            break;
     }
 
     // lv_mem_free(cmsg);
@@ -210,23 +265,33 @@ void controller_manage_message(pman_handle_t handle, void *msg) {
 
 
 void controller_manage(model_t *pmodel) {
-    static unsigned long fastts     = 0;
-    static unsigned long slowts     = 0;
-    static unsigned long wifits     = 0;
-    static int           first_sync = 1;
+    static unsigned long fastts        = 0;
+    static unsigned long slowts        = 0;
+    static unsigned long wifits        = 0;
+    static unsigned long statsts       = 0;
+    static unsigned long savets        = 0;
+    static int           first_sync    = 1;
+    static int           last_progress = -1;
 
     disk_op_manage_response(pmodel);
 
+    if (!model_is_boot_complete(pmodel)) {
+        // Senza parametri e programmi lo stato della macchina non puo' essere ripreso
+        return;
+    }
+
     if (is_expired(fastts, get_millis(), 300UL)) {
-        if (model_is_in_test(pmodel)) {
+        if (model_is_in_test(pmodel) && !input_stream) {
             machine_refresh_test_values();
         }
         machine_refresh_state();
 
-        if (model_update_drive_status(pmodel, disk_op_is_drive_mounted())) {
-            pmodel->system.num_drive_machines    = disk_op_drive_machines(&pmodel->system.drive_machines);
-            pmodel->system.firmware_update_ready = disk_op_is_firmware_present();
-            view_event((view_event_t){.code = VIEW_EVENT_CODE_DRIVE});
+        int progress = disk_op_get_progress();
+        if (progress != last_progress) {
+            last_progress = progress;
+            if (progress >= 0) {
+                view_event((view_event_t){.code = VIEW_EVENT_CODE_IO_PROGRESS, .io_progress = progress});
+            }
         }
 
         fastts = get_millis();
@@ -250,6 +315,9 @@ void controller_manage(model_t *pmodel) {
         pmodel->system.connected = ip1 || ip2;
 
         wifits = get_millis();
+    } else if (is_expired(statsts, get_millis(), STATISTICS_SAMPLE_PERIOD)) {
+        machine_read_statistics();
+        statsts = get_millis();
     }
 
 
@@ -262,14 +330,28 @@ void controller_manage(model_t *pmodel) {
                 break;
 
             case MACHINE_RESPONSE_MESSAGE_CODE_READ_STATISTICS:
-                model_update_statistics(pmodel, msg.stats);
+                statistics_dirty |= model_update_statistics(pmodel, msg.stats);
+                // La lettura che chiude un ciclo viene salvata subito
+                if (statistics_flush) {
+                    statistics_flush = 0;
+                    save_statistics(pmodel);
+                    savets = get_millis();
+                }
                 view_event((view_event_t){.code = VIEW_EVENT_CODE_STATS_READ});
                 break;
 
             case MACHINE_RESPONSE_MESSAGE_CODE_TEST_READ_INPUT:
+                model_set_test_inputs(pmodel, msg.value);
                 view_event((view_event_t){.code = VIEW_EVENT_CODE_TEST_INPUT_VALUES, .digital_inputs = msg.value});
                 break;
 
+            case MACHINE_RESPONSE_MESSAGE_CODE_TEST_INPUT_EDGES:
+                model_update_input_stream(pmodel, msg.stream_inputs, msg.edges, msg.num_edges, msg.stream_samples,
+                                          msg.stream_period);
+                view_event(
+                    (view_event_t){.code = VIEW_EVENT_CODE_TEST_INPUT_VALUES, .digital_inputs = msg.stream_inputs});
+                break;
+
             case MACHINE_RESPONSE_MESSAGE_CODE_READ_SENSORS:
                 if (model_update_sensors(pmodel, msg.coins, msg.payment, msg.t1_adc, msg.t2_adc, msg.t1, msg.t2,
                                          msg.actual_temperature, msg.h_rs485)) {
@@ -285,8 +367,13 @@ void controller_manage(model_t *pmodel) {
                 if (model_pick_up_machine_state(pmodel, msg.state, msg.program_number, msg.step_number)) {
                     machine_send_step(pmodel, model_get_current_step(pmodel), model_get_current_program_number(pmodel),
                                       model_get_current_step_number(pmodel), pmodel->configuration.parmac.autoavvio);
+                    machine_read_statistics();
                     view_event((view_event_t){.code = VIEW_EVENT_CODE_STATE_SYNCED});
                     view_event((view_event_t){.code = VIEW_EVENT_CODE_STATE_CHANGED});
+                } else if (msg.state != MACHINE_STATE_STOPPED && msg.program_number < model_get_num_programs(pmodel) &&
+                           !model_is_program_loaded(pmodel, msg.program_number)) {
+                    // Il caricamento degli step e' stato appena richiesto: si risincronizza quando arrivano
+                    resync_pending = 1;
                 }
                 first_sync = 0;
                 break;
@@ -308,9 +395,14 @@ void controller_manage(model_t *pmodel) {
                                               model_get_current_program_number(pmodel),
                                               model_get_current_step_number(pmodel), old_state != MACHINE_STATE_PAUSED);
                         } else {
+                            end_cycle(pmodel, CYCLE_STOP_REASON_COMPLETED);
                             model_stop_program(pmodel);
                             machine_send_command(COMMAND_REGISTER_DONE);
                         }
+                    } else if (model_is_machine_stopped(pmodel) && !pending_change) {
+                        // Ciclo interrotto dalla macchina
+                        end_cycle(pmodel, model_is_any_alarm_active(pmodel) ? CYCLE_STOP_REASON_ALARM
+                                                                            : CYCLE_STOP_REASON_INTERRUPTED);
                     }
 
                     pending_change = 0;
@@ -331,9 +423,17 @@ void controller_manage(model_t *pmodel) {
 
     if (model_should_autostop(pmodel) && !pending_change) {
         pending_change = 1;
+        end_cycle(pmodel, CYCLE_STOP_REASON_AUTOSTOP);
         model_stop_program(pmodel);
         machine_send_command(COMMAND_REGISTER_STOP);
     }
+
+    flush_alarm_events(pmodel, ALARM_HISTORY_FLUSH_PERIOD);
+
+    if (statistics_dirty && is_expired(savets, get_millis(), STATISTICS_SAVE_PERIOD)) {
+        save_statistics(pmodel);
+        savets = get_millis();
+    }
 }
 
 
@@ -361,7 +461,11 @@ static void load_programs_callback(model_t *pmodel, void *data, void *arg) {
     pmodel->configuration.num_programs = list->num_programs;
     log_info("Caricati %zu programmi", list->num_programs);
     for (size_t i = 0; i < model_get_num_programs(pmodel); i++) {
-        dryer_program_t *p = model_get_program(pmodel, i);
+        dryer_program_t *p = &pmodel->configuration.programs[i];
+        if (!p->steps_loaded) {
+            // Il controllo dei limiti viene fatto quando gli step vengono caricati
+            continue;
+        }
         for (size_t j = 0; j < p->num_steps; j++) {
             // Limit check
             parciclo_init(pmodel, i, j);
@@ -370,11 +474,160 @@ static void load_programs_callback(model_t *pmodel, void *data, void *arg) {
 }
 
 
-static void load_password_callback(model_t *pmodel, void *data, void *arg) {
-    if (data != NULL) {
-        model_set_password(pmodel, data);
-        free(data);
+static void load_program_steps(model_t *pmodel, size_t num, dryer_program_t *p) {
+    (void)pmodel;
+    (void)num;
+    char *filename = strdup(p->filename);
+    assert(filename != NULL);
+    disk_op_load_program(p->filename, program_steps_callback, program_steps_error_callback, filename);
+}
+
+
+static void program_steps_callback(model_t *pmodel, void *data, void *arg) {
+    dryer_program_t *loaded = data;
+
+    int num = model_set_program_steps(pmodel, loaded);
+    free(arg);
+    if (num < 0) {
+        return;
+    }
+
+    for (size_t j = 0; j < loaded->num_steps; j++) {
+        // Limit check
+        parciclo_init(pmodel, num, j);
+    }
+    log_info("Caricati %i step del programma %s", loaded->num_steps, loaded->filename);
+    view_event((view_event_t){.code = VIEW_EVENT_CODE_PROGRAM_LOADED});
+
+    if (resync_pending) {
+        resync_pending = 0;
+        machine_get_extended_state();
+    }
+}
+
+
+static void program_steps_error_callback(model_t *pmodel, void *arg) {
+    log_error("Non sono riuscito a caricare gli step del programma %s", (char *)arg);
+    model_program_steps_failed(pmodel, arg);
+    free(arg);
+}
+
+
+static void boot_parmac_callback(model_t *pmodel, void *data, void *arg) {
+    load_parmac_callback(pmodel, data, arg);
+    machine_send_parmac(&pmodel->configuration.parmac);
+    boot_load_done(pmodel, "parametri macchina");
+}
+
+
+static void boot_parmac_error_callback(model_t *pmodel, void *arg) {
+    load_parmac_error_callback(pmodel, arg);
+    machine_send_parmac(&pmodel->configuration.parmac);
+    boot_load_done(pmodel, "parametri macchina");
+}
+
+
+static void boot_programs_callback(model_t *pmodel, void *data, void *arg) {
+    load_programs_callback(pmodel, data, arg);
+    boot_load_done(pmodel, "programmi");
+}
+
+
+static void boot_password_callback(model_t *pmodel, void *data, void *arg) {
+    char   password[PASSWORD_MAX_SIZE + 1] = {0};
+    size_t len                             = 0;
+
+    // Basta il primo blocco: la password non puo' essere piu' lunga
+    const uint8_t *chunk = disk_op_stream_get_chunk(data, &len);
+    memcpy(password, chunk, len < PASSWORD_MAX_SIZE ? len : PASSWORD_MAX_SIZE);
+    disk_op_close_stream(data);
+
+    model_set_password(pmodel, password);
+    boot_load_done(pmodel, "password");
+}
+
+
+static void boot_statistics_callback(model_t *pmodel, void *data, void *arg) {
+    (void)arg;
+    model_restore_statistics(pmodel, data);
+    boot_load_done(pmodel, "statistiche");
+}
+
+
+static void boot_load_error_callback(model_t *pmodel, void *arg) {
+    log_warn("Caricamento all'avvio fallito: %s", (const char *)arg);
+    boot_load_done(pmodel, arg);
+}
+
+
+static void boot_load_done(model_t *pmodel, const char *phase) {
+    boot_timeline_mark(phase);
+
+    if (boot_pending_loads > 0 && --boot_pending_loads == 0) {
+        model_set_boot_complete(pmodel);
+        boot_timeline_mark("avvio completato");
+        boot_timeline_log();
+
+        buzzer_beep(2, 500);
+        view_event((view_event_t){.code = VIEW_EVENT_CODE_BOOT_COMPLETE});
+
+        // Le stime dei tempi dei programmi partono dai cicli gia' registrati
+        disk_op_read_cycle_history(0, UINT32_MAX, cycle_history_callback, cycle_history_error_callback, NULL);
+    }
+}
+
+
+/*
+ * Lo storico arriva a pagine di CYCLE_HISTORY_QUERY_MAX cicli, dal piu' recente: una pagina piena puo' non essere
+ * l'ultima e si prosegue con i cicli iniziati prima del piu' vecchio letto. Si impara solo alla fine, dal piu' vecchio
+ */
+static void cycle_history_callback(model_t *pmodel, void *data, void *arg) {
+    (void)arg;
+    cycle_history_t *history = data;
+    uint32_t         oldest  = UINT32_MAX;
+
+    if (history->count > 0) {
+        cycle_record_t *records = realloc(seed_records, sizeof(cycle_record_t) * (seed_count + history->count));
+        if (records == NULL) {
+            log_error("Memoria esaurita leggendo lo storico cicli");
+            learn_cycle_history(pmodel);
+            return;
+        }
+        memcpy(&records[seed_count], history->records, sizeof(cycle_record_t) * history->count);
+        seed_records = records;
+        seed_count += history->count;
+    }
+
+    // L'orologio puo' essere stato spostato: il limite e' l'inizio minimo della pagina, che cala sempre
+    for (size_t i = 0; i < history->count; i++) {
+        oldest = history->records[i].start < oldest ? history->records[i].start : oldest;
+    }
+
+    if (history->count == CYCLE_HISTORY_QUERY_MAX && oldest > 0) {
+        disk_op_read_cycle_history(0, oldest - 1, cycle_history_callback, cycle_history_error_callback, NULL);
+    } else {
+        learn_cycle_history(pmodel);
+    }
+}
+
+
+static void cycle_history_error_callback(model_t *pmodel, void *arg) {
+    (void)arg;
+    log_warn("Lettura dello storico cicli interrotta, stime dai %zu cicli gia' letti", seed_count);
+    learn_cycle_history(pmodel);
+}
+
+
+static void learn_cycle_history(model_t *pmodel) {
+    // Dal piu' vecchio, perche' i cicli recenti pesino di piu'
+    for (size_t i = seed_count; i > 0; i--) {
+        model_learn_cycle(pmodel, &seed_records[i - 1]);
     }
+    log_info("Stime dei tempi da %zu cicli registrati", seed_count);
+
+    free(seed_records);
+    seed_records = NULL;
+    seed_count   = 0;
 }
 
 
@@ -388,6 +641,7 @@ static void disk_io_callback(model_t *pmodel, void *data, void *arg) {
 static void firmware_update_callback(model_t *pmodel, void *data, void *arg) {
     (void)pmodel;
 #ifndef TARGET_DEBUG
+    async_log_flush();
     reboot(LINUX_REBOOT_CMD_RESTART);
 #endif
     view_event_t event = {.code = VIEW_EVENT_CODE_IO_DONE, .io_data = data, .io_op = (int)(uintptr_t)arg};
@@ -395,10 +649,31 @@ static void firmware_update_callback(model_t *pmodel, void *data, void *arg) {
 }
 
 
-static void disk_io_refresh_machines_callback(model_t *pmodel, void *data, void *arg) {
-    pmodel->system.num_drive_machines = disk_op_drive_machines(&pmodel->system.drive_machines);
+static void drive_callback(model_t *pmodel, void *data, void *arg) {
+    if (model_update_drive_status(pmodel, disk_op_is_drive_mounted())) {
+        pmodel->system.firmware_update_ready = disk_op_is_firmware_present();
+    }
+    refresh_drive_machines(pmodel);
     view_event((view_event_t){.code = VIEW_EVENT_CODE_DRIVE});
-    view_event((view_event_t){.code = VIEW_EVENT_CODE_IO_DONE, .io_data = data, .io_op = (int)(uintptr_t)arg});
+}
+
+
+/*
+ * Il modello punta direttamente ai nomi della fotografia del catalogo, che resta valida
+ * finche' non ne viene presa una piu' recente
+ */
+static int refresh_drive_machines(model_t *pmodel) {
+    if (drive_machines != NULL && drive_machines->generation == machine_catalog_generation()) {
+        return 0;
+    }
+
+    machine_catalog_snapshot_t *snapshot = machine_catalog_acquire();
+    machine_catalog_release(drive_machines);
+    drive_machines = snapshot;
+
+    pmodel->system.drive_machines     = snapshot->names;
+    pmodel->system.num_drive_machines = snapshot->num;
+    return 1;
 }
 
 
@@ -423,3 +698,40 @@ static void disk_io_error_callback(model_t *pmodel, void *arg) {
     (void)pmodel;
     view_event((view_event_t){.code = VIEW_EVENT_CODE_IO_DONE, .io_op = (int)(uintptr_t)arg, .error = 1});
 }
+
+
+static void end_cycle(model_t *pmodel, cycle_stop_reason_t reason) {
+    cycle_record_t record;
+
+    if (model_finish_cycle(pmodel, reason, &record)) {
+        log_info("Fine ciclo %s: %lu s, motivo %i, allarmi 0x%X", record.program_name,
+                 (unsigned long)(record.end - record.start), reason, record.alarms);
+        disk_op_append_cycle(&record);
+
+        // Le statistiche del ciclo si chiudono con la prossima lettura
+        statistics_flush = 1;
+        machine_read_statistics();
+    }
+
+    // Gli allarmi del ciclo vengono salvati insieme al consuntivo
+    flush_alarm_events(pmodel, 0);
+}
+
+
+/*
+ * I fronti degli allarmi si scrivono a gruppi, per non aprire una finestra in scrittura a ogni evento
+ */
+static void flush_alarm_events(model_t *pmodel, unsigned long delay) {
+    alarm_event_t events[ALARM_EVENT_PENDING];
+
+    size_t num = model_take_alarm_events(pmodel, events, delay);
+    if (num > 0) {
+        disk_op_append_alarm_events(events, num);
+    }
+}
+
+
+static void save_statistics(model_t *pmodel) {
+    disk_op_save_statistics(&pmodel->statistics);
+    statistics_dirty = 0;
+}
@@ -17,12 +17,14 @@
 #include "gel/timer/timecheck.h"
 #include "gel/serializer/serializer.h"
 #include "modbus.h"
-#include "log.h"
+#include "utils/boot_timeline.h"
+#include "utils/async_log.h"
 #include "model/model.h"
 
 
 #define TIMEOUT              100
 #define DELAY                30
+#define INPUT_STREAM_PERIOD  100
 #define REQUEST_SOCKET_PATH  "/tmp/.application_machine_request_socket"
 #define RESPONSE_SOCKET_PATH "/tmp/.application_machine_response_socket"
 
@@ -133,6 +135,8 @@ typedef enum {
     MACHINE_MESSAGE_CODE_SEND_STEP,
     MACHINE_MESSAGE_CODE_WRITE_HOLDING_REGISTER,
     MACHINE_MESSAGE_CODE_READ_STATISTICS,
+    MACHINE_MESSAGE_CODE_START_INPUT_STREAM,
+    MACHINE_MESSAGE_CODE_STOP_INPUT_STREAM,
 } machine_message_code_t;
 
 
@@ -198,11 +202,22 @@ static int   send_request(int fd, ModbusMaster *master, size_t expected_len);
 static int   task_manage_message(machine_message_t message, ModbusMaster *master, int fd, int *stop);
 static void  report_error(void);
 static void  send_response(machine_response_message_t *message);
+static int   poll_input_stream(ModbusMaster *master, int fd);
 
 
 static socketq_t requestq  = {0};
 static socketq_t responseq = {0};
 
+/* Stato della modalita' di streaming degli ingressi; usato solo dal thread seriale */
+static struct {
+    int                        active;
+    int                        valid;
+    uint16_t                   inputs;
+    unsigned long              timestamp;
+    machine_response_message_t response;
+} input_stream = {0};
+
+
 void machine_init(void) {
     int res1 = socketq_init(&requestq, REQUEST_SOCKET_PATH, sizeof(machine_message_t));
     int res2 = socketq_init(&responseq, RESPONSE_SOCKET_PATH, sizeof(machine_response_message_t));
@@ -341,6 +356,18 @@ void machine_stop_communication(void) {
 }
 
 
+void machine_start_input_stream(void) {
+    machine_message_t message = {.code = MACHINE_MESSAGE_CODE_START_INPUT_STREAM};
+    send_message(&message);
+}
+
+
+void machine_stop_input_stream(void) {
+    machine_message_t message = {.code = MACHINE_MESSAGE_CODE_STOP_INPUT_STREAM};
+    send_message(&message);
+}
+
+
 void machine_change_remaining_time(uint16_t seconds) {
     send_write_holding_register(MACHINE_HOLDING_REGISTER_TEMPO_RIMANENTE, seconds);
 }
@@ -564,6 +591,7 @@ static void *serial_port_task(void *args) {
         communication_error = 1;
         report_error();
     }
+    boot_timeline_mark("porta seriale");
     setup_port(fd);
 
     ModbusMaster    master;
@@ -580,9 +608,18 @@ static void *serial_port_task(void *args) {
     machine_message_t not_delivered = {0};
 
     for (;;) {
-        machine_message_t message = {0};
+        machine_message_t message   = {0};
+        int               streaming = input_stream.active && !(communication_error || communication_stop);
+        int               received  = 0;
 
-        if (socketq_receive(&requestq, (uint8_t *)&message)) {
+        if (streaming) {
+            // In streaming non ci si blocca sulla coda: il bus viene interrogato di continuo
+            received = socketq_receive_nonblock(&requestq, (uint8_t *)&message, 0);
+        } else {
+            received = socketq_receive(&requestq, (uint8_t *)&message);
+        }
+
+        if (received) {
             /* received a new message */
             if ((communication_error || communication_stop) && message.code == MACHINE_MESSAGE_CODE_RESTART) {
                 communication_stop = 0;
@@ -612,7 +649,13 @@ static void *serial_port_task(void *args) {
             }
         }
 
-        usleep(DELAY * 1000);
+        if (input_stream.active && !(communication_error || communication_stop)) {
+            if ((communication_error = poll_input_stream(&master, fd))) {
+                report_error();
+            }
+        } else {
+            usleep(DELAY * 1000);
+        }
     }
 
     close(fd);
@@ -629,6 +672,42 @@ static void send_response(machine_response_message_t *message) {
 }
 
 
+static int poll_input_stream(ModbusMaster *master, int fd) {
+    machine_response_message_t  sample   = {.code = MACHINE_RESPONSE_MESSAGE_CODE_TEST_READ_INPUT};
+    modbus_context_t            context  = {.response = &sample, .callback = read_test_input_cb};
+    machine_response_message_t *response = &input_stream.response;
+
+    modbusMasterSetUserPointer(master, (void *)&context);
+    int res = read_input_status(fd, master, MODBUS_MACHINE_ADDRESS, 0, 16);
+    modbusMasterSetUserPointer(master, NULL);
+    if (res) {
+        return res;
+    }
+
+    unsigned long now = get_millis();
+    response->stream_samples++;
+    response->stream_inputs = sample.value;
+
+    if (!input_stream.valid || sample.value != input_stream.inputs) {
+        response->edges[response->num_edges++] = (input_edge_t){.timestamp = now, .inputs = sample.value};
+        input_stream.inputs                     = sample.value;
+        input_stream.valid                      = 1;
+    }
+
+    // I fronti vengono inviati a blocchi per non inondare la coda delle risposte
+    if (response->num_edges == MACHINE_INPUT_STREAM_EDGES ||
+        is_expired(input_stream.timestamp, now, INPUT_STREAM_PERIOD)) {
+        response->stream_period = time_interval(input_stream.timestamp, now);
+        send_response(response);
+
+        *response = (machine_response_message_t){.code = MACHINE_RESPONSE_MESSAGE_CODE_TEST_INPUT_EDGES};
+        input_stream.timestamp = now;
+    }
+
+    return 0;
+}
+
+
 static void report_error(void) {
     log_warn("Communication error!");
     machine_response_message_t message = {.code = MACHINE_RESPONSE_MESSAGE_CODE_ERROR};
@@ -879,6 +958,22 @@ static int task_manage_message(machine_message_t message, ModbusMaster *master,
             break;
         }
 
+        case MACHINE_MESSAGE_CODE_START_INPUT_STREAM:
+            log_info("Inizio streaming ingressi");
+            input_stream.active    = 1;
+            input_stream.valid     = 0;
+            input_stream.timestamp = get_millis();
+            input_stream.response =
+                (machine_response_message_t){.code = MACHINE_RESPONSE_MESSAGE_CODE_TEST_INPUT_EDGES};
+            break;
+
+        case MACHINE_MESSAGE_CODE_STOP_INPUT_STREAM:
+            if (input_stream.active) {
+                log_info("Fine streaming ingressi");
+            }
+            input_stream.active = 0;
+            break;
+
         case MACHINE_MESSAGE_CODE_RESTART:
             break;
     }
@@ -16,6 +16,8 @@
 #define COMMAND_REGISTER_EXIT_TEST    8
 #define COMMAND_REGISTER_INITIALIZE   9
 
+#define MACHINE_INPUT_STREAM_EDGES 16
+
 
 
 typedef enum {
@@ -26,6 +28,7 @@ typedef enum {
     MACHINE_RESPONSE_MESSAGE_CODE_READ_SENSORS,
     MACHINE_RESPONSE_MESSAGE_CODE_READ_STATISTICS,
     MACHINE_RESPONSE_MESSAGE_CODE_VERSION,
+    MACHINE_RESPONSE_MESSAGE_CODE_TEST_INPUT_EDGES,
 } machine_response_message_code_t;
 
 
@@ -65,6 +68,14 @@ typedef struct {
         };
 
         statistics_t stats;
+
+        struct {
+            uint16_t      stream_inputs;
+            uint16_t      stream_samples;
+            unsigned long stream_period;
+            size_t        num_edges;
+            input_edge_t  edges[MACHINE_INPUT_STREAM_EDGES];
+        };
     };
 } machine_response_message_t;
 
@@ -88,5 +99,7 @@ void machine_change_humidity(uint16_t humidity);
 void machine_change_remaining_time(uint16_t seconds);
 void machine_read_statistics(void);
 void machine_stop_communication(void);
+void machine_start_input_stream(void);
+void machine_stop_input_stream(void);
 
 #endif
@@ -7,7 +7,7 @@
 #include <unistd.h>
 #include "gel/collections/circular_buffer.h"
 #include "gel/timer/timecheck.h"
-#include "log.h"
+#include "utils/async_log.h"
 
 
 int serial_set_interface_attribs(int fd, int speed) {
@@ -15,9 +15,10 @@
 #include <linux/if_link.h>
 
 #include "utils/system_time.h"
+#include "utils/boot_timeline.h"
 #include "wifi.h"
 #include "wpa_ctrl.h"
-#include "log.h"
+#include "utils/async_log.h"
 
 #ifdef TARGET_DEBUG
 #define WPASOCK "/run/wpa_supplicant/wlp112s0"
@@ -39,25 +40,34 @@ static inline void remount_rw() {
 #endif
 
 
-static int strncpy_until(char *dest, size_t max, char *src, char until);
+#define WPA_CONNECT_ATTEMPTS 20
+#define WPA_CONNECT_DELAY    500UL
 
 
-static struct wpa_ctrl *ctrl = NULL;
+static int              strncpy_until(char *dest, size_t max, char *src, char until);
+static void            *wpa_connect_task(void *args);
+static struct wpa_ctrl *get_ctrl(void);
 
 
-int wifi_init(void) {
-    ctrl = wpa_ctrl_open(WPASOCK);
+static pthread_mutex_t  ctrl_lock  = PTHREAD_MUTEX_INITIALIZER;
+static struct wpa_ctrl *wpa_handle = NULL;
 
-    if (ctrl == NULL) {
-        log_warn("Non sono riuscito a collegarmi a wpa_supplicant");
+
+/*
+ * All'avvio wpa_supplicant potrebbe non essere ancora pronto: la connessione viene tentata in background
+ */
+int wifi_init(void) {
+    pthread_t id;
+    if (pthread_create(&id, NULL, wpa_connect_task, NULL)) {
+        log_warn("Non riesco ad avviare la connessione a wpa_supplicant: %s", strerror(errno));
         return -1;
-    } else {
-        log_info("Connesso con successo a wpa_supplicant");
-        return 0;
     }
+    pthread_detach(id);
+    return 0;
 }
 
 void wifi_connect(char *ssid, char *psk) {
+    struct wpa_ctrl *ctrl = get_ctrl();
     if (ctrl == NULL)
         return;
 
@@ -76,9 +86,10 @@ void wifi_connect(char *ssid, char *psk) {
 }
 
 wifi_status_t wifi_status(char *ssid) {
-    wifi_status_t res = WIFI_INACTIVE;
-    char          reply[1024];
-    char          value[32];
+    wifi_status_t    res = WIFI_INACTIVE;
+    char             reply[1024];
+    char             value[32];
+    struct wpa_ctrl *ctrl = get_ctrl();
     if (ctrl == NULL) {
         return WIFI_INACTIVE;
     }
@@ -113,7 +124,8 @@ wifi_status_t wifi_status(char *ssid) {
 
 
 void wifi_scan(void) {
-    char reply[1024];
+    char             reply[1024];
+    struct wpa_ctrl *ctrl = get_ctrl();
     if (ctrl == NULL) {
         return;
     }
@@ -122,7 +134,8 @@ void wifi_scan(void) {
 
 
 int wifi_read_scan(wifi_network_t **networks) {
-    char *step;
+    char            *step;
+    struct wpa_ctrl *ctrl = get_ctrl();
     if (ctrl == NULL)
         return 0;
 
@@ -179,6 +192,7 @@ int wifi_read_scan(wifi_network_t **networks) {
 
 
 int wifi_save_config(void) {
+    struct wpa_ctrl *ctrl = get_ctrl();
     if (ctrl == NULL) {
         return -1;
     }
@@ -355,6 +369,38 @@ pthread_t launch_wifi_time_sync_task(void (*cb)(time_t)) {
 }
 
 
+static void *wpa_connect_task(void *args) {
+    (void)args;
+
+    for (size_t i = 0; i < WPA_CONNECT_ATTEMPTS; i++) {
+        struct wpa_ctrl *ctrl = wpa_ctrl_open(WPASOCK);
+
+        if (ctrl != NULL) {
+            pthread_mutex_lock(&ctrl_lock);
+            wpa_handle = ctrl;
+            pthread_mutex_unlock(&ctrl_lock);
+
+            log_info("Connesso con successo a wpa_supplicant");
+            boot_timeline_mark("wpa_supplicant");
+            return NULL;
+        }
+
+        usleep(WPA_CONNECT_DELAY * 1000UL);
+    }
+
+    log_warn("Non sono riuscito a collegarmi a wpa_supplicant");
+    return NULL;
+}
+
+
+static struct wpa_ctrl *get_ctrl(void) {
+    pthread_mutex_lock(&ctrl_lock);
+    struct wpa_ctrl *ctrl = wpa_handle;
+    pthread_mutex_unlock(&ctrl_lock);
+    return ctrl;
+}
+
+
 static int strncpy_until(char *dest, size_t max, char *src, char until) {
     assert(src);
     assert(dest);
@@ -0,0 +1,530 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "gel/serializer/serializer.h"
+#include "gel/timer/timecheck.h"
+#include "utils/crc32.h"
+#include "utils/system_time.h"
+#include "alarm_history.h"
+#include "storage.h"
+#include "utils/async_log.h"
+
+
+/*
+ *  Storico allarmi (big endian):
+ *   - intestazione: magic, versione, numero di eventi scritti dall'inizio, CRC
+ *   - contatori giornalieri: MAX_DAYS voci indicizzate dal giorno (locale) modulo MAX_DAYS, ciascuna con il numero
+ *     del giorno, le attivazioni per codice e il proprio CRC; una voce di un altro giorno vale zero
+ *   - anello di MAX_EVENTS eventi a dimensione fissa, ciascuno con il proprio CRC
+ *  Un gruppo di eventi costa una sola finestra in scrittura: gli eventi, le voci dei giorni toccati e l'intestazione.
+ *  Le attivazioni di un mese si contano leggendo al piu' 31 voci, senza scorrere gli eventi.
+ *  Se l'intestazione e' illeggibile il numero di eventi scritti viene ricostruito dai CRC degli eventi dell'anello.
+ */
+
+#define HISTORY_MAGIC     0x4453414CUL     // "DSAL"
+#define HISTORY_VERSION   1
+#define HEADER_SIZE       16
+#define HEADER_CRC_OFFSET (HEADER_SIZE - 4)
+#define MAX_DAYS          400
+#define DAY_SIZE          (4 + ALARM_EVENT_CODES * 2 + 4)
+#define DAY_CRC_OFFSET    (DAY_SIZE - 4)
+#define MAX_EVENTS        4096
+#define EVENT_SIZE        16
+#define EVENT_CRC_OFFSET  (EVENT_SIZE - 4)
+#define READ_EVENTS       64     // Eventi letti per volta scorrendo l'anello
+#define DAYS_START        HEADER_SIZE
+#define EVENTS_START      (DAYS_START + MAX_DAYS * DAY_SIZE)
+#define DAY_OFFSET(d)     ((off_t)DAYS_START + (off_t)((d) % MAX_DAYS) * DAY_SIZE)
+#define EVENT_OFFSET(n)   ((off_t)EVENTS_START + (off_t)((n) % MAX_EVENTS) * EVENT_SIZE)
+#define SECONDS_PER_DAY   86400UL
+#define PATH_SIZE         128
+#define TMP_SUFFIX        ".tmp"
+
+
+typedef struct {
+    uint32_t number;
+    uint16_t counts[ALARM_EVENT_CODES];
+} day_t;
+
+
+static uint32_t day_number(uint32_t timestamp);
+static int      load_header(int fd, uint32_t *written);
+static int      rebuild_header(int fd, uint32_t *written);
+static void     serialize_header(uint8_t *buffer, uint32_t written);
+static void     serialize_event(uint8_t *buffer, const alarm_event_t *event);
+static int      parse_event(const uint8_t *buffer, alarm_event_t *event);
+static void     serialize_day(uint8_t *buffer, const day_t *day);
+static int      read_day(int fd, uint32_t number, day_t *day);
+static void     scan_events(int fd, uint32_t written, uint32_t from, uint32_t to, alarm_history_t *history);
+static void     export_event(FILE *f, const alarm_event_t *event);
+
+
+int alarm_history_append(const char *path, const alarm_event_t *events, size_t num) {
+    uint8_t  buffer[ALARM_EVENT_PENDING * EVENT_SIZE];
+    uint8_t  entry[DAY_SIZE];
+    uint8_t  header[HEADER_SIZE];
+    day_t    days[ALARM_EVENT_PENDING];
+    size_t   num_days = 0;
+    uint32_t written  = 0;
+
+    assert(num <= ALARM_EVENT_PENDING);
+    if (num == 0) {
+        return 0;
+    }
+
+    // Eventi, contatori e intestazione nella stessa finestra in scrittura
+    storage_transaction_begin();
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_warn("Non riesco ad aprire %s: %s", path, strerror(errno));
+        storage_transaction_commit();
+        return -1;
+    }
+
+    int res = load_header(fd, &written) < 0;
+
+    // Di solito il gruppo tocca un solo giorno, che viene letto una volta sola
+    for (size_t i = 0; i < num && !res; i++) {
+        if ((events[i].flags & ALARM_EVENT_FLAG_RAISED) == 0 || events[i].code >= ALARM_EVENT_CODES) {
+            continue;
+        }
+
+        uint32_t number = day_number(events[i].timestamp);
+        size_t   j      = 0;
+        while (j < num_days && days[j].number != number) {
+            j++;
+        }
+        if (j == num_days) {
+            read_day(fd, number, &days[num_days++]);
+        }
+        if (days[j].counts[events[i].code] < UINT16_MAX) {
+            days[j].counts[events[i].code]++;
+        }
+    }
+
+    // L'anello puo' ricominciare a meta' gruppo
+    size_t first = MAX_EVENTS - written % MAX_EVENTS;
+    first        = first < num ? first : num;
+    for (size_t i = 0; i < num; i++) {
+        serialize_event(&buffer[i * EVENT_SIZE], &events[i]);
+    }
+    if (!res) {
+        res = storage_pwrite_all(fd, buffer, first * EVENT_SIZE, EVENT_OFFSET(written));
+    }
+    if (!res && first < num) {
+        res = storage_pwrite_all(fd, &buffer[first * EVENT_SIZE], (num - first) * EVENT_SIZE, EVENT_OFFSET(0));
+    }
+
+    for (size_t i = 0; i < num_days && !res; i++) {
+        serialize_day(entry, &days[i]);
+        res = storage_pwrite_all(fd, entry, DAY_SIZE, DAY_OFFSET(days[i].number));
+    }
+
+    if (!res) {
+        serialize_header(header, written + num);
+        res = storage_pwrite_all(fd, header, HEADER_SIZE, 0);
+    }
+
+    if (!res && fdatasync(fd) < 0) {
+        log_warn("Errore nella sincronizzazione di %s: %s", path, strerror(errno));
+        res = 1;
+    }
+
+    close(fd);
+    int commit = storage_transaction_commit();
+    return res ? res : commit;
+}
+
+
+/*
+ * Attivazioni per codice nei giorni compresi tra `from` e `to` (secondi dal 1970) e gli ultimi eventi dello stesso
+ * intervallo, fino a ALARM_HISTORY_QUERY_MAX
+ */
+int alarm_history_query(const char *path, uint32_t from, uint32_t to, alarm_history_t *history) {
+    uint32_t written = 0;
+    day_t    day;
+
+    memset(history->counts, 0, sizeof(history->counts));
+    history->count = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        // Nessun allarme ancora registrato
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    int res = load_header(fd, &written);
+    if (res < 0) {
+        close(fd);
+        return -1;
+    } else if (res > 0) {
+        close(fd);
+        return 0;
+    }
+
+    // Le voci piu' vecchie di MAX_DAYS sono gia' state riusate
+    uint32_t today = day_number((uint32_t)time(NULL));
+    uint32_t first = day_number(from);
+    uint32_t last  = day_number(to);
+    last           = last < today ? last : today;
+    if (first + MAX_DAYS <= today) {
+        first = today - MAX_DAYS + 1;
+    }
+    for (uint32_t number = first; number <= last; number++) {
+        read_day(fd, number, &day);
+        for (size_t i = 0; i < ALARM_EVENT_CODES; i++) {
+            history->counts[i] += day.counts[i];
+        }
+    }
+
+    scan_events(fd, written, from, to, history);
+
+    close(fd);
+    return 0;
+}
+
+
+/*
+ * Scrive in `destination` un CSV con tutti gli eventi conservati e i contatori giornalieri
+ */
+int alarm_history_export(const char *path, const char *destination, storage_progress_cb_t progress, void *arg) {
+    uint8_t       buffer[READ_EVENTS * EVENT_SIZE];
+    char          name[64], file_path[PATH_SIZE], tmp_path[PATH_SIZE + sizeof(TMP_SUFFIX)];
+    uint32_t      written = 0;
+    unsigned long start   = get_millis();
+    int           res     = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 && errno != ENOENT) {
+        log_warn("Non riesco ad aprire %s: %s", path, strerror(errno));
+        return -1;
+    } else if (fd >= 0 && load_header(fd, &written) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    time_t    now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(name, sizeof(name), "DS2021_allarmi_%Y%m%d_%H%M%S.csv", &tm);
+    snprintf(file_path, sizeof(file_path), "%s/%s", destination, name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", file_path, TMP_SUFFIX);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        log_warn("Non riesco a creare %s: %s", tmp_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    size_t available = written < MAX_EVENTS ? written : MAX_EVENTS;
+    size_t total     = available + MAX_DAYS;
+
+    // Eventi dal piu' vecchio
+    fprintf(f, "data;ora;codice;evento;programma;passo\n");
+    for (size_t done = 0; done < available && !res;) {
+        uint32_t first = written - available + done;
+        size_t   num   = available - done < READ_EVENTS ? available - done : READ_EVENTS;
+        num            = num < MAX_EVENTS - first % MAX_EVENTS ? num : MAX_EVENTS - first % MAX_EVENTS;
+
+        if (pread(fd, buffer, num * EVENT_SIZE, EVENT_OFFSET(first)) != (ssize_t)(num * EVENT_SIZE)) {
+            log_warn("Errore nella lettura dello storico allarmi: %s", strerror(errno));
+            res = -1;
+            break;
+        }
+
+        for (size_t i = 0; i < num; i++) {
+            alarm_event_t event;
+            if (parse_event(&buffer[i * EVENT_SIZE], &event) == 0) {
+                export_event(f, &event);
+            }
+        }
+
+        done += num;
+        if (progress != NULL && progress(done, total, arg)) {
+            res = -1;
+        }
+    }
+
+    // Contatori giornalieri, dal giorno piu' vecchio conservato
+    fprintf(f, "\ngiorno");
+    for (size_t i = 0; i < ALARM_EVENT_CODES; i++) {
+        fprintf(f, ";codice %zu", i + 1);
+    }
+    fprintf(f, "\n");
+
+    uint32_t today = day_number((uint32_t)now);
+    for (uint32_t number = today - MAX_DAYS + 1; fd >= 0 && number <= today && !res; number++) {
+        day_t day;
+        if (read_day(fd, number, &day)) {
+            continue;
+        }
+
+        char   date[16];
+        time_t t = (time_t)number * SECONDS_PER_DAY;
+        // Il numero del giorno e' gia' in ora locale
+        gmtime_r(&t, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+        fprintf(f, "%s", date);
+        for (size_t i = 0; i < ALARM_EVENT_CODES; i++) {
+            fprintf(f, ";%u", day.counts[i]);
+        }
+        fprintf(f, "\n");
+    }
+
+    if (progress != NULL && !res) {
+        res = progress(total, total, arg);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    // La chiavetta puo' essere estratta appena l'esportazione risulta conclusa
+    if (!res && (fflush(f) != 0 || fsync(fileno(f)) < 0)) {
+        log_warn("Errore nella sincronizzazione di %s: %s", tmp_path, strerror(errno));
+        res = -1;
+    }
+    if (fclose(f) != 0) {
+        log_warn("Errore nella chiusura di %s: %s", tmp_path, strerror(errno));
+        res = -1;
+    }
+
+    if (res || rename(tmp_path, file_path) < 0 || storage_sync_dir(destination)) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    log_info("Esportati %zu eventi di allarme in %s in %lu ms", available, file_path,
+             time_interval(start, get_millis()));
+    return 0;
+}
+
+
+/*
+ *  Static functions
+ */
+
+static uint32_t day_number(uint32_t timestamp) {
+    time_t    t = timestamp;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return (uint32_t)(((int64_t)timestamp + tm.tm_gmtoff) / (int64_t)SECONDS_PER_DAY);
+}
+
+
+/*
+ * Ritorna 1 se il file e' nuovo, -1 in caso di errore. Un'intestazione illeggibile viene ricostruita dall'anello e
+ * riscritta alla prossima aggiunta
+ */
+static int load_header(int fd, uint32_t *written) {
+    uint8_t  buffer[HEADER_SIZE];
+    uint32_t magic = 0, crc = 0;
+    uint16_t version = 0;
+
+    *written = 0;
+
+    ssize_t len = pread(fd, buffer, HEADER_SIZE, 0);
+    if (len < 0) {
+        log_warn("Errore nella lettura dello storico allarmi: %s", strerror(errno));
+        return -1;
+    } else if (len == 0) {
+        return 1;
+    }
+
+    if (len == HEADER_SIZE) {
+        deserialize_uint32_be(&magic, &buffer[0]);
+        deserialize_uint16_be(&version, &buffer[4]);
+        deserialize_uint32_be(&crc, &buffer[HEADER_CRC_OFFSET]);
+    }
+
+    if (magic != HISTORY_MAGIC || version != HISTORY_VERSION || crc != crc32(buffer, HEADER_CRC_OFFSET)) {
+        log_error("Intestazione dello storico allarmi corrotta, la ricostruisco dagli eventi");
+        return rebuild_header(fd, written);
+    }
+
+    deserialize_uint32_be(written, &buffer[8]);
+    return 0;
+}
+
+
+/*
+ * Finche' l'anello non ha fatto il giro gli eventi validi ne occupano l'inizio senza buchi; dopo, la prossima posizione
+ * da scrivere segue l'evento piu' recente. Il conteggio oltre MAX_EVENTS non serve: basta la posizione nell'anello
+ */
+static int rebuild_header(int fd, uint32_t *written) {
+    uint8_t  buffer[READ_EVENTS * EVENT_SIZE];
+    size_t   valid = 0, last_valid = 0, newest = 0;
+    uint32_t newest_timestamp = 0;
+
+    *written = 0;
+
+    for (size_t first = 0; first < MAX_EVENTS; first += READ_EVENTS) {
+        ssize_t len = pread(fd, buffer, sizeof(buffer), EVENT_OFFSET(first));
+        if (len < 0) {
+            log_warn("Errore nella lettura dello storico allarmi: %s", strerror(errno));
+            return -1;
+        }
+
+        for (size_t i = 0; (ssize_t)((i + 1) * EVENT_SIZE) <= len; i++) {
+            alarm_event_t event;
+            if (parse_event(&buffer[i * EVENT_SIZE], &event) == 0) {
+                valid++;
+                last_valid = first + i;
+                if (event.timestamp >= newest_timestamp) {
+                    newest_timestamp = event.timestamp;
+                    newest           = first + i;
+                }
+            }
+        }
+
+        if ((size_t)len < sizeof(buffer)) {
+            break;
+        }
+    }
+
+    if (valid == last_valid + 1 && valid < MAX_EVENTS) {
+        *written = valid;
+    } else if (valid > 0) {
+        *written = MAX_EVENTS + (newest + 1) % MAX_EVENTS;
+    }
+
+    log_info("Intestazione dello storico allarmi ricostruita: %zu eventi validi", valid);
+    return 0;
+}
+
+
+static void serialize_header(uint8_t *buffer, uint32_t written) {
+    memset(buffer, 0, HEADER_SIZE);
+    serialize_uint32_be(&buffer[0], HISTORY_MAGIC);
+    serialize_uint16_be(&buffer[4], HISTORY_VERSION);
+    serialize_uint32_be(&buffer[8], written);
+    serialize_uint32_be(&buffer[HEADER_CRC_OFFSET], crc32(buffer, HEADER_CRC_OFFSET));
+}
+
+
+static void serialize_event(uint8_t *buffer, const alarm_event_t *event) {
+    size_t i = 0;
+
+    i += serialize_uint32_be(&buffer[i], event->timestamp);
+    i += serialize_uint16_be(&buffer[i], event->code);
+    i += serialize_uint16_be(&buffer[i], event->flags);
+    i += serialize_uint16_be(&buffer[i], event->program_number);
+    i += serialize_uint16_be(&buffer[i], event->step);
+    serialize_uint32_be(&buffer[EVENT_CRC_OFFSET], crc32(buffer, EVENT_CRC_OFFSET));
+}
+
+
+static int parse_event(const uint8_t *buffer, alarm_event_t *event) {
+    uint32_t crc = 0;
+    size_t   i   = 0;
+
+    deserialize_uint32_be(&crc, &buffer[EVENT_CRC_OFFSET]);
+    if (crc != crc32(buffer, EVENT_CRC_OFFSET)) {
+        return -1;
+    }
+
+    i += deserialize_uint32_be(&event->timestamp, &buffer[i]);
+    i += deserialize_uint16_be(&event->code, &buffer[i]);
+    i += deserialize_uint16_be(&event->flags, &buffer[i]);
+    i += deserialize_uint16_be(&event->program_number, &buffer[i]);
+    i += deserialize_uint16_be(&event->step, &buffer[i]);
+    return 0;
+}
+
+
+static void serialize_day(uint8_t *buffer, const day_t *day) {
+    size_t i = 0;
+
+    i += serialize_uint32_be(&buffer[i], day->number);
+    for (size_t j = 0; j < ALARM_EVENT_CODES; j++) {
+        i += serialize_uint16_be(&buffer[i], day->counts[j]);
+    }
+    serialize_uint32_be(&buffer[DAY_CRC_OFFSET], crc32(buffer, DAY_CRC_OFFSET));
+}
+
+
+/*
+ * Contatori del giorno `number`; ritorna 1 (e contatori a zero) se la voce e' vuota o appartiene a un altro giorno
+ */
+static int read_day(int fd, uint32_t number, day_t *day) {
+    uint8_t  buffer[DAY_SIZE];
+    uint32_t crc = 0, stored = 0;
+
+    memset(day, 0, sizeof(day_t));
+    day->number = number;
+
+    if (pread(fd, buffer, DAY_SIZE, DAY_OFFSET(number)) != DAY_SIZE) {
+        return 1;
+    }
+
+    deserialize_uint32_be(&crc, &buffer[DAY_CRC_OFFSET]);
+    deserialize_uint32_be(&stored, &buffer[0]);
+    if (crc != crc32(buffer, DAY_CRC_OFFSET) || stored != number) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < ALARM_EVENT_CODES; i++) {
+        deserialize_uint16_be(&day->counts[i], &buffer[4 + i * 2]);
+    }
+    return 0;
+}
+
+
+/*
+ * Scorre l'anello all'indietro a blocchi, fermandosi quando ha trovato abbastanza eventi
+ */
+static void scan_events(int fd, uint32_t written, uint32_t from, uint32_t to, alarm_history_t *history) {
+    uint8_t  buffer[READ_EVENTS * EVENT_SIZE];
+    size_t   available = written < MAX_EVENTS ? written : MAX_EVENTS;
+    uint32_t end       = written;
+
+    while (available > 0 && history->count < ALARM_HISTORY_QUERY_MAX) {
+        // Un blocco non attraversa la fine dell'anello
+        size_t position = end % MAX_EVENTS == 0 ? MAX_EVENTS : end % MAX_EVENTS;
+        size_t num      = available < READ_EVENTS ? available : READ_EVENTS;
+        num             = num < position ? num : position;
+
+        if (pread(fd, buffer, num * EVENT_SIZE, EVENT_OFFSET(end - num)) != (ssize_t)(num * EVENT_SIZE)) {
+            log_warn("Errore nella lettura dello storico allarmi: %s", strerror(errno));
+            break;
+        }
+
+        for (size_t i = num; i > 0 && history->count < ALARM_HISTORY_QUERY_MAX; i--) {
+            alarm_event_t *event = &history->events[history->count];
+            if (parse_event(&buffer[(i - 1) * EVENT_SIZE], event) == 0 && event->timestamp >= from &&
+                event->timestamp <= to) {
+                history->count++;
+            }
+        }
+
+        end -= num;
+        available -= num;
+    }
+}
+
+
+static void export_event(FILE *f, const alarm_event_t *event) {
+    char      date[32];
+    time_t    t = event->timestamp;
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d;%H:%M:%S", &tm);
+    fprintf(f, "%s;%u;%s;", date, event->code + 1, (event->flags & ALARM_EVENT_FLAG_RAISED) ? "attivato" : "rientrato");
+    if (event->program_number == ALARM_EVENT_NO_PROGRAM) {
+        fprintf(f, ";\n");
+    } else {
+        fprintf(f, "%u;%u\n", event->program_number + 1, event->step + 1);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef ALARM_HISTORY_H_INCLUDED
+#define ALARM_HISTORY_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "model/alarm_event.h"
+#include "storage.h"
+
+
+int alarm_history_append(const char *path, const alarm_event_t *events, size_t num);
+int alarm_history_query(const char *path, uint32_t from, uint32_t to, alarm_history_t *history);
+int alarm_history_export(const char *path, const char *destination, storage_progress_cb_t progress, void *arg);
+
+
+#endif
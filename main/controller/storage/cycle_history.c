@@ -0,0 +1,407 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "gel/serializer/serializer.h"
+#include "utils/crc32.h"
+#include "cycle_history.h"
+#include "storage.h"
+#include "utils/async_log.h"
+
+
+/*
+ *  Storico dei cicli (big endian), scritto solo in coda:
+ *   - intestazione: magic, versione, numero di gruppi chiusi, CRC dell'indice
+ *   - indice di MAX_GROUPS voci: orario di inizio minimo e massimo dei record di ciascun gruppo chiuso
+ *   - record a dimensione fissa con il proprio CRC, a gruppi di GROUP_RECORDS
+ *  Un ciclo costa la scrittura del solo record in un'unica finestra in scrittura della partizione; l'indice viene
+ *  riscritto solo alla chiusura di un gruppo. I record del gruppo aperto sono validati dal CRC, per cui una scrittura
+ *  interrotta viene ignorata e poi sovrascritta. Quando i gruppi finiscono si tiene la meta' piu' recente.
+ *  L'indice e' solo un riassunto dei record: se e' illeggibile viene ricostruito dai loro CRC, senza perdere cicli.
+ */
+
+#define HISTORY_MAGIC     0x44534348UL     // "DSCH"
+#define HISTORY_VERSION   1
+#define HEADER_SIZE       16
+#define INDEX_ENTRY_SIZE  8
+#define MAX_GROUPS        64
+#define GROUP_RECORDS     32
+#define RECORD_SIZE       128
+#define RECORD_CRC_OFFSET (RECORD_SIZE - 4)
+#define GROUP_SIZE        (RECORD_SIZE * GROUP_RECORDS)
+#define DATA_START        (HEADER_SIZE + INDEX_ENTRY_SIZE * MAX_GROUPS)
+#define RECORD_OFFSET(n)  ((off_t)DATA_START + (off_t)(n) * RECORD_SIZE)
+
+
+typedef struct {
+    uint32_t first;     // Inizio piu' vecchio e piu' recente: l'orologio puo' essere stato spostato
+    uint32_t last;
+} group_t;
+
+
+typedef struct {
+    size_t  num_groups;
+    group_t groups[MAX_GROUPS];
+    size_t  tail;     // Record validi dopo l'ultimo gruppo chiuso
+} journal_t;
+
+
+static void serialize_record(uint8_t *buffer, const cycle_record_t *record);
+static int  parse_record(const uint8_t *buffer, cycle_record_t *record);
+static void serialize_index(uint8_t *buffer, journal_t *journal);
+static int  load_journal(int fd, journal_t *journal);
+static int  rebuild_journal(int fd, journal_t *journal);
+static void count_tail(int fd, journal_t *journal);
+static int  close_group(int fd, journal_t *journal);
+static int  compact(const char *path, int fd, journal_t *journal);
+static void scan_records(int fd, size_t first, size_t count, uint32_t from, uint32_t to, cycle_history_t *history);
+
+
+int cycle_history_append(const char *path, const cycle_record_t *record) {
+    uint8_t   buffer[RECORD_SIZE];
+    uint8_t   index[DATA_START];
+    journal_t journal;
+
+    serialize_record(buffer, record);
+
+    // Record, indice ed eventuale compattazione nella stessa finestra in scrittura
+    storage_transaction_begin();
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_warn("Non riesco ad aprire %s: %s", path, strerror(errno));
+        storage_transaction_commit();
+        return -1;
+    }
+
+    int dirty = load_journal(fd, &journal);
+    int res   = dirty < 0;
+
+    // Gruppo riempito da una scrittura interrotta prima di aggiornare l'indice
+    if (!res && journal.tail == GROUP_RECORDS) {
+        res   = close_group(fd, &journal);
+        dirty = 1;
+    }
+
+    if (!res) {
+        res = storage_pwrite_all(fd, buffer, RECORD_SIZE,
+                                 RECORD_OFFSET(journal.num_groups * GROUP_RECORDS + journal.tail));
+        journal.tail++;
+    }
+    if (!res && journal.tail == GROUP_RECORDS) {
+        res   = close_group(fd, &journal);
+        dirty = 1;
+    }
+
+    if (!res && journal.num_groups >= MAX_GROUPS) {
+        res = compact(path, fd, &journal);
+    } else if (!res && dirty) {
+        serialize_index(index, &journal);
+        res = storage_pwrite_all(fd, index, DATA_START, 0);
+    }
+
+    if (!res && fdatasync(fd) < 0) {
+        log_warn("Errore nella sincronizzazione di %s: %s", path, strerror(errno));
+        res = 1;
+    }
+
+    close(fd);
+    int commit = storage_transaction_commit();
+    return res ? res : commit;
+}
+
+
+/*
+ * Cicli iniziati nell'intervallo [from, to], dal piu' recente; se sono piu' di CYCLE_HISTORY_QUERY_MAX vengono
+ * riportati solo gli ultimi
+ */
+int cycle_history_query(const char *path, uint32_t from, uint32_t to, cycle_history_t *history) {
+    journal_t journal;
+
+    history->count = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        // Nessun ciclo ancora registrato
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    if (load_journal(fd, &journal) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    scan_records(fd, journal.num_groups * GROUP_RECORDS, journal.tail, from, to, history);
+
+    // Grazie all'indice si leggono solo i gruppi che possono contenere l'intervallo
+    for (size_t i = journal.num_groups; i > 0 && history->count < CYCLE_HISTORY_QUERY_MAX; i--) {
+        group_t *group = &journal.groups[i - 1];
+        if (group->last >= from && group->first <= to) {
+            scan_records(fd, (i - 1) * GROUP_RECORDS, GROUP_RECORDS, from, to, history);
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+
+/*
+ *  Static functions
+ */
+
+static void serialize_record(uint8_t *buffer, const cycle_record_t *record) {
+    size_t i = 0;
+
+    memset(buffer, 0, RECORD_SIZE);
+    i += serialize_uint32_be(&buffer[i], record->start);
+    i += serialize_uint32_be(&buffer[i], record->end);
+    i += serialize_uint16_be(&buffer[i], record->program_number);
+    i += serialize_uint16_be(&buffer[i], record->flags);
+    i += serialize_uint16_be(&buffer[i], record->stop_reason);
+    i += serialize_uint16_be(&buffer[i], record->alarms);
+    i += serialize_uint16_be(&buffer[i], record->num_alarms);
+    i += serialize_uint16_be(&buffer[i], (uint16_t)record->min_temperature);
+    i += serialize_uint16_be(&buffer[i], (uint16_t)record->max_temperature);
+    i += serialize_uint16_be(&buffer[i], (uint16_t)record->avg_temperature);
+    i += serialize_uint16_be(&buffer[i], (uint16_t)record->min_humidity);
+    i += serialize_uint16_be(&buffer[i], (uint16_t)record->max_humidity);
+    i += serialize_uint16_be(&buffer[i], (uint16_t)record->avg_humidity);
+    i += serialize_uint16_be(&buffer[i], record->num_steps);
+    for (size_t j = 0; j < MAX_STEPS; j++) {
+        i += serialize_uint16_be(&buffer[i], record->step_durations[j]);
+    }
+    memcpy(&buffer[i], record->program_name, STRING_NAME_SIZE);
+
+    serialize_uint32_be(&buffer[RECORD_CRC_OFFSET], crc32(buffer, RECORD_CRC_OFFSET));
+}
+
+
+static int parse_record(const uint8_t *buffer, cycle_record_t *record) {
+    uint32_t crc = 0;
+    uint16_t values[6];
+    size_t   i = 0;
+
+    deserialize_uint32_be(&crc, &buffer[RECORD_CRC_OFFSET]);
+    if (crc != crc32(buffer, RECORD_CRC_OFFSET)) {
+        return -1;
+    }
+
+    memset(record, 0, sizeof(cycle_record_t));
+    i += deserialize_uint32_be(&record->start, &buffer[i]);
+    i += deserialize_uint32_be(&record->end, &buffer[i]);
+    i += deserialize_uint16_be(&record->program_number, &buffer[i]);
+    i += deserialize_uint16_be(&record->flags, &buffer[i]);
+    i += deserialize_uint16_be(&record->stop_reason, &buffer[i]);
+    i += deserialize_uint16_be(&record->alarms, &buffer[i]);
+    i += deserialize_uint16_be(&record->num_alarms, &buffer[i]);
+    for (size_t j = 0; j < 6; j++) {
+        i += deserialize_uint16_be(&values[j], &buffer[i]);
+    }
+    i += deserialize_uint16_be(&record->num_steps, &buffer[i]);
+    for (size_t j = 0; j < MAX_STEPS; j++) {
+        i += deserialize_uint16_be(&record->step_durations[j], &buffer[i]);
+    }
+    memcpy(record->program_name, &buffer[i], STRING_NAME_SIZE);
+    record->program_name[STRING_NAME_SIZE - 1] = '\0';
+
+    record->min_temperature = (int16_t)values[0];
+    record->max_temperature = (int16_t)values[1];
+    record->avg_temperature = (int16_t)values[2];
+    record->min_humidity    = (int16_t)values[3];
+    record->max_humidity    = (int16_t)values[4];
+    record->avg_humidity    = (int16_t)values[5];
+    return 0;
+}
+
+
+static void serialize_index(uint8_t *buffer, journal_t *journal) {
+    memset(buffer, 0, DATA_START);
+
+    for (size_t i = 0; i < journal->num_groups; i++) {
+        uint8_t *p = &buffer[HEADER_SIZE + i * INDEX_ENTRY_SIZE];
+        serialize_uint32_be(&p[0], journal->groups[i].first);
+        serialize_uint32_be(&p[4], journal->groups[i].last);
+    }
+
+    serialize_uint32_be(&buffer[0], HISTORY_MAGIC);
+    serialize_uint16_be(&buffer[4], HISTORY_VERSION);
+    serialize_uint16_be(&buffer[6], journal->num_groups);
+    serialize_uint32_be(&buffer[12], crc32(&buffer[HEADER_SIZE], DATA_START - HEADER_SIZE));
+}
+
+
+/*
+ * Legge l'indice e conta i record validi del gruppo aperto. Ritorna 1 se l'intestazione va scritta (file nuovo o
+ * indice ricostruito), -1 in caso di errore
+ */
+static int load_journal(int fd, journal_t *journal) {
+    uint8_t  buffer[DATA_START];
+    uint32_t magic = 0, crc = 0;
+    uint16_t version = 0, num_groups = 0;
+
+    memset(journal, 0, sizeof(journal_t));
+
+    ssize_t len = pread(fd, buffer, DATA_START, 0);
+    if (len < 0) {
+        log_warn("Errore nella lettura dello storico cicli: %s", strerror(errno));
+        return -1;
+    } else if (len == 0) {
+        return 1;
+    }
+
+    if (len == DATA_START) {
+        deserialize_uint32_be(&magic, &buffer[0]);
+        deserialize_uint16_be(&version, &buffer[4]);
+        deserialize_uint16_be(&num_groups, &buffer[6]);
+        deserialize_uint32_be(&crc, &buffer[12]);
+    }
+
+    if (magic != HISTORY_MAGIC || version != HISTORY_VERSION || num_groups > MAX_GROUPS ||
+        crc != crc32(&buffer[HEADER_SIZE], DATA_START - HEADER_SIZE)) {
+        log_error("Indice dello storico cicli corrotto, lo ricostruisco dai record");
+        // In sola lettura l'indice ricostruito resta in memoria fino alla prossima aggiunta
+        return rebuild_journal(fd, journal);
+    }
+
+    journal->num_groups = num_groups;
+    for (size_t i = 0; i < num_groups; i++) {
+        deserialize_uint32_be(&journal->groups[i].first, &buffer[HEADER_SIZE + i * INDEX_ENTRY_SIZE]);
+        deserialize_uint32_be(&journal->groups[i].last, &buffer[HEADER_SIZE + i * INDEX_ENTRY_SIZE + 4]);
+    }
+
+    count_tail(fd, journal);
+    return 0;
+}
+
+
+/*
+ * Ricostruisce l'indice dalla dimensione del file: ogni gruppo completo e' chiuso e i suoi limiti vengono ricalcolati
+ * dai record validi. Ritorna 1 (l'indice va riscritto) o -1 in caso di errore
+ */
+static int rebuild_journal(int fd, journal_t *journal) {
+    struct stat st;
+
+    memset(journal, 0, sizeof(journal_t));
+    if (fstat(fd, &st) < 0) {
+        log_warn("Errore nella lettura dello storico cicli: %s", strerror(errno));
+        return -1;
+    }
+
+    size_t slots  = st.st_size > DATA_START ? (st.st_size - DATA_START) / RECORD_SIZE : 0;
+    size_t groups = slots / GROUP_RECORDS;
+    if (groups > MAX_GROUPS) {
+        // Non capita con un file scritto da qui: i gruppi oltre l'indice verranno sovrascritti
+        log_warn("Storico cicli con %zu gruppi, ne tengo %i", groups, MAX_GROUPS);
+        groups = MAX_GROUPS;
+    }
+
+    while (journal->num_groups < groups) {
+        if (close_group(fd, journal)) {
+            return -1;
+        }
+    }
+
+    count_tail(fd, journal);
+    log_info("Indice dello storico cicli ricostruito: %zu gruppi, %zu record nel gruppo aperto", journal->num_groups,
+             journal->tail);
+    return 1;
+}
+
+
+static void count_tail(int fd, journal_t *journal) {
+    uint8_t buffer[GROUP_SIZE];
+
+    journal->tail = 0;
+
+    ssize_t len = pread(fd, buffer, GROUP_SIZE, RECORD_OFFSET(journal->num_groups * GROUP_RECORDS));
+    for (ssize_t i = 0; i + RECORD_SIZE <= len; i += RECORD_SIZE) {
+        cycle_record_t record;
+        if (parse_record(&buffer[i], &record)) {
+            break;
+        }
+        journal->tail++;
+    }
+}
+
+
+static int close_group(int fd, journal_t *journal) {
+    uint8_t        buffer[GROUP_SIZE];
+    cycle_record_t record;
+    group_t       *group = &journal->groups[journal->num_groups];
+
+    if (pread(fd, buffer, GROUP_SIZE, RECORD_OFFSET(journal->num_groups * GROUP_RECORDS)) != GROUP_SIZE) {
+        log_warn("Errore nella lettura dello storico cicli: %s", strerror(errno));
+        return 1;
+    }
+
+    group->first = UINT32_MAX;
+    group->last  = 0;
+    for (size_t i = 0; i < GROUP_RECORDS; i++) {
+        if (parse_record(&buffer[i * RECORD_SIZE], &record) == 0) {
+            group->first = record.start < group->first ? record.start : group->first;
+            group->last  = record.start > group->last ? record.start : group->last;
+        }
+    }
+
+    journal->num_groups++;
+    journal->tail = 0;
+    return 0;
+}
+
+
+/*
+ * Riscrive lo storico con la meta' piu' recente dei gruppi e il gruppo aperto
+ */
+static int compact(const char *path, int fd, journal_t *journal) {
+    size_t first = journal->num_groups - MAX_GROUPS / 2;
+    size_t count = MAX_GROUPS / 2 * GROUP_RECORDS + journal->tail;
+    size_t size  = DATA_START + count * RECORD_SIZE;
+
+    uint8_t *image = malloc(size);
+    if (image == NULL) {
+        log_error("Memoria esaurita nella compattazione di %s", path);
+        return 1;
+    }
+
+    if (pread(fd, &image[DATA_START], count * RECORD_SIZE, RECORD_OFFSET(first * GROUP_RECORDS)) !=
+        (ssize_t)(count * RECORD_SIZE)) {
+        log_warn("Errore nella lettura dello storico cicli: %s", strerror(errno));
+        free(image);
+        return 1;
+    }
+
+    memmove(journal->groups, &journal->groups[first], sizeof(group_t) * MAX_GROUPS / 2);
+    journal->num_groups = MAX_GROUPS / 2;
+    serialize_index(image, journal);
+
+    // Il file viene sostituito al commit della transazione
+    int res = storage_transaction_write(path, image, size);
+    free(image);
+
+    log_info("Storico cicli compattato: %zu cicli conservati", count);
+    return res;
+}
+
+
+static void scan_records(int fd, size_t first, size_t count, uint32_t from, uint32_t to, cycle_history_t *history) {
+    uint8_t buffer[GROUP_SIZE];
+
+    ssize_t len = pread(fd, buffer, count * RECORD_SIZE, RECORD_OFFSET(first));
+    if (len < (ssize_t)(count * RECORD_SIZE)) {
+        count = len > 0 ? len / RECORD_SIZE : 0;
+    }
+
+    for (size_t i = count; i > 0 && history->count < CYCLE_HISTORY_QUERY_MAX; i--) {
+        cycle_record_t *record = &history->records[history->count];
+        if (parse_record(&buffer[(i - 1) * RECORD_SIZE], record) == 0 && record->start >= from &&
+            record->start <= to) {
+            history->count++;
+        }
+    }
+}
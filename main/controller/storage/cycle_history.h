@@ -0,0 +1,23 @@
+#ifndef CYCLE_HISTORY_H_INCLUDED
+#define CYCLE_HISTORY_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "model/cycle_record.h"
+
+
+#define CYCLE_HISTORY_QUERY_MAX 64
+
+
+typedef struct {
+    size_t         count;
+    cycle_record_t records[CYCLE_HISTORY_QUERY_MAX];     // Dal piu' recente
+} cycle_history_t;
+
+
+int cycle_history_append(const char *path, const cycle_record_t *record);
+int cycle_history_query(const char *path, uint32_t from, uint32_t to, cycle_history_t *history);
+
+
+#endif
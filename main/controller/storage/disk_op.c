@@ -13,15 +13,27 @@
 #include "utils/socketq.h"
 #include "disk_op.h"
 #include "storage.h"
+#include "machine_catalog.h"
+#include "hotplug.h"
+#include "log_archive.h"
+#include "cycle_history.h"
+#include "alarm_history.h"
+#include "stats_store.h"
 #include "config/app_conf.h"
 #include "../network/wifi.h"
-#include "log.h"
+#include "gel/timer/timecheck.h"
+#include "utils/system_time.h"
+#include "utils/async_log.h"
 
 
-#define REQUEST_SOCKET_PATH  "/tmp/.application_disk_request_socket"
 #define RESPONSE_SOCKET_PATH "/tmp/.application_disk_response_socket"
 #define MOUNT_ATTEMPTS       5
+#define CATALOG_POLL_BUDGET  50UL
+#define DRIVE_POLL_PERIOD    500UL
+#define HOTPLUG_SETTLE       100UL
+#define NUM_WORKERS          3
 #define APP_UPDATE           "/tmp/mnt/DS2021.bin"
+#define APP_DELTA            "/tmp/mnt/DS2021.delta"
 
 #ifdef TARGET_DEBUG
 #define TEMPORARY_APP "./newapp"
@@ -36,19 +48,59 @@ typedef struct {
 } disk_op_name_list_t;
 
 
+typedef struct {
+    int  save_password;
+    char password[PASSWORD_MAX_SIZE + 1];
+
+    int      save_parmac;
+    parmac_t parmac;
+
+    int    save_index;
+    size_t num_names;
+    name_t names[MAX_PROGRAMS];
+
+    size_t          num_programs;
+    dryer_program_t programs[MAX_PROGRAMS];
+} disk_op_save_all_t;
+
+
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+} disk_op_time_range_t;
+
+
+typedef struct {
+    size_t        num;
+    alarm_event_t events[ALARM_EVENT_PENDING];
+} disk_op_alarm_events_t;
+
+
 typedef enum {
     DISK_OP_MESSAGE_CODE_LOAD_PARMAC,
     DISK_OP_MESSAGE_CODE_LOAD_PROGRAMS,
+    DISK_OP_MESSAGE_CODE_LOAD_PROGRAM,
     DISK_OP_MESSAGE_CODE_SAVE_PARMAC,
     DISK_OP_MESSAGE_CODE_SAVE_PROGRAM_INDEX,
     DISK_OP_MESSAGE_CODE_SAVE_PROGRAM,
     DISK_OP_MESSAGE_CODE_SAVE_PASSWORD,
     DISK_OP_MESSAGE_CODE_REMOVE_PROGRAM,
     DISK_OP_MESSAGE_CODE_SAVE_WIFI_CONFIG,
-    DISK_OP_MESSAGE_CODE_READ_FILE,
     DISK_OP_MESSAGE_CODE_EXPORT_CURRENT_MACHINE,
     DISK_OP_MESSAGE_CODE_IMPORT_CURRENT_MACHINE,
     DISK_OP_MESSAGE_CODE_FIRMWARE_UPDATE,
+    DISK_OP_MESSAGE_CODE_SAVE_ALL,
+    DISK_OP_MESSAGE_CODE_PERSIST_LOG,
+    DISK_OP_MESSAGE_CODE_EXPORT_LOGS,
+    DISK_OP_MESSAGE_CODE_STREAM_CHUNK,
+    DISK_OP_MESSAGE_CODE_STREAM_CLOSE,
+    DISK_OP_MESSAGE_CODE_APPEND_CYCLE,
+    DISK_OP_MESSAGE_CODE_READ_CYCLE_HISTORY,
+    DISK_OP_MESSAGE_CODE_APPEND_ALARM_EVENTS,
+    DISK_OP_MESSAGE_CODE_READ_ALARM_HISTORY,
+    DISK_OP_MESSAGE_CODE_EXPORT_ALARMS,
+    DISK_OP_MESSAGE_CODE_LOAD_STATISTICS,
+    DISK_OP_MESSAGE_CODE_SAVE_STATISTICS,
 } disk_op_message_code_t;
 
 
@@ -61,28 +113,131 @@ typedef struct {
 } disk_op_message_t;
 
 
+// Risorse che due richieste non possono usare contemporaneamente
+typedef enum {
+    RESOURCE_DATA     = 0x01,     // Finestra in scrittura sulla partizione dati
+    RESOURCE_PROGRAMS = 0x02,     // Contenuto dell'archivio programmi
+    RESOURCE_DRIVE    = 0x04,     // Chiavetta (montaggio compreso)
+    RESOURCE_ROOT     = 0x08,     // Partizione di sistema
+} resource_t;
+
+
+struct disk_op_stream {
+    storage_stream_t file;
+    char            *path;     // Il file viene aperto alla prima lettura, dal worker
+    size_t           chunk_size;
+    size_t           len;
+    int              last;
+
+    disk_op_callback_t       callback;
+    disk_op_error_callback_t error_callback;
+    void                    *arg;
+
+    uint8_t chunk[];
+};
+
+
+typedef struct job {
+    disk_op_message_t msg;
+    disk_op_lane_t    lane;
+    unsigned int      resources;
+    unsigned long     ts;
+    unsigned long     seq;     // Ordine di accodamento, comune a tutte le corsie
+    int               cancelled;
+    struct job       *next;
+} job_t;
+
+
 static void *disk_interaction_task(void *args);
+static void *worker_task(void *args);
+static void  enqueue(disk_op_message_t *msg);
+static job_t *take_job(void);
+static unsigned int older_data_jobs(job_t *job);
+static void  execute(job_t *job);
+static void  discard(job_t *job);
+static void  acquire_resources(unsigned int resources);
+static void  release_resources(unsigned int resources);
 static void  simple_request(int code, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
+static int   save_all(disk_op_save_all_t *save);
+static int   is_cancelled(job_t *job);
+static int   update_progress(size_t done, size_t total, void *arg);
+static int   check_drive(unsigned int *mount_attempts);
+static void  notify_drive(void);
+static void  rotate_log(const char *path);
+static int   read_chunk(disk_op_stream_t *stream);
+static void  free_stream(disk_op_stream_t *stream);
+static void  stream_request(int code, disk_op_stream_t *stream);
 
 
-static socketq_t       requestq;
 static socketq_t       responseq;
 static pthread_mutex_t sem;
-static int             drive_mounted      = 0;
-static size_t          drive_machines_num = 0;
-static name_t         *drive_machines     = NULL;
+static int             drive_mounted = 0;
+static int             progress      = -1;
+
+static disk_op_callback_t drive_callback = NULL;
+
+// Code delle richieste, una per corsia, e risorse occupate dai worker
+static pthread_mutex_t jobs_sem;
+static pthread_cond_t  jobs_cond;
+static job_t          *lanes[DISK_OP_NUM_LANES] = {NULL};
+static job_t          *running[NUM_WORKERS]     = {NULL};
+static unsigned int    busy_resources           = 0;
+static unsigned long   next_seq                 = 0;
+
+static struct {
+    unsigned long count;
+    unsigned long total_wait;
+    unsigned long max_wait;
+} latency[DISK_OP_NUM_LANES] = {0};
 
 
-void disk_op_init(void) {
-    int res1 = socketq_init(&requestq, REQUEST_SOCKET_PATH, sizeof(disk_op_message_t));
-    int res2 = socketq_init(&responseq, RESPONSE_SOCKET_PATH, sizeof(disk_op_response_t));
-    assert(res1 == 0 && res2 == 0);
+/*
+ * drive_cb viene chiamata (dal thread del controller) ogni volta che cambia lo stato della chiavetta o il suo contenuto
+ */
+void disk_op_init(disk_op_callback_t drive_cb) {
+    drive_callback = drive_cb;
+
+    int res = socketq_init(&responseq, RESPONSE_SOCKET_PATH, sizeof(disk_op_response_t));
+    assert(res == 0);
 
     assert(pthread_mutex_init(&sem, NULL) == 0);
+    assert(pthread_mutex_init(&jobs_sem, NULL) == 0);
+    assert(pthread_cond_init(&jobs_cond, NULL) == 0);
+    machine_catalog_init();
+    async_log_set_rotation(LOG_SEGMENT_SIZE, LOG_SEGMENT_PERIOD, rotate_log);
 
     pthread_t id;
     pthread_create(&id, NULL, disk_interaction_task, NULL);
     pthread_detach(id);
+
+    for (size_t i = 0; i < NUM_WORKERS; i++) {
+        pthread_create(&id, NULL, worker_task, (void *)(uintptr_t)i);
+        pthread_detach(id);
+    }
+}
+
+
+/*
+ * Scarta le richieste in coda nella corsia indicata e chiede a quelle in corso di interrompersi;
+ * i rispettivi error callback vengono chiamati come per un errore
+ */
+void disk_op_cancel(disk_op_lane_t lane) {
+    pthread_mutex_lock(&jobs_sem);
+    job_t *queued = lanes[lane];
+    lanes[lane]   = NULL;
+    for (size_t i = 0; i < NUM_WORKERS; i++) {
+        if (running[i] != NULL && running[i]->lane == lane) {
+            running[i]->cancelled = 1;
+        }
+    }
+    pthread_mutex_unlock(&jobs_sem);
+
+    while (queued != NULL) {
+        job_t *next = queued->next;
+        log_info("Richiesta %i annullata prima dell'esecuzione", queued->msg.code);
+        discard(queued);
+        queued = next;
+    }
 }
 
 
@@ -97,7 +252,7 @@ void disk_op_remove_program(char *filename, disk_op_callback_t cb, disk_op_error
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
 }
 
 
@@ -112,7 +267,7 @@ void disk_op_save_password(char *password, disk_op_callback_t cb, disk_op_error_
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
 }
 
 
@@ -127,7 +282,7 @@ void disk_op_save_program(dryer_program_t *p, disk_op_callback_t cb, disk_op_err
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
 }
 
 
@@ -136,7 +291,7 @@ void disk_op_save_program_index(model_t *pmodel, disk_op_callback_t cb, disk_op_
     name_t              *names = malloc(sizeof(name_t) * model_get_num_programs(pmodel));
     assert(names != NULL);
     for (size_t i = 0; i < model_get_num_programs(pmodel); i++) {
-        memcpy(names[i], model_get_program(pmodel, i)->filename, sizeof(name_t));
+        memcpy(names[i], model_get_program_filename(pmodel, i), sizeof(name_t));
     }
     list->names           = names;
     list->num             = model_get_num_programs(pmodel);
@@ -147,7 +302,7 @@ void disk_op_save_program_index(model_t *pmodel, disk_op_callback_t cb, disk_op_
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
 }
 
 
@@ -162,7 +317,48 @@ void disk_op_save_parmac(parmac_t *parmac, disk_op_callback_t cb, disk_op_error_
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
+}
+
+
+void disk_op_save_all(model_t *pmodel, int password, int parmac, int index, uint64_t programs, disk_op_callback_t cb,
+                      disk_op_error_callback_t errcb, void *arg) {
+    disk_op_save_all_t *save = malloc(sizeof(disk_op_save_all_t));
+    assert(save != NULL);
+    memset(save, 0, sizeof(disk_op_save_all_t));
+
+    if (password) {
+        save->save_password = 1;
+        snprintf(save->password, sizeof(save->password), "%s", model_get_password(pmodel));
+    }
+
+    if (parmac) {
+        save->save_parmac = 1;
+        memcpy(&save->parmac, &pmodel->configuration.parmac, sizeof(parmac_t));
+    }
+
+    if (index) {
+        save->save_index = 1;
+        save->num_names  = model_get_num_programs(pmodel);
+        for (size_t i = 0; i < save->num_names; i++) {
+            memcpy(save->names[i], model_get_program_filename(pmodel, i), sizeof(name_t));
+        }
+    }
+
+    for (size_t i = 0; i < MAX_PROGRAMS; i++) {
+        if (programs & (1ULL << i)) {
+            memcpy(&save->programs[save->num_programs++], model_get_program(pmodel, i), sizeof(dryer_program_t));
+        }
+    }
+
+    disk_op_message_t msg = {
+        .code           = DISK_OP_MESSAGE_CODE_SAVE_ALL,
+        .data           = save,
+        .callback       = cb,
+        .error_callback = errcb,
+        .arg            = arg,
+    };
+    enqueue(&msg);
 }
 
 
@@ -177,7 +373,7 @@ void disk_op_export_current_machine(char *name, disk_op_callback_t cb, disk_op_e
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
 }
 
 
@@ -192,7 +388,7 @@ void disk_op_import_current_machine(char *name, disk_op_callback_t cb, disk_op_e
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
 }
 
 
@@ -202,6 +398,23 @@ void disk_op_load_programs(disk_op_callback_t cb, disk_op_error_callback_t errcb
 }
 
 
+/*
+ * La callback riceve il programma `filename` completo di step
+ */
+void disk_op_load_program(const char *filename, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
+    char *filename_copy = strdup(filename);
+    assert(filename_copy != NULL);
+    disk_op_message_t msg = {
+        .code           = DISK_OP_MESSAGE_CODE_LOAD_PROGRAM,
+        .data           = filename_copy,
+        .callback       = cb,
+        .error_callback = errcb,
+        .arg            = arg,
+    };
+    enqueue(&msg);
+}
+
+
 void disk_op_load_parmac(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
     simple_request(DISK_OP_MESSAGE_CODE_LOAD_PARMAC, cb, errcb, arg);
 }
@@ -217,20 +430,157 @@ void disk_op_firmware_update(disk_op_callback_t cb, disk_op_error_callback_t err
 }
 
 
-void disk_op_read_file(char *name, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
-    size_t len       = strlen(name) + 1;
-    char  *file_name = malloc(len);
-    memset(file_name, 0, len);
-    strcpy(file_name, name);
-    assert(file_name != NULL);
+void disk_op_export_logs(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
+    simple_request(DISK_OP_MESSAGE_CODE_EXPORT_LOGS, cb, errcb, arg);
+}
+
+
+void disk_op_export_alarms(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
+    simple_request(DISK_OP_MESSAGE_CODE_EXPORT_ALARMS, cb, errcb, arg);
+}
+
+
+/*
+ * Accoda il consuntivo di un ciclo allo storico; nessuno attende la risposta
+ */
+void disk_op_append_cycle(cycle_record_t *record) {
+    cycle_record_t *record_copy = malloc(sizeof(cycle_record_t));
+    assert(record_copy != NULL);
+    memcpy(record_copy, record, sizeof(cycle_record_t));
+    disk_op_message_t msg = {
+        .code = DISK_OP_MESSAGE_CODE_APPEND_CYCLE,
+        .data = record_copy,
+    };
+    enqueue(&msg);
+}
+
+
+/*
+ * La callback riceve un cycle_history_t con i cicli iniziati tra `from` e `to` (secondi dal 1970)
+ */
+void disk_op_read_cycle_history(uint32_t from, uint32_t to, disk_op_callback_t cb, disk_op_error_callback_t errcb,
+                                void *arg) {
+    disk_op_time_range_t *range = malloc(sizeof(disk_op_time_range_t));
+    assert(range != NULL);
+    range->from           = from;
+    range->to             = to;
+    disk_op_message_t msg = {
+        .code           = DISK_OP_MESSAGE_CODE_READ_CYCLE_HISTORY,
+        .data           = range,
+        .callback       = cb,
+        .error_callback = errcb,
+        .arg            = arg,
+    };
+    enqueue(&msg);
+}
+
+
+/*
+ * Accoda un gruppo di fronti degli allarmi allo storico; nessuno attende la risposta
+ */
+void disk_op_append_alarm_events(alarm_event_t *events, size_t num) {
+    assert(num <= ALARM_EVENT_PENDING);
+    disk_op_alarm_events_t *batch = malloc(sizeof(disk_op_alarm_events_t));
+    assert(batch != NULL);
+    batch->num = num;
+    memcpy(batch->events, events, sizeof(alarm_event_t) * num);
+    disk_op_message_t msg = {
+        .code = DISK_OP_MESSAGE_CODE_APPEND_ALARM_EVENTS,
+        .data = batch,
+    };
+    enqueue(&msg);
+}
+
+
+/*
+ * La callback riceve un alarm_history_t con le attivazioni e gli ultimi eventi tra `from` e `to` (secondi dal 1970)
+ */
+void disk_op_read_alarm_history(uint32_t from, uint32_t to, disk_op_callback_t cb, disk_op_error_callback_t errcb,
+                                void *arg) {
+    disk_op_time_range_t *range = malloc(sizeof(disk_op_time_range_t));
+    assert(range != NULL);
+    range->from           = from;
+    range->to             = to;
     disk_op_message_t msg = {
-        .code           = DISK_OP_MESSAGE_CODE_READ_FILE,
-        .data           = file_name,
+        .code           = DISK_OP_MESSAGE_CODE_READ_ALARM_HISTORY,
+        .data           = range,
         .callback       = cb,
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
+}
+
+
+/*
+ * La callback riceve uno stats_tracker_t con gli aggregati dell'ultimo salvataggio (vuoto se non ce ne sono)
+ */
+void disk_op_load_statistics(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
+    simple_request(DISK_OP_MESSAGE_CODE_LOAD_STATISTICS, cb, errcb, arg);
+}
+
+
+/*
+ * Salva una copia degli aggregati delle statistiche; nessuno attende la risposta
+ */
+void disk_op_save_statistics(const stats_tracker_t *tracker) {
+    stats_tracker_t *tracker_copy = malloc(sizeof(stats_tracker_t));
+    assert(tracker_copy != NULL);
+    memcpy(tracker_copy, tracker, sizeof(stats_tracker_t));
+    disk_op_message_t msg = {
+        .code = DISK_OP_MESSAGE_CODE_SAVE_STATISTICS,
+        .data = tracker_copy,
+    };
+    enqueue(&msg);
+}
+
+
+/*
+ * Il primo blocco viene letto subito; i successivi solo su richiesta, per cui in memoria ce n'e' sempre uno solo
+ */
+disk_op_stream_t *disk_op_open_stream(const char *path, size_t chunk_size, disk_op_callback_t cb,
+                                      disk_op_error_callback_t errcb, void *arg) {
+    disk_op_stream_t *stream = malloc(sizeof(disk_op_stream_t) + chunk_size);
+    assert(stream != NULL);
+    stream->path = strdup(path);
+    assert(stream->path != NULL);
+    stream->file.fd        = -1;
+    stream->chunk_size     = chunk_size;
+    stream->len            = 0;
+    stream->last           = 0;
+    stream->callback       = cb;
+    stream->error_callback = errcb;
+    stream->arg            = arg;
+
+    stream_request(DISK_OP_MESSAGE_CODE_STREAM_CHUNK, stream);
+    return stream;
+}
+
+
+void disk_op_next_chunk(disk_op_stream_t *stream) {
+    stream_request(DISK_OP_MESSAGE_CODE_STREAM_CHUNK, stream);
+}
+
+
+void disk_op_close_stream(disk_op_stream_t *stream) {
+    // Il file si chiude dal worker, come tutte le altre operazioni sul disco
+    stream_request(DISK_OP_MESSAGE_CODE_STREAM_CLOSE, stream);
+}
+
+
+const uint8_t *disk_op_stream_get_chunk(disk_op_stream_t *stream, size_t *len) {
+    *len = stream->len;
+    return stream->chunk;
+}
+
+
+int disk_op_stream_is_last(disk_op_stream_t *stream) {
+    return stream->last;
+}
+
+
+size_t disk_op_stream_get_size(disk_op_stream_t *stream) {
+    return stream->file.size;
 }
 
 
@@ -242,17 +592,13 @@ int disk_op_is_drive_mounted(void) {
 }
 
 
-size_t disk_op_drive_machines(name_t **machines) {
-    if (!disk_op_is_drive_mounted()) {
-        return 0;
-    }
-
+/*
+ * Avanzamento percentuale dell'operazione in corso, -1 se non disponibile
+ */
+int disk_op_get_progress(void) {
     pthread_mutex_lock(&sem);
-    size_t res = drive_machines_num;
-    *machines  = realloc(*machines, sizeof(name_t) * drive_machines_num);
-    memcpy(*machines, drive_machines, sizeof(name_t) * drive_machines_num);
+    int res = progress;
     pthread_mutex_unlock(&sem);
-
     return res;
 }
 
@@ -279,164 +625,617 @@ int disk_op_manage_response(model_t *pmodel) {
 
 
 int disk_op_is_firmware_present(void) {
-    return storage_is_file(APP_UPDATE);
+    return storage_is_file(APP_UPDATE) || storage_is_file(APP_DELTA);
+}
+
+
+static int is_cancelled(job_t *job) {
+    pthread_mutex_lock(&jobs_sem);
+    int cancelled = job->cancelled;
+    pthread_mutex_unlock(&jobs_sem);
+    return cancelled;
+}
+
+
+static int update_progress(size_t done, size_t total, void *arg) {
+    job_t *job = arg;
+
+    pthread_mutex_lock(&sem);
+    progress = total > 0 ? (int)((done * 100) / total) : -1;
+    pthread_mutex_unlock(&sem);
+
+    return job != NULL && is_cancelled(job);
 }
 
 
 static void *disk_interaction_task(void *args) {
-    unsigned int mount_attempts = 0;
+    unsigned int  mount_attempts  = 0;
+    int           check_scheduled = 1;     // Una chiavetta potrebbe essere gia' inserita
+    unsigned long check_ts        = get_millis();
+    unsigned long check_delay     = 0;
+    int           hotplug_fd      = hotplug_open();
 
+    acquire_resources(RESOURCE_DATA);
     storage_create_dir(DEFAULT_PROGRAMS_PATH);
     storage_create_dir(DEFAULT_PARAMS_PATH);
+    storage_create_dir(DEFAULT_HISTORY_PATH);
+#if CONFIG_LOG_PERSIST
+    storage_create_dir(LOG_PERSIST_PATH);
+#endif
+    release_resources(RESOURCE_DATA);
 
+    if (hotplug_fd < 0) {
+        log_info("Uevent non disponibili, controllo periodico delle chiavette");
+    }
+
+    // Le richieste sono eseguite dai worker: qui si gestiscono solo chiavetta e catalogo
     for (;;) {
-        disk_op_message_t msg;
-        if (socketq_receive_nonblock(&requestq, (uint8_t *)&msg, 500)) {
-            disk_op_response_t response = {
-                .callback       = msg.callback,
-                .error_callback = msg.error_callback,
-                .data           = NULL,
-                .arg            = msg.arg,
-                .transfer_data  = 0,
-            };
-
-            switch (msg.code) {
-                case DISK_OP_MESSAGE_CODE_IMPORT_CURRENT_MACHINE: {
-                    if (CONFIG_DATA_VERSION != storage_read_archive_data_version(DRIVE_MOUNT_PATH, msg.data)) {
-                        response.error = 1;
-                    } else {
-                        response.error = storage_load_current_machine_config(DRIVE_MOUNT_PATH, msg.data);
-                    }
-                    free(msg.data);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-                }
+        // Senza controlli in programma il thread resta fermo fino al prossimo evento
+        int timeout = -1;
 
-                case DISK_OP_MESSAGE_CODE_EXPORT_CURRENT_MACHINE:
-                    response.error = storage_save_current_machine_config(DRIVE_MOUNT_PATH, msg.data);
-                    free(msg.data);
+        if (check_scheduled) {
+            unsigned long elapsed = time_interval(check_ts, get_millis());
+            timeout               = elapsed >= check_delay ? 0 : (int)(check_delay - elapsed);
+        }
+        if (machine_catalog_is_pending()) {
+            timeout = 0;
+        }
 
-                    // Refresh saved machines on the drive
-                    pthread_mutex_lock(&sem);
-                    drive_machines_num = storage_list_saved_machines(DRIVE_MOUNT_PATH, &drive_machines);
-                    pthread_mutex_unlock(&sem);
+        struct pollfd fds[] = {
+            {.fd = hotplug_fd, .events = POLLIN},
+            {.fd = machine_catalog_get_fd(), .events = POLLIN},
+        };
+        poll(fds, sizeof(fds) / sizeof(fds[0]), timeout);
+
+        if ((fds[0].revents & POLLIN) && hotplug_read(hotplug_fd)) {
+            // Lascia al kernel il tempo di annunciare anche le partizioni
+            mount_attempts  = 0;
+            check_scheduled = 1;
+            check_ts        = get_millis();
+            check_delay     = HOTPLUG_SETTLE;
+        }
 
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
+        if ((fds[1].revents & POLLIN) || machine_catalog_is_pending()) {
+            if (machine_catalog_poll(CATALOG_POLL_BUDGET)) {
+                notify_drive();
+            }
+        }
 
-                case DISK_OP_MESSAGE_CODE_READ_FILE: {
-                    response.data          = storage_read_file(msg.data);
-                    response.transfer_data = 1;
-                    free(msg.data);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-                }
+        if (check_scheduled && is_expired(check_ts, get_millis(), check_delay)) {
+            int retry       = check_drive(&mount_attempts);
+            check_scheduled = retry || hotplug_fd < 0;
+            check_ts        = get_millis();
+            check_delay     = DRIVE_POLL_PERIOD;
+        }
+    }
 
-                case DISK_OP_MESSAGE_CODE_SAVE_PROGRAM_INDEX: {
-                    disk_op_name_list_t *list = msg.data;
-                    response.error = storage_update_program_index(DEFAULT_PROGRAMS_PATH, list->names, list->num);
-                    free(list);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-                }
+    pthread_exit(NULL);
+    return NULL;
+}
+
+
+static void *worker_task(void *args) {
+    size_t slot = (size_t)(uintptr_t)args;
+
+    for (;;) {
+        job_t *job;
+
+        pthread_mutex_lock(&jobs_sem);
+        while ((job = take_job()) == NULL) {
+            pthread_cond_wait(&jobs_cond, &jobs_sem);
+        }
+        busy_resources |= job->resources;
+        running[slot] = job;
+        pthread_mutex_unlock(&jobs_sem);
+
+        unsigned long start = get_millis();
+        unsigned long wait  = time_interval(job->ts, start);
+        execute(job);
+        log_debug("Richiesta %i (corsia %i): attesa %lu ms, esecuzione %lu ms", job->msg.code, job->lane, wait,
+                  time_interval(start, get_millis()));
+
+        pthread_mutex_lock(&jobs_sem);
+        busy_resources &= ~job->resources;
+        running[slot] = NULL;
+
+        latency[job->lane].count++;
+        latency[job->lane].total_wait += wait;
+        if (wait > latency[job->lane].max_wait) {
+            latency[job->lane].max_wait = wait;
+        }
+
+        // Al termine di un'operazione lunga si riporta quanto hanno atteso le richieste interattive nel frattempo
+        if (job->lane == DISK_OP_LANE_BULK) {
+            if (latency[DISK_OP_LANE_INTERACTIVE].count > 0) {
+                log_info("Latenza richieste interattive: %lu richieste, media %lu ms, massima %lu ms",
+                         latency[DISK_OP_LANE_INTERACTIVE].count,
+                         latency[DISK_OP_LANE_INTERACTIVE].total_wait / latency[DISK_OP_LANE_INTERACTIVE].count,
+                         latency[DISK_OP_LANE_INTERACTIVE].max_wait);
+            }
+            memset(latency, 0, sizeof(latency));
+        }
+
+        pthread_cond_broadcast(&jobs_cond);
+        pthread_mutex_unlock(&jobs_sem);
+
+        free(job);
+    }
+
+    pthread_exit(NULL);
+    return NULL;
+}
+
+
+static void execute(job_t *job) {
+    disk_op_message_t *msg = &job->msg;
+
+    disk_op_response_t response = {
+        .callback       = msg->callback,
+        .error_callback = msg->error_callback,
+        .data           = NULL,
+        .arg            = msg->arg,
+        .transfer_data  = 0,
+    };
+
+    switch (msg->code) {
+        case DISK_OP_MESSAGE_CODE_IMPORT_CURRENT_MACHINE: {
+            response.error = storage_import_machine_config(DRIVE_MOUNT_PATH, msg->data);
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+        }
+
+        case DISK_OP_MESSAGE_CODE_EXPORT_CURRENT_MACHINE:
+            response.error = storage_save_current_machine_config(DRIVE_MOUNT_PATH, msg->data,
+                                                                 CONFIG_EXPORT_COMPRESSION, update_progress, job);
+            free(msg->data);
+            update_progress(0, 0, NULL);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_EXPORT_LOGS:
+            response.error = log_archive_export(DRIVE_MOUNT_PATH, update_progress, job);
+            update_progress(0, 0, NULL);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_EXPORT_ALARMS:
+            response.error = alarm_history_export(DEFAULT_PATH_FILE_ALARMS, DRIVE_MOUNT_PATH, update_progress, job);
+            update_progress(0, 0, NULL);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_PERSIST_LOG:
+            // Richiesta interna, nessuno attende la risposta
+            log_archive_persist(msg->data);
+            free(msg->data);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_STREAM_CHUNK:
+            // Lo stream resta di chi lo ha aperto; in caso di errore viene liberato qui
+            response.error = read_chunk(msg->data);
+            if (response.error) {
+                free_stream(msg->data);
+            } else {
+                response.data          = msg->data;
+                response.transfer_data = 1;
+            }
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_STREAM_CLOSE:
+            // Richiesta interna, nessuno attende la risposta
+            free_stream(msg->data);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_APPEND_CYCLE:
+            // Richiesta interna, nessuno attende la risposta
+            if (cycle_history_append(DEFAULT_PATH_FILE_HISTORY, msg->data)) {
+                log_warn("Non sono riuscito a registrare il ciclo nello storico");
+            }
+            free(msg->data);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_READ_CYCLE_HISTORY: {
+            disk_op_time_range_t *range = msg->data;
+            response.data               = malloc(sizeof(cycle_history_t));
+            if (response.data == NULL) {
+                response.error = 1;
+            } else {
+                response.error = cycle_history_query(DEFAULT_PATH_FILE_HISTORY, range->from, range->to,
+                                                     response.data);
+            }
+            free(range);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+        }
 
-                case DISK_OP_MESSAGE_CODE_REMOVE_PROGRAM:
-                    storage_remove_program(DEFAULT_PROGRAMS_PATH, msg.data);
-                    free(msg.data);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_SAVE_PASSWORD:
-                    response.error = storage_write_file(DEFAULT_PATH_FILE_PASSWORD, msg.data, strlen(msg.data));
-                    free(msg.data);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_SAVE_PROGRAM:
-                    response.error = storage_update_program(DEFAULT_PROGRAMS_PATH, msg.data);
-                    free(msg.data);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_SAVE_PARMAC:
-                    response.error = storage_save_parmac(DEFAULT_PATH_FILE_PARMAC, msg.data);
-                    free(msg.data);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_LOAD_PARMAC:
-                    response.data = malloc(sizeof(parmac_t));
-                    if (response.data == NULL) {
-                        response.error = 1;
-                    } else {
-                        response.error = storage_load_parmac(DEFAULT_PATH_FILE_PARMAC, response.data);
-                    }
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_LOAD_PROGRAMS:
-                    response.data = malloc(sizeof(storage_program_list_t));
-                    if (response.data == NULL) {
-                        response.error = 1;
-                    } else {
-                        response.error = storage_load_saved_programs(DEFAULT_PROGRAMS_PATH, response.data);
-                    }
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_SAVE_WIFI_CONFIG:
-                    response.error = wifi_save_config();
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
-
-                case DISK_OP_MESSAGE_CODE_FIRMWARE_UPDATE:
-                    response.error = storage_update_temporary_firmware(APP_UPDATE, TEMPORARY_APP);
-                    socketq_send(&responseq, (uint8_t *)&response);
-                    break;
+        case DISK_OP_MESSAGE_CODE_APPEND_ALARM_EVENTS: {
+            // Richiesta interna, nessuno attende la risposta
+            disk_op_alarm_events_t *batch = msg->data;
+            if (alarm_history_append(DEFAULT_PATH_FILE_ALARMS, batch->events, batch->num)) {
+                log_warn("Non sono riuscito a registrare %zu eventi di allarme", batch->num);
             }
+            free(batch);
+            break;
         }
 
-        if (storage_get_file_size(LOGFILE) > MAX_LOGFILE_SIZE) {
-            storage_clear_file(LOGFILE);
+        case DISK_OP_MESSAGE_CODE_READ_ALARM_HISTORY: {
+            disk_op_time_range_t *range = msg->data;
+            response.data               = malloc(sizeof(alarm_history_t));
+            if (response.data == NULL) {
+                response.error = 1;
+            } else {
+                response.error = alarm_history_query(DEFAULT_PATH_FILE_ALARMS, range->from, range->to, response.data);
+            }
+            free(range);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
         }
 
-        int drive_already_mounted = disk_op_is_drive_mounted();
-        int drive_plugged         = storage_is_drive_plugged();
-
-        if (drive_already_mounted && !drive_plugged) {
-            pthread_mutex_lock(&sem);
-            drive_mounted = 0;
-            pthread_mutex_unlock(&sem);
-            storage_unmount_drive();
-            log_info("Chiavetta rimossa");
-            mount_attempts = 0;
-        } else if (!drive_already_mounted && drive_plugged) {
-            if (mount_attempts < MOUNT_ATTEMPTS) {
-                mount_attempts++;
-                log_info("Rilevata una chiavetta");
-                if (storage_mount_drive() == 0) {
-                    pthread_mutex_lock(&sem);
-                    drive_mounted      = 1;
-                    drive_machines_num = storage_list_saved_machines(DRIVE_MOUNT_PATH, &drive_machines);
-                    pthread_mutex_unlock(&sem);
-                    // model->system.f_update_ready  = is_firmware_present();
-                    log_info("Chiavetta montata con successo");
-                    mount_attempts = 0;
+        case DISK_OP_MESSAGE_CODE_LOAD_STATISTICS:
+            response.data = malloc(sizeof(stats_tracker_t));
+            if (response.data == NULL) {
+                response.error = 1;
+            } else {
+                response.error = stats_store_load(DEFAULT_PATH_FILE_STATISTICS, response.data);
+            }
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_STATISTICS:
+            // Richiesta interna, nessuno attende la risposta
+            if (stats_store_save(DEFAULT_PATH_FILE_STATISTICS, msg->data)) {
+                log_warn("Non sono riuscito a salvare le statistiche");
+            }
+            free(msg->data);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_PROGRAM_INDEX: {
+            disk_op_name_list_t *list = msg->data;
+            response.error = storage_update_program_index(DEFAULT_PROGRAMS_PATH, list->names, list->num);
+            free(list->names);
+            free(list);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+        }
+
+        case DISK_OP_MESSAGE_CODE_REMOVE_PROGRAM:
+            storage_remove_program(DEFAULT_PROGRAMS_PATH, msg->data);
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_PASSWORD:
+            response.error = storage_write_file(DEFAULT_PATH_FILE_PASSWORD, msg->data, strlen(msg->data));
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_PROGRAM:
+            response.error = storage_update_program(DEFAULT_PROGRAMS_PATH, msg->data);
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_PARMAC:
+            response.error = storage_save_parmac(DEFAULT_PATH_FILE_PARMAC, msg->data);
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_LOAD_PARMAC:
+            response.data = malloc(sizeof(parmac_t));
+            if (response.data == NULL) {
+                response.error = 1;
+            } else {
+                response.error = storage_load_parmac(DEFAULT_PATH_FILE_PARMAC, response.data);
+            }
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_LOAD_PROGRAMS:
+            response.data = malloc(sizeof(storage_program_list_t));
+            if (response.data == NULL) {
+                response.error = 1;
+            } else {
+                response.error = storage_load_saved_programs(DEFAULT_PROGRAMS_PATH, response.data);
+            }
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_LOAD_PROGRAM: {
+            dryer_program_t *p = malloc(sizeof(dryer_program_t));
+            if (p == NULL) {
+                response.error = 1;
+            } else {
+                snprintf(p->filename, sizeof(p->filename), "%s", (char *)msg->data);
+                response.error = storage_load_program(DEFAULT_PROGRAMS_PATH, p);
+                if (response.error) {
+                    free(p);
                 } else {
-                    pthread_mutex_lock(&sem);
-                    drive_mounted = 0;
-                    pthread_mutex_unlock(&sem);
-                    log_warn("Non sono riuscito a montare la chiavetta!");
+                    response.data = p;
                 }
             }
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+        }
+
+        case DISK_OP_MESSAGE_CODE_SAVE_WIFI_CONFIG:
+            response.error = wifi_save_config();
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_FIRMWARE_UPDATE:
+            response.error = -1;
+            // La patch e' molto piu' piccola dell'immagine completa, che resta come riserva
+            if (storage_is_file(APP_DELTA)) {
+                response.error = storage_apply_firmware_delta(APP_DELTA, TEMPORARY_APP, update_progress, job);
+            }
+            if (response.error && !is_cancelled(job) && storage_is_file(APP_UPDATE)) {
+                response.error = storage_update_temporary_firmware(APP_UPDATE, TEMPORARY_APP, update_progress, job);
+            }
+            update_progress(0, 0, NULL);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_ALL:
+            response.error = save_all(msg->data);
+            free(msg->data);
+            socketq_send(&responseq, (uint8_t *)&response);
+            break;
+    }
+}
+
+
+static void enqueue(disk_op_message_t *msg) {
+    job_t *job = malloc(sizeof(job_t));
+    assert(job != NULL);
+
+    job->msg       = *msg;
+    job->ts        = get_millis();
+    job->cancelled = 0;
+    job->next      = NULL;
+
+    switch (msg->code) {
+        case DISK_OP_MESSAGE_CODE_STREAM_CLOSE:
+            job->lane      = DISK_OP_LANE_INTERACTIVE;
+            job->resources = 0;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_LOAD_PARMAC:
+        case DISK_OP_MESSAGE_CODE_STREAM_CHUNK:
+        case DISK_OP_MESSAGE_CODE_READ_CYCLE_HISTORY:
+        case DISK_OP_MESSAGE_CODE_READ_ALARM_HISTORY:
+        case DISK_OP_MESSAGE_CODE_LOAD_STATISTICS:
+            // Le letture non devono vedere a meta' una scrittura in corso sulla partizione dati
+            job->lane      = DISK_OP_LANE_INTERACTIVE;
+            job->resources = RESOURCE_DATA;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_LOAD_PROGRAMS:
+            // Puo' migrare il vecchio formato
+            job->lane      = DISK_OP_LANE_INTERACTIVE;
+            job->resources = RESOURCE_DATA | RESOURCE_PROGRAMS;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_LOAD_PROGRAM:
+            job->lane      = DISK_OP_LANE_INTERACTIVE;
+            job->resources = RESOURCE_DATA | RESOURCE_PROGRAMS;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_PARMAC:
+        case DISK_OP_MESSAGE_CODE_SAVE_PASSWORD:
+            job->lane      = DISK_OP_LANE_PERSISTENCE;
+            job->resources = RESOURCE_DATA;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_WIFI_CONFIG:
+            job->lane      = DISK_OP_LANE_PERSISTENCE;
+            job->resources = RESOURCE_ROOT;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_SAVE_PROGRAM_INDEX:
+        case DISK_OP_MESSAGE_CODE_SAVE_PROGRAM:
+        case DISK_OP_MESSAGE_CODE_REMOVE_PROGRAM:
+        case DISK_OP_MESSAGE_CODE_SAVE_ALL:
+            job->lane      = DISK_OP_LANE_PERSISTENCE;
+            job->resources = RESOURCE_DATA | RESOURCE_PROGRAMS;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_EXPORT_CURRENT_MACHINE:
+            // Legge parametri e password: un salvataggio contemporaneo finirebbe a meta' nell'archivio
+            job->lane      = DISK_OP_LANE_BULK;
+            job->resources = RESOURCE_DRIVE | RESOURCE_DATA | RESOURCE_PROGRAMS;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_IMPORT_CURRENT_MACHINE:
+            job->lane      = DISK_OP_LANE_BULK;
+            job->resources = RESOURCE_DRIVE | RESOURCE_DATA | RESOURCE_PROGRAMS;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_FIRMWARE_UPDATE:
+            job->lane      = DISK_OP_LANE_BULK;
+            job->resources = RESOURCE_DRIVE | RESOURCE_ROOT;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_EXPORT_LOGS:
+        case DISK_OP_MESSAGE_CODE_EXPORT_ALARMS:
+            // Una rotazione dei log o un nuovo allarme cambierebbero i file durante la copia
+            job->lane      = DISK_OP_LANE_BULK;
+            job->resources = RESOURCE_DRIVE | RESOURCE_DATA;
+            break;
+
+        case DISK_OP_MESSAGE_CODE_PERSIST_LOG:
+        case DISK_OP_MESSAGE_CODE_APPEND_CYCLE:
+        case DISK_OP_MESSAGE_CODE_APPEND_ALARM_EVENTS:
+        case DISK_OP_MESSAGE_CODE_SAVE_STATISTICS:
+            job->lane      = DISK_OP_LANE_PERSISTENCE;
+            job->resources = RESOURCE_DATA;
+            break;
+    }
+
+    pthread_mutex_lock(&jobs_sem);
+    job->seq     = next_seq++;
+    job_t **tail = &lanes[job->lane];
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = job;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_sem);
+}
+
+
+/*
+ * Prima richiesta eseguibile, per priorita' di corsia; va chiamata con jobs_sem acquisito.
+ * Una richiesta non scavalca quelle della stessa corsia che usano le sue stesse risorse, ne' quelle di altre corsie
+ * accodate prima di lei che usano la partizione dati: una lettura interattiva vede sempre i salvataggi chiesti prima.
+ */
+static job_t *take_job(void) {
+    for (size_t lane = 0; lane < DISK_OP_NUM_LANES; lane++) {
+        unsigned int blocked = busy_resources;
+
+        for (job_t **job = &lanes[lane]; *job != NULL; job = &(*job)->next) {
+            if (((*job)->resources & (blocked | older_data_jobs(*job))) == 0) {
+                job_t *found = *job;
+                *job         = found->next;
+                return found;
+            }
+            blocked |= (*job)->resources;
         }
     }
 
-    pthread_exit(NULL);
     return NULL;
 }
 
 
+/*
+ * RESOURCE_DATA se una richiesta di un'altra corsia, accodata prima di job, usa la partizione dati.
+ * Le code sono in ordine di accodamento: ci si ferma alla prima richiesta piu' recente
+ */
+static unsigned int older_data_jobs(job_t *job) {
+    if ((job->resources & RESOURCE_DATA) == 0) {
+        return 0;
+    }
+
+    for (size_t lane = 0; lane < DISK_OP_NUM_LANES; lane++) {
+        if (lane == job->lane) {
+            continue;
+        }
+        for (job_t *other = lanes[lane]; other != NULL && other->seq < job->seq; other = other->next) {
+            if (other->resources & RESOURCE_DATA) {
+                return RESOURCE_DATA;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static void discard(job_t *job) {
+    if (job->msg.code == DISK_OP_MESSAGE_CODE_SAVE_PROGRAM_INDEX) {
+        free(((disk_op_name_list_t *)job->msg.data)->names);
+    }
+    if (job->msg.code == DISK_OP_MESSAGE_CODE_STREAM_CHUNK || job->msg.code == DISK_OP_MESSAGE_CODE_STREAM_CLOSE) {
+        free_stream(job->msg.data);
+    } else {
+        free(job->msg.data);
+    }
+
+    disk_op_response_t response = {
+        .callback       = job->msg.callback,
+        .error_callback = job->msg.error_callback,
+        .arg            = job->msg.arg,
+        .error          = 1,
+    };
+    socketq_send(&responseq, (uint8_t *)&response);
+    free(job);
+}
+
+
+/*
+ * Per le operazioni fuori dai worker (montaggio della chiavetta)
+ */
+static void acquire_resources(unsigned int resources) {
+    pthread_mutex_lock(&jobs_sem);
+    while (busy_resources & resources) {
+        pthread_cond_wait(&jobs_cond, &jobs_sem);
+    }
+    busy_resources |= resources;
+    pthread_mutex_unlock(&jobs_sem);
+}
+
+
+static void release_resources(unsigned int resources) {
+    pthread_mutex_lock(&jobs_sem);
+    busy_resources &= ~resources;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_sem);
+}
+
+
+/*
+ * Monta o smonta la chiavetta secondo lo stato dei dispositivi; ritorna 1 se va ritentato il montaggio
+ */
+static int check_drive(unsigned int *mount_attempts) {
+    int drive_already_mounted = disk_op_is_drive_mounted();
+    int drive_plugged         = storage_is_drive_plugged();
+
+    if (drive_already_mounted && !drive_plugged) {
+        // Le operazioni sulla chiavetta non possono piu' concludersi
+        disk_op_cancel(DISK_OP_LANE_BULK);
+        acquire_resources(RESOURCE_DRIVE);
+        pthread_mutex_lock(&sem);
+        drive_mounted = 0;
+        pthread_mutex_unlock(&sem);
+        machine_catalog_close();
+        storage_unmount_drive();
+        release_resources(RESOURCE_DRIVE);
+        log_info("Chiavetta rimossa");
+        *mount_attempts = 0;
+        notify_drive();
+    } else if (!drive_already_mounted && drive_plugged) {
+        if (*mount_attempts < MOUNT_ATTEMPTS) {
+            (*mount_attempts)++;
+            log_info("Rilevata una chiavetta");
+            acquire_resources(RESOURCE_DRIVE);
+            int res = storage_mount_drive();
+            if (res == 0) {
+                machine_catalog_open(DRIVE_MOUNT_PATH);
+                pthread_mutex_lock(&sem);
+                drive_mounted = 1;
+                pthread_mutex_unlock(&sem);
+            }
+            release_resources(RESOURCE_DRIVE);
+
+            if (res == 0) {
+                log_info("Chiavetta montata con successo");
+                *mount_attempts = 0;
+                notify_drive();
+            } else {
+                log_warn("Non sono riuscito a montare la chiavetta!");
+                return *mount_attempts < MOUNT_ATTEMPTS;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static void notify_drive(void) {
+    if (drive_callback == NULL) {
+        return;
+    }
+
+    disk_op_response_t response = {.callback = drive_callback};
+    socketq_send(&responseq, (uint8_t *)&response);
+}
+
+
 static void simple_request(int code, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg) {
     disk_op_message_t msg = {
         .code           = code,
@@ -445,5 +1244,97 @@ static void simple_request(int code, disk_op_callback_t cb, disk_op_error_callba
         .error_callback = errcb,
         .arg            = arg,
     };
-    socketq_send(&requestq, (uint8_t *)&msg);
+    enqueue(&msg);
+}
+
+
+static int save_all(disk_op_save_all_t *save) {
+    unsigned long start  = get_millis();
+    size_t        files  = 0;
+    int           failed = 0;
+
+    // Tutte le scritture condividono un'unica finestra in lettura/scrittura e vengono rese visibili insieme
+    storage_transaction_begin();
+
+    if (save->save_password) {
+        storage_write_file(DEFAULT_PATH_FILE_PASSWORD, save->password, strlen(save->password));
+        files++;
+    }
+    if (save->save_parmac) {
+        storage_save_parmac(DEFAULT_PATH_FILE_PARMAC, &save->parmac);
+        files++;
+    }
+    if (save->save_index || save->num_programs > 0) {
+        // Indice e programmi finiscono nello stesso archivio: un solo aggiornamento
+        // Un programma senza step caricati viene scartato senza fallire la transazione, ma va segnalato
+        failed = storage_save_programs(DEFAULT_PROGRAMS_PATH, save->save_index, save->names, save->num_names,
+                                       save->programs, save->num_programs) != 0;
+        files++;
+    }
+
+    int res = storage_transaction_commit();
+    res     = res ? res : failed;
+    log_info("Salvataggio di %zu file completato in %lu ms (%s)", files, time_interval(start, get_millis()),
+             res ? "errore" : "ok");
+    return res;
+}
+
+
+/*
+ * Chiamata dal logger, su un thread suo, quando chiude un file di log
+ */
+static void rotate_log(const char *path) {
+    char segment[128];
+
+    if (log_archive_compress(path, segment, sizeof(segment))) {
+        return;
+    }
+
+#if CONFIG_LOG_PERSIST
+    char *segment_copy = strdup(segment);
+    assert(segment_copy != NULL);
+    disk_op_message_t msg = {
+        .code = DISK_OP_MESSAGE_CODE_PERSIST_LOG,
+        .data = segment_copy,
+    };
+    enqueue(&msg);
+#endif
+}
+
+
+static int read_chunk(disk_op_stream_t *stream) {
+    if (stream->file.fd < 0) {
+        if (storage_stream_open(&stream->file, stream->path) < 0) {
+            log_warn("Non riesco ad aprire %s: %s", stream->path, strerror(errno));
+            return -1;
+        }
+    }
+
+    stream->len = storage_stream_read(&stream->file, stream->chunk, stream->chunk_size);
+    if (stream->file.error) {
+        log_warn("Errore nella lettura di %s: %s", stream->path, strerror(errno));
+        return -1;
+    }
+
+    stream->last = stream->len < stream->chunk_size || stream->file.offset >= stream->file.size;
+    return 0;
+}
+
+
+static void free_stream(disk_op_stream_t *stream) {
+    storage_stream_close(&stream->file);
+    free(stream->path);
+    free(stream);
+}
+
+
+static void stream_request(int code, disk_op_stream_t *stream) {
+    disk_op_message_t msg = {
+        .code           = code,
+        .data           = stream,
+        .callback       = code == DISK_OP_MESSAGE_CODE_STREAM_CHUNK ? stream->callback : NULL,
+        .error_callback = code == DISK_OP_MESSAGE_CODE_STREAM_CHUNK ? stream->error_callback : NULL,
+        .arg            = stream->arg,
+    };
+    enqueue(&msg);
 }
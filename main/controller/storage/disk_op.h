@@ -5,10 +5,27 @@
 #include "model/model.h"
 
 
+// Corsie in ordine di priorita'
+typedef enum {
+    DISK_OP_LANE_INTERACTIVE = 0,     // Letture attese dall'interfaccia
+    DISK_OP_LANE_PERSISTENCE,         // Salvataggi della configurazione
+    DISK_OP_LANE_BULK,                // Esportazione, importazione, aggiornamento
+    DISK_OP_NUM_LANES,
+} disk_op_lane_t;
+
+
 typedef void (*disk_op_callback_t)(model_t *, void *, void *);
 typedef void (*disk_op_error_callback_t)(model_t *, void *);
 
 
+/*
+ * Lettura a blocchi: la callback riceve lo stream come `data` ogni volta che un blocco e' pronto.
+ * Il blocco successivo viene letto solo quando richiesto con disk_op_next_chunk; lo stream va chiuso con
+ * disk_op_close_stream, tranne dopo l'error callback, quando non e' piu' valido.
+ */
+typedef struct disk_op_stream disk_op_stream_t;
+
+
 typedef struct {
     disk_op_callback_t       callback;
     disk_op_error_callback_t error_callback;
@@ -19,23 +36,44 @@ typedef struct {
 } disk_op_response_t;
 
 
-void   disk_op_init(void);
+void   disk_op_init(disk_op_callback_t drive_cb);
+void   disk_op_cancel(disk_op_lane_t lane);
 void   disk_op_load_parmac(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_load_programs(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
+void   disk_op_load_program(const char *filename, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_save_parmac(parmac_t *parmac, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_save_program_index(model_t *pmodel, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_save_program(dryer_program_t *p, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 int    disk_op_manage_response(model_t *pmodel);
 void   disk_op_remove_program(char *filename, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_save_wifi_config(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
-void   disk_op_read_file(char *name, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_save_password(char *password, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 int    disk_op_is_drive_mounted(void);
-size_t disk_op_drive_machines(name_t **machines);
+int    disk_op_get_progress(void);
 void   disk_op_export_current_machine(char *name, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 void   disk_op_import_current_machine(char *name, disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
 int    disk_op_is_firmware_present(void);
 void   disk_op_firmware_update(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
+void   disk_op_export_logs(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
+void   disk_op_save_all(model_t *pmodel, int password, int parmac, int index, uint64_t programs, disk_op_callback_t cb,
+                        disk_op_error_callback_t errcb, void *arg);
+void   disk_op_append_cycle(cycle_record_t *record);
+void   disk_op_read_cycle_history(uint32_t from, uint32_t to, disk_op_callback_t cb, disk_op_error_callback_t errcb,
+                                  void *arg);
+void   disk_op_append_alarm_events(alarm_event_t *events, size_t num);
+void   disk_op_read_alarm_history(uint32_t from, uint32_t to, disk_op_callback_t cb, disk_op_error_callback_t errcb,
+                                  void *arg);
+void   disk_op_export_alarms(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
+void   disk_op_load_statistics(disk_op_callback_t cb, disk_op_error_callback_t errcb, void *arg);
+void   disk_op_save_statistics(const stats_tracker_t *tracker);
+
+disk_op_stream_t *disk_op_open_stream(const char *path, size_t chunk_size, disk_op_callback_t cb,
+                                      disk_op_error_callback_t errcb, void *arg);
+void              disk_op_next_chunk(disk_op_stream_t *stream);
+void              disk_op_close_stream(disk_op_stream_t *stream);
+const uint8_t    *disk_op_stream_get_chunk(disk_op_stream_t *stream, size_t *len);
+int               disk_op_stream_is_last(disk_op_stream_t *stream);
+size_t            disk_op_stream_get_size(disk_op_stream_t *stream);
 
 
 #endif
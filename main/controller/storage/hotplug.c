@@ -0,0 +1,92 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "hotplug.h"
+#include "utils/async_log.h"
+
+
+#define UEVENT_BUFFER_SIZE 2048
+
+
+static int is_usb_drive_event(const char *buffer, size_t len);
+
+
+/*
+ * Socket netlink sugli uevent del kernel; -1 se non disponibile (nel simulatore si ricorre al controllo periodico)
+ */
+int hotplug_open(void) {
+#ifdef TARGET_DEBUG
+    return -1;
+#else
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_pid    = 0,
+        .nl_groups = 1,     // Eventi inviati direttamente dal kernel
+    };
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        log_warn("Non riesco ad aprire il socket uevent: %s", strerror(errno));
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_warn("Non riesco a ricevere gli uevent: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#endif
+}
+
+
+/*
+ * Svuota il socket e ritorna 1 se almeno un evento riguarda l'aggiunta o la rimozione di una chiavetta
+ */
+int hotplug_read(int fd) {
+    char               buffer[UEVENT_BUFFER_SIZE];
+    struct sockaddr_nl sender;
+    int                found = 0;
+
+    for (;;) {
+        socklen_t sender_len = sizeof(sender);
+        ssize_t   len = recvfrom(fd, buffer, sizeof(buffer) - 1, 0, (struct sockaddr *)&sender, &sender_len);
+        if (len <= 0) {
+            break;
+        }
+
+        // Solo i messaggi del kernel sono affidabili
+        if (sender.nl_pid != 0) {
+            continue;
+        }
+
+        buffer[len] = '\0';
+        found |= is_usb_drive_event(buffer, len);
+    }
+
+    return found;
+}
+
+
+static int is_usb_drive_event(const char *buffer, size_t len) {
+    int block = 0, drive = 0, action = 0;
+
+    // Formato: "azione@percorso\0CHIAVE=valore\0..."
+    for (size_t i = strlen(buffer) + 1; i < len; i += strlen(&buffer[i]) + 1) {
+        const char *field = &buffer[i];
+
+        if (strcmp(field, "SUBSYSTEM=block") == 0) {
+            block = 1;
+        } else if (strncmp(field, "DEVNAME=sd", 10) == 0) {
+            drive = 1;
+        } else if (strcmp(field, "ACTION=add") == 0 || strcmp(field, "ACTION=remove") == 0 ||
+                   strcmp(field, "ACTION=change") == 0) {
+            action = 1;
+        }
+    }
+
+    return block && drive && action;
+}
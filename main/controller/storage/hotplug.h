@@ -0,0 +1,9 @@
+#ifndef HOTPLUG_H_INCLUDED
+#define HOTPLUG_H_INCLUDED
+
+
+int hotplug_open(void);
+int hotplug_read(int fd);
+
+
+#endif
@@ -0,0 +1,416 @@
+#include <archive.h>
+#include <archive_entry.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "config/app_conf.h"
+#include "gel/timer/timecheck.h"
+#include "utils/async_log.h"
+#include "utils/system_time.h"
+#include "log_archive.h"
+#include "storage.h"
+
+
+/*
+ *  Segmenti del log: il file corrente viene ruotato dal logger, compresso in LOG_SEGMENTS_PATH e,
+ *  se CONFIG_LOG_PERSIST, copiato sulla partizione dati. I segmenti sono numerati in ordine crescente.
+ */
+
+
+#define BLOCK_SIZE  (64 * 1024)
+#define PATH_SIZE   128
+#define TMP_SUFFIX  ".tmp"
+#define MAX_ENTRIES 256
+#define LOGFILE_NAME (strrchr(LOGFILE, '/') + 1)
+
+
+typedef struct {
+    unsigned int sequence;
+    size_t       size;
+} segment_t;
+
+
+typedef struct {
+    char   path[PATH_SIZE];
+    char   name[64];
+    size_t size;
+    time_t mtime;
+} export_entry_t;
+
+
+static int  list_segments(const char *dir, segment_t **segments);
+static void segment_path(char *path, size_t len, const char *dir, unsigned int sequence);
+static void enforce_retention(const char *dir, size_t budget, size_t extra);
+static int  add_export_entry(export_entry_t *entries, size_t *num, const char *path, const char *name);
+static int  write_entry(struct archive *a, export_entry_t *entry, size_t *done, size_t total,
+                        storage_progress_cb_t progress, void *arg);
+static int  compare_segments(const void *a, const void *b);
+
+
+static unsigned int next_sequence = 0;     // Usato solo dal thread di rotazione
+
+
+/*
+ * Comprime il file ruotato in un nuovo segmento e lo rimuove; ritorna in `segment` il percorso del segmento
+ */
+int log_archive_compress(const char *path, char *segment, size_t len) {
+    static uint8_t buffer[BLOCK_SIZE];
+    unsigned long  start = get_millis();
+    char             tmp_path[PATH_SIZE + sizeof(TMP_SUFFIX)];
+    storage_stream_t stream;
+    size_t           read_len;
+    int              res = 0;
+
+    if (next_sequence == 0) {
+        // Si riparte dopo l'ultimo segmento conservato, anche se /tmp e' stata svuotata da un riavvio
+        const char *dirs[] = {LOG_SEGMENTS_PATH, LOG_PERSIST_PATH};
+        next_sequence      = 1;
+        for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+            segment_t *segments = NULL;
+            int        num      = list_segments(dirs[i], &segments);
+            if (num > 0 && segments[num - 1].sequence >= next_sequence) {
+                next_sequence = segments[num - 1].sequence + 1;
+            }
+            free(segments);
+        }
+    }
+
+    if (mkdir(LOG_SEGMENTS_PATH, 0755) < 0 && errno != EEXIST) {
+        log_warn("Non riesco a creare %s: %s", LOG_SEGMENTS_PATH, strerror(errno));
+        return -1;
+    }
+
+    if (storage_stream_open(&stream, path) < 0) {
+        log_warn("Non riesco ad aprire %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    segment_path(segment, len, LOG_SEGMENTS_PATH, next_sequence);
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", segment, TMP_SUFFIX);
+
+    struct archive *a = archive_write_new();
+    archive_write_add_filter_gzip(a);
+    archive_write_set_format_raw(a);
+
+    if (archive_write_open_filename(a, tmp_path) != ARCHIVE_OK) {
+        log_warn("Non riesco a creare %s: %s", tmp_path, archive_error_string(a));
+        archive_write_free(a);
+        storage_stream_close(&stream);
+        return -1;
+    }
+
+    struct archive_entry *entry = archive_entry_new();
+    archive_entry_set_pathname(entry, LOGFILE_NAME);
+    archive_entry_set_size(entry, stream.size);
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    if (archive_write_header(a, entry) != ARCHIVE_OK) {
+        log_warn("Errore nella compressione del log: %s", archive_error_string(a));
+        res = -1;
+    }
+
+    while (!res && (read_len = storage_stream_read(&stream, buffer, sizeof(buffer))) > 0) {
+        if (archive_write_data(a, buffer, read_len) < 0) {
+            log_warn("Errore nella compressione del log: %s", archive_error_string(a));
+            res = -1;
+        }
+    }
+    if (stream.error) {
+        log_warn("Errore nella lettura di %s: %s", path, strerror(errno));
+        res = -1;
+    }
+
+    archive_entry_free(entry);
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        res = -1;
+    }
+    archive_write_free(a);
+    storage_stream_close(&stream);
+
+    if (res || rename(tmp_path, segment) < 0) {
+        log_warn("Segmento di log %s non creato", segment);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    next_sequence++;
+    unlink(path);
+    enforce_retention(LOG_SEGMENTS_PATH, LOG_SEGMENTS_RETENTION, 0);
+
+    log_info("Segmento di log %s: %zu byte compressi in %zu in %lu ms", segment, stream.size,
+             storage_get_file_size(segment), time_interval(start, get_millis()));
+    return 0;
+}
+
+
+/*
+ * Copia un segmento sulla partizione dati; va eseguita con la partizione a disposizione (disk_op)
+ */
+int log_archive_persist(const char *segment) {
+    char             path[PATH_SIZE];
+    storage_stream_t stream;
+
+    // Il segmento potrebbe essere gia' stato eliminato dalla rotazione
+    if (storage_stream_open(&stream, segment) < 0) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", LOG_PERSIST_PATH, strrchr(segment, '/') + 1);
+
+    storage_transaction_begin();
+    enforce_retention(LOG_PERSIST_PATH, LOG_PERSIST_RETENTION, stream.size);
+    storage_transaction_write_stream(path, &stream);
+    int res = storage_transaction_commit();
+
+    storage_stream_close(&stream);
+    return res;
+}
+
+
+/*
+ * Scrive in `destination` un tar con tutti i segmenti (compressi) e il log corrente, un blocco alla volta
+ */
+int log_archive_export(const char *destination, storage_progress_cb_t progress, void *arg) {
+    static export_entry_t entries[MAX_ENTRIES];
+    unsigned long         start = get_millis();
+    size_t                num   = 0, total = 0, done = 0;
+    char                  path[PATH_SIZE], tmp_path[PATH_SIZE + sizeof(TMP_SUFFIX)], name[64];
+    segment_t            *persisted = NULL, *segments = NULL;
+    int                   res       = 0;
+
+    // Quello che e' ancora in coda nel logger finisce nel file corrente
+    async_log_flush();
+
+    int num_persisted = list_segments(LOG_PERSIST_PATH, &persisted);
+    int num_segments  = list_segments(LOG_SEGMENTS_PATH, &segments);
+
+    // I segmenti copiati sulla partizione dati e ancora in /tmp si esportano una volta sola
+    for (int i = 0; i < num_persisted; i++) {
+        if (num_segments > 0 && bsearch(&persisted[i], segments, num_segments, sizeof(segment_t), compare_segments)) {
+            continue;
+        }
+        segment_path(path, sizeof(path), LOG_PERSIST_PATH, persisted[i].sequence);
+        add_export_entry(entries, &num, path, strrchr(path, '/') + 1);
+    }
+    for (int i = 0; i < num_segments; i++) {
+        segment_path(path, sizeof(path), LOG_SEGMENTS_PATH, segments[i].sequence);
+        add_export_entry(entries, &num, path, strrchr(path, '/') + 1);
+    }
+    free(persisted);
+    free(segments);
+
+    snprintf(path, sizeof(path), "%s%s", LOGFILE, ASYNC_LOG_ROTATED_SUFFIX);
+    snprintf(name, sizeof(name), "%s%s", LOGFILE_NAME, ASYNC_LOG_ROTATED_SUFFIX);
+    add_export_entry(entries, &num, path, name);
+    add_export_entry(entries, &num, LOGFILE, LOGFILE_NAME);
+
+    for (size_t i = 0; i < num; i++) {
+        total += entries[i].size;
+    }
+
+    time_t    now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(name, sizeof(name), "DS2021_log_%Y%m%d_%H%M%S.tar", &tm);
+    snprintf(path, sizeof(path), "%s/%s", destination, name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, TMP_SUFFIX);
+
+    // Descrittore mio per poter sincronizzare il file prima di renderlo visibile
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_warn("Non riesco a creare %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    // I segmenti sono gia' compressi
+    struct archive *a = archive_write_new();
+    archive_write_set_format_pax_restricted(a);
+    if (archive_write_open_fd(a, fd) != ARCHIVE_OK) {
+        log_warn("Non riesco a creare %s: %s", tmp_path, archive_error_string(a));
+        archive_write_free(a);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    for (size_t i = 0; i < num && !res; i++) {
+        res = write_entry(a, &entries[i], &done, total, progress, arg);
+    }
+
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        log_warn("Errore nella chiusura di %s: %s", tmp_path, archive_error_string(a));
+        res = -1;
+    }
+    archive_write_free(a);
+
+    // La chiavetta puo' essere estratta appena l'esportazione risulta conclusa
+    if (!res && fsync(fd) < 0) {
+        log_warn("Errore nella sincronizzazione di %s: %s", tmp_path, strerror(errno));
+        res = -1;
+    }
+    close(fd);
+
+    if (res || rename(tmp_path, path) < 0 || storage_sync_dir(destination)) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    log_info("Esportati %zu file di log (%zu byte) in %s in %lu ms", num, total, path,
+             time_interval(start, get_millis()));
+    return 0;
+}
+
+
+/*
+ *  Static functions
+ */
+
+static int list_segments(const char *dir, segment_t **segments) {
+    struct dirent *entry;
+    size_t         num = 0, capacity = 0;
+
+    *segments = NULL;
+
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+
+    while ((entry = readdir(d)) != NULL) {
+        unsigned int sequence;
+        char         extension[8];
+        struct stat  st;
+
+        if (sscanf(entry->d_name, LOG_SEGMENT_PREFIX "%u%7s", &sequence, extension) != 2 ||
+            strcmp(extension, LOG_SEGMENT_EXTENSION) != 0 || fstatat(dirfd(d), entry->d_name, &st, 0) < 0) {
+            continue;
+        }
+
+        if (num == capacity) {
+            capacity            = capacity == 0 ? 16 : capacity * 2;
+            segment_t *resized = realloc(*segments, capacity * sizeof(segment_t));
+            if (resized == NULL) {
+                break;
+            }
+            *segments = resized;
+        }
+
+        (*segments)[num].sequence = sequence;
+        (*segments)[num].size     = st.st_size;
+        num++;
+    }
+    closedir(d);
+
+    qsort(*segments, num, sizeof(segment_t), compare_segments);
+    return (int)num;
+}
+
+
+static void segment_path(char *path, size_t len, const char *dir, unsigned int sequence) {
+    snprintf(path, len, "%s/" LOG_SEGMENT_PREFIX "%06u" LOG_SEGMENT_EXTENSION, dir, sequence);
+}
+
+
+/*
+ * Elimina i segmenti piu' vecchi finche' non rientrano nel budget, lasciando spazio per `extra` byte
+ */
+static void enforce_retention(const char *dir, size_t budget, size_t extra) {
+    segment_t *segments = NULL;
+    size_t     total    = extra;
+    char       path[PATH_SIZE];
+
+    int num = list_segments(dir, &segments);
+    for (int i = 0; i < num; i++) {
+        total += segments[i].size;
+    }
+
+    for (int i = 0; i < num && total > budget; i++) {
+        // Il segmento piu' recente resta comunque
+        if (extra == 0 && i == num - 1) {
+            break;
+        }
+        segment_path(path, sizeof(path), dir, segments[i].sequence);
+        if (unlink(path) == 0) {
+            total -= segments[i].size;
+        }
+    }
+
+    free(segments);
+}
+
+
+static int add_export_entry(export_entry_t *entries, size_t *num, const char *path, const char *name) {
+    struct stat st;
+
+    if (*num >= MAX_ENTRIES || stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+
+    snprintf(entries[*num].path, sizeof(entries[*num].path), "%s", path);
+    snprintf(entries[*num].name, sizeof(entries[*num].name), "%s", name);
+    entries[*num].size  = st.st_size;
+    entries[*num].mtime = st.st_mtime;
+    (*num)++;
+    return 0;
+}
+
+
+static int write_entry(struct archive *a, export_entry_t *entry, size_t *done, size_t total,
+                       storage_progress_cb_t progress, void *arg) {
+    static uint8_t   buffer[BLOCK_SIZE];
+    size_t           remaining = entry->size;
+    int              res       = 0;
+    storage_stream_t stream;
+
+    // Un segmento eliminato dalla rotazione nel frattempo viene saltato
+    if (storage_stream_open(&stream, entry->path) < 0) {
+        *done += entry->size;
+        return 0;
+    }
+
+    struct archive_entry *archive_entry = archive_entry_new();
+    archive_entry_set_pathname(archive_entry, entry->name);
+    archive_entry_set_size(archive_entry, entry->size);
+    archive_entry_set_mtime(archive_entry, entry->mtime, 0);
+    archive_entry_set_filetype(archive_entry, AE_IFREG);
+    archive_entry_set_perm(archive_entry, 0644);
+    if (archive_write_header(a, archive_entry) != ARCHIVE_OK) {
+        log_warn("Errore nella creazione dell'archivio: %s", archive_error_string(a));
+        res = -1;
+    }
+
+    // Il log corrente continua a crescere: se ne copia solo la parte presente all'inizio
+    while (!res && remaining > 0) {
+        size_t len = storage_stream_read(&stream, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer));
+        if (len == 0) {
+            break;
+        }
+        if (archive_write_data(a, buffer, len) < 0) {
+            log_warn("Errore nella scrittura dell'archivio: %s", archive_error_string(a));
+            res = -1;
+        }
+
+        remaining -= len;
+        *done += len;
+        if (progress != NULL && progress(*done, total, arg)) {
+            res = -1;
+        }
+    }
+
+    archive_entry_free(archive_entry);
+    storage_stream_close(&stream);
+    return res;
+}
+
+
+static int compare_segments(const void *a, const void *b) {
+    unsigned int first = ((const segment_t *)a)->sequence, second = ((const segment_t *)b)->sequence;
+    return (first > second) - (first < second);
+}
@@ -0,0 +1,18 @@
+#ifndef LOG_ARCHIVE_H_INCLUDED
+#define LOG_ARCHIVE_H_INCLUDED
+
+
+#include <stddef.h>
+#include "storage.h"
+
+
+#define LOG_SEGMENT_PREFIX    "DS2021_log."
+#define LOG_SEGMENT_EXTENSION ".gz"
+
+
+int log_archive_compress(const char *path, char *segment, size_t len);
+int log_archive_persist(const char *segment);
+int log_archive_export(const char *destination, storage_progress_cb_t progress, void *arg);
+
+
+#endif
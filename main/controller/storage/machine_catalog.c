@@ -0,0 +1,390 @@
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "config/app_conf.h"
+#include "gel/timer/timecheck.h"
+#include "utils/system_time.h"
+#include "machine_catalog.h"
+#include "storage.h"
+#include "utils/async_log.h"
+
+
+#define WATCH_EVENTS      (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR)
+#define EVENT_BUFFER_SIZE 4096
+#define INITIAL_CAPACITY  16
+
+
+static int    scan(void);
+static int    archive_name(const char *filename, name_t name);
+static size_t lower_bound(const name_t name);
+static int    reserve(void);
+static int    update_archive(const char *filename);
+static int    remove_archive(const char *filename);
+static int    resolve_versions(unsigned long budget_ms);
+static void   publish(void);
+static int    compare_archives(const void *a, const void *b);
+
+
+static pthread_mutex_t             sem;
+static machine_catalog_snapshot_t *current    = NULL;
+static unsigned int                generation = 0;
+
+// Stato di lavoro, usato solo dal thread dei dischi
+static char               root[128]    = {0};
+static int                inotify_fd   = -1;
+static machine_archive_t *archives     = NULL;
+static size_t             num_archives = 0;
+static size_t             capacity     = 0;
+
+
+void machine_catalog_init(void) {
+    assert(pthread_mutex_init(&sem, NULL) == 0);
+    publish();
+}
+
+
+/*
+ * Costruisce il catalogo della cartella indicata con una sola lettura; da qui in poi
+ * viene tenuto aggiornato dagli eventi inotify
+ */
+int machine_catalog_open(const char *path) {
+    unsigned long start = get_millis();
+
+    machine_catalog_close();
+    snprintf(root, sizeof(root), "%s", path);
+
+    // La sorveglianza parte prima della lettura per non perdere modifiche
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        log_warn("Non riesco a inizializzare inotify: %s", strerror(errno));
+    } else if (inotify_add_watch(inotify_fd, root, WATCH_EVENTS) < 0) {
+        log_warn("Non riesco a sorvegliare %s: %s", root, strerror(errno));
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+
+    int res = scan();
+    publish();
+    log_info("Catalogo archivi di %s: %zu voci in %lu ms", root, num_archives, time_interval(start, get_millis()));
+    return res;
+}
+
+
+void machine_catalog_close(void) {
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+
+    if (root[0] != '\0' || num_archives > 0) {
+        root[0]      = '\0';
+        num_archives = 0;
+        publish();
+    }
+}
+
+
+/*
+ * Applica gli eventi inotify in coda e legge la versione dei nuovi archivi entro il tempo indicato.
+ * Ritorna 1 se e' stata pubblicata una nuova fotografia
+ */
+int machine_catalog_poll(unsigned long budget_ms) {
+    char    buffer[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    int     changed = 0, rescan = 0, gone = 0;
+
+    if (root[0] == '\0') {
+        return 0;
+    }
+
+    while (inotify_fd >= 0 && (len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        const struct inotify_event *event;
+
+        for (char *ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)ptr;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                rescan = 1;
+            } else if (event->mask & (IN_DELETE_SELF | IN_UNMOUNT | IN_IGNORED)) {
+                gone = 1;
+            } else if (event->len > 0 && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+                changed |= update_archive(event->name);
+            } else if (event->len > 0 && (event->mask & (IN_DELETE | IN_MOVED_FROM))) {
+                changed |= remove_archive(event->name);
+            }
+        }
+    }
+
+    if (gone) {
+        log_warn("La cartella %s non e' piu' disponibile", root);
+        machine_catalog_close();
+        return 1;
+    }
+
+    if (rescan) {
+        log_warn("Coda inotify piena, rileggo %s", root);
+        scan();
+        changed = 1;
+    }
+
+    changed |= resolve_versions(budget_ms);
+
+    if (changed) {
+        publish();
+    }
+    return changed;
+}
+
+
+/*
+ * Descrittore su cui attendere le modifiche alla cartella, -1 se non sorvegliata
+ */
+int machine_catalog_get_fd(void) {
+    return inotify_fd;
+}
+
+
+/*
+ * Ci sono ancora archivi di cui leggere la versione
+ */
+int machine_catalog_is_pending(void) {
+    for (size_t i = 0; i < num_archives; i++) {
+        if (archives[i].version == MACHINE_ARCHIVE_VERSION_UNKNOWN) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+unsigned int machine_catalog_generation(void) {
+    pthread_mutex_lock(&sem);
+    unsigned int res = generation;
+    pthread_mutex_unlock(&sem);
+    return res;
+}
+
+
+machine_catalog_snapshot_t *machine_catalog_acquire(void) {
+    pthread_mutex_lock(&sem);
+    machine_catalog_snapshot_t *snapshot = current;
+    if (snapshot != NULL) {
+        snapshot->refs++;
+    }
+    pthread_mutex_unlock(&sem);
+    return snapshot;
+}
+
+
+void machine_catalog_release(machine_catalog_snapshot_t *snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&sem);
+    int last = --snapshot->refs == 0;
+    pthread_mutex_unlock(&sem);
+
+    if (last) {
+        free(snapshot);
+    }
+}
+
+
+static int scan(void) {
+    struct dirent *dir;
+
+    num_archives = 0;
+
+    DIR *d = opendir(root);
+    if (d == NULL) {
+        log_warn("Non riesco ad aprire %s: %s", root, strerror(errno));
+        return -1;
+    }
+
+    while ((dir = readdir(d)) != NULL) {
+        struct stat st;
+        name_t      name;
+
+        // Il filtro sul nome evita di interrogare il file system per i file estranei
+        if ((dir->d_type != DT_REG && dir->d_type != DT_UNKNOWN) || archive_name(dir->d_name, name)) {
+            continue;
+        }
+        if (fstatat(dirfd(d), dir->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (reserve()) {
+            break;
+        }
+
+        machine_archive_t *archive = &archives[num_archives++];
+        memcpy(archive->name, name, sizeof(name_t));
+        archive->size    = st.st_size;
+        archive->mtime   = st.st_mtime;
+        archive->version = MACHINE_ARCHIVE_VERSION_UNKNOWN;
+    }
+    closedir(d);
+
+    qsort(archives, num_archives, sizeof(machine_archive_t), compare_archives);
+    return 0;
+}
+
+
+static int archive_name(const char *filename, name_t name) {
+    size_t len     = strlen(filename);
+    size_t ext_len = strlen(ARCHIVE_EXTENSION);
+
+    if (len <= ext_len || strcmp(&filename[len - ext_len], ARCHIVE_EXTENSION) != 0) {
+        return -1;
+    }
+
+    len = len - ext_len > MAX_NAME_SIZE ? MAX_NAME_SIZE : len - ext_len;
+    memset(name, 0, sizeof(name_t));
+    memcpy(name, filename, len);
+    return 0;
+}
+
+
+static size_t lower_bound(const name_t name) {
+    size_t low = 0, high = num_archives;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(archives[mid].name, name) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+static int reserve(void) {
+    if (num_archives < capacity) {
+        return 0;
+    }
+
+    size_t             new_capacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+    machine_archive_t *new_archives = realloc(archives, new_capacity * sizeof(machine_archive_t));
+    if (new_archives == NULL) {
+        log_error("Memoria esaurita per il catalogo archivi");
+        return -1;
+    }
+
+    archives = new_archives;
+    capacity = new_capacity;
+    return 0;
+}
+
+
+static int update_archive(const char *filename) {
+    struct stat st;
+    name_t      name;
+    char        path[300];
+
+    if (archive_name(filename, name)) {
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", root, filename);
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return remove_archive(filename);
+    }
+
+    size_t index = lower_bound(name);
+    if (index >= num_archives || strcmp(archives[index].name, name) != 0) {
+        if (reserve()) {
+            return 0;
+        }
+        memmove(&archives[index + 1], &archives[index], (num_archives - index) * sizeof(machine_archive_t));
+        num_archives++;
+        memcpy(archives[index].name, name, sizeof(name_t));
+    }
+
+    archives[index].size    = st.st_size;
+    archives[index].mtime   = st.st_mtime;
+    archives[index].version = MACHINE_ARCHIVE_VERSION_UNKNOWN;
+    return 1;
+}
+
+
+static int remove_archive(const char *filename) {
+    name_t name;
+
+    if (archive_name(filename, name)) {
+        return 0;
+    }
+
+    size_t index = lower_bound(name);
+    if (index >= num_archives || strcmp(archives[index].name, name) != 0) {
+        return 0;
+    }
+
+    memmove(&archives[index], &archives[index + 1], (num_archives - index - 1) * sizeof(machine_archive_t));
+    num_archives--;
+    return 1;
+}
+
+
+/*
+ * La versione richiede di aprire l'archivio: la si legge poco per volta dopo aver gia' pubblicato i nomi
+ */
+static int resolve_versions(unsigned long budget_ms) {
+    unsigned long start    = get_millis();
+    int           resolved = 0;
+    char          path[300];
+
+    for (size_t i = 0; i < num_archives && !is_expired(start, get_millis(), budget_ms); i++) {
+        if (archives[i].version != MACHINE_ARCHIVE_VERSION_UNKNOWN) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s%s", root, archives[i].name, ARCHIVE_EXTENSION);
+        int version         = storage_read_archive_version(path);
+        archives[i].version = version > 0 ? version : MACHINE_ARCHIVE_VERSION_INVALID;
+        resolved            = 1;
+    }
+
+    return resolved;
+}
+
+
+static void publish(void) {
+    machine_catalog_snapshot_t *snapshot =
+        malloc(sizeof(machine_catalog_snapshot_t) + num_archives * (sizeof(machine_archive_t) + sizeof(name_t)));
+    if (snapshot == NULL) {
+        log_error("Memoria esaurita per il catalogo archivi");
+        return;
+    }
+
+    snapshot->num      = num_archives;
+    snapshot->archives = (machine_archive_t *)&snapshot[1];
+    snapshot->names    = (name_t *)&snapshot->archives[num_archives];
+    snapshot->refs     = 1;     // Riferimento tenuto dal catalogo
+    memcpy(snapshot->archives, archives, num_archives * sizeof(machine_archive_t));
+    for (size_t i = 0; i < num_archives; i++) {
+        memcpy(snapshot->names[i], archives[i].name, sizeof(name_t));
+    }
+
+    pthread_mutex_lock(&sem);
+    snapshot->generation             = ++generation;
+    machine_catalog_snapshot_t *prev = current;
+    current                          = snapshot;
+    pthread_mutex_unlock(&sem);
+
+    machine_catalog_release(prev);
+}
+
+
+static int compare_archives(const void *a, const void *b) {
+    return strcmp(((const machine_archive_t *)a)->name, ((const machine_archive_t *)b)->name);
+}
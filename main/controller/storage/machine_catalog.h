@@ -0,0 +1,46 @@
+#ifndef MACHINE_CATALOG_H_INCLUDED
+#define MACHINE_CATALOG_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "model/program.h"
+
+
+#define MACHINE_ARCHIVE_VERSION_UNKNOWN 0
+#define MACHINE_ARCHIVE_VERSION_INVALID -1
+
+
+typedef struct {
+    name_t   name;
+    uint64_t size;
+    time_t   mtime;
+    int      version;
+} machine_archive_t;
+
+
+/*
+ * Fotografia immutabile del catalogo; va restituita con machine_catalog_release
+ */
+typedef struct {
+    unsigned int       generation;
+    size_t             num;
+    name_t            *names;
+    machine_archive_t *archives;
+    unsigned int       refs;
+} machine_catalog_snapshot_t;
+
+
+void                        machine_catalog_init(void);
+int                         machine_catalog_open(const char *path);
+void                        machine_catalog_close(void);
+int                         machine_catalog_poll(unsigned long budget_ms);
+int                         machine_catalog_get_fd(void);
+int                         machine_catalog_is_pending(void);
+unsigned int                machine_catalog_generation(void);
+machine_catalog_snapshot_t *machine_catalog_acquire(void);
+void                        machine_catalog_release(machine_catalog_snapshot_t *snapshot);
+
+
+#endif
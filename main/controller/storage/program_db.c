@@ -0,0 +1,619 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "gel/serializer/serializer.h"
+#include "utils/crc32.h"
+#include "program_db.h"
+#include "storage.h"
+#include "utils/async_log.h"
+
+
+/*
+ *  Archivio unico dei programmi (big endian):
+ *   - intestazione: magic, versione, numero di voci, fine dell'area dati, CRC dell'indice
+ *   - indice di MAX_PROGRAMS voci a dimensione fissa: nome, offset, lunghezza, capacita', CRC del record e durata
+ *     totale del programma (per mostrarla senza caricare gli step)
+ *   - area dati con i programmi serializzati, ciascuno con un po' di spazio per crescere
+ *  L'ordine delle voci nell'indice e' l'ordine dei programmi.
+ *  Ogni modifica scrive un'immagine compattata nel file temporaneo della transazione di storage, che la rende
+ *  visibile con una rinomina: un'interruzione lascia l'archivio precedente o quello nuovo, mai uno a meta'.
+ *  Un archivio con l'indice illeggibile non viene mai riscritto: viene spostato da parte (CORRUPT_SUFFIX) per
+ *  poterne recuperare i programmi e l'errore risale al chiamante.
+ */
+
+#define DB_MAGIC                0x44534442UL     // "DSDB"
+#define DB_VERSION              1
+#define HEADER_SIZE             16
+#define ENTRY_SIZE              48
+#define DATA_START              (HEADER_SIZE + ENTRY_SIZE * MAX_PROGRAMS)
+#define RECORD_ALIGNMENT        (STEP_SIZE * 4)
+#define RECORD_NUM_STEPS_OFFSET (STRING_NAME_SIZE * NUM_LINGUE + 2)
+#define RECORD_SIZE(steps)      ((size_t)(RECORD_NUM_STEPS_OFFSET + 2 + STEP_SIZE * (steps)))
+#define CORRUPT_SUFFIX          ".corrupt"
+
+
+typedef struct {
+    name_t   name;
+    uint32_t offset;
+    uint16_t length;
+    uint16_t capacity;
+    uint32_t crc;
+    uint16_t total_time;
+} entry_t;
+
+
+typedef struct {
+    size_t   num_entries;
+    entry_t  entries[MAX_PROGRAMS];
+    uint32_t data_end;
+
+    uint8_t *image;
+    size_t   size;
+} db_t;
+
+
+static void  serialize_index(uint8_t *buffer, db_t *db);
+static int   parse_index(db_t *db, uint8_t *buffer, size_t size);
+static int   read_record(db_t *db, entry_t *entry, dryer_program_t *p);
+static int   read_record_header(db_t *db, entry_t *entry, dryer_program_t *p);
+static int   load_program(int fd, const char *name, dryer_program_t *p);
+static int   set_record(db_t *db, entry_t *entry, dryer_program_t *p);
+static int   find_entry(db_t *db, const char *name);
+static int   db_begin(const char *path, db_t *db);
+static int   db_end(const char *path, db_t *db, int res);
+static int   write_compacted(const char *path, db_t *db);
+static void  set_aside(const char *path);
+static int   grow_image(db_t *db, size_t size);
+
+
+/*
+ * Ritorna -1 se l'archivio non esiste, 1 se non si riesce a leggere (se e' corrotto viene spostato da parte)
+ */
+int program_db_load(const char *path, storage_program_list_t *list, int headers_only) {
+    size_t count = 0;
+    db_t   db    = {0};
+
+    list->num_programs = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_info("Archivio programmi %s non trovato", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_error("Non riesco a leggere %s: %s", path, strerror(errno));
+        close(fd);
+        return 1;
+    } else if ((size_t)st.st_size < DATA_START) {
+        close(fd);
+        set_aside(path);
+        return 1;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("Non riesco a mappare %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    if (parse_index(&db, map, st.st_size)) {
+        munmap(map, st.st_size);
+        set_aside(path);
+        return 1;
+    }
+
+    db.image = map;
+    db.size  = st.st_size;
+
+    for (size_t i = 0; i < db.num_entries; i++) {
+        if (db.entries[i].length == 0) {
+            continue;
+        }
+
+        int res = headers_only ? read_record_header(&db, &db.entries[i], &list->programs[count])
+                               : read_record(&db, &db.entries[i], &list->programs[count]);
+        if (res == 0) {
+            count++;
+        } else {
+            log_error("Programma %s corrotto, lo ignoro", db.entries[i].name);
+        }
+    }
+
+    munmap(map, st.st_size);
+
+    list->num_programs = count;
+    log_info("Caricati %zu programmi%s", count, headers_only ? " (solo intestazioni)" : "");
+    return 0;
+}
+
+
+int program_db_load_program(const char *path, const char *name, dryer_program_t *p) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_error("Non riesco ad aprire %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    // Il file aperto resta quello letto anche se nel frattempo un salvataggio lo sostituisce
+    int res = load_program(fd, name, p);
+
+    close(fd);
+    if (res) {
+        log_error("Non sono riuscito a caricare il programma %s", name);
+    }
+    return res;
+}
+
+
+int program_db_parse_program(uint8_t *buffer, size_t len, dryer_program_t *p) {
+    uint16_t num_steps = 0;
+
+    if (len < RECORD_SIZE(0)) {
+        return -1;
+    }
+
+    deserialize_uint16_be(&num_steps, &buffer[RECORD_NUM_STEPS_OFFSET]);
+    if (num_steps > MAX_STEPS || RECORD_SIZE(num_steps) > len) {
+        return -1;
+    }
+
+    memset(p, 0, sizeof(dryer_program_t));
+    program_deserialize(p, buffer);
+    for (size_t i = 0; i < NUM_LINGUE; i++) {
+        p->nomi[i][STRING_NAME_SIZE - 1] = '\0';
+    }
+    return 0;
+}
+
+
+int program_db_validate(uint8_t *image, size_t size) {
+    db_t             db    = {0};
+    dryer_program_t *p     = malloc(sizeof(dryer_program_t));
+    int              count = 0;
+
+    if (p == NULL || parse_index(&db, image, size)) {
+        free(p);
+        return -1;
+    }
+
+    db.image = image;
+    db.size  = size;
+
+    for (size_t i = 0; i < db.num_entries; i++) {
+        if (db.entries[i].length == 0) {
+            continue;
+        }
+        if (read_record(&db, &db.entries[i], p)) {
+            log_warn("Programma %s corrotto", db.entries[i].name);
+            count = -1;
+            break;
+        }
+        count++;
+    }
+
+    free(p);
+    return count;
+}
+
+
+int program_db_write(const char *path, dryer_program_t *programs, size_t num) {
+    db_t db = {.data_end = DATA_START};
+
+    if (grow_image(&db, DATA_START)) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < num && i < MAX_PROGRAMS; i++) {
+        entry_t *entry = &db.entries[db.num_entries++];
+        snprintf(entry->name, sizeof(name_t), "%s", programs[i].filename);
+        set_record(&db, entry, &programs[i]);
+    }
+
+    storage_transaction_begin();
+    int res = write_compacted(path, &db);
+    free(db.image);
+
+    int commit = storage_transaction_commit();
+    return res ? res : commit;
+}
+
+
+int program_db_save(const char *path, int update_index, name_t *names, size_t num_names, dryer_program_t *programs,
+                    size_t num_programs) {
+    db_t db  = {0};
+    int  res = db_begin(path, &db);
+
+    if (!res && update_index) {
+        entry_t entries[MAX_PROGRAMS] = {0};
+        size_t  count                 = 0;
+
+        for (size_t i = 0; i < num_names && count < MAX_PROGRAMS; i++) {
+            if (strlen(names[i]) == 0) {
+                continue;
+            }
+
+            int found = find_entry(&db, names[i]);
+            if (found >= 0) {
+                entries[count] = db.entries[found];
+            } else {
+                // Il programma verra' scritto subito dopo; per ora riservo la voce
+                snprintf(entries[count].name, sizeof(name_t), "%s", names[i]);
+            }
+            count++;
+        }
+
+        memcpy(db.entries, entries, sizeof(entries));
+        db.num_entries = count;
+    }
+
+    int refused = 0;
+    for (size_t i = 0; !res && i < num_programs; i++) {
+        if (!programs[i].steps_loaded) {
+            // Scriverebbe una lista di step vuota al posto di quella in archivio
+            log_error("Step del programma %s non caricati, non lo salvo", programs[i].filename);
+            refused = 1;
+            continue;
+        }
+
+        int found = find_entry(&db, programs[i].filename);
+
+        if (found < 0) {
+            if (db.num_entries >= MAX_PROGRAMS) {
+                log_error("Archivio programmi pieno, non posso salvare %s", programs[i].filename);
+                res = 1;
+                break;
+            }
+            found = db.num_entries++;
+            memset(&db.entries[found], 0, sizeof(entry_t));
+            snprintf(db.entries[found].name, sizeof(name_t), "%s", programs[i].filename);
+        }
+
+        res = set_record(&db, &db.entries[found], &programs[i]);
+        if (!res) {
+            log_info("Salvato programma %s con %i step", programs[i].nomi[0], programs[i].num_steps);
+        }
+    }
+
+    res = db_end(path, &db, res);
+    return res ? res : refused;
+}
+
+
+int program_db_remove(const char *path, const char *name) {
+    db_t db  = {0};
+    int  res = db_begin(path, &db);
+
+    int found = res ? -1 : find_entry(&db, name);
+    if (found >= 0) {
+        memmove(&db.entries[found], &db.entries[found + 1], sizeof(entry_t) * (db.num_entries - found - 1));
+        db.num_entries--;
+    } else if (!res) {
+        log_warn("Programma %s non presente in archivio", name);
+    }
+
+    return db_end(path, &db, res);
+}
+
+
+int program_db_compact(const char *path) {
+    db_t db  = {0};
+    int  res = db_begin(path, &db);
+
+    return db_end(path, &db, res);
+}
+
+
+/*
+ *  Static functions
+ */
+
+/*
+ * Legge l'archivio in memoria; va chiuso con db_end anche in caso di errore
+ */
+static int db_begin(const char *path, db_t *db) {
+    memset(db, 0, sizeof(db_t));
+    db->data_end = DATA_START;
+
+    storage_transaction_begin();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            log_error("Non riesco ad aprire %s: %s", path, strerror(errno));
+            return 1;
+        }
+        return grow_image(db, DATA_START);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || grow_image(db, st.st_size > DATA_START ? st.st_size : DATA_START)) {
+        close(fd);
+        return 1;
+    }
+
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t len = pread(fd, &db->image[total], st.st_size - total, total);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        } else if (len <= 0) {
+            break;
+        }
+        total += len;
+    }
+    close(fd);
+
+    if (total < (size_t)st.st_size) {
+        log_error("Errore nella lettura di %s: %s", path, strerror(errno));
+        return 1;
+    } else if (parse_index(db, db->image, total)) {
+        set_aside(path);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int db_end(const char *path, db_t *db, int res) {
+    if (!res) {
+        res = write_compacted(path, db);
+    }
+    free(db->image);
+
+    int commit = storage_transaction_commit();
+    return res ? res : commit;
+}
+
+
+static int write_compacted(const char *path, db_t *db) {
+    uint32_t end = DATA_START;
+    for (size_t i = 0; i < db->num_entries; i++) {
+        end += db->entries[i].capacity;
+    }
+
+    uint8_t *image = calloc(1, end);
+    if (image == NULL) {
+        log_error("Memoria esaurita nella compattazione di %s", path);
+        return 1;
+    }
+
+    end = DATA_START;
+    for (size_t i = 0; i < db->num_entries; i++) {
+        entry_t *entry = &db->entries[i];
+        if (entry->capacity == 0) {
+            entry->offset = 0;
+            continue;
+        }
+
+        memcpy(&image[end], &db->image[entry->offset], entry->length);
+        entry->offset = end;
+        end += entry->capacity;
+    }
+
+    db->data_end = end;
+    serialize_index(image, db);
+
+    int res = storage_transaction_write(path, image, end);
+    free(image);
+    return res;
+}
+
+
+static void serialize_index(uint8_t *buffer, db_t *db) {
+    memset(buffer, 0, DATA_START);
+
+    for (size_t i = 0; i < db->num_entries; i++) {
+        entry_t *entry = &db->entries[i];
+        uint8_t *p     = &buffer[HEADER_SIZE + i * ENTRY_SIZE];
+        size_t   j     = 0;
+
+        memcpy(&p[j], entry->name, STRING_NAME_SIZE);
+        j += STRING_NAME_SIZE;
+        j += serialize_uint32_be(&p[j], entry->offset);
+        j += serialize_uint16_be(&p[j], entry->length);
+        j += serialize_uint16_be(&p[j], entry->capacity);
+        j += serialize_uint32_be(&p[j], entry->crc);
+        j += serialize_uint16_be(&p[j], entry->total_time);
+    }
+
+    serialize_uint32_be(&buffer[0], DB_MAGIC);
+    serialize_uint16_be(&buffer[4], DB_VERSION);
+    serialize_uint16_be(&buffer[6], db->num_entries);
+    serialize_uint32_be(&buffer[8], db->data_end);
+    serialize_uint32_be(&buffer[12], crc32(&buffer[HEADER_SIZE], DATA_START - HEADER_SIZE));
+}
+
+
+static int parse_index(db_t *db, uint8_t *buffer, size_t size) {
+    uint32_t magic = 0, data_end = 0, crc = 0;
+    uint16_t version = 0, num_entries = 0;
+
+    if (size < DATA_START) {
+        return -1;
+    }
+
+    deserialize_uint32_be(&magic, &buffer[0]);
+    deserialize_uint16_be(&version, &buffer[4]);
+    deserialize_uint16_be(&num_entries, &buffer[6]);
+    deserialize_uint32_be(&data_end, &buffer[8]);
+    deserialize_uint32_be(&crc, &buffer[12]);
+
+    if (magic != DB_MAGIC || version != DB_VERSION || num_entries > MAX_PROGRAMS || data_end < DATA_START ||
+        data_end > size || crc != crc32(&buffer[HEADER_SIZE], DATA_START - HEADER_SIZE)) {
+        return -1;
+    }
+
+    db->num_entries = num_entries;
+    db->data_end    = data_end;
+
+    for (size_t i = 0; i < num_entries; i++) {
+        entry_t *entry = &db->entries[i];
+        uint8_t *p     = &buffer[HEADER_SIZE + i * ENTRY_SIZE];
+        size_t   j     = 0;
+
+        memset(entry, 0, sizeof(entry_t));
+        memcpy(entry->name, &p[j], STRING_NAME_SIZE);
+        entry->name[STRING_NAME_SIZE - 1] = '\0';
+        j += STRING_NAME_SIZE;
+        j += deserialize_uint32_be(&entry->offset, &p[j]);
+        j += deserialize_uint16_be(&entry->length, &p[j]);
+        j += deserialize_uint16_be(&entry->capacity, &p[j]);
+        j += deserialize_uint32_be(&entry->crc, &p[j]);
+        j += deserialize_uint16_be(&entry->total_time, &p[j]);
+
+        if (entry->capacity > 0 && (entry->offset < DATA_START || entry->offset + entry->capacity > data_end ||
+                                    entry->length > entry->capacity || entry->length > MAX_PROGRAM_SIZE)) {
+            log_warn("Voce %s dell'archivio programmi non valida", entry->name);
+            entry->offset   = 0;
+            entry->length   = 0;
+            entry->capacity = 0;
+        }
+    }
+
+    return 0;
+}
+
+
+static int read_record(db_t *db, entry_t *entry, dryer_program_t *p) {
+    uint8_t *record = &db->image[entry->offset];
+
+    if (crc32(record, entry->length) != entry->crc || program_db_parse_program(record, entry->length, p)) {
+        return -1;
+    }
+
+    p->total_time = entry->total_time;
+    memcpy(p->filename, entry->name, sizeof(name_t));
+    return 0;
+}
+
+
+static int read_record_header(db_t *db, entry_t *entry, dryer_program_t *p) {
+    uint8_t *record = &db->image[entry->offset];
+    size_t   i      = 0;
+
+    if (entry->length < RECORD_SIZE(0)) {
+        return -1;
+    }
+
+    memset(p, 0, sizeof(dryer_program_t));
+    for (size_t j = 0; j < NUM_LINGUE; j++) {
+        memcpy(p->nomi[j], &record[i], STRING_NAME_SIZE);
+        p->nomi[j][STRING_NAME_SIZE - 1] = '\0';
+        i += STRING_NAME_SIZE;
+    }
+    i += deserialize_uint16_be(&p->type, &record[i]);
+    i += deserialize_uint16_be(&p->num_steps, &record[i]);
+
+    if (p->num_steps > MAX_STEPS || RECORD_SIZE(p->num_steps) > entry->length) {
+        return -1;
+    }
+
+    // Gli step vengono caricati alla prima richiesta del programma
+    p->steps_loaded = 0;
+    p->total_time   = entry->total_time;
+    memcpy(p->filename, entry->name, sizeof(name_t));
+    return 0;
+}
+
+
+static int load_program(int fd, const char *name, dryer_program_t *p) {
+    uint8_t index[DATA_START];
+    uint8_t record[MAX_PROGRAM_SIZE];
+    db_t    db = {0};
+
+    if (pread(fd, index, DATA_START, 0) != DATA_START || parse_index(&db, index, SIZE_MAX)) {
+        return 1;
+    }
+
+    int found = find_entry(&db, name);
+    if (found < 0) {
+        log_warn("Programma %s non presente in archivio", name);
+        return -1;
+    }
+
+    entry_t *entry = &db.entries[found];
+    if (entry->length == 0 || pread(fd, record, entry->length, entry->offset) != entry->length) {
+        return 1;
+    }
+
+    // Il record e' stato letto a parte: lo rendo raggiungibile da read_record con offset nullo
+    entry->offset = 0;
+    db.image      = record;
+    return read_record(&db, entry, p) == 0 ? 0 : 1;
+}
+
+
+static int set_record(db_t *db, entry_t *entry, dryer_program_t *p) {
+    uint8_t buffer[MAX_PROGRAM_SIZE];
+    size_t  len = program_serialize(buffer, p);
+
+    if (len > entry->capacity) {
+        // Non c'e' spazio: il record viene spostato in coda e il vecchio sparisce con la compattazione
+        size_t capacity = ((len + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT) * RECORD_ALIGNMENT;
+        if (grow_image(db, db->data_end + capacity)) {
+            return 1;
+        }
+        entry->offset   = db->data_end;
+        entry->capacity = capacity;
+        db->data_end += capacity;
+    }
+
+    memcpy(&db->image[entry->offset], buffer, len);
+    entry->length     = len;
+    entry->crc        = crc32(buffer, len);
+    entry->total_time = program_get_total_time(p);
+    return 0;
+}
+
+
+static int find_entry(db_t *db, const char *name) {
+    for (size_t i = 0; i < db->num_entries; i++) {
+        if (strcmp(db->entries[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static int grow_image(db_t *db, size_t size) {
+    if (size <= db->size) {
+        return 0;
+    }
+
+    uint8_t *image = realloc(db->image, size);
+    if (image == NULL) {
+        log_error("Memoria esaurita per l'archivio programmi");
+        return 1;
+    }
+
+    memset(&image[db->size], 0, size - db->size);
+    db->image = image;
+    db->size  = size;
+    return 0;
+}
+
+
+static void set_aside(const char *path) {
+    char corrupt_path[256];
+    snprintf(corrupt_path, sizeof(corrupt_path), "%s%s", path, CORRUPT_SUFFIX);
+
+    storage_transaction_begin();
+    if (rename(path, corrupt_path) < 0) {
+        log_error("Archivio programmi %s corrotto, non riesco a spostarlo: %s", path, strerror(errno));
+    } else {
+        log_error("Archivio programmi %s corrotto, spostato in %s", path, corrupt_path);
+    }
+    storage_transaction_commit();
+}
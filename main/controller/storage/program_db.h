@@ -0,0 +1,20 @@
+#ifndef PROGRAM_DB_H_INCLUDED
+#define PROGRAM_DB_H_INCLUDED
+
+
+#include "model/program.h"
+#include "storage.h"
+
+
+int program_db_load(const char *path, storage_program_list_t *list, int headers_only);
+int program_db_load_program(const char *path, const char *name, dryer_program_t *p);
+int program_db_write(const char *path, dryer_program_t *programs, size_t num);
+int program_db_save(const char *path, int update_index, name_t *names, size_t num_names, dryer_program_t *programs,
+                    size_t num_programs);
+int program_db_remove(const char *path, const char *name);
+int program_db_compact(const char *path);
+int program_db_parse_program(uint8_t *buffer, size_t len, dryer_program_t *p);
+int program_db_validate(uint8_t *image, size_t size);
+
+
+#endif
@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "gel/serializer/serializer.h"
+#include "utils/crc32.h"
+#include "stats_store.h"
+#include "storage.h"
+#include "utils/async_log.h"
+
+
+/*
+ *  Aggregati delle statistiche (big endian), in NUM_SLOTS copie scritte a rotazione:
+ *   - magic, versione, numero progressivo del salvataggio
+ *   - contatori assoluti, consuntivo dell'ultimo ciclo e differenze degli ultimi STATS_TRACKER_DAYS giorni
+ *   - CRC della copia
+ *  Ogni salvataggio scrive solo la copia successiva, per cui le scritture si distribuiscono su tutto il file e una
+ *  scrittura interrotta lascia valida la copia precedente. Al caricamento vince la copia valida piu' recente.
+ */
+
+#define STORE_MAGIC     0x44535354UL     // "DSST"
+#define STORE_VERSION   1
+#define NUM_SLOTS       16
+#define SLOT_SIZE       512
+#define SLOT_CRC_OFFSET (SLOT_SIZE - 4)
+#define SLOT_OFFSET(n)  ((off_t)((n) % NUM_SLOTS) * SLOT_SIZE)
+
+
+static size_t serialize_statistics(uint8_t *buffer, const statistics_t *stats);
+static size_t deserialize_statistics(statistics_t *stats, const uint8_t *buffer);
+static void   serialize_slot(uint8_t *buffer, uint32_t sequence, const stats_tracker_t *tracker);
+static int    parse_slot(const uint8_t *buffer, uint32_t *sequence, stats_tracker_t *tracker);
+static int    load_slots(int fd, uint32_t *sequence, stats_tracker_t *tracker);
+
+
+int stats_store_save(const char *path, const stats_tracker_t *tracker) {
+    uint8_t  buffer[SLOT_SIZE];
+    uint32_t sequence = 0;
+
+    storage_transaction_begin();
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_warn("Non riesco ad aprire %s: %s", path, strerror(errno));
+        storage_transaction_commit();
+        return -1;
+    }
+
+    int found = load_slots(fd, &sequence, NULL);
+    int res   = found < 0;
+
+    if (!res) {
+        sequence = found ? sequence + 1 : 0;
+        serialize_slot(buffer, sequence, tracker);
+        res = storage_pwrite_all(fd, buffer, SLOT_SIZE, SLOT_OFFSET(sequence)) < 0;
+        if (res) {
+            log_warn("Errore nella scrittura di %s: %s", path, strerror(errno));
+        }
+    }
+
+    if (!res && fdatasync(fd) < 0) {
+        log_warn("Errore nella sincronizzazione di %s: %s", path, strerror(errno));
+        res = 1;
+    }
+
+    close(fd);
+    int commit = storage_transaction_commit();
+    return res ? res : commit;
+}
+
+
+/*
+ * Senza salvataggi validi `tracker` resta vuoto e non e' un errore
+ */
+int stats_store_load(const char *path, stats_tracker_t *tracker) {
+    uint32_t sequence = 0;
+
+    stats_tracker_init(tracker);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    int res = load_slots(fd, &sequence, tracker);
+    close(fd);
+    return res < 0 ? -1 : 0;
+}
+
+
+/*
+ *  Static functions
+ */
+
+static size_t serialize_statistics(uint8_t *buffer, const statistics_t *stats) {
+    size_t i = 0;
+    i += serialize_uint16_be(&buffer[i], stats->complete_cycles);
+    i += serialize_uint16_be(&buffer[i], stats->partial_cycles);
+    i += serialize_uint32_be(&buffer[i], stats->active_time);
+    i += serialize_uint32_be(&buffer[i], stats->work_time);
+    i += serialize_uint32_be(&buffer[i], stats->rotation_time);
+    i += serialize_uint32_be(&buffer[i], stats->ventilation_time);
+    i += serialize_uint32_be(&buffer[i], stats->heating_time);
+    return i;
+}
+
+
+static size_t deserialize_statistics(statistics_t *stats, const uint8_t *buffer) {
+    size_t i = 0;
+    i += deserialize_uint16_be(&stats->complete_cycles, &buffer[i]);
+    i += deserialize_uint16_be(&stats->partial_cycles, &buffer[i]);
+    i += deserialize_uint32_be(&stats->active_time, &buffer[i]);
+    i += deserialize_uint32_be(&stats->work_time, &buffer[i]);
+    i += deserialize_uint32_be(&stats->rotation_time, &buffer[i]);
+    i += deserialize_uint32_be(&stats->ventilation_time, &buffer[i]);
+    i += deserialize_uint32_be(&stats->heating_time, &buffer[i]);
+    return i;
+}
+
+
+static void serialize_slot(uint8_t *buffer, uint32_t sequence, const stats_tracker_t *tracker) {
+    size_t i = 0;
+
+    memset(buffer, 0, SLOT_SIZE);
+    i += serialize_uint32_be(&buffer[i], STORE_MAGIC);
+    i += serialize_uint16_be(&buffer[i], STORE_VERSION);
+    i += serialize_uint16_be(&buffer[i], tracker->valid);
+    i += serialize_uint32_be(&buffer[i], sequence);
+    i += serialize_statistics(&buffer[i], &tracker->lifetime);
+    i += serialize_statistics(&buffer[i], &tracker->last_cycle);
+    for (size_t j = 0; j < STATS_TRACKER_DAYS; j++) {
+        i += serialize_uint32_be(&buffer[i], tracker->days[j].number);
+        i += serialize_statistics(&buffer[i], &tracker->days[j].delta);
+    }
+
+    serialize_uint32_be(&buffer[SLOT_CRC_OFFSET], crc32(buffer, SLOT_CRC_OFFSET));
+}
+
+
+static int parse_slot(const uint8_t *buffer, uint32_t *sequence, stats_tracker_t *tracker) {
+    uint32_t magic = 0, crc = 0;
+    uint16_t version = 0, valid = 0;
+    size_t   i = 0;
+
+    deserialize_uint32_be(&crc, &buffer[SLOT_CRC_OFFSET]);
+    if (crc != crc32(buffer, SLOT_CRC_OFFSET)) {
+        return -1;
+    }
+
+    i += deserialize_uint32_be(&magic, &buffer[i]);
+    i += deserialize_uint16_be(&version, &buffer[i]);
+    if (magic != STORE_MAGIC || version != STORE_VERSION) {
+        return -1;
+    }
+    i += deserialize_uint16_be(&valid, &buffer[i]);
+    i += deserialize_uint32_be(sequence, &buffer[i]);
+
+    if (tracker != NULL) {
+        stats_tracker_init(tracker);
+        tracker->valid = (uint8_t)valid;
+        i += deserialize_statistics(&tracker->lifetime, &buffer[i]);
+        i += deserialize_statistics(&tracker->last_cycle, &buffer[i]);
+        for (size_t j = 0; j < STATS_TRACKER_DAYS; j++) {
+            i += deserialize_uint32_be(&tracker->days[j].number, &buffer[i]);
+            i += deserialize_statistics(&tracker->days[j].delta, &buffer[i]);
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Cerca la copia valida piu' recente; ritorna 1 se c'e', 0 se non ce ne sono, -1 in caso di errore
+ */
+static int load_slots(int fd, uint32_t *sequence, stats_tracker_t *tracker) {
+    uint8_t         buffer[SLOT_SIZE * NUM_SLOTS];
+    stats_tracker_t candidate;
+    int             found = 0;
+
+    ssize_t len = pread(fd, buffer, sizeof(buffer), 0);
+    if (len < 0) {
+        log_warn("Errore nella lettura delle statistiche: %s", strerror(errno));
+        return -1;
+    }
+
+    for (ssize_t i = 0; i + SLOT_SIZE <= len; i += SLOT_SIZE) {
+        uint32_t slot_sequence = 0;
+        if (parse_slot(&buffer[i], &slot_sequence, tracker != NULL ? &candidate : NULL)) {
+            continue;
+        }
+        if (!found || slot_sequence > *sequence) {
+            found     = 1;
+            *sequence = slot_sequence;
+            if (tracker != NULL) {
+                *tracker = candidate;
+            }
+        }
+    }
+
+    return found;
+}
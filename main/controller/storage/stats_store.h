@@ -0,0 +1,12 @@
+#ifndef STATS_STORE_H_INCLUDED
+#define STATS_STORE_H_INCLUDED
+
+
+#include "model/stats_tracker.h"
+
+
+int stats_store_save(const char *path, const stats_tracker_t *tracker);
+int stats_store_load(const char *path, stats_tracker_t *tracker);
+
+
+#endif
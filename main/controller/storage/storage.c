@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* syncfs */
 #include <unistd.h>
 #include <archive.h>
 #include <archive_entry.h>
@@ -8,10 +9,16 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mount.h>
+#include <sys/mman.h>
 #include "errno.h"
 #include "model/model.h"
+#include "gel/timer/timecheck.h"
+#include "gel/serializer/serializer.h"
+#include "utils/system_time.h"
 #include "storage.h"
-#include "log.h"
+#include "program_db.h"
+#include "utils/crc32.h"
+#include "utils/async_log.h"
 #include "config/app_conf.h"
 
 #define DIR_CHECK(x)                                                                                                   \
@@ -21,309 +28,386 @@
             log_error("Errore nel maneggiare una cartella: %s", strerror(errno));                                      \
     }
 
-#ifdef TARGET_DEBUG
-#define remount_ro()
-#define remount_rw()
-#else
-static inline void remount_ro() {
-    if (mount("/dev/mmcblk0p3", DEFAULT_BASE_PATH, "ext2", MS_REMOUNT | MS_RDONLY, NULL) < 0)
-        log_error("Errore nel montare la partizione %s: %s (%i)", DEFAULT_BASE_PATH, strerror(errno), errno);
-}
-
-static inline void remount_rw() {
-    if (mount("/dev/mmcblk0p3", DEFAULT_BASE_PATH, "ext2", MS_REMOUNT, NULL) < 0)
-        log_error("Errore nel montare la partizione %s: %s (%i)", DEFAULT_BASE_PATH, strerror(errno), errno);
-}
-#endif
 #define BASENAME(x) (strrchr(x, '/') + 1)
 
+#define TRANSACTION_MAX_FILES  (MAX_PROGRAMS + 8)
+#define TRANSACTION_PATH_SIZE  128
+#define TRANSACTION_TMP_SUFFIX ".tmp"
+
+#define IMPORT_BLOCK_SIZE     10240
+#define IMPORT_MAX_ENTRY_SIZE (256L * 1024L)
+
+#define EXPORT_BLOCK_SIZE     (64 * 1024)
+#define EXPORT_BENCHMARK_RUNS 5
+#define STREAM_BLOCK_SIZE     (16 * 1024)
+#define FIRMWARE_BLOCK_SIZE   (128 * 1024)
+
+#define FIRMWARE_MANIFEST_EXTENSION ".manifest"
+
+// Patch: intestazione (magic, dimensione e CRC di origine e destinazione) seguita da record
+// di controllo (byte da sommare all'origine, byte nuovi, spostamento nell'origine) con i rispettivi dati
+#define DELTA_MAGIC        "DSDELTA1"
+#define DELTA_HEADER_SIZE  (8 + 4 * 4)
+#define DELTA_CONTROL_SIZE (3 * 4)
+
+
+typedef struct {
+    int                    version;
+    uint8_t               *parmac;
+    size_t                 parmac_size;
+    uint8_t               *db;
+    size_t                 db_size;
+    int                    legacy_index;
+    size_t                 num_names;
+    name_t                 names[MAX_PROGRAMS];
+    storage_program_list_t legacy;     // Programmi nel vecchio formato, in ordine di archivio
+} import_t;
+
+
+typedef struct {
+    const char           *path;
+    const char           *program_db;
+    const char           *parmac;
+    storage_compression_t compression;
+    storage_progress_cb_t progress;
+    void                 *progress_arg;
+    size_t                done;
+    size_t                total;
+    int                   cancelled;
+} export_t;
+
+
+typedef struct {
+    size_t   size;
+    uint32_t crc;
+} firmware_manifest_t;
+
+
+// Firmware in scrittura nel file temporaneo
+typedef struct {
+    const char           *path;
+    char                  tmp_path[256];
+    int                   fd;
+    uint32_t              crc;
+    size_t                done;
+    size_t                total;
+    unsigned long         start;
+    storage_progress_cb_t progress;
+    void                 *progress_arg;
+} firmware_stage_t;
+
 
 static int   is_dir(const char *path);
 static int   dir_exists(char *name);
 static int   is_drive(const char *path);
-static char *nth_strrchr(const char *str, char c, int n);
-static int   count_occurrences(const char *str, char c);
-static void  add_entry_from_data(struct archive *a, struct archive_entry *entry, uint8_t *data, size_t len, char *name);
-static void  add_entry_from_path(struct archive *a, struct archive_entry *entry, char *path, char *name);
-static int   copy_archive(struct archive *ar, struct archive *aw);
-static int   copy_file(const char *to, const char *from);
+static int   export_archive(export_t *export);
+static void  set_export_filter(struct archive *a, storage_compression_t compression);
+static int   export_progress(export_t *export, size_t len);
+static int   add_entry_from_data(struct archive *a, struct archive_entry *entry, uint8_t *data, size_t len, char *name,
+                                 export_t *export);
+static int   add_entry_from_path(struct archive *a, struct archive_entry *entry, const char *path, char *name,
+                                 export_t *export);
+static int   write_all(int fd, const uint8_t *buffer, size_t len);
+static int   file_crc(const char *path, size_t size, uint32_t *crc);
+static int   read_firmware_manifest(const char *path, firmware_manifest_t *manifest);
+static int   stage_begin(firmware_stage_t *stage, const char *path, size_t total, storage_progress_cb_t progress,
+                         void *arg);
+static int   stage_write(firmware_stage_t *stage, const uint8_t *data, size_t len);
+static int   stage_end(firmware_stage_t *stage, int res, const firmware_manifest_t *expected);
+static int   read_exactly(struct archive *a, uint8_t *buffer, size_t len);
+static void  remount_rw(void);
+static void  remount_ro(void);
+static int   open_transaction_file(const char *path, size_t *index);
+static void  close_transaction_file(const char *path, size_t index, int fd);
+static int   list_legacy_programs(const char *path, char *names[]);
+static void  load_legacy_programs(const char *path, storage_program_list_t *list);
+static void  clear_legacy_programs(const char *path);
+static int   read_archive_entry(struct archive *a, struct archive_entry *entry, uint8_t **data, size_t *size);
+static void  parse_legacy_index(import_t *import, char *text);
+static int   validate_import(import_t *import);
 
 
-int storage_load_parmac(char *path, parmac_t *parmac) {
-    uint8_t buffer[PARMAC_SIZE] = {0};
-    int     res                 = 0;
-    FILE   *f                   = fopen(path, "r");
+/*
+ *  Le funzioni di storage sono chiamate dai worker di disk_op, che sono piu' d'uno: lo stato che segue non ha lock
+ *  perche' tutte le richieste che scrivono sulla partizione dati (e quindi aprono finestre o transazioni) occupano
+ *  RESOURCE_DATA, che disk_op concede a un solo worker per volta.
+ */
 
-    if (!f) {
-        log_info("Parametri macchina non trovati");
-        return -1;
-    } else {
-        if ((res = fread(buffer, 1, PARMAC_SIZE, f)) == 0) {
-            log_warn("Errore nel caricamento dei parametri macchina: %s", strerror(errno));
-        }
-        fclose(f);
+static size_t rw_windows = 0;
 
-        if (res == 0) {
-            return -1;
-        } else {
-            model_deserialize_parmac(parmac, buffer);
-            return 0;
-        }
-    }
-}
+static struct {
+    size_t depth;
+    int    error;
+    size_t num_files;
+    char   paths[TRANSACTION_MAX_FILES][TRANSACTION_PATH_SIZE];
+} transaction = {0};
 
 
-int storage_save_parmac(char *path, parmac_t *parmac) {
-    uint8_t buffer[PARMAC_SIZE] = {0};
-    int     res                 = 0;
+/*
+ *  Transazioni
+ */
 
-    size_t size = model_serialize_parmac(buffer, parmac);
+void storage_transaction_begin(void) {
+    if (transaction.depth++ == 0) {
+        transaction.error     = 0;
+        transaction.num_files = 0;
+        remount_rw();
+    }
+}
 
-    remount_rw();
 
-    FILE *f = fopen(path, "w");
-    if (!f) {
-        log_warn("Non riesco ad aprire %s in scrittura: %s", path, strerror(errno));
-        res = 1;
-    } else {
-        if (fwrite(buffer, 1, size, f) == 0) {
-            log_warn("Non riesco a scrivere i parametri macchina: %s", strerror(errno));
-            res = 1;
-        }
-        fclose(f);
+int storage_transaction_write(const char *path, const void *data, size_t len) {
+    size_t index = 0;
+    int    fd    = open_transaction_file(path, &index);
+    if (fd < 0) {
+        return -1;
     }
 
-    remount_ro();
+    if (write_all(fd, data, len) < 0) {
+        log_warn("Non riesco a scrivere il file %s: %s", path, strerror(errno));
+        transaction.error = 1;
+    }
+    close_transaction_file(path, index, fd);
 
-    return res;
+    return transaction.error ? -1 : 0;
 }
 
 
-void storage_remove_program(char *path, char *name) {
-    char filename[128];
-    snprintf(filename, sizeof(filename), "%s/%s", path, name);
+/*
+ * Come storage_transaction_write, ma il contenuto viene letto da `source` un blocco alla volta
+ */
+int storage_transaction_write_stream(const char *path, storage_stream_t *source) {
+    static uint8_t buffer[STREAM_BLOCK_SIZE];
 
-    remount_rw();
+    size_t index = 0;
+    int    fd    = open_transaction_file(path, &index);
+    if (fd < 0) {
+        return -1;
+    }
 
-    if (remove(filename)) {
-        log_warn("Non sono riuscito a cancellare il file %s: %s", filename, strerror(errno));
+    for (;;) {
+        size_t len = storage_stream_read(source, buffer, sizeof(buffer));
+        if (source->error || write_all(fd, buffer, len) < 0) {
+            log_warn("Non riesco a copiare il file %s: %s", path, strerror(errno));
+            transaction.error = 1;
+            break;
+        } else if (len < sizeof(buffer)) {
+            break;
+        }
     }
+    close_transaction_file(path, index, fd);
 
-    remount_ro();
+    return transaction.error ? -1 : 0;
 }
 
 
-int storage_update_program(const char *path, dryer_program_t *p) {
-    char    filename[128];
-    uint8_t buffer[MAX_PROGRAM_SIZE];
-    int     res = 0;
+int storage_transaction_commit(void) {
+    char tmp_path[TRANSACTION_PATH_SIZE + sizeof(TRANSACTION_TMP_SUFFIX)];
 
-    size_t size = program_serialize(buffer, p);
+    if (transaction.depth == 0) {
+        log_error("Commit senza una transazione aperta");
+        return -1;
+    }
 
-    remount_rw();
+    if (--transaction.depth > 0) {
+        return transaction.error;
+    }
 
-    snprintf(filename, sizeof(filename), "%s/%s", path, p->filename);
-    FILE *fp = fopen(filename, "w");
-    if (fp == NULL) {
-        log_error("Unable to open %s: %s", filename, strerror(errno));
+    int res = transaction.error;
+
+    // Un solo flush per tutti i file temporanei prima di renderli visibili
+    if (!res && transaction.num_files > 0) {
+        int fd = open(DEFAULT_BASE_PATH, O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || syncfs(fd) < 0) {
+            log_warn("Errore nella sincronizzazione di %s: %s", DEFAULT_BASE_PATH, strerror(errno));
+            res = 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
     }
-    if (fwrite(buffer, 1, size, fp) == 0) {
-        res = 1;
-        log_error("Non sono riuscito a scrivere il file %s : %s", filename, strerror(errno));
+
+    for (size_t i = 0; i < transaction.num_files; i++) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s%s", transaction.paths[i], TRANSACTION_TMP_SUFFIX);
+
+        if (res) {
+            unlink(tmp_path);
+        } else if (rename(tmp_path, transaction.paths[i]) < 0) {
+            log_error("Non riesco a rinominare %s: %s", tmp_path, strerror(errno));
+            unlink(tmp_path);
+            res = 1;
+        }
     }
-    log_info("Salvato programma %s con %i step", p->nomi[0], p->num_steps);
 
-    fclose(fp);
+    transaction.num_files = 0;
+    transaction.error     = 0;
+
+    // Il passaggio in sola lettura scrive anche i metadati delle rinomine
     remount_ro();
     return res;
 }
 
 
-int storage_update_program_index(const char *path, name_t *names, size_t len) {
-    int  res = 0;
-    char filename[128];
-    snprintf(filename, sizeof(filename), "%s/%s", path, INDEX_FILE_NAME);
-    remount_rw();
-
-    FILE *findex = fopen(filename, "w");
+int storage_load_parmac(char *path, parmac_t *parmac) {
+    uint8_t buffer[PARMAC_SIZE] = {0};
+    int     res                 = 0;
+    FILE   *f                   = fopen(path, "r");
 
-    if (!findex) {
-        log_warn("Operazione di scrittura dell'indice fallita: %s", strerror(errno));
-        res = 1;
+    if (!f) {
+        log_info("Parametri macchina non trovati");
+        return -1;
     } else {
-        char buffer[64];
-
-        for (size_t i = 0; i < len; i++) {
-            if (strlen(names[i]) == 0) {
-                continue;
-            }
+        if ((res = fread(buffer, 1, PARMAC_SIZE, f)) == 0) {
+            log_warn("Errore nel caricamento dei parametri macchina: %s", strerror(errno));
+        }
+        fclose(f);
 
-            snprintf(buffer, STRING_NAME_SIZE + 1, "%s\n", names[i]);
-            if (fwrite(buffer, 1, strlen(buffer), findex) == 0) {
-                log_warn("Errore durante la scrittura dell'indice dei programmi: %s", strerror(errno));
-                res = 1;
-            }
+        if (res == 0) {
+            return -1;
+        } else {
+            model_deserialize_parmac(parmac, buffer);
+            return 0;
         }
-        fclose(findex);
     }
-    remount_ro();
-
-    return res;
 }
 
 
-void storage_clear_orphan_programs(char *path, dryer_program_t *ps, int num) {
-    struct dirent *dir;
-    char           string[300];
-
-    remount_rw();
+int storage_save_parmac(char *path, parmac_t *parmac) {
+    uint8_t buffer[PARMAC_SIZE] = {0};
 
-    DIR *d = opendir(path);
+    size_t size = model_serialize_parmac(buffer, parmac);
 
-    if (d) {
-        while ((dir = readdir(d)) != NULL) {
-            int orphan = 1;
+    storage_transaction_begin();
+    storage_transaction_write(path, buffer, size);
+    return storage_transaction_commit();
+}
 
-            if (strcmp(dir->d_name, INDEX_FILE_NAME) == 0)
-                continue;
 
-            for (int i = 0; i < num; i++) {
-                if (strcmp(ps[i].filename, dir->d_name) == 0) {
-                    orphan = 0;
-                    break;
-                }
-            }
+void storage_remove_program(char *path, char *name) {
+    char db_path[128];
+    snprintf(db_path, sizeof(db_path), "%s/%s", path, PROGRAM_DB_FILE_NAME);
 
-            if (orphan) {
-                snprintf(string, sizeof(string), "%s/%s", path, dir->d_name);
-                remove(string);
-            }
-        }
-        closedir(d);
+    if (program_db_remove(db_path, name)) {
+        log_warn("Non sono riuscito a cancellare il programma %s", name);
     }
+}
 
-    remount_ro();
+
+int storage_update_program(const char *path, dryer_program_t *p) {
+    return storage_save_programs(path, 0, NULL, 0, p, 1);
 }
 
 
-int storage_list_saved_programs(const char *path, char *names[]) {
-    char filename[128] = {0};
-    int  count         = 0;
+int storage_update_program_index(const char *path, name_t *names, size_t len) {
+    return storage_save_programs(path, 1, names, len, NULL, 0);
+}
 
-    snprintf(filename, sizeof(filename), "%s/%s", path, INDEX_FILE_NAME);
-    FILE *findex = fopen(filename, "r");
-    if (!findex) {
-        log_info("Indice non trovato: %s", strerror(errno));
-        return -1;
-    } else {
-        char filename[STRING_NAME_SIZE + 1];
 
-        while (fgets(filename, STRING_NAME_SIZE + 1, findex)) {
-            int len = strlen(filename);
+int storage_save_programs(const char *path, int update_index, name_t *names, size_t num_names,
+                          dryer_program_t *programs, size_t num_programs) {
+    char db_path[128];
+    snprintf(db_path, sizeof(db_path), "%s/%s", path, PROGRAM_DB_FILE_NAME);
 
-            if (filename[len - 1] == '\n')     // Rimuovo il newline
-                filename[len - 1] = 0;
+    return program_db_save(db_path, update_index, names, num_names, programs, num_programs);
+}
 
-            names[count] = malloc(strlen(filename) + 1);
-            strcpy(names[count++], filename);
-        }
 
-        fclose(findex);
-    }
+int storage_load_program(const char *path, dryer_program_t *p) {
+    char db_path[128];
+    snprintf(db_path, sizeof(db_path), "%s/%s", path, PROGRAM_DB_FILE_NAME);
 
-    return count;
+    return program_db_load_program(db_path, p->filename, p);
 }
 
 
 int storage_load_saved_programs(const char *path, storage_program_list_t *list) {
-    uint8_t buffer[MAX_PROGRAM_SIZE];
-    char   *names[100];
-    name_t  filename;
-    int     num = storage_list_saved_programs(path, names);
-    char    file_path[128];
-    int     count = 0;
+    char          db_path[128], index_path[128];
+    unsigned long start = get_millis();
+    int           res   = 0;
+
+    snprintf(db_path, sizeof(db_path), "%s/%s", path, PROGRAM_DB_FILE_NAME);
+    snprintf(index_path, sizeof(index_path), "%s/%s", path, INDEX_FILE_NAME);
 
-    if (num < 0) {
-        storage_update_program_index(path, NULL, 0);
-        num = 0;
+    if (storage_is_file(index_path)) {
+        // Vecchio formato (o archivio importato da una versione precedente): un file per programma
+        log_info("Migrazione dei programmi nell'archivio %s", db_path);
+        load_legacy_programs(path, list);
+
+        if (program_db_write(db_path, list->programs, list->num_programs) == 0) {
+            clear_legacy_programs(path);
+        } else {
+            log_error("Migrazione dei programmi fallita");
+        }
+    } else if ((res = program_db_load(db_path, list, CONFIG_LAZY_PROGRAM_LOADING)) < 0) {
+        program_db_write(db_path, NULL, 0);
+        res = 0;
     }
 
-    for (int i = 0; i < num; i++) {
-        sprintf(file_path, "%s/%s", path, names[i]);
-        memset(filename, 0, sizeof(name_t));
-        strcpy(filename, names[i]);
-        free(names[i]);
+    log_info("Caricamento dei programmi completato in %lu ms%s", time_interval(start, get_millis()),
+             res ? " (errore)" : "");
+    return res;
+}
 
-        if (storage_is_file(file_path)) {
-            log_info("Trovato lavaggio %s", file_path);
-            FILE *fp = fopen(file_path, "r");
 
-            if (!fp) {
-                log_error("Non sono riuscito ad aprire il file %s: %s", file_path, strerror(errno));
-                continue;
-            }
+char storage_write_file(char *path, char *content, size_t len) {
+    storage_transaction_begin();
+    storage_transaction_write(path, content, len);
+    return storage_transaction_commit() != 0;
+}
 
-            size_t read = fread(buffer, 1, MAX_PROGRAM_SIZE, fp);
 
-            if (read == 0) {
-                log_error("Non sono riuscito a leggere il file %s: %s", file_path, strerror(errno));
-            } else {
-                program_deserialize(&list->programs[count], buffer);
-                memcpy(&list->programs[count].filename, filename, STRING_NAME_SIZE);
-                log_info("Prog %zu with %i steps", count, list->programs[count].num_steps);
+int storage_stream_open(storage_stream_t *stream, const char *path) {
+    struct stat st;
 
-                count++;
-            }
+    stream->offset = 0;
+    stream->size   = 0;
+    stream->error  = 0;
+    stream->fd     = open(path, O_RDONLY | O_CLOEXEC);
+    if (stream->fd < 0) {
+        return -1;
+    }
 
-            fclose(fp);
-        }
+    if (fstat(stream->fd, &st) < 0) {
+        storage_stream_close(stream);
+        return -1;
     }
 
-    list->num_programs = count;
+    stream->size = st.st_size;
     return 0;
 }
 
 
-char storage_write_file(char *path, char *content, size_t len) {
-    int res = 0;
-
-    remount_rw();
-    FILE *f = fopen(path, "w");
-    if (!f) {
-        log_warn("Non riesco ad aprire %s in scrittura: %s", path, strerror(errno));
-        res = 1;
-    } else {
-        if (fwrite(content, 1, len, f) == 0) {
-            log_warn("Non riesco a scrivere il file %s: %s", path, strerror(errno));
-            res = 1;
+/*
+ * Riempie `buffer` fino a `len` byte; ne ritorna meno solo alla fine del file o in caso di errore (stream->error)
+ */
+size_t storage_stream_read(storage_stream_t *stream, void *buffer, size_t len) {
+    uint8_t *data  = buffer;
+    size_t   total = 0;
+
+    while (total < len) {
+        ssize_t res = read(stream->fd, &data[total], len - total);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            stream->error = 1;
+            break;
+        } else if (res == 0) {
+            break;
         }
-        fclose(f);
+        total += res;
     }
 
-    remount_ro();
-
-    return res;
+    stream->offset += total;
+    return total;
 }
 
 
-char *storage_read_file(char *name) {
-    unsigned long size = 0;
-    char         *r    = NULL;
-    FILE         *fp   = fopen(name, "r");
-
-    if (fp != NULL) {
-        fseek(fp, 0L, SEEK_END);
-        size = ftell(fp);
-        rewind(fp);
-
-        r = malloc(size);
-        fread(r, sizeof(char), size, fp);
-        r[size] = 0;
-    } else {
-        log_error("Non sono riuscito a leggere il file %s: %s", name, strerror(errno));
+void storage_stream_close(storage_stream_t *stream) {
+    if (stream->fd >= 0) {
+        close(stream->fd);
+        stream->fd = -1;
     }
-
-    return r;
 }
 
 
@@ -344,223 +428,306 @@ void storage_clear_file(const char *path) {
 }
 
 
-int storage_list_saved_machines(char *location, name_t **names) {
-    int            count = 0, num = 0;
-    struct dirent *dir;
-    char           path[300];
-
-    DIR *d = opendir(location);
+/*
+ * Scrittura completa a partire da `offset`, per i file aggiornati sul posto (storici dei cicli e degli allarmi)
+ */
+int storage_pwrite_all(int fd, const uint8_t *buffer, size_t len, off_t offset) {
+    size_t written = 0;
 
-    if (d != NULL) {
-        while ((dir = readdir(d)) != NULL) {
-            snprintf(path, sizeof(path), "%s/%s", location, dir->d_name);
-            if (storage_is_file(path)) {
-                num++;
+    while (written < len) {
+        ssize_t res = pwrite(fd, &buffer[written], len - written, offset + written);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            log_warn("Errore di scrittura: %s", strerror(errno));
+            return -1;
         }
+        written += res;
+    }
 
-        *names = realloc(*names, sizeof(name_t) * num);
-        memset(*names, 0, sizeof(name_t) * num);
-        rewinddir(d);
-
-        while ((dir = readdir(d)) != NULL && count < num) {
-            snprintf(path, sizeof(path), "%s/%s", location, dir->d_name);
+    return 0;
+}
 
-            if (!storage_is_file(path)) {
-                continue;
-            }
 
-            char *ext = nth_strrchr(dir->d_name, '.', count_occurrences(ARCHIVE_EXTENSION, '.'));
-            if (strcmp(ext, ARCHIVE_EXTENSION)) {
-                continue;
-            }
+/*
+ * Rende persistenti le voci della cartella (file creati o rinominati)
+ */
+int storage_sync_dir(const char *path) {
+    int res = 0;
+    int fd  = open(path, O_RDONLY | O_DIRECTORY);
 
-            int len = strlen(dir->d_name) - strlen(ARCHIVE_EXTENSION);
-            len     = len > MAX_NAME_SIZE ? MAX_NAME_SIZE : len;
-            memcpy((*names)[count], dir->d_name, len);
-            count++;
-        }
-        closedir(d);
+    if (fd < 0 || fsync(fd) < 0) {
+        log_warn("Errore nella sincronizzazione di %s: %s", path, strerror(errno));
+        res = -1;
     }
-
-    return count;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return res;
 }
 
 
-int storage_save_current_machine_config(const char *destination, const char *name) {
+/*
+ * Legge solo la versione dei dati di un archivio; l'esportazione la scrive come prima voce,
+ * per cui normalmente basta decomprimere il primo blocco.
+ */
+int storage_read_archive_version(const char *path) {
     struct archive       *a;
     struct archive_entry *entry;
-    char                  path[300], filename[256], buffer[17];
-    char                 *names[MAX_PROGRAMS];
+    int                   version = -1;
 
-    int num = storage_list_saved_programs(DEFAULT_PROGRAMS_PATH, names);
-
-    remount_rw();
+    a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
 
-    snprintf(path, sizeof(path), "%s/%s%s", destination, name, ARCHIVE_EXTENSION);
-    a = archive_write_new();
-    archive_write_add_filter_gzip(a);
-    archive_write_set_format_pax_restricted(a);     // Note 1
-    if (archive_write_open_filename(a, path) != ARCHIVE_OK) {
-        log_error("Errore nell'aprire l'archivio: %s", archive_error_string(a));
-        remount_ro();
-        return 1;
+    if (archive_read_open_filename(a, path, IMPORT_BLOCK_SIZE)) {
+        log_warn("Non sono riuscito ad aprire l'archivio %s: %s", path, archive_error_string(a));
+        archive_read_free(a);
+        return -1;
     }
-    entry = archive_entry_new();     // Note 2
 
-    sprintf(filename, "%s", BASENAME(DEFAULT_PATH_FILE_DATA_VERSION));
-    snprintf(buffer, 16, "%i", CONFIG_DATA_VERSION);
-    add_entry_from_data(a, entry, (uint8_t *)buffer, strlen(buffer), filename);
-
-    sprintf(filename, "%s/%s", BASENAME(DEFAULT_PROGRAMS_PATH), INDEX_FILE_NAME);
-    add_entry_from_path(a, entry, DEFAULT_PATH_FILE_INDEX, filename);
-
-    sprintf(filename, "%s/%s", BASENAME(DEFAULT_PARAMS_PATH), BASENAME(DEFAULT_PATH_FILE_PARMAC));
-    add_entry_from_path(a, entry, DEFAULT_PATH_FILE_PARMAC, filename);
+    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+        if (strcmp(archive_entry_pathname(entry), BASENAME(DEFAULT_PATH_FILE_DATA_VERSION)) != 0) {
+            continue;
+        }
 
-    for (int i = 0; i < num; i++) {
-        sprintf(path, "%s/%s", DEFAULT_PROGRAMS_PATH, names[i]);
-        sprintf(filename, "%s/%s", BASENAME(DEFAULT_PROGRAMS_PATH), names[i]);
-        add_entry_from_path(a, entry, path, filename);
-        free(names[i]);
+        uint8_t *data = NULL;
+        size_t   size = 0;
+        if (read_archive_entry(a, entry, &data, &size) == 0) {
+            version = atoi((char *)data);
+            free(data);
+        }
+        break;
     }
 
-    archive_entry_free(entry);
-    archive_write_close(a);
-    archive_write_free(a);
-    sync();
+    archive_read_free(a);
+    return version;
+}
 
-    remount_ro();
 
-    return 0;
+int storage_save_current_machine_config(const char *destination, const char *name, storage_compression_t compression,
+                                        storage_progress_cb_t progress, void *arg) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%s%s", destination, name, ARCHIVE_EXTENSION);
+
+    export_t export = {
+        .path         = path,
+        .program_db   = DEFAULT_PATH_FILE_PROGRAM_DB,
+        .parmac       = DEFAULT_PATH_FILE_PARMAC,
+        .compression  = compression,
+        .progress     = progress,
+        .progress_arg = arg,
+    };
+    return export_archive(&export);
 }
 
 
-int storage_read_archive_data_version(const char *location, const char *name) {
-    struct archive       *a;
-    struct archive_entry *entry;
-    int                   r, res = 0;
-    char                  path[256];
+#ifdef TARGET_DEBUG
+/*
+ * Misura i tempi di esportazione su una libreria sintetica di MAX_PROGRAMS programmi pieni, scritta in `destination`
+ * (ad esempio un tmpfs o un'immagine vfat montata in loop, vedi tools/bench_export.sh)
+ */
+int storage_benchmark_export(const char *destination) {
+    const char *compressions[] = {"nessuna", "gzip veloce", "zstd"};
+    char        db_path[256], parmac_path[256], path[256];
+    uint8_t     parmac[PARMAC_SIZE] = {0};
 
-    remount_rw();
+    dryer_program_t *programs = calloc(MAX_PROGRAMS, sizeof(dryer_program_t));
+    if (programs == NULL) {
+        return -1;
+    }
 
-    a = archive_read_new();
-    archive_read_support_filter_all(a);
-    archive_read_support_format_all(a);
+    for (size_t i = 0; i < MAX_PROGRAMS; i++) {
+        dryer_program_t *p = &programs[i];
+        snprintf(p->filename, sizeof(name_t), "bench%zu", i);
+        for (size_t j = 0; j < NUM_LINGUE; j++) {
+            snprintf(p->nomi[j], sizeof(name_t), "Programma di prova %zu", i);
+        }
+        p->num_steps = MAX_STEPS;
+        for (size_t j = 0; j < MAX_STEPS; j++) {
+            p->steps[j].type            = j % NUM_DRYER_PROGRAM_STEP_TYPES;
+            p->steps[j].drying.duration = 60 + i * j;
+        }
+    }
 
-    sprintf(path, "%s/%s%s", location, name, ARCHIVE_EXTENSION);
-    if ((r = archive_read_open_filename(a, path, 10240))) {
-        log_error("Non sono riuscito ad aprire l'archivio: %s\n", archive_error_string(a));
-        remount_ro();
-        return -1;
+    snprintf(db_path, sizeof(db_path), "%s/bench_%s", destination, PROGRAM_DB_FILE_NAME);
+    snprintf(parmac_path, sizeof(parmac_path), "%s/bench_parmac.bin", destination);
+    int res = program_db_write(db_path, programs, MAX_PROGRAMS);
+    free(programs);
+
+    FILE *fp = fopen(parmac_path, "w");
+    if (fp != NULL) {
+        fwrite(parmac, 1, sizeof(parmac), fp);
+        fclose(fp);
     }
 
-    for (;;) {
-        r                = archive_read_next_header(a, &entry);
-        const char *path = archive_entry_pathname(entry);
-        if (r == ARCHIVE_EOF)
-            break;
-        if (r < ARCHIVE_OK)
-            log_warn("%s\n", archive_error_string(a));
-        if (r < ARCHIVE_WARN)
-            break;
+    for (int c = STORAGE_COMPRESSION_NONE; c <= STORAGE_COMPRESSION_ZSTD && !res; c++) {
+        unsigned long total = 0;
 
-        if (strcmp(path, BASENAME(DEFAULT_PATH_FILE_DATA_VERSION)))
-            continue;
+        for (int run = 0; run < EXPORT_BENCHMARK_RUNS && !res; run++) {
+            snprintf(path, sizeof(path), "%s/bench%s", destination, ARCHIVE_EXTENSION);
 
-        char buffer[17] = {0};
-        int  len        = archive_read_data(a, buffer, 16);
-        if (len > 0) {
-            res = atoi(buffer);
-            break;
-        } else {
-            log_warn("Non sono riuscito a leggere la versione dei dati: %s\n", archive_error_string(a));
-            res = -1;
-            break;
+            export_t export = {
+                .path        = path,
+                .program_db  = db_path,
+                .parmac      = parmac_path,
+                .compression = c,
+            };
+
+            unsigned long start = get_millis();
+            res                 = export_archive(&export);
+            total += time_interval(start, get_millis());
         }
-    }
-    archive_read_close(a);
-    archive_read_free(a);
 
-    remount_ro();
+        log_info("Benchmark esportazione su %s, compressione %s: %lu ms in media, %zu byte", destination,
+                 compressions[c], total / EXPORT_BENCHMARK_RUNS, storage_get_file_size(path));
+    }
 
+    unlink(path);
+    unlink(db_path);
+    unlink(parmac_path);
     return res;
 }
+#endif
 
 
-int storage_load_current_machine_config(const char *location, const char *name) {
+/*
+ * Importa una configurazione macchina con una sola lettura dell'archivio. Ogni voce viene decompressa in memoria e
+ * validata; il disco viene toccato solo alla fine, con un'unica transazione.
+ */
+int storage_import_machine_config(const char *location, const char *name) {
     struct archive       *a;
-    struct archive       *ext;
     struct archive_entry *entry;
+    char                  path[300], parmac_path[64], programs_prefix[64];
+    int                   r, res = 0;
+    unsigned long         start  = get_millis();
+    import_t             *import = malloc(sizeof(import_t));
 
-    int  r;
-    char newname[256];
-    char path[256];
+    if (import == NULL) {
+        log_error("Memoria esaurita per l'importazione");
+        return -1;
+    }
+    memset(import, 0, sizeof(import_t));
 
-    remount_rw();
+    snprintf(parmac_path, sizeof(parmac_path), "%s/%s", BASENAME(DEFAULT_PARAMS_PATH),
+             BASENAME(DEFAULT_PATH_FILE_PARMAC));
+    snprintf(programs_prefix, sizeof(programs_prefix), "%s/", BASENAME(DEFAULT_PROGRAMS_PATH));
+    size_t prefix_len = strlen(programs_prefix);
 
     a = archive_read_new();
     archive_read_support_filter_all(a);
     archive_read_support_format_all(a);
-    ext = archive_write_disk_new();
-    archive_write_disk_set_options(ext, 0);
-    // archive_write_disk_set_standard_lookup(ext);
 
-    sprintf(path, "%s/%s%s", location, name, ARCHIVE_EXTENSION);
-    if ((r = archive_read_open_filename(a, path, 10240))) {
-        log_error("Non sono riuscito ad aprire l'archivio: %s\n", archive_error_string(a));
-        remount_ro();
+    snprintf(path, sizeof(path), "%s/%s%s", location, name, ARCHIVE_EXTENSION);
+    if ((r = archive_read_open_filename(a, path, IMPORT_BLOCK_SIZE))) {
+        log_error("Non sono riuscito ad aprire l'archivio: %s", archive_error_string(a));
+        archive_read_free(a);
+        free(import);
         return -1;
     }
 
-    for (;;) {
+    while (!res) {
         r = archive_read_next_header(a, &entry);
-
         if (r == ARCHIVE_EOF)
             break;
         if (r < ARCHIVE_OK)
-            log_warn("%s\n", archive_error_string(a));
-        if (r < ARCHIVE_WARN)
+            log_warn("%s", archive_error_string(a));
+        if (r < ARCHIVE_WARN) {
+            res = -1;
             break;
+        }
 
-        const char *path = archive_entry_pathname(entry);
+        const char *entry_path = archive_entry_pathname(entry);
+        uint8_t    *data       = NULL;
+        size_t      size       = 0;
 
-        if (strcmp(path, BASENAME(DEFAULT_PATH_FILE_DATA_VERSION)) == 0) {
+        if (archive_entry_filetype(entry) != AE_IFREG) {
             continue;
         }
+        if (read_archive_entry(a, entry, &data, &size)) {
+            res = -1;
+            break;
+        }
 
-        sprintf(newname, "%s/%s", DEFAULT_BASE_PATH, path);
-        archive_entry_set_pathname(entry, newname);
-
-        r = archive_write_header(ext, entry);
-        if (r < ARCHIVE_OK)
-            log_warn("%s\n", archive_error_string(ext));
-
-        else if (archive_entry_size(entry) > 0) {
-            r = copy_archive(a, ext);
-            if (r < ARCHIVE_OK) {
-                log_warn("%s\n", archive_error_string(ext));
-            }
-            if (r < ARCHIVE_WARN) {
-                break;
+        if (strcmp(entry_path, BASENAME(DEFAULT_PATH_FILE_DATA_VERSION)) == 0) {
+            import->version = atoi((char *)data);
+        } else if (strcmp(entry_path, parmac_path) == 0) {
+            free(import->parmac);
+            import->parmac      = data;
+            import->parmac_size = size;
+            data                = NULL;
+        } else if (strncmp(entry_path, programs_prefix, prefix_len) == 0) {
+            const char *filename = &entry_path[prefix_len];
+
+            if (strcmp(filename, PROGRAM_DB_FILE_NAME) == 0) {
+                free(import->db);
+                import->db      = data;
+                import->db_size = size;
+                data            = NULL;
+            } else if (strcmp(filename, INDEX_FILE_NAME) == 0) {
+                parse_legacy_index(import, (char *)data);
+            } else if (import->legacy.num_programs < MAX_PROGRAMS) {
+                dryer_program_t *p = &import->legacy.programs[import->legacy.num_programs];
+                if (strlen(filename) > MAX_NAME_SIZE || program_db_parse_program(data, size, p)) {
+                    log_error("Programma %s non valido nell'archivio", entry_path);
+                    res = -1;
+                } else {
+                    snprintf(p->filename, sizeof(name_t), "%s", filename);
+                    import->legacy.num_programs++;
+                }
+            } else {
+                log_error("Troppi programmi nell'archivio");
+                res = -1;
             }
+        } else {
+            log_warn("Voce sconosciuta nell'archivio: %s", entry_path);
         }
-        r = archive_write_finish_entry(ext);
-        if (r < ARCHIVE_OK) {
-            log_warn("%s\n", archive_error_string(ext));
-        }
-        if (r < ARCHIVE_WARN) {
-            break;
-        }
+
+        free(data);
     }
+
     archive_read_close(a);
     archive_read_free(a);
-    archive_write_close(ext);
-    archive_write_free(ext);
 
-    remount_ro();
+    if (!res) {
+        res = validate_import(import);
+    }
 
-    return 0;
+    if (!res) {
+        storage_transaction_begin();
+        storage_transaction_write(DEFAULT_PATH_FILE_PARMAC, import->parmac, import->parmac_size);
+
+        if (import->db != NULL) {
+            storage_transaction_write(DEFAULT_PATH_FILE_PROGRAM_DB, import->db, import->db_size);
+        } else {
+            // Archivio nel vecchio formato: i programmi vengono riordinati secondo l'indice e convertiti
+            storage_program_list_t *list = &import->legacy;
+            size_t                  num  = 0;
+
+            for (size_t i = 0; i < import->num_names; i++) {
+                for (size_t j = num; j < list->num_programs; j++) {
+                    if (strcmp(list->programs[j].filename, import->names[i]) == 0) {
+                        dryer_program_t p     = list->programs[num];
+                        list->programs[num++] = list->programs[j];
+                        list->programs[j]     = p;
+                        break;
+                    }
+                }
+            }
+            program_db_write(DEFAULT_PATH_FILE_PROGRAM_DB, list->programs, num);
+        }
+
+        res = storage_transaction_commit();
+    }
+
+    log_info("Importazione di %s %s in %lu ms", name, res ? "fallita" : "completata",
+             time_interval(start, get_millis()));
+
+    free(import->parmac);
+    free(import->db);
+    free(import);
+    return res;
 }
 
 
@@ -641,30 +808,202 @@ int storage_is_file(const char *path) {
 }
 
 
-int storage_update_temporary_firmware(char *app_path, char *temporary_path) {
-    int res = 0;
+/*
+ * Copia il firmware dalla chiavetta in un unico passaggio a blocchi grandi calcolando il CRC, lo rilegge dal disco
+ * per verificarlo con il manifest (o, se manca, con quanto letto dalla chiavetta) e lo rende visibile con una rename
+ * atomica
+ */
+int storage_update_temporary_firmware(const char *app_path, const char *temporary_path,
+                                      storage_progress_cb_t progress, void *arg) {
+    static uint8_t      buffer[FIRMWARE_BLOCK_SIZE] __attribute__((aligned(4096)));
+    firmware_manifest_t manifest;
+    firmware_stage_t    stage;
+    char                manifest_path[256];
+    struct stat         st;
+    uint32_t            crc = CRC32_INIT;
+    int                 res = 0;
+
+    int fd_from = open(app_path, O_RDONLY);
+    if (fd_from < 0 || fstat(fd_from, &st) < 0) {
+        log_warn("Non sono riuscito ad aprire %s: %s", app_path, strerror(errno));
+        if (fd_from >= 0) {
+            close(fd_from);
+        }
+        return -1;
+    }
 
-#ifdef TARGET_DEBUG
-    return 0;
-#endif
+    snprintf(manifest_path, sizeof(manifest_path), "%s%s", app_path, FIRMWARE_MANIFEST_EXTENSION);
+    int has_manifest = read_firmware_manifest(manifest_path, &manifest) == 0;
+    if (!has_manifest) {
+        log_warn("Manifest %s assente o non valido: il firmware sara' confrontato solo con l'originale", manifest_path);
+    } else if (manifest.size != (size_t)st.st_size) {
+        // Scartato prima di scrivere qualsiasi cosa
+        log_error("Dimensione del firmware errata: %zu invece di %zu", (size_t)st.st_size, manifest.size);
+        close(fd_from);
+        return -1;
+    } else if (file_crc(temporary_path, manifest.size, &crc) == 0 && crc == manifest.crc) {
+        log_info("Il firmware %08X e' gia' pronto in %s", manifest.crc, temporary_path);
+        close(fd_from);
+        return 0;
+    }
 
-    if (storage_is_file(app_path)) {
-        if (mount("/dev/root", "/", "ext2", MS_REMOUNT, NULL) < 0) {
-            log_error("Errore nel montare la root: %s (%i)", strerror(errno), errno);
-            return -1;
+    posix_fadvise(fd_from, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (stage_begin(&stage, temporary_path, st.st_size, progress, arg)) {
+        close(fd_from);
+        return -1;
+    }
+
+    while (res == 0) {
+        ssize_t len = read(fd_from, buffer, sizeof(buffer));
+        if (len == 0) {
+            break;
+        } else if (len < 0) {
+            log_error("Errore nella lettura di %s: %s", app_path, strerror(errno));
+            res = -1;
+        } else {
+            res = stage_write(&stage, buffer, len);
         }
+    }
+    close(fd_from);
 
-        if ((res = copy_file(temporary_path, app_path)) < 0)
-            log_error("Non sono riuscito ad aggiornare il firmware");
+    if (!has_manifest) {
+        // Tutto il file e nient'altro: una chiavetta rimossa a meta' non lascia un firmware troncato
+        manifest.size = st.st_size;
+        manifest.crc  = stage.crc;
+    }
+    return stage_end(&stage, res, &manifest);
+}
 
-        if (mount("/dev/root", "/", "ext2", MS_REMOUNT | MS_RDONLY, NULL) < 0)
-            log_warn("Errore nel rimontare la root: %s (%i)", strerror(errno), errno);
 
-        sync();
-    } else {
+/*
+ * Ricostruisce il firmware applicando una patch (vedi tools/firmware_delta.py) all'eseguibile in funzione.
+ * La patch puo' essere compressa; e' letta e applicata in streaming
+ */
+int storage_apply_firmware_delta(const char *delta_path, const char *temporary_path, storage_progress_cb_t progress,
+                                 void *arg) {
+    static uint8_t        buffer[FIRMWARE_BLOCK_SIZE] __attribute__((aligned(4096)));
+    struct archive       *a;
+    struct archive_entry *entry;
+    firmware_manifest_t   target;
+    firmware_stage_t      stage;
+    uint8_t               header[DELTA_HEADER_SIZE], control[DELTA_CONTROL_SIZE];
+    uint32_t              source_size, source_crc, target_size, target_crc;
+    struct stat           st;
+    unsigned long         start = get_millis();
+    int                   res   = 0;
+
+    a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_raw(a);
+    if (archive_read_open_filename(a, delta_path, IMPORT_BLOCK_SIZE) != ARCHIVE_OK ||
+        archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+        log_warn("Non riesco ad aprire la patch %s: %s", delta_path, archive_error_string(a));
+        archive_read_free(a);
+        return -1;
+    }
+
+    if (read_exactly(a, header, sizeof(header)) || memcmp(header, DELTA_MAGIC, strlen(DELTA_MAGIC)) != 0) {
+        log_warn("%s non e' una patch valida", delta_path);
+        archive_read_free(a);
+        return -1;
+    }
+    size_t i = strlen(DELTA_MAGIC);
+    i += deserialize_uint32_be(&source_size, &header[i]);
+    i += deserialize_uint32_be(&source_crc, &header[i]);
+    i += deserialize_uint32_be(&target_size, &header[i]);
+    i += deserialize_uint32_be(&target_crc, &header[i]);
+
+    // La patch vale solo per l'eseguibile da cui e' stata calcolata
+    int fd_source = open("/proc/self/exe", O_RDONLY);
+    if (fd_source < 0 || fstat(fd_source, &st) < 0 || (size_t)st.st_size != source_size) {
+        log_warn("La patch non e' per questa versione del firmware");
+        if (fd_source >= 0) {
+            close(fd_source);
+        }
+        archive_read_free(a);
         return -1;
     }
 
+    uint8_t *source = mmap(NULL, source_size, PROT_READ, MAP_PRIVATE, fd_source, 0);
+    close(fd_source);
+    if (source == MAP_FAILED) {
+        log_error("Non riesco a mappare l'eseguibile: %s", strerror(errno));
+        archive_read_free(a);
+        return -1;
+    }
+
+    if (crc32(source, source_size) != source_crc) {
+        log_warn("La patch non e' per questa versione del firmware");
+        munmap(source, source_size);
+        archive_read_free(a);
+        return -1;
+    }
+
+    if (stage_begin(&stage, temporary_path, target_size, progress, arg)) {
+        munmap(source, source_size);
+        archive_read_free(a);
+        return -1;
+    }
+
+    int64_t source_pos = 0;
+    while (res == 0 && stage.done < target_size) {
+        uint32_t diff_len, extra_len, seek;
+
+        if (read_exactly(a, control, sizeof(control))) {
+            log_error("Patch troncata");
+            res = -1;
+            break;
+        }
+        i = 0;
+        i += deserialize_uint32_be(&diff_len, &control[i]);
+        i += deserialize_uint32_be(&extra_len, &control[i]);
+        i += deserialize_uint32_be(&seek, &control[i]);
+
+        if ((uint64_t)stage.done + diff_len + extra_len > target_size || source_pos < 0 ||
+            source_pos + diff_len > source_size) {
+            log_error("Patch corrotta");
+            res = -1;
+            break;
+        }
+
+        // Differenze byte per byte rispetto all'eseguibile corrente
+        while (res == 0 && diff_len > 0) {
+            size_t len = diff_len > sizeof(buffer) ? sizeof(buffer) : diff_len;
+            if ((res = read_exactly(a, buffer, len)) != 0) {
+                break;
+            }
+            for (size_t j = 0; j < len; j++) {
+                buffer[j] += source[source_pos + j];
+            }
+            res = stage_write(&stage, buffer, len);
+            source_pos += len;
+            diff_len -= len;
+        }
+
+        // Byte nuovi
+        while (res == 0 && extra_len > 0) {
+            size_t len = extra_len > sizeof(buffer) ? sizeof(buffer) : extra_len;
+            if ((res = read_exactly(a, buffer, len)) == 0) {
+                res = stage_write(&stage, buffer, len);
+            }
+            extra_len -= len;
+        }
+
+        source_pos += (int32_t)seek;
+    }
+
+    int64_t delta_size = archive_filter_bytes(a, -1);
+    munmap(source, source_size);
+    archive_read_free(a);
+
+    target.size = target_size;
+    target.crc  = target_crc;
+    res         = stage_end(&stage, res, &target);
+    if (res == 0) {
+        log_info("Patch di %lli byte applicata in %lu ms: %zu byte scritti", (long long)delta_size,
+                 time_interval(start, get_millis()), stage.done);
+    }
     return res;
 }
 
@@ -674,6 +1013,79 @@ int storage_update_temporary_firmware(char *app_path, char *temporary_path) {
  */
 
 
+/*
+ * La partizione dati viene rimontata in scrittura una sola volta anche quando le richieste si annidano
+ */
+static void remount_rw(void) {
+    if (rw_windows++ > 0) {
+        return;
+    }
+
+#ifndef TARGET_DEBUG
+    if (mount("/dev/mmcblk0p3", DEFAULT_BASE_PATH, "ext2", MS_REMOUNT, NULL) < 0)
+        log_error("Errore nel montare la partizione %s: %s (%i)", DEFAULT_BASE_PATH, strerror(errno), errno);
+#endif
+}
+
+
+static void remount_ro(void) {
+    if (rw_windows == 0) {
+        log_warn("Partizione %s gia' in sola lettura", DEFAULT_BASE_PATH);
+        return;
+    } else if (--rw_windows > 0) {
+        return;
+    }
+
+#ifndef TARGET_DEBUG
+    if (mount("/dev/mmcblk0p3", DEFAULT_BASE_PATH, "ext2", MS_REMOUNT | MS_RDONLY, NULL) < 0)
+        log_error("Errore nel montare la partizione %s: %s (%i)", DEFAULT_BASE_PATH, strerror(errno), errno);
+#endif
+}
+
+
+/*
+ * Apre in scrittura il file temporaneo di `path` e ne ritorna la posizione nella transazione
+ */
+static int open_transaction_file(const char *path, size_t *index) {
+    char tmp_path[TRANSACTION_PATH_SIZE + sizeof(TRANSACTION_TMP_SUFFIX)];
+
+    if (transaction.depth == 0) {
+        log_error("Scrittura di %s fuori da una transazione", path);
+        return -1;
+    }
+
+    for (*index = 0; *index < transaction.num_files; (*index)++) {
+        if (strcmp(transaction.paths[*index], path) == 0) {
+            break;
+        }
+    }
+
+    if (*index == TRANSACTION_MAX_FILES || strlen(path) >= TRANSACTION_PATH_SIZE) {
+        log_error("Impossibile aggiungere %s alla transazione", path);
+        transaction.error = 1;
+        return -1;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, TRANSACTION_TMP_SUFFIX);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_warn("Non riesco ad aprire %s in scrittura: %s", tmp_path, strerror(errno));
+        transaction.error = 1;
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void close_transaction_file(const char *path, size_t index, int fd) {
+    close(fd);
+    if (index == transaction.num_files) {
+        strcpy(transaction.paths[transaction.num_files++], path);
+    }
+}
+
+
 static int is_dir(const char *path) {
     struct stat path_stat;
     if (stat(path, &path_stat) < 0)
@@ -700,22 +1112,106 @@ static int dir_exists(char *name) {
 }
 
 
-static char *nth_strrchr(const char *str, char c, int n) {
-    const char *s = &str[strlen(str) - 1];
+/*
+ *  Vecchio formato dei programmi, letto solo per la migrazione
+ */
+
+static int list_legacy_programs(const char *path, char *names[]) {
+    char filename[128] = {0};
+    int  count         = 0;
+
+    snprintf(filename, sizeof(filename), "%s/%s", path, INDEX_FILE_NAME);
+    FILE *findex = fopen(filename, "r");
+    if (!findex) {
+        log_info("Indice non trovato: %s", strerror(errno));
+        return -1;
+    } else {
+        char filename[STRING_NAME_SIZE + 1];
+
+        while (count < MAX_PROGRAMS && fgets(filename, STRING_NAME_SIZE + 1, findex)) {
+            int len = strlen(filename);
+
+            if (filename[len - 1] == '\n')     // Rimuovo il newline
+                filename[len - 1] = 0;
 
-    while ((n -= (*s == c)) && (s != str)) {
-        s--;
+            names[count] = malloc(strlen(filename) + 1);
+            strcpy(names[count++], filename);
+        }
+
+        fclose(findex);
     }
 
-    return (char *)s;
+    return count;
 }
 
 
-static int count_occurrences(const char *str, char c) {
-    int i = 0;
-    for (i = 0; str[i]; str[i] == c ? i++ : *str++)
-        ;
-    return i;
+static void load_legacy_programs(const char *path, storage_program_list_t *list) {
+    uint8_t buffer[MAX_PROGRAM_SIZE];
+    char   *names[MAX_PROGRAMS];
+    name_t  filename;
+    int     num = list_legacy_programs(path, names);
+    char    file_path[128];
+    int     count = 0;
+
+    for (int i = 0; i < num; i++) {
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, names[i]);
+        memset(filename, 0, sizeof(name_t));
+        snprintf(filename, sizeof(name_t), "%s", names[i]);
+        free(names[i]);
+
+        if (storage_is_file(file_path)) {
+            log_info("Trovato lavaggio %s", file_path);
+            FILE *fp = fopen(file_path, "r");
+
+            if (!fp) {
+                log_error("Non sono riuscito ad aprire il file %s: %s", file_path, strerror(errno));
+                continue;
+            }
+
+            memset(buffer, 0, sizeof(buffer));
+            size_t read = fread(buffer, 1, MAX_PROGRAM_SIZE, fp);
+
+            if (read == 0) {
+                log_error("Non sono riuscito a leggere il file %s: %s", file_path, strerror(errno));
+            } else {
+                program_deserialize(&list->programs[count], buffer);
+                memcpy(&list->programs[count].filename, filename, STRING_NAME_SIZE);
+                log_info("Prog %i with %i steps", count, list->programs[count].num_steps);
+
+                count++;
+            }
+
+            fclose(fp);
+        }
+    }
+
+    list->num_programs = count;
+}
+
+
+static void clear_legacy_programs(const char *path) {
+    char *names[MAX_PROGRAMS];
+    char  string[300];
+    int   num = list_legacy_programs(path, names);
+
+    remount_rw();
+
+    // Senza indice i vecchi file non vengono piu' considerati: lo rimuovo per primo
+    snprintf(string, sizeof(string), "%s/%s", path, INDEX_FILE_NAME);
+    remove(string);
+
+    // Solo i programmi elencati: nella cartella restano l'archivio e le sue copie da parte
+    for (int i = 0; i < num; i++) {
+        if (strchr(names[i], '/') == NULL && strcmp(names[i], PROGRAM_DB_FILE_NAME) != 0) {
+            snprintf(string, sizeof(string), "%s/%s", path, names[i]);
+            if (storage_is_file(string)) {
+                remove(string);
+            }
+        }
+        free(names[i]);
+    }
+
+    remount_ro();
 }
 
 
@@ -723,127 +1219,451 @@ static int count_occurrences(const char *str, char c) {
  *  Archivio di configurazioni macchina
  */
 
-static void add_entry_from_data(struct archive *a, struct archive_entry *entry, uint8_t *data, size_t len, char *name) {
+static int read_archive_entry(struct archive *a, struct archive_entry *entry, uint8_t **data, size_t *size) {
+    int64_t len = archive_entry_size(entry);
+
+    if (len < 0 || len > IMPORT_MAX_ENTRY_SIZE) {
+        log_error("Dimensione non valida per %s: %lli", archive_entry_pathname(entry), (long long)len);
+        return -1;
+    }
+
+    uint8_t *buffer = malloc(len + 1);
+    if (buffer == NULL) {
+        log_error("Memoria esaurita per %s", archive_entry_pathname(entry));
+        return -1;
+    }
+
+    int64_t total = 0;
+    while (total < len) {
+        ssize_t r = archive_read_data(a, &buffer[total], len - total);
+        if (r <= 0) {
+            break;
+        }
+        total += r;
+    }
+
+    if (total != len) {
+        log_error("Lettura di %s fallita: %s", archive_entry_pathname(entry), archive_error_string(a));
+        free(buffer);
+        return -1;
+    }
+
+    buffer[len] = '\0';
+    *data       = buffer;
+    *size       = len;
+    return 0;
+}
+
+
+static void parse_legacy_index(import_t *import, char *text) {
+    char *saveptr = NULL;
+
+    import->legacy_index = 1;
+    import->num_names    = 0;
+
+    for (char *line = strtok_r(text, "\r\n", &saveptr); line != NULL && import->num_names < MAX_PROGRAMS;
+         line = strtok_r(NULL, "\r\n", &saveptr)) {
+        snprintf(import->names[import->num_names++], sizeof(name_t), "%s", line);
+    }
+}
+
+
+static int validate_import(import_t *import) {
+    if (import->version <= 0 || import->version > CONFIG_DATA_VERSION) {
+        log_error("Versione dei dati %i non supportata", import->version);
+        return -1;
+    }
+
+    if (import->parmac == NULL || import->parmac_size == 0 || import->parmac_size > PARMAC_SIZE) {
+        log_error("Parametri macchina mancanti o non validi (%zu byte)", import->parmac_size);
+        return -1;
+    }
+
+    if (import->db != NULL) {
+        int num = program_db_validate(import->db, import->db_size);
+        if (num < 0) {
+            log_error("Archivio programmi non valido");
+            return -1;
+        }
+        log_info("Archivio con %i programmi", num);
+    } else if (!import->legacy_index) {
+        log_error("Programmi mancanti nell'archivio");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int export_archive(export_t *export) {
+    struct archive       *a;
+    struct archive_entry *entry;
+    char                  version[17], filename[256];
+    unsigned long         start = get_millis();
+    int                   res   = 0;
+
+    snprintf(version, sizeof(version), "%i", CONFIG_DATA_VERSION);
+    export->done      = 0;
+    export->cancelled = 0;
+    export->total     = strlen(version) + storage_get_file_size(export->program_db) + storage_get_file_size(export->parmac);
+
+    // Scrivo su un descrittore mio per poter sincronizzare solo il file di destinazione
+    int fd = open(export->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("Non riesco a creare l'archivio %s: %s", export->path, strerror(errno));
+        return 1;
+    }
+
+    a = archive_write_new();
+    set_export_filter(a, export->compression);
+    archive_write_set_format_pax_restricted(a);     // Note 1
+    // Blocchi grandi: meno scritture sulla chiavetta; l'ultimo blocco non viene riempito
+    archive_write_set_bytes_per_block(a, EXPORT_BLOCK_SIZE);
+    archive_write_set_bytes_in_last_block(a, 1);
+    if (archive_write_open_fd(a, fd) != ARCHIVE_OK) {
+        log_error("Errore nell'aprire l'archivio: %s", archive_error_string(a));
+        archive_write_free(a);
+        close(fd);
+        return 1;
+    }
+    entry = archive_entry_new();     // Note 2
+
+    snprintf(filename, sizeof(filename), "%s", BASENAME(DEFAULT_PATH_FILE_DATA_VERSION));
+    res |= add_entry_from_data(a, entry, (uint8_t *)version, strlen(version), filename, export);
+
+    snprintf(filename, sizeof(filename), "%s/%s", BASENAME(DEFAULT_PROGRAMS_PATH), PROGRAM_DB_FILE_NAME);
+    res |= add_entry_from_path(a, entry, export->program_db, filename, export);
+
+    snprintf(filename, sizeof(filename), "%s/%s", BASENAME(DEFAULT_PARAMS_PATH), BASENAME(DEFAULT_PATH_FILE_PARMAC));
+    res |= add_entry_from_path(a, entry, export->parmac, filename, export);
+
+    archive_entry_free(entry);
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        log_warn("Errore nella chiusura dell'archivio: %s", archive_error_string(a));
+        res = 1;
+    }
+    archive_write_free(a);
+
+    if (fsync(fd) < 0) {
+        log_warn("Errore nella sincronizzazione di %s: %s", export->path, strerror(errno));
+        res = 1;
+    }
+    close(fd);
+
+    if (export->cancelled) {
+        // Un archivio incompleto non deve comparire tra quelli importabili
+        unlink(export->path);
+        log_info("Esportazione di %s annullata", export->path);
+        return 1;
+    }
+
+    log_info("Esportati %zu byte in %s in %lu ms", export->total, export->path, time_interval(start, get_millis()));
+    return res;
+}
+
+
+static void set_export_filter(struct archive *a, storage_compression_t compression) {
+    switch (compression) {
+        case STORAGE_COMPRESSION_NONE:
+            archive_write_add_filter_none(a);
+            return;
+
+        case STORAGE_COMPRESSION_ZSTD:
+#if ARCHIVE_VERSION_NUMBER >= 3003003
+            if (archive_write_add_filter_zstd(a) == ARCHIVE_OK) {
+                archive_write_set_filter_option(a, "zstd", "compression-level", "1");
+                return;
+            }
+#endif
+            log_warn("Compressione zstd non disponibile, uso gzip");
+            // fall through
+
+        case STORAGE_COMPRESSION_GZIP_FAST:
+        default:
+            // I dati sono pochi: il livello piu' veloce comprime quasi quanto quello predefinito
+            archive_write_add_filter_gzip(a);
+            archive_write_set_filter_option(a, "gzip", "compression-level", "1");
+            return;
+    }
+}
+
+
+static int export_progress(export_t *export, size_t len) {
+    export->done += len;
+    if (export->progress != NULL && export->progress(export->done, export->total, export->progress_arg)) {
+        export->cancelled = 1;
+    }
+    return export->cancelled;
+}
+
+
+static int add_entry_from_data(struct archive *a, struct archive_entry *entry, uint8_t *data, size_t len, char *name,
+                               export_t *export) {
+    int res = 0;
+
+    if (export->cancelled) {
+        return 1;
+    }
+
     archive_entry_set_pathname(entry, name);
     archive_entry_set_size(entry, len);
     archive_entry_set_filetype(entry, AE_IFREG);
     archive_entry_set_perm(entry, 0644);
     if (archive_write_header(a, entry) != ARCHIVE_OK) {
         log_warn("Errore nella creazione dell'archivio: %s", archive_error_string(a));
-        return;
+        return 1;
     }
 
-    if (archive_write_data(a, data, len) < 0)
+    if (archive_write_data(a, data, len) < 0) {
         log_warn("Errore nella scrittura dell'archivio: %s", archive_error_string(a));
+        res = 1;
+    }
+    res |= export_progress(export, len);
 
     archive_entry_clear(entry);
+    return res;
 }
 
 
+static int add_entry_from_path(struct archive *a, struct archive_entry *entry, const char *path, char *name,
+                               export_t *export) {
+    // disk_op esegue una sola esportazione alla volta (risorsa chiavetta)
+    static uint8_t buffer[EXPORT_BLOCK_SIZE] __attribute__((aligned(4096)));
+    ssize_t        len;
+    int            fd, res = 0;
+    struct stat    st;
 
-static void add_entry_from_path(struct archive *a, struct archive_entry *entry, char *path, char *name) {
-    char        buff[2048];
-    int         len, fd;
-    struct stat st;
+    if (export->cancelled) {
+        return 1;
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        log_warn("Non riesco ad aprire il file %s:%s", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
 
-    stat(path, &st);
     archive_entry_set_pathname(entry, name);
     archive_entry_set_size(entry, st.st_size);
     archive_entry_set_filetype(entry, AE_IFREG);
     archive_entry_set_perm(entry, 0644);
     if (archive_write_header(a, entry) != ARCHIVE_OK) {
         log_warn("Errore nella creazione dell'archivio: %s", archive_error_string(a));
-        return;
-    }
-
-    if ((fd = open(path, O_RDONLY)) < 0) {
-        log_warn("Non riesco ad aprire il file %s:%s", path, strerror(errno));
-        return;
+        close(fd);
+        return 1;
     }
 
-    len = read(fd, buff, sizeof(buff));
-    while (len > 0) {
-        if (archive_write_data(a, buff, len) < 0) {
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (archive_write_data(a, buffer, len) < 0) {
             log_warn("Errore nella scrittura dell'archivio: %s", archive_error_string(a));
+            res = 1;
+            break;
+        }
+        if (export_progress(export, len)) {
+            res = 1;
             break;
         }
-        len = read(fd, buff, sizeof(buff));
     }
     close(fd);
     archive_entry_clear(entry);
+    return res;
 }
 
 
-static int copy_archive(struct archive *ar, struct archive *aw) {
-    int         r;
-    const void *buff;
-    size_t      size;
-#if ARCHIVE_VERSION_NUMBER >= 3000000
-    int64_t offset;
-#else
-    off_t offset;
-#endif
+void storage_create_dir(char *name) {
+    remount_rw();
+    DIR_CHECK(mkdir(name, 0766));
+    remount_ro();
+}
 
-    for (;;) {
-        r = archive_read_data_block(ar, &buff, &size, &offset);
-        if (r == ARCHIVE_EOF)
-            return (ARCHIVE_OK);
-        if (r != ARCHIVE_OK)
-            return (r);
-        r = archive_write_data_block(aw, buff, size, offset);
-        if (r != ARCHIVE_OK) {
-            printf("archive_write_data_block(): %s", archive_error_string(aw));
-            return (r);
+
+static int write_all(int fd, const uint8_t *buffer, size_t len) {
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t res = write(fd, &buffer[written], len - written);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
+        written += res;
     }
+
+    return 0;
 }
 
 
-void storage_create_dir(char *name) {
-    remount_rw();
-    DIR_CHECK(mkdir(name, 0766));
-    remount_ro();
+/*
+ * CRC del file; fallisce se non ha la dimensione attesa
+ */
+static int file_crc(const char *path, size_t size, uint32_t *crc) {
+    uint8_t     buffer[4096];
+    struct stat st;
+    ssize_t     len;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != size) {
+        close(fd);
+        return -1;
+    }
+
+    *crc = CRC32_INIT;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        *crc = crc32_update(*crc, buffer, len);
+    }
+    close(fd);
+
+    return len < 0 ? -1 : 0;
 }
 
 
-static int copy_file(const char *to, const char *from) {
-    int     fd_to, fd_from;
-    char    buf[4096];
-    ssize_t nread;
+/*
+ * Il manifest e' un file di testo accanto al firmware:
+ *   size=<byte>
+ *   crc32=<esadecimale>
+ */
+static int read_firmware_manifest(const char *path, firmware_manifest_t *manifest) {
+    char          line[64];
+    unsigned long size = 0, crc = 0;
+    int           found_size = 0, found_crc = 0;
 
-    fd_from = open(from, O_RDONLY);
-    if (fd_from < 0) {
-        log_warn("Non sono riuscito ad aprire %s: %s", from, strerror(errno));
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
         return -1;
     }
 
-    fd_to = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd_to < 0) {
-        log_warn("Non sono riuscito ad aprire %s: %s", to, strerror(errno));
-        close(fd_from);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "size=%lu", &size) == 1) {
+            found_size = 1;
+        } else if (sscanf(line, "crc32=%lx", &crc) == 1) {
+            found_crc = 1;
+        }
+    }
+    fclose(fp);
+
+    if (!found_size || !found_crc) {
         return -1;
     }
 
-    while ((nread = read(fd_from, buf, sizeof buf)) > 0) {
-        char   *out_ptr = buf;
-        ssize_t nwritten;
+    manifest->size = size;
+    manifest->crc  = (uint32_t)crc;
+    return 0;
+}
 
-        do {
-            nwritten = write(fd_to, out_ptr, nread);
 
-            if (nwritten >= 0) {
-                nread -= nwritten;
-                out_ptr += nwritten;
-            } else {
-                close(fd_from);
-                close(fd_to);
-                return -1;
-            }
-        } while (nread > 0);
+static int stage_begin(firmware_stage_t *stage, const char *path, size_t total, storage_progress_cb_t progress,
+                       void *arg) {
+    stage->path         = path;
+    stage->crc          = CRC32_INIT;
+    stage->done         = 0;
+    stage->total        = total;
+    stage->start        = get_millis();
+    stage->progress     = progress;
+    stage->progress_arg = arg;
+
+#ifndef TARGET_DEBUG
+    if (mount("/dev/root", "/", "ext2", MS_REMOUNT, NULL) < 0) {
+        log_error("Errore nel montare la root: %s (%i)", strerror(errno), errno);
+        return -1;
     }
+#endif
 
-    close(fd_to);
-    close(fd_from);
+    snprintf(stage->tmp_path, sizeof(stage->tmp_path), "%s%s", path, TRANSACTION_TMP_SUFFIX);
+    stage->fd = open(stage->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (stage->fd < 0) {
+        log_warn("Non sono riuscito ad aprire %s: %s", stage->tmp_path, strerror(errno));
+#ifndef TARGET_DEBUG
+        mount("/dev/root", "/", "ext2", MS_REMOUNT | MS_RDONLY, NULL);
+#endif
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int stage_write(firmware_stage_t *stage, const uint8_t *data, size_t len) {
+    if (write_all(stage->fd, data, len) < 0) {
+        log_error("Errore nella scrittura di %s: %s", stage->tmp_path, strerror(errno));
+        return -1;
+    }
+
+    stage->crc = crc32_update(stage->crc, data, len);
+    stage->done += len;
+    if (stage->progress != NULL && stage->progress(stage->done, stage->total, stage->progress_arg)) {
+        log_info("Aggiornamento del firmware annullato");
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Sincronizza e verifica il file temporaneo, poi lo rinomina al posto di quello finale (o lo elimina in caso di errore)
+ */
+static int stage_end(firmware_stage_t *stage, int res, const firmware_manifest_t *expected) {
+    uint32_t crc = CRC32_INIT;
+
+    if (res == 0 && fsync(stage->fd) < 0) {
+        log_error("Errore nella sincronizzazione di %s: %s", stage->tmp_path, strerror(errno));
+        res = -1;
+    }
+    // La verifica deve leggere il disco, non la cache
+    posix_fadvise(stage->fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(stage->fd);
+
+    if (res == 0 && (stage->done != expected->size || stage->crc != expected->crc)) {
+        log_error("Firmware errato: %zu byte con CRC %08X invece di %zu con CRC %08X", stage->done, stage->crc,
+                  expected->size, expected->crc);
+        res = -1;
+    }
+
+    if (res == 0 && (file_crc(stage->tmp_path, expected->size, &crc) < 0 || crc != expected->crc)) {
+        log_error("Il firmware scritto in %s non corrisponde: CRC %08X invece di %08X", stage->tmp_path, crc,
+                  expected->crc);
+        res = -1;
+    }
+
+    if (res == 0 && rename(stage->tmp_path, stage->path) < 0) {
+        log_error("Non sono riuscito a rinominare %s: %s", stage->tmp_path, strerror(errno));
+        res = -1;
+    }
+
+    if (res != 0) {
+        unlink(stage->tmp_path);
+    }
+
+    // Il ritorno in sola lettura rende persistente anche la rinomina
+#ifndef TARGET_DEBUG
+    if (mount("/dev/root", "/", "ext2", MS_REMOUNT | MS_RDONLY, NULL) < 0)
+        log_warn("Errore nel rimontare la root: %s (%i)", strerror(errno), errno);
+#endif
+
+    if (res == 0) {
+        log_info("Firmware di %zu byte (CRC %08X) scritto in %lu ms", stage->done, stage->crc,
+                 time_interval(stage->start, get_millis()));
+    }
+    return res;
+}
+
+
+static int read_exactly(struct archive *a, uint8_t *buffer, size_t len) {
+    size_t total = 0;
+
+    while (total < len) {
+        ssize_t r = archive_read_data(a, &buffer[total], len - total);
+        if (r <= 0) {
+            return -1;
+        }
+        total += r;
+    }
 
     return 0;
 }
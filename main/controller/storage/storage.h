@@ -2,6 +2,8 @@
 #define STORAGE_H_INCLUDED
 
 
+#include <stdint.h>
+#include <sys/types.h>
 #include "model/model.h"
 
 
@@ -11,25 +13,63 @@ typedef struct {
 } storage_program_list_t;
 
 
+typedef enum {
+    STORAGE_COMPRESSION_NONE = 0,
+    STORAGE_COMPRESSION_GZIP_FAST,
+    STORAGE_COMPRESSION_ZSTD,
+} storage_compression_t;
+
+
+// Un valore diverso da 0 interrompe l'operazione
+typedef int (*storage_progress_cb_t)(size_t done, size_t total, void *arg);
+
+
+// Lettura sequenziale di un file a blocchi, come fread/ferror
+typedef struct {
+    int    fd;
+    int    error;
+    size_t size;
+    size_t offset;
+} storage_stream_t;
+
+
 int    storage_save_parmac(char *path, parmac_t *parmac);
 int    storage_load_parmac(char *path, parmac_t *parmac);
 int    storage_load_saved_programs(const char *path, storage_program_list_t *pmodel);
+int    storage_load_program(const char *path, dryer_program_t *p);
 int    storage_update_program_index(const char *path, name_t *names, size_t len);
 int    storage_update_program(const char *path, dryer_program_t *p);
+int    storage_save_programs(const char *path, int update_index, name_t *names, size_t num_names,
+                             dryer_program_t *programs, size_t num_programs);
 void   storage_remove_program(char *path, char *name);
-char  *storage_read_file(char *name);
+int    storage_stream_open(storage_stream_t *stream, const char *path);
+size_t storage_stream_read(storage_stream_t *stream, void *buffer, size_t len);
+void   storage_stream_close(storage_stream_t *stream);
 size_t storage_get_file_size(const char *path);
 void   storage_clear_file(const char *path);
+int    storage_pwrite_all(int fd, const uint8_t *buffer, size_t len, off_t offset);
+int    storage_sync_dir(const char *path);
 char   storage_write_file(char *path, char *content, size_t len);
 char   storage_is_drive_plugged(void);
 int    storage_mount_drive(void);
 void   storage_unmount_drive(void);
-int    storage_list_saved_machines(char *location, name_t **names);
-int    storage_save_current_machine_config(const char *destination, const char *name);
-int    storage_load_current_machine_config(const char *location, const char *name);
-int    storage_read_archive_data_version(const char *location, const char *name);
+int    storage_read_archive_version(const char *path);
+int    storage_save_current_machine_config(const char *destination, const char *name, storage_compression_t compression,
+                                           storage_progress_cb_t progress, void *arg);
+int    storage_import_machine_config(const char *location, const char *name);
 int    storage_is_file(const char *path);
 void   storage_create_dir(char *name);
-int    storage_update_temporary_firmware(char *app_path, char *temporary_path);
+int    storage_update_temporary_firmware(const char *app_path, const char *temporary_path,
+                                         storage_progress_cb_t progress, void *arg);
+int    storage_apply_firmware_delta(const char *delta_path, const char *temporary_path, storage_progress_cb_t progress,
+                                    void *arg);
+void   storage_transaction_begin(void);
+int    storage_transaction_write(const char *path, const void *data, size_t len);
+int    storage_transaction_write_stream(const char *path, storage_stream_t *source);
+int    storage_transaction_commit(void);
+
+#ifdef TARGET_DEBUG
+int storage_benchmark_export(const char *destination);
+#endif
 
 #endif
@@ -1,7 +1,6 @@
 #include <sys/stat.h>
-#include <assert.h>
+#include <stdlib.h>
 #include <unistd.h>
-#include <pthread.h>
 
 #include "lvgl.h"
 #include "sdl/sdl.h"
@@ -11,31 +10,43 @@
 #include "model/model.h"
 #include "controller/controller.h"
 #include "controller/gui.h"
+#include "controller/storage/storage.h"
 #include "config/app_conf.h"
 #include "utils/system_time.h"
-#include "log.h"
-
-
-static void log_file_init(void);
-static void log_lock(void *arg, int op);
-
-
-static pthread_mutex_t lock;
+#include "utils/boot_timeline.h"
+#include "utils/async_log.h"
 
 
 int main(int argc, char *argv[]) {
     static_model_updater_t model_updater_buffer;
     model_t                model;
     model_updater_t        model_updater = model_updater_init(&model, &model_updater_buffer);
+    int                    first_frame   = 1;
 
+    boot_timeline_init();
     log_set_level(CONFIG_LOG_LEVEL);
-    log_file_init();
+    async_log_init(LOGFILE);
+    // Ad esempio DS2021_LOG_LEVELS="*=info,machine=debug"
+    if (getenv("DS2021_LOG_LEVELS") != NULL) {
+        async_log_configure(getenv("DS2021_LOG_LEVELS"));
+    }
 
     log_info("App version %s, %s", SOFTWARE_VERSION, SOFTWARE_BUILD_DATE);
 
+#ifdef TARGET_DEBUG
+    // Vedi tools/bench_export.sh
+    if (getenv("DS2021_BENCHMARK_EXPORT") != NULL) {
+        return storage_benchmark_export(getenv("DS2021_BENCHMARK_EXPORT"));
+    }
+    if (getenv("DS2021_BENCHMARK_LOG") != NULL) {
+        return async_log_benchmark(strtoul(getenv("DS2021_BENCHMARK_LOG"), NULL, 10));
+    }
+#endif
+
     model_init(&model);
 
     lv_init();
+    boot_timeline_mark("lvgl");
 #if USE_SDL
     sdl_init();
     view_init(model_updater, controller_manage_message, sdl_display_flush, sdl_mouse_read);
@@ -45,11 +56,17 @@ int main(int argc, char *argv[]) {
     evdev_init();
     view_init(model_updater, controller_manage_message, fbdev_flush, evdev_read);
 #endif
+    boot_timeline_mark("display");
 
     controller_init(&model);
 
     for (;;) {
         controller_gui_manage(&model);
+        if (first_frame) {
+            // Il primo giro di lvgl disegna la pagina di splash
+            boot_timeline_mark("primo frame");
+            first_frame = 0;
+        }
         controller_manage(&model);
 
         usleep(5 * 1000);
@@ -57,18 +74,3 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
-
-
-static void log_file_init(void) {
-    assert(pthread_mutex_init(&lock, NULL) == 0);
-    log_set_lock(log_lock);
-    log_set_udata(&lock);
-
-    log_set_fp(fopen(LOGFILE, "a+"));
-    log_set_fileinfo(0);
-}
-
-
-static void log_lock(void *arg, int op) {
-    op ? pthread_mutex_lock(arg) : pthread_mutex_unlock(arg);
-}
@@ -0,0 +1,66 @@
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "alarm_event.h"
+#include "gel/timer/timecheck.h"
+#include "utils/system_time.h"
+
+
+void alarm_event_queue_init(alarm_event_queue_t *queue) {
+    assert(queue != NULL);
+    memset(queue, 0, sizeof(alarm_event_queue_t));
+}
+
+
+/*
+ * Registra un evento per ogni bit cambiato rispetto all'ultima lettura del registro allarmi
+ */
+void alarm_event_queue_update(alarm_event_queue_t *queue, uint16_t alarms, uint16_t program_number, uint16_t step) {
+    assert(queue != NULL);
+
+    uint16_t changed = alarms ^ queue->alarms;
+    queue->alarms    = alarms;
+    if (changed == 0) {
+        return;
+    }
+
+    uint32_t now = (uint32_t)time(NULL);
+    for (size_t i = 0; i < ALARM_EVENT_CODES; i++) {
+        if ((changed & (1 << i)) == 0) {
+            continue;
+        }
+
+        // Non succede finche' il controller svuota la coda a meta'
+        if (queue->count == ALARM_EVENT_PENDING) {
+            break;
+        } else if (queue->count == 0) {
+            queue->first_ts = get_millis();
+        }
+
+        alarm_event_t *event  = &queue->events[queue->count++];
+        event->timestamp      = now;
+        event->code           = i;
+        event->flags          = (alarms & (1 << i)) ? ALARM_EVENT_FLAG_RAISED : 0;
+        event->program_number = program_number;
+        event->step           = step;
+    }
+}
+
+
+/*
+ * Copia e rimuove gli eventi in attesa se il piu' vecchio aspetta da almeno `delay` ms o se la coda e' piena a meta';
+ * ritorna il numero di eventi copiati
+ */
+size_t alarm_event_queue_take(alarm_event_queue_t *queue, alarm_event_t *events, unsigned long delay) {
+    assert(queue != NULL);
+
+    if (queue->count == 0 ||
+        (queue->count < ALARM_EVENT_PENDING / 2 && !is_expired(queue->first_ts, get_millis(), delay))) {
+        return 0;
+    }
+
+    size_t count = queue->count;
+    memcpy(events, queue->events, sizeof(alarm_event_t) * count);
+    queue->count = 0;
+    return count;
+}
@@ -0,0 +1,51 @@
+#ifndef ALARM_EVENT_H_INCLUDED
+#define ALARM_EVENT_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define ALARM_EVENT_CODES       16     // Un codice per ciascun bit del registro allarmi
+#define ALARM_EVENT_PENDING     32
+#define ALARM_EVENT_NO_PROGRAM  0xFFFF
+#define ALARM_EVENT_FLAG_RAISED 0x01     // Attivazione; senza, rientro dell'allarme
+#define ALARM_HISTORY_QUERY_MAX 64
+
+
+typedef struct {
+    uint32_t timestamp;     // s dal 1970
+    uint16_t code;
+    uint16_t flags;
+    uint16_t program_number;
+    uint16_t step;
+} alarm_event_t;
+
+
+/*
+ * Fronti degli allarmi non ancora scritti sul disco, che vengono registrati a gruppi
+ */
+typedef struct {
+    uint16_t      alarms;
+    size_t        count;
+    unsigned long first_ts;     // Fronte piu' vecchio in attesa, ms da get_millis
+    alarm_event_t events[ALARM_EVENT_PENDING];
+} alarm_event_queue_t;
+
+
+/*
+ * Risultato di una lettura dello storico allarmi
+ */
+typedef struct {
+    uint32_t      counts[ALARM_EVENT_CODES];     // Attivazioni nell'intervallo, dai contatori giornalieri
+    size_t        count;
+    alarm_event_t events[ALARM_HISTORY_QUERY_MAX];     // Dal piu' recente
+} alarm_history_t;
+
+
+void   alarm_event_queue_init(alarm_event_queue_t *queue);
+void   alarm_event_queue_update(alarm_event_queue_t *queue, uint16_t alarms, uint16_t program_number, uint16_t step);
+size_t alarm_event_queue_take(alarm_event_queue_t *queue, alarm_event_t *events, unsigned long delay);
+
+
+#endif
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cycle_record.h"
+#include "gel/timer/timecheck.h"
+#include "utils/system_time.h"
+
+
+static void close_step(cycle_tracker_t *tracker);
+
+
+void cycle_tracker_start(cycle_tracker_t *tracker, size_t program_number, const char *name, size_t num_steps,
+                         size_t step, int resumed) {
+    assert(tracker != NULL);
+
+    memset(tracker, 0, sizeof(cycle_tracker_t));
+    tracker->active                = 1;
+    tracker->step                  = step;
+    tracker->step_ts               = get_millis();
+    tracker->record.start          = (uint32_t)time(NULL);
+    tracker->record.program_number = program_number;
+    tracker->record.num_steps      = num_steps;
+    tracker->record.flags          = resumed ? CYCLE_RECORD_FLAG_RESUMED : 0;
+    snprintf(tracker->record.program_name, sizeof(name_t), "%s", name);
+}
+
+
+void cycle_tracker_step(cycle_tracker_t *tracker, size_t step) {
+    assert(tracker != NULL);
+    if (!tracker->active) {
+        return;
+    }
+
+    close_step(tracker);
+    tracker->step    = step;
+    tracker->step_ts = get_millis();
+}
+
+
+void cycle_tracker_sample(cycle_tracker_t *tracker, int temperature, int humidity) {
+    assert(tracker != NULL);
+    if (!tracker->active) {
+        return;
+    }
+
+    cycle_record_t *record = &tracker->record;
+    if (tracker->num_samples == 0) {
+        record->min_temperature = record->max_temperature = temperature;
+        record->min_humidity = record->max_humidity = humidity;
+    } else {
+        record->min_temperature = temperature < record->min_temperature ? temperature : record->min_temperature;
+        record->max_temperature = temperature > record->max_temperature ? temperature : record->max_temperature;
+        record->min_humidity    = humidity < record->min_humidity ? humidity : record->min_humidity;
+        record->max_humidity    = humidity > record->max_humidity ? humidity : record->max_humidity;
+    }
+
+    tracker->num_samples++;
+    tracker->temperature_sum += temperature;
+    tracker->humidity_sum += humidity;
+}
+
+
+void cycle_tracker_alarms(cycle_tracker_t *tracker, uint16_t alarms) {
+    assert(tracker != NULL);
+    if (!tracker->active) {
+        return;
+    }
+
+    // Conta solo gli allarmi che si sono appena attivati
+    uint16_t raised = alarms & ~tracker->alarms;
+    for (size_t i = 0; i < sizeof(raised) * 8; i++) {
+        if (raised & (1 << i)) {
+            tracker->record.num_alarms++;
+        }
+    }
+    tracker->record.alarms |= alarms;
+    tracker->alarms = alarms;
+}
+
+
+/*
+ * Chiude il ciclo in corso; ritorna 1 e lo copia in `record` se c'era un ciclo da registrare
+ */
+int cycle_tracker_finish(cycle_tracker_t *tracker, cycle_stop_reason_t reason, cycle_record_t *record) {
+    assert(tracker != NULL);
+    if (!tracker->active) {
+        return 0;
+    }
+
+    close_step(tracker);
+    tracker->active             = 0;
+    tracker->record.end         = (uint32_t)time(NULL);
+    tracker->record.stop_reason = reason;
+    if (tracker->num_samples > 0) {
+        tracker->record.avg_temperature = tracker->temperature_sum / (int32_t)tracker->num_samples;
+        tracker->record.avg_humidity    = tracker->humidity_sum / (int32_t)tracker->num_samples;
+    }
+
+    *record = tracker->record;
+    return 1;
+}
+
+
+/*
+ *  Static functions
+ */
+
+static void close_step(cycle_tracker_t *tracker) {
+    if (tracker->step < MAX_STEPS) {
+        tracker->record.step_durations[tracker->step] += time_interval(tracker->step_ts, get_millis()) / 1000UL;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef CYCLE_RECORD_H_INCLUDED
+#define CYCLE_RECORD_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "program.h"
+
+
+#define CYCLE_RECORD_FLAG_RESUMED 0x01     // Ripreso dopo un riavvio: manca la parte iniziale
+
+
+typedef enum {
+    CYCLE_STOP_REASON_COMPLETED = 0,
+    CYCLE_STOP_REASON_USER,
+    CYCLE_STOP_REASON_AUTOSTOP,
+    CYCLE_STOP_REASON_ALARM,
+    CYCLE_STOP_REASON_INTERRUPTED,     // Fermato dalla macchina senza allarmi
+    NUM_CYCLE_STOP_REASONS,
+} cycle_stop_reason_t;
+
+
+/*
+ * Consuntivo di un ciclo di asciugatura. Gli orari sono in secondi dal 1970, le durate in secondi (pause comprese)
+ */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint16_t program_number;
+    name_t   program_name;
+    uint16_t flags;
+    uint16_t stop_reason;
+
+    uint16_t num_steps;
+    uint16_t step_durations[MAX_STEPS];
+
+    int16_t min_temperature;
+    int16_t max_temperature;
+    int16_t avg_temperature;
+    int16_t min_humidity;
+    int16_t max_humidity;
+    int16_t avg_humidity;
+
+    uint16_t alarms;         // Maschera degli allarmi comparsi durante il ciclo
+    uint16_t num_alarms;     // Numero di attivazioni
+} cycle_record_t;
+
+
+// Raccolta dei dati del ciclo in corso
+typedef struct {
+    int            active;
+    cycle_record_t record;
+    size_t         step;
+    unsigned long  step_ts;
+    uint16_t       alarms;
+    uint32_t       num_samples;
+    int32_t        temperature_sum;
+    int32_t        humidity_sum;
+} cycle_tracker_t;
+
+
+void cycle_tracker_start(cycle_tracker_t *tracker, size_t program_number, const char *name, size_t num_steps,
+                         size_t step, int resumed);
+void cycle_tracker_step(cycle_tracker_t *tracker, size_t step);
+void cycle_tracker_sample(cycle_tracker_t *tracker, int temperature, int humidity);
+void cycle_tracker_alarms(cycle_tracker_t *tracker, uint16_t alarms);
+int  cycle_tracker_finish(cycle_tracker_t *tracker, cycle_stop_reason_t reason, cycle_record_t *record);
+
+
+#endif
@@ -0,0 +1,250 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "eta.h"
+#include "gel/timer/timecheck.h"
+#include "utils/system_time.h"
+
+
+#define MIN_HEATING_TIME 60000UL     // ms; riscaldamenti piu' brevi non bastano a misurare la velocita'
+
+
+static eta_program_t *find_program(eta_t *eta, const char *name);
+static int            is_waiting(const parameters_step_t *step, uint16_t remaining, int temperature);
+static uint32_t       heating_time(const eta_t *eta, int delta);
+static uint32_t       predict_tail(const eta_t *eta, const dryer_program_t *program, size_t step, int temperature);
+static uint16_t       average(uint16_t average, uint32_t value, uint8_t samples);
+
+
+void eta_init(eta_t *eta) {
+    assert(eta != NULL);
+    memset(eta, 0, sizeof(eta_t));
+    eta->heating_rate = ETA_DEFAULT_HEATING_RATE;
+}
+
+
+/*
+ * Impara dai cicli completati; un programma modificato nel numero di step ricomincia da capo.
+ * I programmi usati meno di recente lasciano il posto ai nuovi
+ */
+void eta_learn(eta_t *eta, const cycle_record_t *record) {
+    assert(eta != NULL && record != NULL);
+
+    if (record->stop_reason != CYCLE_STOP_REASON_COMPLETED || (record->flags & CYCLE_RECORD_FLAG_RESUMED) ||
+        record->num_steps == 0 || record->num_steps > MAX_STEPS) {
+        return;
+    }
+
+    eta_program_t *entry = find_program(eta, record->program_name);
+    if (entry == NULL) {
+        entry = &eta->programs[0];
+        for (size_t i = 1; i < ETA_PROGRAMS; i++) {
+            if (eta->programs[i].last_used < entry->last_used) {
+                entry = &eta->programs[i];
+            }
+        }
+        if (entry == eta->current) {
+            eta->current = NULL;
+        }
+        memset(entry, 0, sizeof(eta_program_t));
+        snprintf(entry->name, sizeof(name_t), "%s", record->program_name);
+    }
+
+    if (entry->num_steps != record->num_steps) {
+        memset(entry->durations, 0, sizeof(entry->durations));
+        memset(entry->samples, 0, sizeof(entry->samples));
+        entry->num_steps = record->num_steps;
+    }
+
+    for (size_t i = 0; i < record->num_steps; i++) {
+        entry->durations[i] = average(entry->durations[i], record->step_durations[i], entry->samples[i]);
+        if (entry->samples[i] < UINT8_MAX) {
+            entry->samples[i]++;
+        }
+    }
+    entry->last_used = ++eta->clock;
+}
+
+
+void eta_begin(eta_t *eta, const dryer_program_t *program, const char *name, size_t step, int temperature) {
+    assert(eta != NULL && program != NULL);
+
+    eta->current = find_program(eta, name);
+    if (eta->current != NULL) {
+        eta->current->last_used = ++eta->clock;
+    }
+    eta_step(eta, program, step, temperature);
+}
+
+
+/*
+ * Gli step successivi vengono stimati una volta sola, al cambio di step
+ */
+void eta_step(eta_t *eta, const dryer_program_t *program, size_t step, int temperature) {
+    assert(eta != NULL && program != NULL);
+
+    eta->step    = step;
+    eta->step_ts = get_millis();
+    eta->heating = 0;
+    eta->tail    = predict_tail(eta, program, step, temperature);
+}
+
+
+/*
+ * Va chiamata a ogni lettura dei sensori: misura la velocita' di riscaldamento durante l'attesa della temperatura
+ */
+void eta_update(eta_t *eta, const dryer_program_t *program, uint16_t remaining, int temperature) {
+    assert(eta != NULL && program != NULL);
+
+    if (eta->step >= program->num_steps) {
+        return;
+    }
+
+    int waiting = is_waiting(&program->steps[eta->step], remaining, temperature);
+    if (waiting && !eta->heating) {
+        eta->heating       = 1;
+        eta->heating_ts    = get_millis();
+        eta->heating_start = (int16_t)temperature;
+    } else if (!waiting && eta->heating) {
+        eta->heating          = 0;
+        unsigned long elapsed = time_interval(eta->heating_ts, get_millis());
+
+        if (elapsed >= MIN_HEATING_TIME && temperature > eta->heating_start) {
+            uint32_t rate = (uint32_t)(temperature - eta->heating_start) * 10UL * 60000UL / elapsed;
+            rate          = rate > 0 ? (rate < UINT16_MAX ? rate : UINT16_MAX) : 1;
+
+            eta->heating_rate = average(eta->heating_rate, rate, 1);
+            if (eta->current != NULL) {
+                eta->current->heating_rate =
+                    average(eta->current->heating_rate, rate, eta->current->heating_rate > 0 ? 1 : 0);
+            }
+        }
+    }
+}
+
+
+/*
+ * Tempo rimanente dell'intero programma, in s: costo costante, adatto a un aggiornamento periodico
+ */
+uint32_t eta_remaining(const eta_t *eta, const dryer_program_t *program, uint16_t remaining, int temperature) {
+    assert(eta != NULL && program != NULL);
+
+    if (eta->step >= program->num_steps) {
+        return remaining;
+    }
+
+    const parameters_step_t *step    = &program->steps[eta->step];
+    uint32_t                 current = remaining;
+
+    switch (step->type) {
+        case DRYER_PROGRAM_STEP_TYPE_DRYING:
+            // Il conto alla rovescia della macchina parte solo a temperatura raggiunta
+            if (is_waiting(step, remaining, temperature)) {
+                current += heating_time(eta, step->drying.temperature - temperature);
+            }
+            break;
+
+        case DRYER_PROGRAM_STEP_TYPE_UNFOLDING: {
+            // Lo step si ferma anche al numero massimo di cicli, spesso prima della durata massima
+            unsigned long elapsed = time_interval(eta->step_ts, get_millis()) / 1000UL;
+            if (eta->current != NULL && eta->current->num_steps == program->num_steps &&
+                eta->current->samples[eta->step] > 0 && eta->current->durations[eta->step] > elapsed) {
+                uint32_t learned = eta->current->durations[eta->step] - elapsed;
+                current          = learned < current ? learned : current;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return current + eta->tail;
+}
+
+
+/*
+ *  Static functions
+ */
+
+static eta_program_t *find_program(eta_t *eta, const char *name) {
+    for (size_t i = 0; i < ETA_PROGRAMS; i++) {
+        if (eta->programs[i].last_used > 0 && strcmp(eta->programs[i].name, name) == 0) {
+            return &eta->programs[i];
+        }
+    }
+    return NULL;
+}
+
+
+static int is_waiting(const parameters_step_t *step, uint16_t remaining, int temperature) {
+    return step->type == DRYER_PROGRAM_STEP_TYPE_DRYING && step->drying.enable_waiting_for_temperature &&
+           remaining >= step->drying.duration && temperature < step->drying.temperature;
+}
+
+
+static uint32_t heating_time(const eta_t *eta, int delta) {
+    uint16_t rate = eta->heating_rate;
+    if (eta->current != NULL && eta->current->heating_rate > 0) {
+        rate = eta->current->heating_rate;
+    }
+    return delta > 0 && rate > 0 ? (uint32_t)delta * 600UL / rate : 0;
+}
+
+
+static uint32_t predict_tail(const eta_t *eta, const dryer_program_t *program, size_t step, int temperature) {
+    const eta_program_t *learned = eta->current;
+    if (learned != NULL && learned->num_steps != program->num_steps) {
+        // Programma modificato dall'ultimo ciclo completato
+        learned = NULL;
+    }
+
+    uint32_t tail = 0;
+    if (step < program->num_steps && program->steps[step].type == DRYER_PROGRAM_STEP_TYPE_DRYING) {
+        temperature = program->steps[step].drying.temperature;
+    }
+
+    for (size_t i = step + 1; i < program->num_steps; i++) {
+        const parameters_step_t *s = &program->steps[i];
+
+        if (learned != NULL && learned->samples[i] > 0) {
+            tail += learned->durations[i];
+        } else {
+            switch (s->type) {
+                case DRYER_PROGRAM_STEP_TYPE_DRYING:
+                    tail += s->drying.duration;
+                    if (s->drying.enable_waiting_for_temperature) {
+                        tail += heating_time(eta, s->drying.temperature - temperature);
+                    }
+                    break;
+
+                case DRYER_PROGRAM_STEP_TYPE_COOLING:
+                    tail += s->cooling.duration;
+                    break;
+
+                case DRYER_PROGRAM_STEP_TYPE_UNFOLDING:
+                    tail += s->unfolding.max_duration;
+                    break;
+            }
+        }
+
+        // Temperatura di partenza dello step successivo
+        if (s->type == DRYER_PROGRAM_STEP_TYPE_DRYING) {
+            temperature = s->drying.temperature;
+        } else if (s->type == DRYER_PROGRAM_STEP_TYPE_COOLING && s->cooling.temperature < temperature) {
+            temperature = s->cooling.temperature;
+        }
+    }
+
+    return tail;
+}
+
+
+// Media mobile esponenziale con peso 1/4 per il nuovo valore; il primo campione vale per intero
+static uint16_t average(uint16_t average, uint32_t value, uint8_t samples) {
+    if (samples == 0) {
+        return (uint16_t)(value < UINT16_MAX ? value : UINT16_MAX);
+    }
+    int32_t result = (int32_t)average + ((int32_t)value - (int32_t)average) / 4;
+    return (uint16_t)(result < 0 ? 0 : (result > UINT16_MAX ? UINT16_MAX : result));
+}
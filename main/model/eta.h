@@ -0,0 +1,52 @@
+#ifndef ETA_H_INCLUDED
+#define ETA_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "program.h"
+#include "cycle_record.h"
+
+
+#define ETA_PROGRAMS             16
+#define ETA_DEFAULT_HEATING_RATE 20     // Decimi di grado al minuto, finche' non ne viene misurata una
+
+
+/*
+ * Durate effettive degli step di un programma, dai cicli completati
+ */
+typedef struct {
+    name_t   name;     // Nome del programma registrato nello storico
+    uint16_t num_steps;
+    uint16_t heating_rate;             // Decimi di grado al minuto, 0 se non ancora misurata
+    uint16_t durations[MAX_STEPS];     // s, media mobile
+    uint8_t  samples[MAX_STEPS];
+    uint32_t last_used;
+} eta_program_t;
+
+
+typedef struct {
+    eta_program_t programs[ETA_PROGRAMS];
+    uint32_t      clock;
+    uint16_t      heating_rate;
+
+    // Ciclo in corso
+    eta_program_t *current;
+    size_t         step;
+    unsigned long  step_ts;
+    uint32_t       tail;     // Durata prevista degli step successivi a quello in corso, s
+    int            heating;
+    unsigned long  heating_ts;
+    int16_t        heating_start;
+} eta_t;
+
+
+void     eta_init(eta_t *eta);
+void     eta_learn(eta_t *eta, const cycle_record_t *record);
+void     eta_begin(eta_t *eta, const dryer_program_t *program, const char *name, size_t step, int temperature);
+void     eta_step(eta_t *eta, const dryer_program_t *program, size_t step, int temperature);
+void     eta_update(eta_t *eta, const dryer_program_t *program, uint16_t remaining, int temperature);
+uint32_t eta_remaining(const eta_t *eta, const dryer_program_t *program, uint16_t remaining, int temperature);
+
+
+#endif
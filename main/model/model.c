@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <assert.h>
+#include <time.h>
 #include "model.h"
 #include "parmac.h"
 #include "gel/serializer/serializer.h"
@@ -8,9 +9,16 @@
 #include "utils/system_time.h"
 
 
+#define REMAINING_STALL_TIME        2000UL      // ms senza scatti prima di considerare fermo il conto alla rovescia
+#define REMAINING_MAX_EXTRAPOLATION 10000UL     // ms oltre l'ultima lettura in cui si continua a interpolare
+
+
 static char *new_unique_filename(model_t *pmodel, name_t filename, unsigned long seed);
 static int   name_intersection(name_t *as, int numa, name_t *bs, int numb);
+static void  begin_program(model_t *pmodel, size_t num, size_t step_num, int resumed);
+
 
+static timeseries_t timeseries;
 
 static const name_t default_program_names[NUM_LINGUE] = {
     "Programma ",
@@ -25,6 +33,11 @@ void model_init(model_t *pmodel) {
     pmodel->machine.communication_enabled = 1;
     pmodel->machine.state                 = MACHINE_STATE_STOPPED;
     pmodel->machine.reported_step_type    = 0;
+    pmodel->machine.remaining             = 0;
+    pmodel->machine.remaining_anchor      = 0;
+    pmodel->machine.remaining_anchor_ts   = 0;
+    pmodel->machine.remaining_ts          = 0;
+    pmodel->machine.remaining_counting    = 0;
 
     pmodel->configuration.parmac.lingua    = LINGUA_ITALIANO;
     pmodel->configuration.num_programs     = 0;
@@ -34,6 +47,13 @@ void model_init(model_t *pmodel) {
 
     pmodel->run.program_number = 0;
     pmodel->run.step_number    = 0;
+    pmodel->run.cycle.active   = 0;
+    alarm_event_queue_init(&pmodel->run.alarm_events);
+    stats_tracker_init(&pmodel->statistics);
+    eta_init(&pmodel->run.eta);
+
+    pmodel->timeseries = &timeseries;
+    timeseries_init(pmodel->timeseries, get_millis());
 
     pmodel->system.networks              = 0;
     pmodel->system.num_networks          = 0;
@@ -41,6 +61,10 @@ void model_init(model_t *pmodel) {
     pmodel->system.drive_machines        = NULL;
     pmodel->system.num_drive_machines    = 0;
     pmodel->system.firmware_update_ready = 0;
+    pmodel->system.program_loader        = NULL;
+    pmodel->system.boot_complete         = 0;
+
+    model_clear_input_edges(pmodel);
 
     parmac_init(pmodel);
 }
@@ -167,7 +191,8 @@ int model_parameter_set_value(parameter_handle_t *par, uint16_t value) {
 int model_pick_up_machine_state(model_t *pmodel, uint16_t state, uint16_t program_number, uint16_t step_number) {
     if (state != MACHINE_STATE_STOPPED) {
         dryer_program_t *p = model_get_program(pmodel, program_number);
-        if (p != NULL && step_number < p->num_steps) {
+        // Senza step il programma non si puo' riprendere: si ritenta quando arrivano
+        if (p != NULL && p->steps_loaded && step_number < p->num_steps) {
             model_resume_program(pmodel, program_number, step_number);
             pmodel->machine.state = state;
             return 1;
@@ -183,6 +208,11 @@ int model_pick_up_machine_state(model_t *pmodel, uint16_t state, uint16_t progra
 int model_update_flags(model_t *pmodel, uint16_t alarms, uint16_t flags) {
     assert(pmodel != NULL);
 
+    cycle_tracker_alarms(&pmodel->run.cycle, alarms);
+    alarm_event_queue_update(&pmodel->run.alarm_events, alarms,
+                             model_is_program_running(pmodel) ? pmodel->run.program_number : ALARM_EVENT_NO_PROGRAM,
+                             pmodel->run.step_number);
+
     if (pmodel->machine.function_flags != flags || pmodel->machine.alarms != alarms) {
         pmodel->machine.alarms         = alarms;
         pmodel->machine.function_flags = flags;
@@ -261,18 +291,12 @@ int model_is_machine_stopped(model_t *pmodel) {
 
 
 void model_start_program(model_t *pmodel, size_t num) {
-    model_resume_program(pmodel, num, 0);
+    begin_program(pmodel, num, 0, 0);
 }
 
 
 void model_resume_program(model_t *pmodel, size_t num, size_t step_num) {
-    assert(pmodel != NULL);
-    assert(num < pmodel->configuration.num_programs);
-    assert(pmodel->configuration.programs[num].num_steps > step_num);
-
-    pmodel->run.program        = pmodel->configuration.programs[num];
-    pmodel->run.program_number = num;
-    pmodel->run.step_number    = step_num;
+    begin_program(pmodel, num, step_num, 1);
 }
 
 
@@ -282,10 +306,61 @@ void model_stop_program(model_t *pmodel) {
 }
 
 
+/*
+ * Chiude la registrazione del ciclo in corso; ritorna 1 se c'e' un consuntivo da salvare in `record`
+ */
+int model_finish_cycle(model_t *pmodel, cycle_stop_reason_t reason, cycle_record_t *record) {
+    assert(pmodel != NULL);
+    stats_tracker_cycle_end(&pmodel->statistics);
+    if (cycle_tracker_finish(&pmodel->run.cycle, reason, record)) {
+        eta_learn(&pmodel->run.eta, record);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+int model_is_cycle_recording(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return pmodel->run.cycle.active;
+}
+
+
+/*
+ * Ciclo gia' registrato nello storico, per le stime del tempo rimanente
+ */
+void model_learn_cycle(model_t *pmodel, const cycle_record_t *record) {
+    assert(pmodel != NULL);
+    eta_learn(&pmodel->run.eta, record);
+}
+
+
+/*
+ * Stima del tempo rimanente dell'intero programma, in s
+ */
+uint32_t model_get_program_remaining(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return eta_remaining(&pmodel->run.eta, &pmodel->run.program, model_get_remaining(pmodel),
+                         pmodel->machine.actual_temperature);
+}
+
+
+/*
+ * Fronti degli allarmi da registrare nello storico; vedi alarm_event_queue_take
+ */
+size_t model_take_alarm_events(model_t *pmodel, alarm_event_t *events, unsigned long delay) {
+    assert(pmodel != NULL);
+    return alarm_event_queue_take(&pmodel->run.alarm_events, events, delay);
+}
+
+
 int model_next_step(model_t *pmodel) {
     assert(pmodel != NULL);
 
     pmodel->run.step_number++;
+    cycle_tracker_step(&pmodel->run.cycle, pmodel->run.step_number);
+    eta_step(&pmodel->run.eta, &pmodel->run.program, pmodel->run.step_number, pmodel->machine.actual_temperature);
     if (model_get_current_step(pmodel) == NULL) {
         return 0;
     } else {
@@ -338,15 +413,63 @@ int model_is_program_running(model_t *pmodel) {
 }
 
 
+/*
+ * La lettura e' in secondi interi: il riferimento per l'interpolazione si sposta solo quando il valore scatta, cosi'
+ * ogni scatto osservato corregge la deriva dell'orologio locale
+ */
 void model_set_remaining(model_t *pmodel, uint16_t remaining) {
     assert(pmodel != NULL);
-    pmodel->machine.remaining = remaining;
+    unsigned long now = get_millis();
+
+    if (remaining != pmodel->machine.remaining) {
+        // Un aumento o un salto sono una modifica del tempo o un cambio di step, non lo scorrere del tempo
+        unsigned long elapsed = time_interval(pmodel->machine.remaining_anchor_ts, now) / 1000UL;
+        unsigned long ticks   = (unsigned long)(pmodel->machine.remaining - remaining);
+
+        pmodel->machine.remaining_counting  = remaining < pmodel->machine.remaining && ticks <= elapsed + 2;
+        pmodel->machine.remaining_anchor    = remaining;
+        pmodel->machine.remaining_anchor_ts = now;
+    } else if (is_expired(pmodel->machine.remaining_anchor_ts, now, REMAINING_STALL_TIME)) {
+        // In attesa della temperatura, in pausa o fermo
+        pmodel->machine.remaining_counting = 0;
+    }
+
+    pmodel->machine.remaining    = remaining;
+    pmodel->machine.remaining_ts = now;
 }
 
 
+/*
+ * Tempo rimanente dello step, interpolato tra le letture; senza letture recenti resta sull'ultima
+ */
 uint16_t model_get_remaining(model_t *pmodel) {
     assert(pmodel != NULL);
-    return pmodel->machine.remaining;
+    unsigned long now       = get_millis();
+    uint16_t      remaining = pmodel->machine.remaining;
+
+    if (!pmodel->machine.remaining_counting ||
+        is_expired(pmodel->machine.remaining_ts, now, REMAINING_MAX_EXTRAPOLATION)) {
+        return remaining;
+    }
+
+    switch (pmodel->machine.state) {
+        case MACHINE_STATE_RUNNING:
+        case MACHINE_STATE_ACTIVE:
+            break;
+
+        case MACHINE_STATE_PAUSED:
+            // Il tempo scorre in pausa solo se la macchina e' configurata cosi'
+            if (pmodel->configuration.parmac.stop_tempo_ciclo) {
+                return remaining;
+            }
+            break;
+
+        default:
+            return remaining;
+    }
+
+    unsigned long elapsed = time_interval(pmodel->machine.remaining_anchor_ts, now) / 1000UL;
+    return elapsed < pmodel->machine.remaining_anchor ? (uint16_t)(pmodel->machine.remaining_anchor - elapsed) : 0;
 }
 
 
@@ -564,7 +687,7 @@ size_t model_get_num_programs(model_t *pmodel) {
 const char *model_get_program_name_in_language(model_t *pmodel, uint16_t language, size_t num) {
     assert(pmodel != NULL);
     if (num < model_get_num_programs(pmodel)) {
-        return model_get_program(pmodel, num)->nomi[language];
+        return pmodel->configuration.programs[num].nomi[language];
     } else {
         return "MISSING";
     }
@@ -610,8 +733,11 @@ dryer_program_t *model_create_new_program_from(model_t *pmodel, size_t src, size
     assert(pos <= model_get_num_programs(pmodel));
     assert(src < model_get_num_programs(pmodel));
 
-    // Copia il sorgente
+    // Copia il sorgente; senza step la copia sarebbe vuota, ma il loro caricamento e' appena stato richiesto
     dryer_program_t from = *model_get_program(pmodel, src);
+    if (!from.steps_loaded) {
+        return NULL;
+    }
     new_unique_filename(pmodel, from.filename, timestamp);
 
     // Aggiungi un programma in fondo
@@ -654,9 +780,93 @@ dryer_program_t *model_get_program(model_t *pmodel, size_t num) {
 
     if (num >= model_get_num_programs(pmodel)) {
         return NULL;
-    } else {
-        return &pmodel->configuration.programs[num];
     }
+
+    dryer_program_t *p = &pmodel->configuration.programs[num];
+    if (!p->steps_loaded && !p->steps_pending && pmodel->system.program_loader != NULL) {
+        // Fino all'arrivo degli step (model_set_program_steps) valgono solo nomi, numero di step e durata
+        p->steps_pending = 1;
+        pmodel->system.program_loader(pmodel, num, p);
+    }
+
+    return p;
+}
+
+
+int model_is_program_loaded(model_t *pmodel, size_t num) {
+    assert(pmodel != NULL);
+    if (num >= model_get_num_programs(pmodel)) {
+        return 0;
+    }
+    return pmodel->configuration.programs[num].steps_loaded;
+}
+
+
+/*
+ * Completa il programma con gli step letti dall'archivio; ritorna la sua posizione o -1 se nel frattempo e' stato
+ * rimosso o caricato
+ */
+int model_set_program_steps(model_t *pmodel, const dryer_program_t *loaded) {
+    assert(pmodel != NULL && loaded != NULL);
+
+    for (size_t i = 0; i < model_get_num_programs(pmodel); i++) {
+        dryer_program_t *p = &pmodel->configuration.programs[i];
+        if (strcmp(p->filename, loaded->filename) != 0) {
+            continue;
+        }
+
+        p->steps_pending = 0;
+        if (p->steps_loaded) {
+            return -1;
+        }
+
+        // Nomi e tipo possono essere gia' stati modificati: dall'archivio si prendono solo gli step
+        p->num_steps = loaded->num_steps;
+        memcpy(p->steps, loaded->steps, sizeof(p->steps));
+        p->steps_loaded = 1;
+        return (int)i;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Il caricamento verra' ritentato al prossimo accesso al programma
+ */
+void model_program_steps_failed(model_t *pmodel, const char *filename) {
+    assert(pmodel != NULL && filename != NULL);
+
+    for (size_t i = 0; i < model_get_num_programs(pmodel); i++) {
+        if (strcmp(pmodel->configuration.programs[i].filename, filename) == 0) {
+            pmodel->configuration.programs[i].steps_pending = 0;
+        }
+    }
+}
+
+
+const char *model_get_program_filename(model_t *pmodel, size_t num) {
+    assert(pmodel != NULL);
+    assert(num < model_get_num_programs(pmodel));
+    return pmodel->configuration.programs[num].filename;
+}
+
+
+void model_set_program_loader(model_t *pmodel, model_program_loader_t loader) {
+    assert(pmodel != NULL);
+    pmodel->system.program_loader = loader;
+}
+
+
+void model_set_boot_complete(model_t *pmodel) {
+    assert(pmodel != NULL);
+    pmodel->system.boot_complete = 1;
+}
+
+
+int model_is_boot_complete(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return pmodel->system.boot_complete;
 }
 
 
@@ -799,6 +1009,23 @@ int model_update_sensors(model_t *pmodel, uint16_t *coins, uint16_t payment, uin
         res                                = 1;
     }
 
+    cycle_tracker_sample(&pmodel->run.cycle, pmodel->machine.actual_temperature, pmodel->machine.actual_humidity);
+    if (model_is_program_running(pmodel)) {
+        eta_update(&pmodel->run.eta, &pmodel->run.program, pmodel->machine.remaining,
+                   pmodel->machine.actual_temperature);
+    }
+
+    int16_t values[TIMESERIES_NUM_CHANNELS] = {
+        [TIMESERIES_CHANNEL_TEMPERATURE]          = pmodel->machine.actual_temperature,
+        [TIMESERIES_CHANNEL_HUMIDITY]             = pmodel->machine.actual_humidity,
+        [TIMESERIES_CHANNEL_PTC1]                 = pmodel->machine.temperature_ptc1,
+        [TIMESERIES_CHANNEL_PTC2]                 = pmodel->machine.temperature_ptc2,
+        [TIMESERIES_CHANNEL_TEMPERATURE_SETPOINT] = model_current_temperature_setpoint(pmodel),
+        [TIMESERIES_CHANNEL_HUMIDITY_SETPOINT]    = model_current_humidity_setpoint(pmodel),
+        [TIMESERIES_CHANNEL_STATE]                = pmodel->machine.state,
+    };
+    timeseries_append(pmodel->timeseries, get_millis(), values);
+
     return res;
 }
 
@@ -843,6 +1070,12 @@ int model_current_humidity_setpoint(model_t *pmodel) {
 }
 
 
+const timeseries_t *model_get_timeseries(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return pmodel->timeseries;
+}
+
+
 int model_current_temperature(model_t *pmodel) {
     assert(pmodel != NULL);
     return pmodel->machine.actual_temperature;
@@ -904,9 +1137,24 @@ int model_menu_view_enabled(model_t *pmodel) {
 }
 
 
-void model_update_statistics(model_t *pmodel, statistics_t stats) {
+/*
+ * Ritorna 1 se gli aggregati sono cambiati e vanno salvati
+ */
+int model_update_statistics(model_t *pmodel, statistics_t stats) {
+    assert(pmodel != NULL);
+    return stats_tracker_update(&pmodel->statistics, &stats, stats_tracker_day((uint32_t)time(NULL)));
+}
+
+
+void model_restore_statistics(model_t *pmodel, const stats_tracker_t *saved) {
     assert(pmodel != NULL);
-    pmodel->statistics = stats;
+    stats_tracker_restore(&pmodel->statistics, saved, stats_tracker_day((uint32_t)time(NULL)));
+}
+
+
+void model_get_statistics(model_t *pmodel, stats_period_t period, statistics_t *stats) {
+    assert(pmodel != NULL);
+    stats_tracker_get(&pmodel->statistics, period, stats_tracker_day((uint32_t)time(NULL)), stats);
 }
 
 
@@ -947,3 +1195,87 @@ static int name_intersection(name_t *as, int numa, name_t *bs, int numb) {
 
     return 0;
 }
+
+
+static void begin_program(model_t *pmodel, size_t num, size_t step_num, int resumed) {
+    assert(pmodel != NULL);
+    assert(num < pmodel->configuration.num_programs);
+    assert(pmodel->configuration.programs[num].steps_loaded);
+    assert(pmodel->configuration.programs[num].num_steps > step_num);
+
+    pmodel->run.program        = *model_get_program(pmodel, num);
+    pmodel->run.program_number = num;
+    pmodel->run.step_number    = step_num;
+
+    // Una risincronizzazione durante il ciclo non ne apre uno nuovo
+    if (resumed && model_is_cycle_recording(pmodel) && pmodel->run.cycle.record.program_number == num) {
+        cycle_tracker_step(&pmodel->run.cycle, step_num);
+        eta_step(&pmodel->run.eta, &pmodel->run.program, step_num, pmodel->machine.actual_temperature);
+    } else {
+        timeseries_clear_raw(pmodel->timeseries);
+        stats_tracker_cycle_begin(&pmodel->statistics);
+        cycle_tracker_start(&pmodel->run.cycle, num, model_get_program_name(pmodel, num),
+                            pmodel->run.program.num_steps, step_num, resumed);
+        eta_begin(&pmodel->run.eta, &pmodel->run.program, model_get_program_name(pmodel, num), step_num,
+                  pmodel->machine.actual_temperature);
+    }
+}
+
+
+void model_clear_input_edges(model_t *pmodel) {
+    assert(pmodel != NULL);
+    pmodel->test.inputs             = 0;
+    pmodel->test.samples_per_second = 0;
+    pmodel->test.first_edge         = 0;
+    pmodel->test.num_edges          = 0;
+}
+
+
+void model_update_input_stream(model_t *pmodel, uint16_t inputs, input_edge_t *edges, size_t num_edges,
+                               uint16_t samples, unsigned long period) {
+    assert(pmodel != NULL);
+    pmodel->test.inputs = inputs;
+
+    if (period > 0) {
+        pmodel->test.samples_per_second = (uint16_t)((samples * 1000UL) / period);
+    }
+
+    for (size_t i = 0; i < num_edges; i++) {
+        size_t index              = (pmodel->test.first_edge + pmodel->test.num_edges) % INPUT_EDGE_LOG_SIZE;
+        pmodel->test.edges[index] = edges[i];
+
+        if (pmodel->test.num_edges < INPUT_EDGE_LOG_SIZE) {
+            pmodel->test.num_edges++;
+        } else {
+            // Il log e' pieno, sovrascrivo il fronte piu' vecchio
+            pmodel->test.first_edge = (pmodel->test.first_edge + 1) % INPUT_EDGE_LOG_SIZE;
+        }
+    }
+}
+
+
+size_t model_get_num_input_edges(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return pmodel->test.num_edges;
+}
+
+
+input_edge_t *model_get_input_edge(model_t *pmodel, size_t num) {
+    assert(pmodel != NULL);
+    if (num >= pmodel->test.num_edges) {
+        return NULL;
+    }
+    return &pmodel->test.edges[(pmodel->test.first_edge + num) % INPUT_EDGE_LOG_SIZE];
+}
+
+
+uint16_t model_get_test_inputs(model_t *pmodel) {
+    assert(pmodel != NULL);
+    return pmodel->test.inputs;
+}
+
+
+void model_set_test_inputs(model_t *pmodel, uint16_t inputs) {
+    assert(pmodel != NULL);
+    pmodel->test.inputs = inputs;
+}
@@ -6,6 +6,11 @@
 #include <stdint.h>
 #include "gel/parameter/parameter.h"
 #include "program.h"
+#include "cycle_record.h"
+#include "alarm_event.h"
+#include "stats_tracker.h"
+#include "eta.h"
+#include "timeseries.h"
 
 
 #define PASSWORD_MAX_SIZE 10
@@ -35,6 +40,8 @@
 
 #define PARMAC_SIZE 93
 
+#define INPUT_EDGE_LOG_SIZE 32
+
 #define USER_ACCESS_LEVEL       1
 #define TECHNICIAN_ACCESS_LEVEL 3
 #define NUM_ACCESS_LEVELS       2
@@ -79,18 +86,14 @@ typedef enum {
     ALARM_CODE_TEMPERATURA,
     ALARM_CODE_RISCALDAMENTO,
     ALARM_CODE_OBLO_APERTO,
+    NUM_ALARM_CODES,
 } alarm_code_t;
 
 
 typedef struct {
-    uint16_t complete_cycles;
-    uint16_t partial_cycles;
-    uint32_t active_time;
-    uint32_t work_time;
-    uint32_t rotation_time;
-    uint32_t ventilation_time;
-    uint32_t heating_time;
-} statistics_t;
+    uint32_t timestamp;
+    uint16_t inputs;
+} input_edge_t;
 
 
 typedef struct {
@@ -173,7 +176,14 @@ tempo_azzeramento_ciclo_pausa //pausa
 } parmac_t;
 
 
-typedef struct {
+struct model;
+
+// Richiede gli step di un programma di cui all'avvio sono stati letti solo nomi e numero di step; arrivano in
+// seguito con model_set_program_steps
+typedef void (*model_program_loader_t)(struct model *pmodel, size_t num, dryer_program_t *p);
+
+
+typedef struct model {
     struct {
         int communication_error;
         int communication_enabled;
@@ -184,6 +194,12 @@ typedef struct {
         uint16_t alarms;
         uint16_t function_flags;
 
+        // Interpolazione del conto alla rovescia tra una lettura e l'altra
+        uint16_t      remaining_anchor;     // Valore all'ultimo scatto osservato
+        unsigned long remaining_anchor_ts;
+        unsigned long remaining_ts;           // Ultima lettura
+        uint8_t       remaining_counting;     // La macchina sta scalando il tempo
+
         uint16_t coins[COIN_LINES];
         uint16_t payment;
         uint16_t adc_ptc1;
@@ -197,6 +213,14 @@ typedef struct {
         char date[32];
     } machine;
 
+    struct {
+        uint16_t     inputs;
+        uint16_t     samples_per_second;
+        input_edge_t edges[INPUT_EDGE_LOG_SIZE];
+        size_t       first_edge;
+        size_t       num_edges;
+    } test;
+
     struct {
         parmac_t        parmac;
         size_t          num_programs;
@@ -219,16 +243,23 @@ typedef struct {
         name_t *drive_machines;
         uint8_t drive_mounted;
         uint8_t firmware_update_ready;
+
+        model_program_loader_t program_loader;
+        uint8_t                boot_complete;
     } system;
 
     struct {
-        dryer_program_t program;
-        size_t          program_number;
-        size_t          step_number;
-        unsigned long   autostop_ts;
+        dryer_program_t     program;
+        size_t              program_number;
+        size_t              step_number;
+        unsigned long       autostop_ts;
+        cycle_tracker_t     cycle;
+        alarm_event_queue_t alarm_events;
+        eta_t               eta;
     } run;
 
-    statistics_t statistics;
+    stats_tracker_t statistics;
+    timeseries_t   *timeseries;     // Memoria statica: il modello vive sullo stack
 
     parameter_handle_t parameter_mac[NUM_PARMAC];
     size_t             num_parciclo;
@@ -258,6 +289,13 @@ size_t           model_get_max_programs(model_t *pmodel);
 dryer_program_t *model_create_new_program(model_t *pmodel, const char *name, size_t lingua, unsigned long timestamp,
                                           size_t *index);
 dryer_program_t *model_get_program(model_t *pmodel, size_t num);
+const char      *model_get_program_filename(model_t *pmodel, size_t num);
+void             model_set_program_loader(model_t *pmodel, model_program_loader_t loader);
+int              model_is_program_loaded(model_t *pmodel, size_t num);
+int              model_set_program_steps(model_t *pmodel, const dryer_program_t *loaded);
+void             model_program_steps_failed(model_t *pmodel, const char *filename);
+void             model_set_boot_complete(model_t *pmodel);
+int              model_is_boot_complete(model_t *pmodel);
 void             model_remove_program(model_t *pmodel, size_t num);
 dryer_program_t *model_create_new_program_from(model_t *pmodel, size_t src, size_t pos, unsigned long timestamp);
 void             model_swap_programs(model_t *pmodel, size_t first, size_t second);
@@ -285,6 +323,11 @@ int                model_get_worst_alarm(model_t *pmodel, alarm_code_t *code, ui
 int                model_is_any_alarm_active(model_t *pmodel);
 uint16_t           model_get_alarms(model_t *pmodel);
 void               model_stop_program(model_t *pmodel);
+int                model_finish_cycle(model_t *pmodel, cycle_stop_reason_t reason, cycle_record_t *record);
+int                model_is_cycle_recording(model_t *pmodel);
+void               model_learn_cycle(model_t *pmodel, const cycle_record_t *record);
+uint32_t           model_get_program_remaining(model_t *pmodel);
+size_t             model_take_alarm_events(model_t *pmodel, alarm_event_t *events, unsigned long delay);
 int                model_is_in_test(model_t *pmodel);
 int         model_update_sensors(model_t *pmodel, uint16_t *coins, uint16_t payment, uint16_t t1_adc, uint16_t t2_adc,
                                  uint16_t t1, uint16_t t2, uint16_t actual_temperature, uint16_t actual_humidity);
@@ -300,6 +343,7 @@ const char *model_get_password(model_t *pmodel);
 void        model_set_password(model_t *pmodel, const char *password);
 int         model_current_temperature(model_t *pmodel);
 int         model_current_humidity(model_t *pmodel);
+const timeseries_t *model_get_timeseries(model_t *pmodel);
 const char *model_get_program_name_in_language(model_t *pmodel, uint16_t language, size_t num);
 uint16_t    model_get_access_level_code(model_t *pmodel);
 void        model_set_access_level_code(model_t *pmodel, uint16_t access_level);
@@ -318,9 +362,18 @@ int         model_menu_view_enabled(model_t *pmodel);
 int         model_display_humidity(model_t *pmodel);
 uint16_t   *model_get_maximum_speed(model_t *pmodel);
 uint16_t   *model_get_minimum_speed(model_t *pmodel);
-void        model_update_statistics(model_t *pmodel, statistics_t stats);
+int         model_update_statistics(model_t *pmodel, statistics_t stats);
+void        model_restore_statistics(model_t *pmodel, const stats_tracker_t *saved);
+void        model_get_statistics(model_t *pmodel, stats_period_t period, statistics_t *stats);
 int         model_is_machine_communication_enabled(model_t *pmodel);
 uint8_t     model_should_display_humidity(model_t *pmodel);
 uint8_t     model_get_speed_in_percentage(model_t *pmodel, uint16_t speed);
+void        model_clear_input_edges(model_t *pmodel);
+void        model_update_input_stream(model_t *pmodel, uint16_t inputs, input_edge_t *edges, size_t num_edges,
+                                      uint16_t samples, unsigned long period);
+size_t      model_get_num_input_edges(model_t *pmodel);
+input_edge_t *model_get_input_edge(model_t *pmodel, size_t num);
+uint16_t    model_get_test_inputs(model_t *pmodel);
+void        model_set_test_inputs(model_t *pmodel, uint16_t inputs);
 
 #endif
@@ -16,13 +16,19 @@ void program_init(dryer_program_t *p, name_t *names, int num) {
         strcpy(p->nomi[i], names[i]);
     }
 
-    p->num_steps = 0;
+    p->num_steps     = 0;
+    p->steps_loaded  = 1;
+    p->steps_pending = 0;
 }
 
 
 uint16_t program_get_total_time(dryer_program_t *p) {
     uint16_t total = 0;
 
+    if (!p->steps_loaded) {
+        return p->total_time;
+    }
+
     for (size_t i = 0; i < p->num_steps; i++) {
         parameters_step_t *s = &p->steps[i];
         switch (s->type) {
@@ -79,6 +85,7 @@ size_t program_deserialize(dryer_program_t *p, uint8_t *buffer) {
     for (size_t j = 0; j < p->num_steps; j++) {
         i += deserialize_step(&p->steps[j], &buffer[i]);
     }
+    p->steps_loaded = 1;
 
     return i;
 }
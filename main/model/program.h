@@ -86,6 +86,10 @@ typedef struct {
     uint16_t          type;
     uint16_t          num_steps;
     parameters_step_t steps[MAX_STEPS];
+
+    uint8_t  steps_loaded;      // 0 se sono stati caricati solo nomi e numero di step
+    uint8_t  steps_pending;     // Caricamento degli step richiesto e non ancora concluso
+    uint16_t total_time;        // Durata totale valida anche senza step caricati
 } dryer_program_t;
 
 
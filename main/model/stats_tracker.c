@@ -0,0 +1,199 @@
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "stats_tracker.h"
+
+
+#define SECONDS_PER_DAY 86400L
+
+
+static void     accumulate(statistics_t *total, const statistics_t *delta);
+static uint32_t counter_delta(uint32_t previous, uint32_t current);
+static void     lifetime_delta(statistics_t *delta, const statistics_t *previous, const statistics_t *current);
+
+
+void stats_tracker_init(stats_tracker_t *tracker) {
+    assert(tracker != NULL);
+    memset(tracker, 0, sizeof(stats_tracker_t));
+}
+
+
+/*
+ * Aggiunge al giorno `day` (ed eventualmente al ciclo in corso) quanto e' cambiato dall'ultima lettura.
+ * Ritorna 1 se gli aggregati sono cambiati
+ */
+int stats_tracker_update(stats_tracker_t *tracker, const statistics_t *sample, uint32_t day) {
+    assert(tracker != NULL && sample != NULL);
+
+    statistics_t delta = {0};
+    if (tracker->valid) {
+        lifetime_delta(&delta, &tracker->lifetime, sample);
+    }
+    int changed = !tracker->valid || memcmp(&tracker->lifetime, sample, sizeof(statistics_t)) != 0 ||
+                  tracker->cycle_state == STATS_CYCLE_CLOSING;
+
+    tracker->valid    = 1;
+    tracker->lifetime = *sample;
+
+    stats_day_t *slot = &tracker->days[day % STATS_TRACKER_DAYS];
+    if (slot->number != day) {
+        memset(slot, 0, sizeof(stats_day_t));
+        slot->number = day;
+    }
+    accumulate(&slot->delta, &delta);
+
+    switch (tracker->cycle_state) {
+        case STATS_CYCLE_STARTING:
+            tracker->cycle_state = STATS_CYCLE_RUNNING;
+            break;
+
+        case STATS_CYCLE_RUNNING:
+            accumulate(&tracker->cycle, &delta);
+            break;
+
+        case STATS_CYCLE_CLOSING:
+            accumulate(&tracker->cycle, &delta);
+            tracker->last_cycle  = tracker->cycle;
+            tracker->cycle_state = STATS_CYCLE_IDLE;
+            break;
+
+        default:
+            break;
+    }
+
+    return changed;
+}
+
+
+/*
+ * Inizio e fine del ciclo valgono dalla lettura successiva, che va richiesta subito
+ */
+void stats_tracker_cycle_begin(stats_tracker_t *tracker) {
+    assert(tracker != NULL);
+    memset(&tracker->cycle, 0, sizeof(statistics_t));
+    tracker->cycle_state = STATS_CYCLE_STARTING;
+}
+
+
+void stats_tracker_cycle_end(stats_tracker_t *tracker) {
+    assert(tracker != NULL);
+    if (tracker->cycle_state == STATS_CYCLE_RUNNING) {
+        tracker->cycle_state = STATS_CYCLE_CLOSING;
+    } else {
+        // Il ciclo e' finito prima della lettura iniziale
+        tracker->cycle_state = STATS_CYCLE_IDLE;
+    }
+}
+
+
+/*
+ * Aggregati salvati prima dello spegnimento; quanto e' stato fatto nel frattempo va a `day`. Giorni e ultimo ciclo
+ * vengono sempre dal salvataggio; se una lettura e' gia' arrivata vale solo il suo totale, e la differenza da quello
+ * salvato viene attribuita subito, altrimenti se ne occupa la prossima lettura
+ */
+void stats_tracker_restore(stats_tracker_t *tracker, const stats_tracker_t *saved, uint32_t day) {
+    assert(tracker != NULL && saved != NULL);
+    if (!saved->valid) {
+        return;
+    }
+
+    uint8_t      valid       = tracker->valid;
+    uint8_t      cycle_state = tracker->cycle_state;
+    statistics_t cycle       = tracker->cycle;
+    statistics_t lifetime    = tracker->lifetime;
+
+    *tracker             = *saved;
+    tracker->cycle_state = cycle_state;
+    tracker->cycle       = cycle;
+
+    if (valid) {
+        // Le differenze gia' contate dalle letture arrivate prima sono comprese in questa
+        statistics_t delta;
+        lifetime_delta(&delta, &saved->lifetime, &lifetime);
+        tracker->lifetime = lifetime;
+
+        stats_day_t *slot = &tracker->days[day % STATS_TRACKER_DAYS];
+        if (slot->number != day) {
+            memset(slot, 0, sizeof(stats_day_t));
+            slot->number = day;
+        }
+        accumulate(&slot->delta, &delta);
+    }
+}
+
+
+void stats_tracker_get(const stats_tracker_t *tracker, stats_period_t period, uint32_t day, statistics_t *stats) {
+    assert(tracker != NULL && stats != NULL);
+    memset(stats, 0, sizeof(statistics_t));
+
+    switch (period) {
+        case STATS_PERIOD_TODAY: {
+            const stats_day_t *slot = &tracker->days[day % STATS_TRACKER_DAYS];
+            if (slot->number == day) {
+                *stats = slot->delta;
+            }
+            break;
+        }
+
+        case STATS_PERIOD_WEEK:
+            for (size_t i = 0; i < STATS_TRACKER_DAYS; i++) {
+                const stats_day_t *slot = &tracker->days[i];
+                if (slot->number <= day && slot->number + STATS_TRACKER_DAYS > day) {
+                    accumulate(stats, &slot->delta);
+                }
+            }
+            break;
+
+        case STATS_PERIOD_LAST_CYCLE:
+            *stats = tracker->last_cycle;
+            break;
+
+        case STATS_PERIOD_LIFETIME:
+            *stats = tracker->lifetime;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+// Giorno locale, per far coincidere "oggi" con la mezzanotte dell'orologio della macchina
+uint32_t stats_tracker_day(uint32_t timestamp) {
+    time_t    t = timestamp;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return (uint32_t)(((int64_t)timestamp + tm.tm_gmtoff) / SECONDS_PER_DAY);
+}
+
+
+/*
+ *  Static functions
+ */
+
+static void accumulate(statistics_t *total, const statistics_t *delta) {
+    total->complete_cycles += delta->complete_cycles;
+    total->partial_cycles += delta->partial_cycles;
+    total->active_time += delta->active_time;
+    total->work_time += delta->work_time;
+    total->rotation_time += delta->rotation_time;
+    total->ventilation_time += delta->ventilation_time;
+    total->heating_time += delta->heating_time;
+}
+
+
+// Un contatore che cala e' stato azzerato sulla macchina: quanto e' stato contato da allora e' il valore attuale
+static uint32_t counter_delta(uint32_t previous, uint32_t current) {
+    return current >= previous ? current - previous : current;
+}
+
+
+static void lifetime_delta(statistics_t *delta, const statistics_t *previous, const statistics_t *current) {
+    delta->complete_cycles  = (uint16_t)counter_delta(previous->complete_cycles, current->complete_cycles);
+    delta->partial_cycles   = (uint16_t)counter_delta(previous->partial_cycles, current->partial_cycles);
+    delta->active_time      = counter_delta(previous->active_time, current->active_time);
+    delta->work_time        = counter_delta(previous->work_time, current->work_time);
+    delta->rotation_time    = counter_delta(previous->rotation_time, current->rotation_time);
+    delta->ventilation_time = counter_delta(previous->ventilation_time, current->ventilation_time);
+    delta->heating_time     = counter_delta(previous->heating_time, current->heating_time);
+}
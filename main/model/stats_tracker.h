@@ -0,0 +1,68 @@
+#ifndef STATS_TRACKER_H_INCLUDED
+#define STATS_TRACKER_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define STATS_TRACKER_DAYS 7
+
+
+typedef struct {
+    uint16_t complete_cycles;
+    uint16_t partial_cycles;
+    uint32_t active_time;
+    uint32_t work_time;
+    uint32_t rotation_time;
+    uint32_t ventilation_time;
+    uint32_t heating_time;
+} statistics_t;
+
+
+typedef enum {
+    STATS_PERIOD_TODAY = 0,
+    STATS_PERIOD_WEEK,
+    STATS_PERIOD_LAST_CYCLE,
+    STATS_PERIOD_LIFETIME,
+    STATS_NUM_PERIODS,
+} stats_period_t;
+
+
+typedef enum {
+    STATS_CYCLE_IDLE = 0,
+    STATS_CYCLE_STARTING,     // In attesa della lettura che fa da riferimento iniziale
+    STATS_CYCLE_RUNNING,
+    STATS_CYCLE_CLOSING,      // In attesa della lettura che chiude il ciclo
+} stats_cycle_state_t;
+
+
+typedef struct {
+    uint32_t     number;     // Giorno locale dal 1970
+    statistics_t delta;
+} stats_day_t;
+
+
+/*
+ * Aggregati dei contatori della macchina, aggiornati a ogni lettura con la differenza dalla precedente
+ */
+typedef struct {
+    uint8_t      valid;     // `lifetime` contiene una lettura
+    uint8_t      cycle_state;
+    statistics_t lifetime;     // Ultima lettura dei contatori
+    statistics_t cycle;
+    statistics_t last_cycle;
+    stats_day_t  days[STATS_TRACKER_DAYS];     // Indicizzati dal giorno modulo STATS_TRACKER_DAYS
+} stats_tracker_t;
+
+
+void     stats_tracker_init(stats_tracker_t *tracker);
+int      stats_tracker_update(stats_tracker_t *tracker, const statistics_t *sample, uint32_t day);
+void     stats_tracker_cycle_begin(stats_tracker_t *tracker);
+void     stats_tracker_cycle_end(stats_tracker_t *tracker);
+void     stats_tracker_restore(stats_tracker_t *tracker, const stats_tracker_t *saved, uint32_t day);
+void     stats_tracker_get(const stats_tracker_t *tracker, stats_period_t period, uint32_t day, statistics_t *stats);
+uint32_t stats_tracker_day(uint32_t timestamp);
+
+
+#endif
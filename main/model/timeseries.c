@@ -0,0 +1,174 @@
+#include <assert.h>
+#include <string.h>
+#include "timeseries.h"
+
+
+static void accumulate(timeseries_rollup_t *rollup, uint32_t seconds, const int16_t *values);
+static void close_bucket(timeseries_rollup_t *rollup);
+
+
+static const uint32_t periods[TIMESERIES_NUM_LEVELS] = {10, 60, 600};
+
+
+void timeseries_init(timeseries_t *ts, unsigned long millis) {
+    assert(ts != NULL);
+
+    ts->clock  = 0;
+    ts->millis = millis;
+    timeseries_clear_raw(ts);
+    for (size_t i = 0; i < TIMESERIES_NUM_LEVELS; i++) {
+        ts->rollups[i].period  = periods[i];
+        ts->rollups[i].first   = 0;
+        ts->rollups[i].count   = 0;
+        ts->rollups[i].samples = 0;
+    }
+}
+
+
+/*
+ * `values` contiene un campione per ciascun canale; tempo costante, senza allocazioni
+ */
+void timeseries_append(timeseries_t *ts, unsigned long millis, const int16_t *values) {
+    assert(ts != NULL);
+
+    ts->clock  = timeseries_time(ts, millis);
+    ts->millis = millis;
+
+    timeseries_raw_t *raw   = &ts->raw;
+    size_t            index = (raw->first + raw->count) % TIMESERIES_RAW_SAMPLES;
+    if (raw->count == 0) {
+        raw->start = ts->clock;
+    }
+    if (raw->count == TIMESERIES_RAW_SAMPLES) {
+        raw->first       = (raw->first + 1) % TIMESERIES_RAW_SAMPLES;
+        raw->overwritten = 1;
+    } else {
+        raw->count++;
+    }
+
+    raw->timestamps[index] = ts->clock;
+    for (size_t i = 0; i < TIMESERIES_NUM_CHANNELS; i++) {
+        raw->values[i][index] = values[i];
+    }
+
+    for (size_t i = 0; i < TIMESERIES_NUM_LEVELS; i++) {
+        accumulate(&ts->rollups[i], (uint32_t)(ts->clock / 1000UL), values);
+    }
+}
+
+
+// Istante di get_millis sull'orologio della serie; la differenza senza segno resta corretta anche a cavallo del giro
+uint64_t timeseries_time(const timeseries_t *ts, unsigned long millis) {
+    assert(ts != NULL);
+    return ts->clock + (unsigned long)(millis - ts->millis);
+}
+
+
+/*
+ * I campioni grezzi riguardano solo il ciclo in corso
+ */
+void timeseries_clear_raw(timeseries_t *ts) {
+    assert(ts != NULL);
+    ts->raw.first       = 0;
+    ts->raw.count       = 0;
+    ts->raw.overwritten = 0;
+}
+
+
+size_t timeseries_raw_count(const timeseries_t *ts) {
+    assert(ts != NULL);
+    return ts->raw.count;
+}
+
+
+uint64_t timeseries_raw_start(const timeseries_t *ts) {
+    assert(ts != NULL);
+    return ts->raw.start;
+}
+
+
+// 0 se il ciclo e' piu' lungo di TIMESERIES_RAW_SAMPLES campioni e il suo inizio si trova solo nei riepiloghi
+int timeseries_raw_is_complete(const timeseries_t *ts) {
+    assert(ts != NULL);
+    return !ts->raw.overwritten;
+}
+
+
+// `num` parte dal campione piu' vecchio
+uint64_t timeseries_raw_timestamp(const timeseries_t *ts, size_t num) {
+    assert(ts != NULL && num < ts->raw.count);
+    return ts->raw.timestamps[(ts->raw.first + num) % TIMESERIES_RAW_SAMPLES];
+}
+
+
+int16_t timeseries_raw_value(const timeseries_t *ts, timeseries_channel_t channel, size_t num) {
+    assert(ts != NULL && num < ts->raw.count);
+    return ts->raw.values[channel][(ts->raw.first + num) % TIMESERIES_RAW_SAMPLES];
+}
+
+
+size_t timeseries_rollup_count(const timeseries_t *ts, timeseries_level_t level) {
+    assert(ts != NULL);
+    return ts->rollups[level].count;
+}
+
+
+// In ms come i campioni grezzi
+uint64_t timeseries_rollup_timestamp(const timeseries_t *ts, timeseries_level_t level, size_t num) {
+    assert(ts != NULL && num < ts->rollups[level].count);
+    return ts->rollups[level].timestamps[(ts->rollups[level].first + num) % TIMESERIES_BUCKETS] * 1000ULL;
+}
+
+
+int16_t timeseries_rollup_value(const timeseries_t *ts, timeseries_level_t level, timeseries_stat_t stat,
+                                timeseries_channel_t channel, size_t num) {
+    assert(ts != NULL && num < ts->rollups[level].count);
+    return ts->rollups[level].values[stat][channel][(ts->rollups[level].first + num) % TIMESERIES_BUCKETS];
+}
+
+
+/*
+ *  Static functions
+ */
+
+static void accumulate(timeseries_rollup_t *rollup, uint32_t seconds, const int16_t *values) {
+    uint32_t start = seconds - seconds % rollup->period;
+
+    if (rollup->samples > 0 && start != rollup->start) {
+        close_bucket(rollup);
+    }
+
+    if (rollup->samples == 0) {
+        rollup->start = start;
+        for (size_t i = 0; i < TIMESERIES_NUM_CHANNELS; i++) {
+            rollup->sum[i] = 0;
+            rollup->min[i] = values[i];
+            rollup->max[i] = values[i];
+        }
+    }
+
+    rollup->samples++;
+    for (size_t i = 0; i < TIMESERIES_NUM_CHANNELS; i++) {
+        rollup->sum[i] += values[i];
+        rollup->min[i] = values[i] < rollup->min[i] ? values[i] : rollup->min[i];
+        rollup->max[i] = values[i] > rollup->max[i] ? values[i] : rollup->max[i];
+    }
+}
+
+
+static void close_bucket(timeseries_rollup_t *rollup) {
+    size_t index = (rollup->first + rollup->count) % TIMESERIES_BUCKETS;
+    if (rollup->count == TIMESERIES_BUCKETS) {
+        rollup->first = (rollup->first + 1) % TIMESERIES_BUCKETS;
+    } else {
+        rollup->count++;
+    }
+
+    rollup->timestamps[index] = rollup->start;
+    for (size_t i = 0; i < TIMESERIES_NUM_CHANNELS; i++) {
+        rollup->values[TIMESERIES_MIN][i][index] = rollup->min[i];
+        rollup->values[TIMESERIES_MAX][i][index] = rollup->max[i];
+        rollup->values[TIMESERIES_AVG][i][index] = (int16_t)(rollup->sum[i] / (int32_t)rollup->samples);
+    }
+    rollup->samples = 0;
+}
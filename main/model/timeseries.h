@@ -0,0 +1,102 @@
+#ifndef TIMESERIES_H_INCLUDED
+#define TIMESERIES_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/*
+ * Occupazione (strutture di array int16):
+ *  - campioni grezzi del ciclo in corso: 6144 x (8 + 7 x 2) byte = 132 KB, circa un'ora a 600 ms; di un ciclo piu'
+ *    lungo restano gli ultimi, e l'inizio va letto dai riepiloghi
+ *  - per ciascuno dei 3 livelli di riepilogo: 2048 x (4 + 7 x 3 x 2) byte = 92 KB; a 10 s, 1 min e 10 min coprono
+ *    circa 6 ore, 34 ore e 14 giorni
+ * Totale circa 408 KB, fissi.
+ *
+ * I tempi sono misurati da timeseries_init con un orologio a 64 bit: get_millis si riavvolge dopo circa 49 giorni,
+ * la serie no.
+ */
+#define TIMESERIES_RAW_SAMPLES 6144
+#define TIMESERIES_BUCKETS     2048
+
+
+typedef enum {
+    TIMESERIES_CHANNEL_TEMPERATURE = 0,
+    TIMESERIES_CHANNEL_HUMIDITY,
+    TIMESERIES_CHANNEL_PTC1,
+    TIMESERIES_CHANNEL_PTC2,
+    TIMESERIES_CHANNEL_TEMPERATURE_SETPOINT,
+    TIMESERIES_CHANNEL_HUMIDITY_SETPOINT,
+    TIMESERIES_CHANNEL_STATE,
+    TIMESERIES_NUM_CHANNELS,
+} timeseries_channel_t;
+
+
+typedef enum {
+    TIMESERIES_LEVEL_10S = 0,
+    TIMESERIES_LEVEL_1MIN,
+    TIMESERIES_LEVEL_10MIN,
+    TIMESERIES_NUM_LEVELS,
+} timeseries_level_t;
+
+
+typedef enum {
+    TIMESERIES_MIN = 0,
+    TIMESERIES_MAX,
+    TIMESERIES_AVG,
+    TIMESERIES_NUM_STATS,
+} timeseries_stat_t;
+
+
+typedef struct {
+    size_t   first;
+    size_t   count;
+    uint64_t start;           // ms, primo campione del ciclo
+    uint8_t  overwritten;     // I campioni piu' vecchi del ciclo sono stati sovrascritti
+    uint64_t timestamps[TIMESERIES_RAW_SAMPLES];     // ms
+    int16_t  values[TIMESERIES_NUM_CHANNELS][TIMESERIES_RAW_SAMPLES];
+} timeseries_raw_t;
+
+
+typedef struct {
+    uint32_t period;     // s
+    size_t   first;
+    size_t   count;
+    uint32_t timestamps[TIMESERIES_BUCKETS];     // Inizio dell'intervallo, in s
+    int16_t  values[TIMESERIES_NUM_STATS][TIMESERIES_NUM_CHANNELS][TIMESERIES_BUCKETS];
+
+    // Intervallo in corso, non ancora visibile
+    uint32_t start;
+    uint32_t samples;
+    int32_t  sum[TIMESERIES_NUM_CHANNELS];
+    int16_t  min[TIMESERIES_NUM_CHANNELS];
+    int16_t  max[TIMESERIES_NUM_CHANNELS];
+} timeseries_rollup_t;
+
+
+typedef struct {
+    uint64_t      clock;      // ms, ultimo campione
+    unsigned long millis;     // get_millis corrispondente a `clock`
+
+    timeseries_raw_t    raw;
+    timeseries_rollup_t rollups[TIMESERIES_NUM_LEVELS];
+} timeseries_t;
+
+
+void     timeseries_init(timeseries_t *ts, unsigned long millis);
+void     timeseries_append(timeseries_t *ts, unsigned long millis, const int16_t *values);
+uint64_t timeseries_time(const timeseries_t *ts, unsigned long millis);
+void     timeseries_clear_raw(timeseries_t *ts);
+size_t   timeseries_raw_count(const timeseries_t *ts);
+uint64_t timeseries_raw_start(const timeseries_t *ts);
+int      timeseries_raw_is_complete(const timeseries_t *ts);
+uint64_t timeseries_raw_timestamp(const timeseries_t *ts, size_t num);
+int16_t  timeseries_raw_value(const timeseries_t *ts, timeseries_channel_t channel, size_t num);
+size_t   timeseries_rollup_count(const timeseries_t *ts, timeseries_level_t level);
+uint64_t timeseries_rollup_timestamp(const timeseries_t *ts, timeseries_level_t level, size_t num);
+int16_t  timeseries_rollup_value(const timeseries_t *ts, timeseries_level_t level, timeseries_stat_t stat,
+                                 timeseries_channel_t channel, size_t num);
+
+
+#endif
@@ -0,0 +1,684 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "gel/timer/timecheck.h"
+#include "system_time.h"
+#include "async_log.h"
+
+
+/*
+ *  Sostituisce l'implementazione di log.c: i thread scrivono il messaggio gia' formattato in un anello
+ *  senza lock e un thread dedicato lo riversa su file a blocchi. Se l'anello e' pieno il messaggio viene
+ *  scartato e contato, cosi' chi scrive non resta mai in attesa del disco.
+ */
+
+
+#define RING_SIZE     256     // Potenza di 2
+#define RECORD_SIZE   160
+#define BATCH_SIZE    16384
+#define FLUSH_PERIOD  200     // ms
+#define HEADER_SIZE   64
+#define PATH_SIZE     128
+#define NSEC(ts)      ((ts).tv_sec * 1000000000ULL + (ts).tv_nsec)
+
+// Limite per punto di chiamata: una raffica di RATE_BURST messaggi, poi uno ogni RATE_INTERVAL ms
+#define RATE_SLOTS     64     // Potenza di 2
+#define RATE_BURST     10
+#define RATE_INTERVAL  1000UL
+#define SUMMARY_PERIOD 10000UL
+
+#define MAX_MODULE_LEVELS 16
+#define MODULE_NAME_SIZE  24
+
+
+typedef struct {
+    atomic_size_t sequence;
+    time_t        timestamp;
+    int           level;
+    const char   *file;
+    char          text[RECORD_SIZE];
+} record_t;
+
+
+typedef struct {
+    atomic_int    lock;
+    const char   *file;
+    int           line;
+    unsigned int  tokens;
+    unsigned long refill_ts;
+    unsigned long suppressed;
+    unsigned long report_ts;
+} rate_slot_t;
+
+
+static void  *flusher_task(void *arg);
+static void   drain(void);
+static void   write_batch(const char *batch, size_t len);
+static void   write_direct(int level, const char *file, const char *fmt, va_list ap);
+static int    format_header(char *buffer, size_t size, time_t timestamp, int level, const char *file);
+static size_t module_name(const char *file, const char **module);
+static int    module_level(const char *file);
+static int    rate_limit(const char *file, int line);
+static size_t report_suppressed(char *batch, size_t len);
+static int    parse_level(const char *string, size_t len);
+static void   check_rotation(void);
+static void   start_rotation(void);
+static void  *rotation_task(void *arg);
+#ifdef TARGET_DEBUG
+static void  *benchmark_task(void *arg);
+#endif
+
+
+static const char *level_strings[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+static record_t      ring[RING_SIZE];
+static atomic_size_t enqueue_position = 0;
+static atomic_size_t dequeue_position = 0;     // Scritto solo sotto consumer_lock
+static atomic_ulong  dropped          = 0;
+static atomic_int    minimum_level    = LOG_TRACE;
+static atomic_int    running          = 0;
+
+static pthread_mutex_t consumer_lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t           wakeup;
+static int             log_fd           = -1;
+static unsigned long   reported_dropped = 0;
+
+// Limiti per punto di chiamata e livelli per modulo
+static rate_slot_t  rate_slots[RATE_SLOTS]                            = {0};
+static atomic_int   rate_limit_enabled                                = 1;
+static atomic_ulong evicted_suppressed                                = 0;
+static atomic_int   num_module_levels                                 = 0;
+static atomic_int   module_levels[MAX_MODULE_LEVELS]                  = {0};
+static char         module_names[MAX_MODULE_LEVELS][MODULE_NAME_SIZE] = {{0}};
+
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Rotazione, protetta da consumer_lock
+static char                  log_path[PATH_SIZE]     = {0};
+static char                  rotated_path[PATH_SIZE] = {0};
+static size_t                segment_bytes           = 0;
+static unsigned long         segment_start           = 0;
+static size_t                rotation_size           = 0;
+static unsigned long         rotation_age            = 0;
+static async_log_rotate_cb_t rotation_cb             = NULL;
+static atomic_int            rotating                = 0;
+
+
+void async_log_init(const char *path) {
+    for (size_t i = 0; i < RING_SIZE; i++) {
+        atomic_init(&ring[i].sequence, i);
+    }
+    assert(sem_init(&wakeup, 0, 0) == 0);
+
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    snprintf(rotated_path, sizeof(rotated_path), "%s%s", path, ASYNC_LOG_ROTATED_SUFFIX);
+
+    struct stat st;
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) {
+        fprintf(stderr, "Non riesco ad aprire %s: %s\n", path, strerror(errno));
+    } else if (fstat(log_fd, &st) == 0) {
+        segment_bytes = st.st_size;
+    }
+    segment_start = get_millis();
+
+    pthread_t id;
+    atomic_store(&running, 1);
+    pthread_create(&id, NULL, flusher_task, NULL);
+    pthread_detach(id);
+
+    atexit(async_log_flush);
+}
+
+
+/*
+ * Scrive subito tutto quello che e' in coda; da chiamare prima di riavviare o terminare
+ */
+void async_log_flush(void) {
+    if (atomic_load(&running)) {
+        drain();
+    }
+}
+
+
+/*
+ * Il file corrente viene chiuso e passato a cb quando supera max_size byte o max_age_ms di eta'
+ */
+void async_log_set_rotation(size_t max_size, unsigned long max_age_ms, async_log_rotate_cb_t cb) {
+    pthread_mutex_lock(&consumer_lock);
+    rotation_size = max_size;
+    rotation_age  = max_age_ms;
+    rotation_cb   = cb;
+
+    // Un file ruotato e non ancora consumato (ad esempio per un riavvio) viene ripreso subito
+    struct stat st;
+    if (cb != NULL && stat(rotated_path, &st) == 0) {
+        start_rotation();
+    }
+    pthread_mutex_unlock(&consumer_lock);
+}
+
+
+unsigned long async_log_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+
+#ifdef TARGET_DEBUG
+/*
+ * Misura il costo di una chiamata dal punto di vista di chi scrive, con la stessa riga che il thread seriale
+ * produce a ogni errore Modbus e un secondo thread che scrive in concorrenza. Il limite per punto di chiamata e'
+ * sospeso per tutta la misura, altrimenti oltre la raffica iniziale si misurerebbe solo il limite
+ */
+int async_log_benchmark(unsigned long records) {
+    pthread_t          id;
+    unsigned long long total = 0, worst = 0;
+    unsigned long      initial_dropped = async_log_dropped();
+
+    atomic_store_explicit(&rate_limit_enabled, 0, memory_order_relaxed);
+    pthread_create(&id, NULL, benchmark_task, (void *)(uintptr_t)records);
+
+    for (unsigned long i = 0; i < records; i++) {
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        log_warn("Modbus error: %i %i (%i)", 1, 2, (int)i);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        unsigned long long elapsed = NSEC(end) - NSEC(start);
+        total += elapsed;
+        if (elapsed > worst) {
+            worst = elapsed;
+        }
+        if (i % 64 == 0) {
+            // Ritmo simile a quello dei tentativi sulla seriale
+            usleep(1000);
+        }
+    }
+
+    pthread_join(id, NULL);
+    async_log_flush();
+    atomic_store_explicit(&rate_limit_enabled, 1, memory_order_relaxed);
+
+    log_info("Benchmark log: %lu chiamate, %llu ns in media, %llu ns al massimo, %lu scartati", records,
+             records > 0 ? total / records : 0, worst, async_log_dropped() - initial_dropped);
+    async_log_flush();
+    return 0;
+}
+#endif
+
+
+void log_set_level(int level) {
+    atomic_store_explicit(&minimum_level, level, memory_order_relaxed);
+}
+
+
+/*
+ * Livello minimo per i messaggi di un modulo, cioe' del file sorgente senza estensione (es. "machine")
+ */
+int async_log_set_module_level(const char *module, int level) {
+    int res = 0;
+
+    pthread_mutex_lock(&config_lock);
+    int num = atomic_load(&num_module_levels);
+    int i   = 0;
+    for (i = 0; i < num; i++) {
+        if (strcmp(module_names[i], module) == 0) {
+            break;
+        }
+    }
+
+    if (i < num) {
+        atomic_store(&module_levels[i], level);
+    } else if (num < MAX_MODULE_LEVELS && strlen(module) < MODULE_NAME_SIZE) {
+        strcpy(module_names[num], module);
+        atomic_store(&module_levels[num], level);
+        // Il nome e' completo prima di diventare visibile a log_log
+        atomic_store_explicit(&num_module_levels, num + 1, memory_order_release);
+    } else {
+        res = -1;
+    }
+    pthread_mutex_unlock(&config_lock);
+
+    return res;
+}
+
+
+/*
+ * Configurazione nel formato "modulo=livello,...", dove il modulo "*" indica il livello generale
+ * (es. "*=warn,machine=debug")
+ */
+int async_log_configure(const char *spec) {
+    int res = 0;
+
+    while (*spec != '\0') {
+        size_t      len    = strcspn(spec, ",");
+        const char *equals = memchr(spec, '=', len);
+
+        if (equals == NULL || equals == spec || (size_t)(equals - spec) >= MODULE_NAME_SIZE) {
+            res = -1;
+        } else {
+            char module[MODULE_NAME_SIZE] = {0};
+            int  level                    = parse_level(equals + 1, len - (equals + 1 - spec));
+            memcpy(module, spec, equals - spec);
+
+            if (level < 0) {
+                res = -1;
+            } else if (strcmp(module, "*") == 0) {
+                log_set_level(level);
+            } else if (async_log_set_module_level(module, level)) {
+                res = -1;
+            }
+        }
+
+        spec += len;
+        if (*spec == ',') {
+            spec++;
+        }
+    }
+
+    if (res) {
+        log_warn("Configurazione dei livelli di log non valida");
+    }
+    return res;
+}
+
+
+void log_log(int level, const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+
+    if (level < module_level(file)) {
+        return;
+    }
+
+    // I guasti ripetuti (es. la seriale) non devono poter inondare il log
+    if (level < LOG_FATAL && atomic_load_explicit(&rate_limit_enabled, memory_order_relaxed) &&
+        rate_limit(file, line)) {
+        return;
+    }
+
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        va_start(ap, fmt);
+        write_direct(level, file, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    // Coda limitata multi produttore (Vyukov): ogni cella porta il numero di giro in cui e' libera
+    size_t    position = atomic_load_explicit(&enqueue_position, memory_order_relaxed);
+    record_t *record;
+    for (;;) {
+        record          = &ring[position & (RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        long   diff     = (long)sequence - (long)position;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            position = atomic_load_explicit(&enqueue_position, memory_order_relaxed);
+        }
+    }
+
+    record->timestamp = time(NULL);
+    record->level     = level;
+    record->file      = file;
+    va_start(ap, fmt);
+    vsnprintf(record->text, sizeof(record->text), fmt, ap);
+    va_end(ap);
+    atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+
+    // Gli errori e l'anello quasi pieno svegliano subito il thread di scrittura, il resto aspetta il periodo
+    if (level >= LOG_ERROR ||
+        position - atomic_load_explicit(&dequeue_position, memory_order_relaxed) > RING_SIZE / 2) {
+        sem_post(&wakeup);
+    }
+}
+
+
+/*
+ *  Static functions
+ */
+
+static void *flusher_task(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FLUSH_PERIOD * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (sem_timedwait(&wakeup, &deadline) < 0 && errno == EINTR) {
+        }
+        while (sem_trywait(&wakeup) == 0) {
+        }
+
+        drain();
+    }
+
+    pthread_exit(NULL);
+    return NULL;
+}
+
+
+static void drain(void) {
+    static char batch[BATCH_SIZE];
+    size_t      len = 0;
+
+    pthread_mutex_lock(&consumer_lock);
+
+    for (;;) {
+        size_t    position = atomic_load_explicit(&dequeue_position, memory_order_relaxed);
+        record_t *record   = &ring[position & (RING_SIZE - 1)];
+        size_t    sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+
+        if (sequence != position + 1) {
+            // Vuoto, oppure il produttore non ha ancora finito di scrivere la cella
+            break;
+        }
+
+        if (len + HEADER_SIZE + RECORD_SIZE + 1 > sizeof(batch)) {
+            write_batch(batch, len);
+            len = 0;
+        }
+
+        len += format_header(&batch[len], sizeof(batch) - len, record->timestamp, record->level, record->file);
+        len += snprintf(&batch[len], sizeof(batch) - len, "%s\n", record->text);
+
+        atomic_store_explicit(&record->sequence, position + RING_SIZE, memory_order_release);
+        atomic_store_explicit(&dequeue_position, position + 1, memory_order_relaxed);
+    }
+
+    unsigned long total_dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (total_dropped != reported_dropped) {
+        if (len + HEADER_SIZE + RECORD_SIZE + 1 > sizeof(batch)) {
+            write_batch(batch, len);
+            len = 0;
+        }
+        len += format_header(&batch[len], sizeof(batch) - len, time(NULL), LOG_WARN, __FILE__);
+        len += snprintf(&batch[len], sizeof(batch) - len, "%lu messaggi di log persi (%lu in totale)\n",
+                        total_dropped - reported_dropped, total_dropped);
+        reported_dropped = total_dropped;
+    }
+
+    len = report_suppressed(batch, len);
+
+    write_batch(batch, len);
+    check_rotation();
+    pthread_mutex_unlock(&consumer_lock);
+}
+
+
+static void write_batch(const char *batch, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    if (write(STDERR_FILENO, batch, len) < 0) {
+        // Niente da fare
+    }
+    if (log_fd >= 0) {
+        ssize_t res = write(log_fd, batch, len);
+        if (res > 0) {
+            segment_bytes += res;
+        }
+    }
+}
+
+
+/*
+ * La rotazione e' decisa da chi scrive il file: nessun altro deve controllarne la dimensione
+ */
+static void check_rotation(void) {
+    if (rotation_cb == NULL || segment_bytes == 0 || atomic_load(&rotating)) {
+        return;
+    }
+    if (segment_bytes < rotation_size && !is_expired(segment_start, get_millis(), rotation_age)) {
+        return;
+    }
+
+    segment_bytes = 0;
+    segment_start = get_millis();
+
+    if (rename(log_path, rotated_path) < 0) {
+        log_warn("Non riesco a ruotare %s: %s", log_path, strerror(errno));
+        return;
+    }
+
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        if (log_fd >= 0) {
+            close(log_fd);
+        }
+        log_fd = fd;
+    }
+
+    start_rotation();
+}
+
+
+static void start_rotation(void) {
+    pthread_t id;
+
+    // La compressione puo' durare: la si lascia a un thread a parte per continuare a svuotare l'anello
+    atomic_store(&rotating, 1);
+    if (pthread_create(&id, NULL, rotation_task, NULL) == 0) {
+        pthread_detach(id);
+    } else {
+        atomic_store(&rotating, 0);
+    }
+}
+
+
+static void *rotation_task(void *arg) {
+    (void)arg;
+    rotation_cb(rotated_path);
+    atomic_store(&rotating, 0);
+    return NULL;
+}
+
+
+/*
+ * Usato solo prima che il thread di scrittura sia partito
+ */
+static void write_direct(int level, const char *file, const char *fmt, va_list ap) {
+    char buffer[HEADER_SIZE + RECORD_SIZE + 1];
+
+    int len = format_header(buffer, sizeof(buffer), time(NULL), level, file);
+    len += vsnprintf(&buffer[len], sizeof(buffer) - len - 1, fmt, ap);
+    if ((size_t)len > sizeof(buffer) - 2) {
+        len = sizeof(buffer) - 2;
+    }
+    buffer[len++] = '\n';
+    write_batch(buffer, len);
+}
+
+
+static int module_level(const char *file) {
+    int minimum = atomic_load_explicit(&minimum_level, memory_order_relaxed);
+    int num     = atomic_load_explicit(&num_module_levels, memory_order_acquire);
+
+    if (num == 0) {
+        return minimum;
+    }
+
+    const char *module = NULL;
+    size_t      len    = module_name(file, &module);
+    for (int i = 0; i < num; i++) {
+        if (strncmp(module_names[i], module, len) == 0 && module_names[i][len] == '\0') {
+            return atomic_load_explicit(&module_levels[i], memory_order_relaxed);
+        }
+    }
+
+    return minimum;
+}
+
+
+/*
+ * Token bucket per punto di chiamata (file e riga); ritorna 1 se il messaggio va soppresso
+ */
+static int rate_limit(const char *file, int line) {
+    uintptr_t     hash = ((uintptr_t)file >> 3) ^ ((uintptr_t)line * 2654435761U);
+    rate_slot_t  *slot = &rate_slots[hash & (RATE_SLOTS - 1)];
+    unsigned long now  = get_millis();
+    int           res  = 0;
+
+    // Un produttore non attende mai: se lo slot e' occupato il messaggio passa senza limite
+    if (atomic_exchange_explicit(&slot->lock, 1, memory_order_acquire)) {
+        return 0;
+    }
+
+    if (slot->file != file || slot->line != line) {
+        // Collisione: il conteggio del punto precedente viene riportato senza indicarne l'origine
+        if (slot->suppressed > 0) {
+            atomic_fetch_add_explicit(&evicted_suppressed, slot->suppressed, memory_order_relaxed);
+        }
+        slot->file       = file;
+        slot->line       = line;
+        slot->tokens     = RATE_BURST;
+        slot->refill_ts  = now;
+        slot->suppressed = 0;
+        slot->report_ts  = now;
+    }
+
+    unsigned long refill = time_interval(slot->refill_ts, now) / RATE_INTERVAL;
+    if (refill > 0) {
+        slot->tokens = slot->tokens + refill > RATE_BURST ? RATE_BURST : slot->tokens + refill;
+        slot->refill_ts += refill * RATE_INTERVAL;
+    }
+
+    if (slot->tokens > 0) {
+        slot->tokens--;
+    } else {
+        slot->suppressed++;
+        res = 1;
+    }
+
+    atomic_store_explicit(&slot->lock, 0, memory_order_release);
+    return res;
+}
+
+
+/*
+ * Aggiunge al blocco il riepilogo dei messaggi soppressi, al massimo uno per punto ogni SUMMARY_PERIOD
+ */
+static size_t report_suppressed(char *batch, size_t len) {
+    unsigned long now = get_millis();
+
+    for (size_t i = 0; i < RATE_SLOTS; i++) {
+        rate_slot_t  *slot  = &rate_slots[i];
+        const char   *file  = NULL;
+        int           line  = 0;
+        unsigned long count = 0;
+
+        // Uno slot occupato da un produttore viene riportato al blocco successivo
+        if (atomic_exchange_explicit(&slot->lock, 1, memory_order_acquire)) {
+            continue;
+        }
+        if (slot->suppressed > 0 && is_expired(slot->report_ts, now, SUMMARY_PERIOD)) {
+            file             = slot->file;
+            line             = slot->line;
+            count            = slot->suppressed;
+            slot->suppressed = 0;
+            slot->report_ts  = now;
+        }
+        atomic_store_explicit(&slot->lock, 0, memory_order_release);
+
+        if (count > 0) {
+            if (len + HEADER_SIZE + RECORD_SIZE + 1 > BATCH_SIZE) {
+                write_batch(batch, len);
+                len = 0;
+            }
+            const char *module = strrchr(file, '/') != NULL ? strrchr(file, '/') + 1 : file;
+            len += format_header(&batch[len], BATCH_SIZE - len, time(NULL), LOG_WARN, file);
+            len += snprintf(&batch[len], BATCH_SIZE - len, "%s:%i: %lu messaggi simili soppressi\n", module, line,
+                            count);
+        }
+    }
+
+    unsigned long evicted = atomic_exchange_explicit(&evicted_suppressed, 0, memory_order_relaxed);
+    if (evicted > 0) {
+        if (len + HEADER_SIZE + RECORD_SIZE + 1 > BATCH_SIZE) {
+            write_batch(batch, len);
+            len = 0;
+        }
+        len += format_header(&batch[len], BATCH_SIZE - len, time(NULL), LOG_WARN, __FILE__);
+        len += snprintf(&batch[len], BATCH_SIZE - len, "%lu messaggi soppressi\n", evicted);
+    }
+
+    return len;
+}
+
+
+static int parse_level(const char *string, size_t len) {
+    for (int i = LOG_TRACE; i <= LOG_FATAL; i++) {
+        if (strlen(level_strings[i]) == len && strncasecmp(level_strings[i], string, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/*
+ * Nome del modulo: il file sorgente senza percorso ne' estensione
+ */
+static size_t module_name(const char *file, const char **module) {
+    *module = strrchr(file, '/') != NULL ? strrchr(file, '/') + 1 : file;
+    return strcspn(*module, ".");
+}
+
+
+static int format_header(char *buffer, size_t size, time_t timestamp, int level, const char *file) {
+    struct tm tm;
+    localtime_r(&timestamp, &tm);
+
+    size_t len = strftime(buffer, size, "%Y-%m-%d %H:%M:%S ", &tm);
+    if (level < LOG_TRACE || level > LOG_FATAL) {
+        level = LOG_FATAL;
+    }
+    const char *module = NULL;
+    int         mlen   = (int)module_name(file, &module);
+    if (mlen > MODULE_NAME_SIZE) {
+        mlen = MODULE_NAME_SIZE;
+    }
+    len += snprintf(&buffer[len], size - len, "%-5s [%.*s] ", level_strings[level], mlen, module);
+    return (int)len;
+}
+
+
+#ifdef TARGET_DEBUG
+static void *benchmark_task(void *arg) {
+    unsigned long records = (unsigned long)(uintptr_t)arg;
+
+    for (unsigned long i = 0; i < records; i++) {
+        log_info("Scrittura concorrente %lu", i);
+        if (i % 64 == 0) {
+            usleep(1000);
+        }
+    }
+
+    return NULL;
+}
+#endif
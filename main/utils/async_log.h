@@ -0,0 +1,49 @@
+#ifndef ASYNC_LOG_H_INCLUDED
+#define ASYNC_LOG_H_INCLUDED
+
+
+#include <stddef.h>
+#include "config/app_conf.h"
+#include "log.h"
+
+
+#if !CONFIG_LOG_DEBUG
+// Gli argomenti restano controllati dal compilatore ma non viene generato codice
+#undef log_trace
+#undef log_debug
+#define log_trace(...)                                                                                                 \
+    do {                                                                                                               \
+        if (0)                                                                                                         \
+            log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__);                                                       \
+    } while (0)
+#define log_debug(...)                                                                                                 \
+    do {                                                                                                               \
+        if (0)                                                                                                         \
+            log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__);                                                       \
+    } while (0)
+#endif
+
+
+#define ASYNC_LOG_ROTATED_SUFFIX ".1"
+
+
+/*
+ * Riceve il file appena chiuso (percorso del log con ASYNC_LOG_ROTATED_SUFFIX) su un thread dedicato;
+ * il file va consumato o rimosso prima che ne possa arrivare un altro
+ */
+typedef void (*async_log_rotate_cb_t)(const char *path);
+
+
+void          async_log_init(const char *path);
+void          async_log_set_rotation(size_t max_size, unsigned long max_age_ms, async_log_rotate_cb_t cb);
+int           async_log_set_module_level(const char *module, int level);
+int           async_log_configure(const char *spec);
+void          async_log_flush(void);
+unsigned long async_log_dropped(void);
+
+#ifdef TARGET_DEBUG
+int async_log_benchmark(unsigned long records);
+#endif
+
+
+#endif
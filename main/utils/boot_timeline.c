@@ -0,0 +1,104 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "gel/timer/timecheck.h"
+#include "system_time.h"
+#include "boot_timeline.h"
+#include "async_log.h"
+
+
+#define MAX_PHASES 24
+
+
+/*
+ *  Istanti delle fasi di avvio, in ms dall'avvio del processo. Le fasi possono essere segnate da thread diversi.
+ */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    unsigned long start;
+    unsigned long process_offset;
+    size_t        num_phases;
+    int           logged;
+    struct {
+        const char   *name;
+        unsigned long timestamp;
+    } phases[MAX_PHASES];
+} timeline = {0};
+
+
+static unsigned long process_age(void);
+
+
+void boot_timeline_init(void) {
+    pthread_mutex_lock(&lock);
+    timeline.start          = get_millis();
+    timeline.process_offset = process_age();
+    timeline.num_phases     = 0;
+    timeline.logged         = 0;
+    pthread_mutex_unlock(&lock);
+
+    boot_timeline_mark("main");
+}
+
+
+void boot_timeline_mark(const char *phase) {
+    pthread_mutex_lock(&lock);
+    if (timeline.num_phases < MAX_PHASES) {
+        timeline.phases[timeline.num_phases].name      = phase;
+        timeline.phases[timeline.num_phases].timestamp =
+            timeline.process_offset + time_interval(timeline.start, get_millis());
+        timeline.num_phases++;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+void boot_timeline_log(void) {
+    pthread_mutex_lock(&lock);
+    if (!timeline.logged) {
+        unsigned long previous = 0;
+
+        log_info("Sequenza di avvio (ms dall'avvio del processo):");
+        for (size_t i = 0; i < timeline.num_phases; i++) {
+            log_info("  %6lu (+%5lu) %s", timeline.phases[i].timestamp, timeline.phases[i].timestamp - previous,
+                     timeline.phases[i].name);
+            previous = timeline.phases[i].timestamp;
+        }
+        timeline.logged = 1;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+/*
+ *  Static functions
+ */
+
+/*
+ * Millisecondi trascorsi dalla creazione del processo, per includere caricamento e inizializzazione statica
+ */
+static unsigned long process_age(void) {
+    unsigned long long starttime = 0;
+    struct timespec    now;
+    FILE              *fp = fopen("/proc/self/stat", "r");
+
+    if (fp == NULL) {
+        return 0;
+    }
+
+    // Il campo 22 e' l'istante di avvio in tick dal boot; il nome del processo (campo 2) non contiene spazi
+    int res = fscanf(fp, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                     &starttime);
+    fclose(fp);
+
+    if (res != 1 || clock_gettime(CLOCK_BOOTTIME, &now) < 0) {
+        return 0;
+    }
+
+    unsigned long long now_ms   = now.tv_sec * 1000ULL + now.tv_nsec / 1000000ULL;
+    unsigned long long start_ms = (starttime * 1000ULL) / sysconf(_SC_CLK_TCK);
+    return now_ms > start_ms ? (unsigned long)(now_ms - start_ms) : 0;
+}
@@ -0,0 +1,10 @@
+#ifndef BOOT_TIMELINE_H_INCLUDED
+#define BOOT_TIMELINE_H_INCLUDED
+
+
+void boot_timeline_init(void);
+void boot_timeline_mark(const char *phase);
+void boot_timeline_log(void);
+
+
+#endif
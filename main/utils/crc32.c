@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "crc32.h"
+
+
+static uint32_t       table[256] = {0};
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+
+static void build_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int j = 0; j < 8; j++) {
+            c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+}
+
+
+/*
+ * CRC-32 (IEEE 802.3, lo stesso di zlib). Puo' essere calcolato a blocchi partendo da CRC32_INIT
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *buffer = data;
+
+    // Piu' worker di disk_op possono arrivare qui insieme
+    pthread_once(&table_once, build_table);
+
+    crc = crc ^ 0xFFFFFFFFUL;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ buffer[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+
+uint32_t crc32(const void *data, size_t len) {
+    return crc32_update(CRC32_INIT, data, len);
+}
@@ -0,0 +1,16 @@
+#ifndef CRC32_H_INCLUDED
+#define CRC32_H_INCLUDED
+
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+#define CRC32_INIT 0
+
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32(const void *data, size_t len);
+
+
+#endif
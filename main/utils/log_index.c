@@ -0,0 +1,550 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_index.h"
+
+
+#define BLOCK_LINES  16     // Righe per blocco prima della prima fusione
+#define BLOOM_BITS   (LOG_INDEX_BLOOM_WORDS * 64)
+#define HEADER_LEVEL 20     // Dopo "AAAA-MM-GG hh:mm:ss "
+#define LEVEL_SIZE   5
+#define MAX_TERMS    8
+#define TERM_PREFIX  4
+
+
+typedef struct {
+    const char *word;
+    size_t      len;
+    uint32_t    hash;
+} term_t;
+
+
+static void     reset_index(log_index_t *index);
+static void     close_file(log_index_t *index);
+static void     unmap_file(log_index_t *index);
+static int      open_file(log_index_t *index);
+static int      remap_file(log_index_t *index, size_t size);
+static void     add_checkpoint(log_index_t *index, size_t offset);
+static void     index_line(log_index_t *index, const char *line, size_t len);
+static size_t   parse_line(log_index_t *index, const char *line, size_t len, int *level, int *module, int add);
+static int      find_module(log_index_t *index, const char *name, size_t len, int add);
+static size_t   next_word(const char *text, size_t len, size_t *position);
+static uint32_t hash_word(const char *word, size_t len);
+static void     bloom_add(log_index_block_t *block, uint32_t hash);
+static int      bloom_test(const log_index_block_t *block, uint32_t hash);
+static size_t   parse_terms(const char *text, term_t *terms);
+static int      block_matches(const log_index_block_t *block, const log_index_filter_t *filter, const term_t *terms,
+                              size_t num_terms);
+static int      line_matches(log_index_t *index, const char *line, size_t len, const log_index_filter_t *filter,
+                             const term_t *terms, size_t num_terms);
+
+
+static const char *level_names[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR", "FATAL"};
+
+
+void log_index_init(log_index_t *index, const char *path) {
+    index->path   = strdup(path);
+    index->fd     = -1;
+    index->inode  = 0;
+    index->map    = NULL;
+    index->mapped = 0;
+    reset_index(index);
+}
+
+
+log_index_update_t log_index_update(log_index_t *index, size_t budget) {
+    log_index_update_t result = LOG_INDEX_UNCHANGED;
+    struct stat        st;
+
+    // Durante la rotazione il file puo' mancare per un istante; si continua con quello aperto
+    if (stat(index->path, &st) == 0 && (index->fd < 0 || st.st_ino != index->inode)) {
+        close_file(index);
+        reset_index(index);
+        if (open_file(index)) {
+            return LOG_INDEX_RESET;
+        }
+        result = LOG_INDEX_RESET;
+    }
+
+    if (index->fd < 0 || fstat(index->fd, &st)) {
+        return result;
+    }
+
+    if ((size_t)st.st_size < index->mapped) {
+        // Il file e' stato troncato: l'indice non e' piu' valido e le pagine oltre la nuova fine darebbero SIGBUS
+        reset_index(index);
+        unmap_file(index);
+        result = LOG_INDEX_RESET;
+    }
+
+    if ((size_t)st.st_size > index->mapped && remap_file(index, st.st_size)) {
+        return result;
+    }
+
+    size_t lines = index->lines;
+    size_t end   = index->indexed + budget < index->mapped ? index->indexed + budget : index->mapped;
+
+    while (index->indexed < end) {
+        char *newline = memchr(&index->map[index->indexed], '\n', end - index->indexed);
+        if (newline == NULL) {
+            index->indexed = end;
+            break;
+        }
+
+        index->indexed = newline - index->map + 1;
+        index_line(index, &index->map[index->tail], newline - &index->map[index->tail]);
+        index->tail = index->indexed;
+        index->lines++;
+        if (index->lines % index->stride == 0) {
+            add_checkpoint(index, index->indexed);
+        }
+    }
+
+    if (result == LOG_INDEX_UNCHANGED && index->lines != lines) {
+        result = LOG_INDEX_GROWN;
+    }
+    return result;
+}
+
+
+size_t log_index_lines(log_index_t *index) {
+    return index->lines;
+}
+
+
+int log_index_is_complete(log_index_t *index) {
+    return index->indexed == index->mapped;
+}
+
+
+size_t log_index_find(log_index_t *index, size_t line) {
+    if (line > index->lines) {
+        line = index->lines;
+    }
+
+    size_t checkpoint = line / index->stride;
+    size_t offset     = index->checkpoints[checkpoint];
+
+    for (size_t i = checkpoint * index->stride; i < line; i++) {
+        char *newline = memchr(&index->map[offset], '\n', index->indexed - offset);
+        offset        = newline - index->map + 1;
+    }
+
+    return offset;
+}
+
+
+size_t log_index_read(log_index_t *index, size_t offset, char *buffer, size_t len) {
+    if (offset >= index->indexed) {
+        buffer[0] = '\0';
+        return index->indexed;
+    }
+
+    char  *start   = &index->map[offset];
+    char  *newline = memchr(start, '\n', index->indexed - offset);
+    size_t next    = newline != NULL ? (size_t)(newline - index->map + 1) : index->indexed;
+    size_t size    = (newline != NULL ? newline : &index->map[index->indexed]) - start;
+
+    if (size > 0 && start[size - 1] == '\r') {
+        size--;
+    }
+    if (size > len - 1) {
+        size = len - 1;
+    }
+
+    memcpy(buffer, start, size);
+    buffer[size] = '\0';
+    return next;
+}
+
+
+size_t log_index_num_modules(log_index_t *index) {
+    return index->num_modules;
+}
+
+
+const char *log_index_module(log_index_t *index, size_t module) {
+    return module < index->num_modules ? index->modules[module] : NULL;
+}
+
+
+void log_index_deinit(log_index_t *index) {
+    close_file(index);
+    free(index->path);
+    index->path = NULL;
+}
+
+
+int log_index_filter_is_empty(const log_index_filter_t *filter) {
+    term_t terms[MAX_TERMS];
+    return filter->levels == 0 && filter->module < 0 && parse_terms(filter->text, terms) == 0;
+}
+
+
+void log_index_search_reset(log_index_results_t *results) {
+    results->count    = 0;
+    results->searched = 0;
+}
+
+
+/*
+ * Esamina le righe aggiunte dall'ultima ricerca. Si leggono solo i blocchi il cui riassunto puo' contenere
+ * righe corrispondenti; ogni parola cercata deve essere l'inizio di una parola del messaggio
+ */
+void log_index_search(log_index_t *index, const log_index_filter_t *filter, log_index_results_t *results) {
+    term_t terms[MAX_TERMS];
+    size_t num_terms = parse_terms(filter->text, terms);
+    size_t line      = results->searched;
+
+    while (line < index->lines) {
+        size_t block = line / index->block_lines;
+        size_t end   = (block + 1) * index->block_lines;
+        if (end > index->lines) {
+            end = index->lines;
+        }
+
+        if (!block_matches(&index->blocks[block], filter, terms, num_terms)) {
+            line = end;
+            continue;
+        }
+
+        size_t offset = log_index_find(index, line);
+        for (; line < end; line++) {
+            const char *start   = &index->map[offset];
+            const char *newline = memchr(start, '\n', index->indexed - offset);
+            size_t      len     = newline - start;
+
+            if (line_matches(index, start, len, filter, terms, num_terms)) {
+                results->lines[results->count % LOG_INDEX_RESULTS] = line;
+                results->count++;
+            }
+            offset += len + 1;
+        }
+    }
+
+    results->searched = index->lines;
+}
+
+
+size_t log_index_results_count(const log_index_results_t *results) {
+    return results->count < LOG_INDEX_RESULTS ? results->count : LOG_INDEX_RESULTS;
+}
+
+
+size_t log_index_result(const log_index_results_t *results, size_t num) {
+    if (results->count > LOG_INDEX_RESULTS) {
+        num += results->count - LOG_INDEX_RESULTS;
+    }
+    return results->lines[num % LOG_INDEX_RESULTS];
+}
+
+
+/*
+ *  Static functions
+ */
+
+
+static void reset_index(log_index_t *index) {
+    index->indexed         = 0;
+    index->tail            = 0;
+    index->lines           = 0;
+    index->stride          = 1;
+    index->num_checkpoints = 1;
+    index->checkpoints[0]  = 0;
+    index->block_lines     = BLOCK_LINES;
+    index->num_modules     = 0;
+    memset(index->blocks, 0, sizeof(index->blocks));
+}
+
+
+static void close_file(log_index_t *index) {
+    unmap_file(index);
+    if (index->fd >= 0) {
+        close(index->fd);
+        index->fd = -1;
+    }
+}
+
+
+static void unmap_file(log_index_t *index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->mapped);
+        index->map    = NULL;
+        index->mapped = 0;
+    }
+}
+
+
+static int open_file(log_index_t *index) {
+    struct stat st;
+
+    index->fd = open(index->path, O_RDONLY | O_CLOEXEC);
+    if (index->fd < 0) {
+        return -1;
+    }
+
+    if (fstat(index->fd, &st)) {
+        close_file(index);
+        return -1;
+    }
+
+    index->inode = st.st_ino;
+    return 0;
+}
+
+
+static int remap_file(log_index_t *index, size_t size) {
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, index->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    if (index->map != NULL) {
+        munmap(index->map, index->mapped);
+    }
+    index->map    = map;
+    index->mapped = size;
+    return 0;
+}
+
+
+static void add_checkpoint(log_index_t *index, size_t offset) {
+    if (index->num_checkpoints == LOG_INDEX_CHECKPOINTS) {
+        // Si tiene un checkpoint su due e si raddoppia la distanza fra uno e l'altro
+        for (size_t i = 0; i < LOG_INDEX_CHECKPOINTS / 2; i++) {
+            index->checkpoints[i] = index->checkpoints[i * 2];
+        }
+        index->num_checkpoints = LOG_INDEX_CHECKPOINTS / 2;
+        index->stride *= 2;
+    }
+
+    if (index->lines % index->stride == 0) {
+        index->checkpoints[index->num_checkpoints++] = offset;
+    }
+}
+
+
+static void index_line(log_index_t *index, const char *line, size_t len) {
+    size_t block = index->lines / index->block_lines;
+
+    if (block >= LOG_INDEX_BLOCKS) {
+        // Come per i checkpoint: i blocchi vengono fusi a coppie e ne raddoppia la dimensione
+        for (size_t i = 0; i < LOG_INDEX_BLOCKS / 2; i++) {
+            log_index_block_t *first  = &index->blocks[i * 2];
+            log_index_block_t *second = &index->blocks[i * 2 + 1];
+
+            index->blocks[i].levels  = first->levels | second->levels;
+            index->blocks[i].modules = first->modules | second->modules;
+            for (size_t j = 0; j < LOG_INDEX_BLOOM_WORDS; j++) {
+                index->blocks[i].bloom[j] = first->bloom[j] | second->bloom[j];
+            }
+        }
+        memset(&index->blocks[LOG_INDEX_BLOCKS / 2], 0, sizeof(index->blocks) / 2);
+        index->block_lines *= 2;
+        block = index->lines / index->block_lines;
+    }
+
+    log_index_block_t *summary = &index->blocks[block];
+    int                level   = LOG_INDEX_LEVEL_OTHER;
+    int                module  = -1;
+    size_t             start   = parse_line(index, line, len, &level, &module, 1);
+
+    summary->levels |= LOG_INDEX_LEVEL(level);
+    if (module >= 0) {
+        summary->modules |= 1UL << module;
+    }
+
+    size_t position = start;
+    size_t size     = 0;
+    while ((size = next_word(line, len, &position)) > 0) {
+        if (size >= TERM_PREFIX - 1) {
+            bloom_add(summary, hash_word(&line[position], TERM_PREFIX - 1));
+        }
+        if (size >= TERM_PREFIX) {
+            bloom_add(summary, hash_word(&line[position], TERM_PREFIX));
+        }
+        position += size;
+    }
+}
+
+
+/*
+ * Riconosce l'intestazione scritta da async_log ("AAAA-MM-GG hh:mm:ss LIVEL [modulo] ");
+ * ritorna la posizione del messaggio
+ */
+static size_t parse_line(log_index_t *index, const char *line, size_t len, int *level, int *module, int add) {
+    *level  = LOG_INDEX_LEVEL_OTHER;
+    *module = -1;
+
+    if (len <= HEADER_LEVEL + LEVEL_SIZE || line[4] != '-' || line[HEADER_LEVEL - 1] != ' ' ||
+        line[HEADER_LEVEL + LEVEL_SIZE] != ' ') {
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+        if (memcmp(&line[HEADER_LEVEL], level_names[i], LEVEL_SIZE) == 0) {
+            *level = (int)i;
+            break;
+        }
+    }
+    if (*level == LOG_INDEX_LEVEL_OTHER) {
+        return 0;
+    }
+
+    size_t position = HEADER_LEVEL + LEVEL_SIZE + 1;
+    if (position < len && line[position] == '[') {
+        size_t      max   = len - position - 1 < LOG_INDEX_MODULE_SIZE ? len - position - 1 : LOG_INDEX_MODULE_SIZE;
+        const char *close = memchr(&line[position + 1], ']', max);
+
+        if (close != NULL) {
+            *module  = find_module(index, &line[position + 1], close - &line[position + 1], add);
+            position = close - line + 1;
+            if (position < len && line[position] == ' ') {
+                position++;
+            }
+        }
+    }
+
+    return position;
+}
+
+
+static int find_module(log_index_t *index, const char *name, size_t len, int add) {
+    if (len == 0 || len >= LOG_INDEX_MODULE_SIZE) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < index->num_modules; i++) {
+        if (strncmp(index->modules[i], name, len) == 0 && index->modules[i][len] == '\0') {
+            return (int)i;
+        }
+    }
+
+    if (!add || index->num_modules == LOG_INDEX_MODULES) {
+        return -1;
+    }
+
+    memcpy(index->modules[index->num_modules], name, len);
+    index->modules[index->num_modules][len] = '\0';
+    return (int)index->num_modules++;
+}
+
+
+/*
+ * Cerca la prossima parola (lettere, cifre e '_') a partire da *position; ritorna la lunghezza, 0 se finite
+ */
+static size_t next_word(const char *text, size_t len, size_t *position) {
+    size_t start = *position;
+    while (start < len && !isalnum((unsigned char)text[start]) && text[start] != '_') {
+        start++;
+    }
+
+    size_t end = start;
+    while (end < len && (isalnum((unsigned char)text[end]) || text[end] == '_')) {
+        end++;
+    }
+
+    *position = start;
+    return end - start;
+}
+
+
+static uint32_t hash_word(const char *word, size_t len) {
+    // FNV-1a, senza distinzione fra maiuscole e minuscole
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)tolower((unsigned char)word[i]);
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+
+static void bloom_add(log_index_block_t *block, uint32_t hash) {
+    uint32_t first  = hash % BLOOM_BITS;
+    uint32_t second = (hash >> 16) % BLOOM_BITS;
+    block->bloom[first / 64] |= 1ULL << (first % 64);
+    block->bloom[second / 64] |= 1ULL << (second % 64);
+}
+
+
+static int bloom_test(const log_index_block_t *block, uint32_t hash) {
+    uint32_t first  = hash % BLOOM_BITS;
+    uint32_t second = (hash >> 16) % BLOOM_BITS;
+    return (block->bloom[first / 64] & (1ULL << (first % 64))) && (block->bloom[second / 64] & (1ULL << (second % 64)));
+}
+
+
+static size_t parse_terms(const char *text, term_t *terms) {
+    size_t len      = strnlen(text, LOG_INDEX_SEARCH_SIZE);
+    size_t position = 0;
+    size_t size     = 0;
+    size_t num      = 0;
+
+    while (num < MAX_TERMS && (size = next_word(text, len, &position)) > 0) {
+        terms[num].word = &text[position];
+        terms[num].len  = size;
+        // Le parole piu' corte di un prefisso indicizzato non possono scartare blocchi
+        terms[num].hash = hash_word(&text[position], size < TERM_PREFIX ? size : TERM_PREFIX);
+        position += size;
+        num++;
+    }
+
+    return num;
+}
+
+
+static int block_matches(const log_index_block_t *block, const log_index_filter_t *filter, const term_t *terms,
+                         size_t num_terms) {
+    if (filter->levels != 0 && (block->levels & filter->levels) == 0) {
+        return 0;
+    }
+    if (filter->module >= 0 && (block->modules & (1UL << filter->module)) == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < num_terms; i++) {
+        if (terms[i].len >= TERM_PREFIX - 1 && !bloom_test(block, terms[i].hash)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static int line_matches(log_index_t *index, const char *line, size_t len, const log_index_filter_t *filter,
+                        const term_t *terms, size_t num_terms) {
+    int    level  = LOG_INDEX_LEVEL_OTHER;
+    int    module = -1;
+    size_t start  = parse_line(index, line, len, &level, &module, 0);
+
+    if (filter->levels != 0 && (LOG_INDEX_LEVEL(level) & filter->levels) == 0) {
+        return 0;
+    }
+    if (filter->module >= 0 && module != filter->module) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < num_terms; i++) {
+        size_t position = start;
+        size_t size     = 0;
+        int    found    = 0;
+
+        while (!found && (size = next_word(line, len, &position)) > 0) {
+            found = size >= terms[i].len && strncasecmp(&line[position], terms[i].word, terms[i].len) == 0;
+            position += size;
+        }
+
+        if (!found) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,100 @@
+#ifndef LOG_INDEX_H_INCLUDED
+#define LOG_INDEX_H_INCLUDED
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+#define LOG_INDEX_CHECKPOINTS  1024
+#define LOG_INDEX_BLOCKS       256
+#define LOG_INDEX_BLOOM_WORDS  16     // 1024 bit per blocco
+#define LOG_INDEX_MODULES      32
+#define LOG_INDEX_MODULE_SIZE  24
+#define LOG_INDEX_RESULTS      2048
+#define LOG_INDEX_SEARCH_SIZE  32
+#define LOG_INDEX_LEVEL_OTHER  6     // Righe senza intestazione riconoscibile
+#define LOG_INDEX_LEVEL(level) (1 << (level))
+
+
+typedef enum {
+    LOG_INDEX_UNCHANGED = 0,
+    LOG_INDEX_GROWN,
+    LOG_INDEX_RESET,
+} log_index_update_t;
+
+
+/*
+ * Riassunto di un gruppo di righe consecutive: livelli e moduli presenti e un filtro di Bloom
+ * sulle parole del messaggio
+ */
+typedef struct {
+    uint8_t  levels;
+    uint32_t modules;
+    uint64_t bloom[LOG_INDEX_BLOOM_WORDS];
+} log_index_block_t;
+
+
+/*
+ * Indice delle righe di un file di log mappato in memoria. Viene salvato l'offset di una riga ogni `stride`;
+ * quando i checkpoint finiscono lo stride raddoppia, per cui l'occupazione non dipende dalla dimensione del file.
+ * Allo stesso modo i blocchi vengono fusi a coppie quando sono esauriti.
+ */
+typedef struct {
+    char  *path;
+    int    fd;
+    ino_t  inode;
+    char  *map;
+    size_t mapped;
+
+    size_t indexed;
+    size_t tail;
+    size_t lines;
+    size_t stride;
+    size_t num_checkpoints;
+    size_t checkpoints[LOG_INDEX_CHECKPOINTS];
+
+    size_t            block_lines;
+    log_index_block_t blocks[LOG_INDEX_BLOCKS];
+
+    size_t num_modules;
+    char   modules[LOG_INDEX_MODULES][LOG_INDEX_MODULE_SIZE];
+} log_index_t;
+
+
+typedef struct {
+    uint8_t levels;     // Maschera di LOG_INDEX_LEVEL, 0 per tutti
+    int     module;     // Indice in log_index_t.modules, -1 per tutti
+    char    text[LOG_INDEX_SEARCH_SIZE];
+} log_index_filter_t;
+
+
+/*
+ * Righe trovate; se sono piu' di LOG_INDEX_RESULTS vengono tenute le ultime
+ */
+typedef struct {
+    size_t   count;
+    size_t   searched;
+    uint32_t lines[LOG_INDEX_RESULTS];
+} log_index_results_t;
+
+
+void               log_index_init(log_index_t *index, const char *path);
+log_index_update_t log_index_update(log_index_t *index, size_t budget);
+size_t             log_index_lines(log_index_t *index);
+int                log_index_is_complete(log_index_t *index);
+size_t             log_index_find(log_index_t *index, size_t line);
+size_t             log_index_read(log_index_t *index, size_t offset, char *buffer, size_t len);
+size_t             log_index_num_modules(log_index_t *index);
+const char        *log_index_module(log_index_t *index, size_t module);
+void               log_index_deinit(log_index_t *index);
+
+int    log_index_filter_is_empty(const log_index_filter_t *filter);
+void   log_index_search_reset(log_index_results_t *results);
+void   log_index_search(log_index_t *index, const log_index_filter_t *filter, log_index_results_t *results);
+size_t log_index_results_count(const log_index_results_t *results);
+size_t log_index_result(const log_index_results_t *results, size_t num);
+
+
+#endif
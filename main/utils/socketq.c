@@ -13,7 +13,7 @@
 #include <sys/types.h>
 #include <sys/un.h>
 #include "socketq.h"
-#include "log.h"
+#include "async_log.h"
 
 
 int socketq_init(socketq_t *socketq, char *path, size_t msg_size) {
@@ -7,7 +7,7 @@
 #include <string.h>
 #include <linux/rtc.h>
 #include <sys/ioctl.h>
-#include "log.h"
+#include "async_log.h"
 
 
 #define RTC_PATH     "/dev/rtc0"
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lvgl.h"
+#include "view/view.h"
+#include "view/intl/intl.h"
+#include "view/common.h"
+#include "model/model.h"
+
+
+enum {
+    BACK_BTN_ID,
+    EXPORT_BTN_ID,
+};
+
+
+// L'esportazione non porta un identificativo
+enum {
+    EXPORT_IO_ID = 0,
+    MONTH_IO_ID,
+    DAY_IO_ID,
+};
+
+
+struct page_data {
+    lv_obj_t *counts_table;
+    lv_obj_t *events_table;
+    lv_obj_t *export_btn;
+    lv_obj_t *blanket;
+
+    view_controller_message_t cmsg;
+};
+
+
+static void     update_export_button(model_t *pmodel, struct page_data *data);
+static void     update_counts(struct page_data *data, const alarm_history_t *history, int column);
+static void     update_events(model_t *pmodel, struct page_data *data, const alarm_history_t *history);
+static void     request_history(struct page_data *data, int io_op, uint32_t from);
+static uint32_t start_of(int month);
+
+
+static const strings_t alarm_names[NUM_ALARM_CODES] = {
+    STRINGS_PULSANTE_EMERGENZA,
+    STRINGS_TEMPERATURA,
+    STRINGS_RISCALDAMENTO,
+    STRINGS_OBLO,
+};
+
+
+static void *create_page(pman_handle_t handle, void *extra) {
+    struct page_data *data = (struct page_data *)malloc(sizeof(struct page_data));
+    return data;
+}
+
+
+static void open_page(pman_handle_t handle, void *state) {
+    struct page_data *data = state;
+    data->blanket          = NULL;
+
+    model_updater_t updater = pman_get_user_data(handle);
+    model_t        *pmodel  = (model_t *)model_updater_get(updater);
+
+    view_common_create_title(lv_scr_act(), view_intl_get_string(pmodel, STRINGS_EVENTI), BACK_BTN_ID);
+
+    lv_obj_t *page = lv_obj_create(lv_scr_act());
+    lv_obj_set_size(page, LV_PCT(95), LV_PCT(85));
+    lv_obj_align(page, LV_ALIGN_BOTTOM_MID, 0, 0);
+
+    lv_obj_t *table = lv_table_create(page);
+    lv_obj_align(table, LV_ALIGN_TOP_LEFT, 0, 0);
+    lv_table_set_col_cnt(table, 3);
+    lv_table_set_row_cnt(table, NUM_ALARM_CODES + 1);
+    lv_table_set_col_width(table, 0, 180);
+    lv_table_set_col_width(table, 1, 80);
+    lv_table_set_col_width(table, 2, 100);
+    lv_obj_set_style_bg_color(table, lv_palette_main(LV_PALETTE_YELLOW), LV_STATE_DEFAULT | LV_PART_ITEMS);
+
+    lv_table_set_cell_value(table, 0, 0, view_intl_get_string(pmodel, STRINGS_CODICE_ALLARME));
+    lv_table_set_cell_value(table, 0, 1, view_intl_get_string(pmodel, STRINGS_OGGI));
+    lv_table_set_cell_value(table, 0, 2, view_intl_get_string(pmodel, STRINGS_QUESTO_MESE));
+    for (size_t i = 0; i < NUM_ALARM_CODES; i++) {
+        lv_table_set_cell_value_fmt(table, i + 1, 0, "%i - %s", (int)i + 1,
+                                    view_intl_get_string(pmodel, alarm_names[i]));
+        lv_table_set_cell_value(table, i + 1, 1, "-");
+        lv_table_set_cell_value(table, i + 1, 2, "-");
+    }
+    data->counts_table = table;
+
+    lv_obj_t *btn = lv_btn_create(page);
+    lv_obj_set_size(btn, 360, 60);
+    lv_obj_t *lbl = lv_label_create(btn);
+    lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
+    lv_obj_set_width(lbl, 340);
+    lv_obj_set_style_text_align(lbl, LV_TEXT_ALIGN_CENTER, LV_STATE_DEFAULT);
+    lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_ESPORTA_ALLARMI_SU_CHIAVETTA));
+    lv_obj_center(lbl);
+    lv_obj_align(btn, LV_ALIGN_BOTTOM_LEFT, 0, 0);
+    view_register_object_default_callback(btn, EXPORT_BTN_ID);
+    data->export_btn = btn;
+
+    table = lv_table_create(page);
+    lv_obj_set_size(table, 380, LV_PCT(100));
+    lv_obj_align(table, LV_ALIGN_TOP_RIGHT, 0, 0);
+    lv_table_set_col_cnt(table, 3);
+    lv_table_set_row_cnt(table, 0);
+    lv_table_set_col_width(table, 0, 150);
+    lv_table_set_col_width(table, 1, 100);
+    lv_table_set_col_width(table, 2, 110);
+    data->events_table = table;
+
+    update_export_button(pmodel, data);
+}
+
+
+static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_event_t event) {
+    pman_msg_t        msg  = PMAN_MSG_NULL;
+    struct page_data *data = state;
+
+    model_updater_t updater = pman_get_user_data(handle);
+    model_t        *pmodel  = (model_t *)model_updater_get(updater);
+
+    data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_NOTHING;
+    msg.user_msg    = &data->cmsg;
+
+    switch (event.tag) {
+        case PMAN_EVENT_TAG_OPEN:
+            // Prima il mese, che porta anche gli ultimi eventi; i contatori di oggi seguono
+            request_history(data, MONTH_IO_ID, start_of(1));
+            break;
+
+        case PMAN_EVENT_TAG_LVGL: {
+            lv_obj_t           *target  = lv_event_get_current_target(event.as.lvgl);
+            view_object_data_t *objdata = lv_obj_get_user_data(target);
+
+            if (lv_event_get_code(event.as.lvgl) == LV_EVENT_CLICKED) {
+                switch (objdata->id) {
+                    case BACK_BTN_ID:
+                        msg.stack_msg.tag = PMAN_STACK_MSG_TAG_BACK;
+                        break;
+
+                    case EXPORT_BTN_ID:
+                        if (data->blanket != NULL) {
+                            lv_obj_del(data->blanket);
+                        }
+                        data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_ALARMS;
+                        data->blanket   = view_common_create_blanket(lv_scr_act());
+                        break;
+                }
+            }
+            break;
+        }
+
+        case PMAN_EVENT_TAG_USER: {
+            view_event_t *user_event = event.as.user;
+            switch (user_event->code) {
+                case VIEW_EVENT_CODE_DRIVE:
+                    update_export_button(pmodel, data);
+                    break;
+
+                case VIEW_EVENT_CODE_IO_DONE:
+                    switch (user_event->io_op) {
+                        case MONTH_IO_ID:
+                            if (!user_event->error) {
+                                update_counts(data, user_event->io_data, 2);
+                                update_events(pmodel, data, user_event->io_data);
+                            }
+                            request_history(data, DAY_IO_ID, start_of(0));
+                            break;
+
+                        case DAY_IO_ID:
+                            if (!user_event->error) {
+                                update_counts(data, user_event->io_data, 1);
+                            }
+                            break;
+
+                        default:
+                            if (data->blanket != NULL) {
+                                lv_obj_del(data->blanket);
+                            }
+                            data->blanket = NULL;
+
+                            if (user_event->error) {
+                                view_common_io_error_toast(pmodel);
+                            }
+                            break;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return msg;
+}
+
+
+const pman_page_t page_alarms = {
+    .create        = create_page,
+    .open          = open_page,
+    .close         = pman_close_all,
+    .destroy       = pman_destroy_all,
+    .process_event = process_page_event,
+};
+
+
+/*
+ *  Static functions
+ */
+
+static void update_export_button(model_t *pmodel, struct page_data *data) {
+    if (model_is_drive_mounted(pmodel)) {
+        lv_obj_clear_state(data->export_btn, LV_STATE_DISABLED);
+    } else {
+        lv_obj_add_state(data->export_btn, LV_STATE_DISABLED);
+    }
+}
+
+
+static void update_counts(struct page_data *data, const alarm_history_t *history, int column) {
+    for (size_t i = 0; i < NUM_ALARM_CODES; i++) {
+        lv_table_set_cell_value_fmt(data->counts_table, i + 1, column, "%u", (unsigned int)history->counts[i]);
+    }
+}
+
+
+static void update_events(model_t *pmodel, struct page_data *data, const alarm_history_t *history) {
+    lv_table_set_row_cnt(data->events_table, history->count);
+
+    for (size_t i = 0; i < history->count; i++) {
+        const alarm_event_t *event = &history->events[i];
+
+        char      string[32] = {0};
+        time_t    timestamp  = event->timestamp;
+        struct tm tm         = *localtime(&timestamp);
+        strftime(string, sizeof(string), "%d/%m %H:%M", &tm);
+        lv_table_set_cell_value(data->events_table, i, 0, string);
+
+        lv_table_set_cell_value_fmt(data->events_table, i, 1, "%s %i",
+                                    (event->flags & ALARM_EVENT_FLAG_RAISED) ? LV_SYMBOL_WARNING : LV_SYMBOL_OK,
+                                    event->code + 1);
+
+        if (event->program_number == ALARM_EVENT_NO_PROGRAM) {
+            lv_table_set_cell_value(data->events_table, i, 2, "-");
+        } else {
+            lv_table_set_cell_value_fmt(data->events_table, i, 2, "P%i/%i", event->program_number + 1,
+                                        event->step + 1);
+        }
+    }
+}
+
+
+static void request_history(struct page_data *data, int io_op, uint32_t from) {
+    data->cmsg.code          = VIEW_CONTROLLER_MESSAGE_CODE_READ_ALARM_HISTORY;
+    data->cmsg.history_io_op = io_op;
+    data->cmsg.from          = from;
+    data->cmsg.to            = (uint32_t)time(NULL);
+}
+
+
+// Mezzanotte di oggi o del primo giorno del mese
+static uint32_t start_of(int month) {
+    time_t    now = time(NULL);
+    struct tm tm  = *localtime(&now);
+    if (month) {
+        tm.tm_mday = 1;
+    }
+    tm.tm_hour  = 0;
+    tm.tm_min   = 0;
+    tm.tm_sec   = 0;
+    tm.tm_isdst = -1;
+    return (uint32_t)mktime(&tm);
+}
@@ -19,6 +19,8 @@ enum {
     LIST_ITEM_ID,
     BTN_FIRMWARE_UPDATE_ID,
     FIRMWARE_CONFIRM_BTN_ID,
+    ABORT_BTN_ID,
+    EXPORT_LOG_BTN_ID,
 };
 
 
@@ -28,6 +30,7 @@ struct page_data {
     lv_obj_t *btn_update;
     lv_obj_t *list;
     size_t    selected_archive;
+    int       aborted;
 
     view_controller_message_t cmsg;
 };
@@ -96,6 +99,8 @@ static void update_buttons(struct page_data *data, model_t *pmodel) {
 
 static void open_page(pman_handle_t handle, void *arg) {
     struct page_data *data = arg;
+    data->blanket          = NULL;
+    data->aborted          = 0;
 
     model_updater_t updater = pman_get_user_data(handle);
     model_t        *pmodel  = (model_t *)model_updater_get(updater);
@@ -107,7 +112,7 @@ static void open_page(pman_handle_t handle, void *arg) {
     lv_obj_t *lbl = lv_label_create(btn);
     lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
     lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_ESPORTA_MACCHINA_SU_CHIAVETTA));
-    lv_obj_set_size(btn, 420, 100);
+    lv_obj_set_size(btn, 420, 80);
     lv_obj_align(btn, LV_ALIGN_TOP_LEFT, 4, 100);
     view_register_object_default_callback(btn, EXPORT_BTN_ID);
     lv_obj_t *prev = btn;
@@ -116,8 +121,8 @@ static void open_page(pman_handle_t handle, void *arg) {
     lbl = lv_label_create(btn);
     lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
     lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_IMPORTA_MACCHINA_DA_CHIAVETTA));
-    lv_obj_set_size(btn, 420, 100);
-    lv_obj_align_to(btn, prev, LV_ALIGN_OUT_BOTTOM_MID, 0, 20);
+    lv_obj_set_size(btn, 420, 80);
+    lv_obj_align_to(btn, prev, LV_ALIGN_OUT_BOTTOM_MID, 0, 12);
     view_register_object_default_callback(btn, IMPORT_BTN_ID);
     data->import_btn = btn;
     prev             = btn;
@@ -126,10 +131,19 @@ static void open_page(pman_handle_t handle, void *arg) {
     lbl = lv_label_create(btn);
     lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
     lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_AGGIORNA_FIRMWARE));
-    lv_obj_set_size(btn, 420, 100);
-    lv_obj_align_to(btn, prev, LV_ALIGN_OUT_BOTTOM_MID, 0, 20);
+    lv_obj_set_size(btn, 420, 80);
+    lv_obj_align_to(btn, prev, LV_ALIGN_OUT_BOTTOM_MID, 0, 12);
     view_register_object_default_callback(btn, BTN_FIRMWARE_UPDATE_ID);
     data->btn_update = btn;
+    prev             = btn;
+
+    btn = lv_btn_create(lv_scr_act());
+    lbl = lv_label_create(btn);
+    lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
+    lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_ESPORTA_LOG_SU_CHIAVETTA));
+    lv_obj_set_size(btn, 420, 80);
+    lv_obj_align_to(btn, prev, LV_ALIGN_OUT_BOTTOM_MID, 0, 12);
+    view_register_object_default_callback(btn, EXPORT_LOG_BTN_ID);
 
     lv_obj_t *img = lv_img_create(lv_scr_act());
     lv_img_set_src(img, &img_thumb_drive);
@@ -161,6 +175,26 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *arg, pman_event
                     }
                     break;
 
+                case VIEW_EVENT_CODE_IO_PROGRESS:
+                    if (data->blanket != NULL) {
+                        // La prima etichetta sul velo mostra l'avanzamento
+                        lv_obj_t *lbl = lv_obj_get_child(data->blanket, 0);
+                        if (lbl == NULL || !lv_obj_check_type(lbl, &lv_label_class)) {
+                            lbl = lv_label_create(data->blanket);
+                            lv_obj_set_style_text_color(lbl, lv_color_white(), LV_STATE_DEFAULT);
+                            lv_obj_center(lbl);
+
+                            lv_obj_t *btn     = lv_btn_create(data->blanket);
+                            lv_obj_t *btn_lbl = lv_label_create(btn);
+                            lv_label_set_text(btn_lbl, LV_SYMBOL_CLOSE);
+                            lv_obj_set_width(btn, 120);
+                            lv_obj_align_to(btn, lbl, LV_ALIGN_OUT_BOTTOM_MID, 0, 24);
+                            view_register_object_default_callback(btn, ABORT_BTN_ID);
+                        }
+                        lv_label_set_text_fmt(lbl, "%i%%", user_event->io_progress);
+                    }
+                    break;
+
                 case VIEW_EVENT_CODE_IO_DONE:
                     if (data->blanket != NULL) {
                         lv_obj_del(data->blanket);
@@ -168,9 +202,11 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *arg, pman_event
                     data->blanket = NULL;
                     update_buttons(data, pmodel);
 
-                    if (user_event->error) {
+                    // Un'operazione annullata non e' un errore da segnalare
+                    if (user_event->error && !data->aborted) {
                         view_common_io_error_toast(pmodel);
                     }
+                    data->aborted = 0;
                     break;
 
                 default:
@@ -194,6 +230,12 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *arg, pman_event
                         data->selected_archive = objdata->number;
                         break;
 
+                    case ABORT_BTN_ID:
+                        data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_CANCEL_IO;
+                        data->aborted   = 1;
+                        lv_obj_add_state(lv_event_get_target(event.as.lvgl), LV_STATE_DISABLED);
+                        break;
+
                     case CANCEL_BTN_ID:
                         if (data->blanket != NULL) {
                             lv_obj_del(data->blanket);
@@ -252,6 +294,11 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *arg, pman_event
                         data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_FIRMWARE_UPDATE;
                         data->blanket   = view_common_create_blanket(lv_scr_act());
                         break;
+
+                    case EXPORT_LOG_BTN_ID:
+                        data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_LOGS;
+                        data->blanket   = view_common_create_blanket(lv_scr_act());
+                        break;
                 }
             }
             break;
@@ -1,25 +1,90 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "lvgl.h"
 #include "view/view.h"
 #include "view/intl/intl.h"
 #include "view/common.h"
 #include "model/model.h"
+#include "config/app_conf.h"
+#include "utils/async_log.h"
+#include "utils/log_index.h"
+
+
+#define VISIBLE_LINES 10
+#define LINE_HEIGHT   26
+#define LINE_LENGTH   160
+#define INDEX_BUDGET  (256UL * 1024UL)
+#define UPDATE_PERIOD 200UL
+#define ERROR_LEVELS  (LOG_INDEX_LEVEL(LOG_ERROR) | LOG_INDEX_LEVEL(LOG_FATAL))
+#define WARN_LEVELS   (LOG_INDEX_LEVEL(LOG_WARN))
 
 
 enum {
     BACK_BTN_ID,
+    TOP_BTN_ID,
+    PAGE_UP_BTN_ID,
+    PAGE_DOWN_BTN_ID,
+    BOTTOM_BTN_ID,
+    FOLLOW_BTN_ID,
+    ERROR_CHIP_ID,
+    WARN_CHIP_ID,
+    MODULE_DD_ID,
+    SEARCH_TA_ID,
+    SEARCH_KB_ID,
+    UPDATE_TIMER_ID,
 };
 
 
 struct page_data {
-    char *logdata;
+    lv_obj_t *rows[VISIBLE_LINES];
+    lv_obj_t *lposition;
+    lv_obj_t *btn_follow;
+    lv_obj_t *chip_error;
+    lv_obj_t *chip_warn;
+    lv_obj_t *dd_module;
+    lv_obj_t *ta_search;
+    lv_obj_t *kb;
+
+    // Le righe visibili vengono copiate qui e mostrate con lv_label_set_text_static
+    char text[VISIBLE_LINES][LINE_LENGTH];
+    char options[LOG_INDEX_MODULES * (LOG_INDEX_MODULE_SIZE + 1) + 64];
+
+    size_t        first;
+    int           follow;
+    int           filtered;
+    size_t        num_modules;
+    pman_timer_t *timer;
+
+    log_index_filter_t  filter;
+    log_index_results_t results;
+    log_index_t         index;
 };
 
 
+static void      apply_filter(struct page_data *data);
+static void      update_filter_bar(struct page_data *data);
+static void      update_modules(model_t *pmodel, struct page_data *data);
+static void      update_position(struct page_data *data);
+static void      update_rows(struct page_data *data);
+static size_t    total_lines(struct page_data *data);
+static size_t    last_page(struct page_data *data);
+static lv_obj_t *create_chip(lv_obj_t *parent, const char *text, int id);
+static lv_obj_t *create_search_kb(struct page_data *data);
+
+
 static void *create_page(pman_handle_t handle, void *extra) {
-    (void)handle;
+    (void)extra;
     struct page_data *data = (struct page_data *)malloc(sizeof(struct page_data));
-    data->logdata          = extra;
+    data->timer            = PMAN_REGISTER_TIMER_ID(handle, UPDATE_PERIOD, UPDATE_TIMER_ID);
+    data->first            = 0;
+    data->follow           = 1;
+    data->filtered         = 0;
+    data->filter.levels    = 0;
+    data->filter.module    = -1;
+    data->filter.text[0]   = '\0';
+    log_index_search_reset(&data->results);
+    log_index_init(&data->index, LOGFILE);
     return data;
 }
 
@@ -30,45 +95,212 @@ static void open_page(pman_handle_t handle, void *state) {
     model_updater_t updater = pman_get_user_data(handle);
     model_t        *pmodel  = (model_t *)model_updater_get(updater);
 
+    data->kb = NULL;
+
     view_common_create_title(lv_scr_act(), view_intl_get_string(pmodel, STRINGS_VERBALE), BACK_BTN_ID);
 
-    lv_obj_t *page = lv_obj_create(lv_scr_act());
-    lv_obj_set_size(page, LV_PCT(100), LV_PCT(85));
-    lv_obj_align(page, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_t *label = lv_label_create(page);
-    lv_label_set_long_mode(label, LV_LABEL_LONG_WRAP);
-    lv_obj_set_width(label, LV_PCT(95));
+    data->chip_error = create_chip(lv_scr_act(), "ERROR", ERROR_CHIP_ID);
+    lv_obj_align(data->chip_error, LV_ALIGN_TOP_LEFT, 8, 72);
 
-    if (data->logdata != NULL) {
-        lv_label_set_text(label, data->logdata);
+    data->chip_warn = create_chip(lv_scr_act(), "WARN", WARN_CHIP_ID);
+    lv_obj_align_to(data->chip_warn, data->chip_error, LV_ALIGN_OUT_RIGHT_MID, 8, 0);
+
+    data->dd_module = lv_dropdown_create(lv_scr_act());
+    lv_obj_set_size(data->dd_module, 200, 56);
+    lv_obj_align_to(data->dd_module, data->chip_warn, LV_ALIGN_OUT_RIGHT_MID, 8, 0);
+    view_register_object_default_callback(data->dd_module, MODULE_DD_ID);
+
+    data->ta_search = lv_textarea_create(lv_scr_act());
+    lv_obj_set_size(data->ta_search, 240, 56);
+    lv_textarea_set_one_line(data->ta_search, 1);
+    lv_textarea_set_placeholder_text(data->ta_search, view_intl_get_string(pmodel, STRINGS_CERCA));
+    lv_textarea_set_text(data->ta_search, data->filter.text);
+    lv_obj_clear_flag(data->ta_search, LV_OBJ_FLAG_CLICK_FOCUSABLE);
+    lv_obj_align_to(data->ta_search, data->dd_module, LV_ALIGN_OUT_RIGHT_MID, 8, 0);
+    view_register_object_default_callback(data->ta_search, SEARCH_TA_ID);
+
+    lv_obj_t *cont = lv_obj_create(lv_scr_act());
+    lv_obj_clear_flag(cont, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_set_scrollbar_mode(cont, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_pad_all(cont, 8, LV_STATE_DEFAULT);
+    lv_obj_set_size(cont, LV_HOR_RES - 96, VISIBLE_LINES * LINE_HEIGHT + 16);
+    lv_obj_align(cont, LV_ALIGN_TOP_LEFT, 8, 136);
+
+    for (size_t i = 0; i < VISIBLE_LINES; i++) {
+        lv_obj_t *lbl = lv_label_create(cont);
+        lv_obj_set_style_text_font(lbl, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+        lv_label_set_long_mode(lbl, LV_LABEL_LONG_CLIP);
+        lv_obj_set_size(lbl, LV_PCT(100), LINE_HEIGHT);
+        lv_obj_align(lbl, LV_ALIGN_TOP_LEFT, 0, i * LINE_HEIGHT);
+        data->text[i][0] = '\0';
+        lv_label_set_text_static(lbl, data->text[i]);
+        data->rows[i] = lbl;
     }
 
-    lv_obj_t *obj = lv_label_create(page);
-    lv_label_set_text(obj, "");
-    lv_obj_align_to(obj, label, LV_ALIGN_OUT_BOTTOM_MID, 0, 0);
-    lv_obj_scroll_to_view(obj, 0);
+    data->lposition = lv_label_create(lv_scr_act());
+    lv_obj_set_style_text_font(data->lposition, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_obj_align_to(data->lposition, cont, LV_ALIGN_OUT_BOTTOM_LEFT, 8, 6);
+
+    const struct {
+        char *symbol;
+        int   id;
+    } buttons[] = {
+        {LV_SYMBOL_UPLOAD, TOP_BTN_ID},      {LV_SYMBOL_UP, PAGE_UP_BTN_ID}, {LV_SYMBOL_DOWN, PAGE_DOWN_BTN_ID},
+        {LV_SYMBOL_DOWNLOAD, BOTTOM_BTN_ID}, {LV_SYMBOL_LOOP, FOLLOW_BTN_ID},
+    };
+
+    for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+        lv_obj_t *btn = view_common_icon_button(lv_scr_act(), buttons[i].symbol, buttons[i].id);
+        lv_obj_align(btn, LV_ALIGN_TOP_RIGHT, -8, 72 + i * 72);
+        if (buttons[i].id == FOLLOW_BTN_ID) {
+            data->btn_follow = btn;
+        }
+    }
+
+    log_index_update(&data->index, INDEX_BUDGET);
+    data->num_modules = (size_t)-1;
+    update_modules(pmodel, data);
+    update_filter_bar(data);
+    apply_filter(data);
+    pman_timer_resume(data->timer);
 }
 
 
 static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_event_t event) {
     pman_msg_t        msg  = PMAN_MSG_NULL;
     struct page_data *data = state;
-    (void)data;
-    (void)handle;
+
+    model_updater_t updater = pman_get_user_data(handle);
+    model_t        *pmodel  = (model_t *)model_updater_get(updater);
 
     switch (event.tag) {
-        case PMAN_EVENT_TAG_LVGL:
-            if (lv_event_get_code(event.as.lvgl) == LV_EVENT_CLICKED) {
-                lv_obj_t           *target  = lv_event_get_target(event.as.lvgl);
-                view_object_data_t *objdata = lv_obj_get_user_data(target);
+        case PMAN_EVENT_TAG_LVGL: {
+            lv_obj_t           *target  = lv_event_get_current_target(event.as.lvgl);
+            view_object_data_t *objdata = lv_obj_get_user_data(target);
 
+            if (lv_event_get_code(event.as.lvgl) == LV_EVENT_CLICKED) {
                 switch (objdata->id) {
                     case BACK_BTN_ID:
                         msg.stack_msg.tag = PMAN_STACK_MSG_TAG_BACK;
                         break;
+
+                    case TOP_BTN_ID:
+                        data->follow = 0;
+                        data->first  = 0;
+                        update_rows(data);
+                        break;
+
+                    case PAGE_UP_BTN_ID:
+                        data->follow = 0;
+                        data->first  = data->first > VISIBLE_LINES ? data->first - VISIBLE_LINES : 0;
+                        update_rows(data);
+                        break;
+
+                    case PAGE_DOWN_BTN_ID:
+                        data->follow = 0;
+                        data->first += VISIBLE_LINES;
+                        update_rows(data);
+                        break;
+
+                    case BOTTOM_BTN_ID:
+                        data->follow = 0;
+                        data->first  = last_page(data);
+                        update_rows(data);
+                        break;
+
+                    case FOLLOW_BTN_ID:
+                        data->follow = !data->follow;
+                        update_rows(data);
+                        break;
+
+                    case ERROR_CHIP_ID:
+                        data->filter.levels ^= ERROR_LEVELS;
+                        update_filter_bar(data);
+                        apply_filter(data);
+                        break;
+
+                    case WARN_CHIP_ID:
+                        data->filter.levels ^= WARN_LEVELS;
+                        update_filter_bar(data);
+                        apply_filter(data);
+                        break;
+
+                    case SEARCH_TA_ID:
+                        if (data->kb == NULL) {
+                            data->kb = create_search_kb(data);
+                        }
+                        break;
+                }
+            } else if (lv_event_get_code(event.as.lvgl) == LV_EVENT_VALUE_CHANGED) {
+                switch (objdata->id) {
+                    case MODULE_DD_ID:
+                        data->filter.module = (int)lv_dropdown_get_selected(target) - 1;
+                        apply_filter(data);
+                        break;
+                }
+            } else if (lv_event_get_code(event.as.lvgl) == LV_EVENT_CANCEL) {
+                switch (objdata->id) {
+                    case SEARCH_KB_ID:
+                        lv_obj_del(data->kb);
+                        data->kb = NULL;
+                        break;
+                }
+            } else if (lv_event_get_code(event.as.lvgl) == LV_EVENT_READY) {
+                switch (objdata->id) {
+                    case SEARCH_KB_ID: {
+                        lv_obj_t *ta = lv_keyboard_get_textarea(target);
+                        snprintf(data->filter.text, sizeof(data->filter.text), "%s", lv_textarea_get_text(ta));
+                        lv_textarea_set_text(data->ta_search, data->filter.text);
+
+                        lv_obj_del(data->kb);
+                        data->kb = NULL;
+                        apply_filter(data);
+                        break;
+                    }
+                }
+            }
+            break;
+        }
+
+        case PMAN_EVENT_TAG_TIMER: {
+            int timer_id = (int)(uintptr_t)pman_timer_get_user_data(event.as.timer);
+
+            switch (timer_id) {
+                case UPDATE_TIMER_ID: {
+                    size_t lines = total_lines(data);
+
+                    switch (log_index_update(&data->index, INDEX_BUDGET)) {
+                        case LOG_INDEX_RESET:
+                            // Il file e' stato ruotato: le righe precedenti sono nel segmento archiviato.
+                            // Anche i moduli vengono rinumerati, per cui il filtro per modulo decade
+                            data->first         = 0;
+                            data->filter.module = -1;
+                            update_modules(pmodel, data);
+                            apply_filter(data);
+                            break;
+
+                        case LOG_INDEX_GROWN:
+                            update_modules(pmodel, data);
+                            if (data->filtered) {
+                                log_index_search(&data->index, &data->filter, &data->results);
+                            }
+
+                            // Si ridisegnano le righe solo se quelle nuove possono finire nella finestra
+                            if (data->follow || data->first + VISIBLE_LINES > lines) {
+                                update_rows(data);
+                            } else {
+                                update_position(data);
+                            }
+                            break;
+
+                        default:
+                            break;
+                    }
+                    break;
                 }
             }
             break;
+        }
 
         default:
             break;
@@ -78,10 +310,159 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
 }
 
 
+static void destroy_page(void *state, void *extra) {
+    (void)extra;
+    struct page_data *data = state;
+    pman_timer_delete(data->timer);
+    log_index_deinit(&data->index);
+    free(data);
+}
+
+
+static void close_page(void *state) {
+    struct page_data *data = state;
+    pman_timer_pause(data->timer);
+    lv_obj_clean(lv_scr_act());
+}
+
+
+/*
+ * Senza filtri si scorre direttamente il file, altrimenti l'elenco delle righe trovate dall'indice
+ */
+static void apply_filter(struct page_data *data) {
+    data->filtered = !log_index_filter_is_empty(&data->filter);
+    data->first    = 0;
+
+    if (data->filtered) {
+        log_index_search_reset(&data->results);
+        log_index_search(&data->index, &data->filter, &data->results);
+    }
+
+    update_rows(data);
+}
+
+
+static void update_filter_bar(struct page_data *data) {
+    if ((data->filter.levels & ERROR_LEVELS) != 0) {
+        lv_obj_add_state(data->chip_error, LV_STATE_CHECKED);
+    } else {
+        lv_obj_clear_state(data->chip_error, LV_STATE_CHECKED);
+    }
+
+    if ((data->filter.levels & WARN_LEVELS) != 0) {
+        lv_obj_add_state(data->chip_warn, LV_STATE_CHECKED);
+    } else {
+        lv_obj_clear_state(data->chip_warn, LV_STATE_CHECKED);
+    }
+}
+
+
+static void update_modules(model_t *pmodel, struct page_data *data) {
+    size_t num = log_index_num_modules(&data->index);
+    if (num == data->num_modules) {
+        return;
+    }
+
+    size_t len =
+        snprintf(data->options, sizeof(data->options), "%s", view_intl_get_string(pmodel, STRINGS_TUTTI_I_MODULI));
+    for (size_t i = 0; i < num && len < sizeof(data->options); i++) {
+        len += snprintf(&data->options[len], sizeof(data->options) - len, "\n%s", log_index_module(&data->index, i));
+    }
+
+    lv_dropdown_set_options(data->dd_module, data->options);
+    lv_dropdown_set_selected(data->dd_module, data->filter.module + 1);
+    data->num_modules = num;
+}
+
+
+static void update_position(struct page_data *data) {
+    size_t lines = total_lines(data);
+    size_t last  = data->first + VISIBLE_LINES < lines ? data->first + VISIBLE_LINES : lines;
+
+    lv_label_set_text_fmt(data->lposition, "%zu-%zu / %zu%s", lines > 0 ? data->first + 1 : 0, last, lines,
+                          log_index_is_complete(&data->index) ? "" : "...");
+}
+
+
+static void update_rows(struct page_data *data) {
+    size_t lines = total_lines(data);
+
+    if (data->follow || data->first > last_page(data)) {
+        data->first = last_page(data);
+    }
+
+    size_t offset = log_index_find(&data->index, data->first);
+    for (size_t i = 0; i < VISIBLE_LINES; i++) {
+        if (data->first + i >= lines) {
+            data->text[i][0] = '\0';
+        } else if (data->filtered) {
+            size_t line = log_index_result(&data->results, data->first + i);
+            log_index_read(&data->index, log_index_find(&data->index, line), data->text[i], LINE_LENGTH);
+        } else {
+            offset = log_index_read(&data->index, offset, data->text[i], LINE_LENGTH);
+        }
+        lv_label_set_text_static(data->rows[i], data->text[i]);
+    }
+
+    if (data->follow) {
+        lv_obj_add_state(data->btn_follow, LV_STATE_CHECKED);
+    } else {
+        lv_obj_clear_state(data->btn_follow, LV_STATE_CHECKED);
+    }
+
+    update_position(data);
+}
+
+
+static size_t total_lines(struct page_data *data) {
+    return data->filtered ? log_index_results_count(&data->results) : log_index_lines(&data->index);
+}
+
+
+static size_t last_page(struct page_data *data) {
+    size_t lines = total_lines(data);
+    return lines > VISIBLE_LINES ? lines - VISIBLE_LINES : 0;
+}
+
+
+static lv_obj_t *create_chip(lv_obj_t *parent, const char *text, int id) {
+    lv_obj_t *btn = lv_btn_create(parent);
+    lv_obj_set_size(btn, 120, 56);
+    lv_obj_set_style_bg_color(btn, lv_palette_main(LV_PALETTE_GREY), LV_STATE_DEFAULT);
+    lv_obj_set_style_bg_color(btn, lv_palette_main(LV_PALETTE_BLUE), LV_STATE_CHECKED);
+
+    lv_obj_t *lbl = lv_label_create(btn);
+    lv_obj_set_style_text_font(lbl, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_label_set_text(lbl, text);
+    lv_obj_center(lbl);
+
+    view_register_object_default_callback(btn, id);
+    return btn;
+}
+
+
+static lv_obj_t *create_search_kb(struct page_data *data) {
+    lv_obj_t *blanket = view_common_create_blanket(lv_scr_act());
+    lv_obj_t *kb      = lv_keyboard_create(blanket);
+    lv_obj_align(kb, LV_ALIGN_BOTTOM_MID, 0, 0);
+
+    lv_obj_t *ta = lv_textarea_create(blanket);
+    lv_obj_set_size(ta, LV_PCT(70), 56);
+    lv_obj_align(ta, LV_ALIGN_TOP_MID, 0, 120);
+    lv_textarea_set_max_length(ta, LOG_INDEX_SEARCH_SIZE - 1);
+    lv_textarea_set_one_line(ta, 1);
+    lv_textarea_set_text(ta, data->filter.text);
+    lv_keyboard_set_textarea(kb, ta);
+    view_register_object_default_callback(kb, SEARCH_KB_ID);
+
+    return blanket;
+}
+
+
 const pman_page_t page_log = {
     .create        = create_page,
     .open          = open_page,
-    .close         = pman_close_all,
-    .destroy       = pman_destroy_all,
+    .close         = close_page,
+    .destroy       = destroy_page,
     .process_event = process_page_event,
 };
@@ -13,7 +13,7 @@
 #include "config/app_conf.h"
 #include "utils/system_time.h"
 #include "view/theme/style.h"
-#include "log.h"
+#include "utils/async_log.h"
 
 
 #define ALARM_DISPLAY_DELAY 2000
@@ -70,6 +70,7 @@ enum {
     PAR_TEMP_BTN_ID,
     PAR_TIME_BTN_ID,
     KILL_BTN_ID,
+    TREND_IMG_ID,
 };
 
 
@@ -281,7 +282,8 @@ static void update_program_data(model_t *pmodel, struct page_data *data) {
     dryer_program_t *prog      = model_get_program(pmodel, data->selected_prog);
     uint16_t         num_steps = prog == NULL ? 0 : prog->num_steps;
 
-    if (num_steps == 0) {
+    // Gli step di un programma appena selezionato possono essere ancora in caricamento
+    if (num_steps == 0 || !prog->steps_loaded) {
         lv_obj_add_state(data->btn_start, LV_STATE_DISABLED);
     } else {
         lv_obj_clear_state(data->btn_start, LV_STATE_DISABLED);
@@ -291,7 +293,7 @@ static void update_program_data(model_t *pmodel, struct page_data *data) {
 
 static void update_time(model_t *pmodel, struct page_data *data) {
     uint16_t remaining = model_get_remaining(pmodel);
-    uint16_t total     = program_get_total_time(model_get_current_program(pmodel));
+    uint32_t total     = model_get_program_remaining(pmodel);
 
     switch (model_get_machine_state(pmodel)) {
         case MACHINE_STATE_STOPPED:
@@ -302,8 +304,9 @@ static void update_time(model_t *pmodel, struct page_data *data) {
         case MACHINE_STATE_WAIT_START:
         case MACHINE_STATE_PAUSED:
         case MACHINE_STATE_RUNNING:
-            lv_label_set_text_fmt(data->lbl_time, "%02i:%02i\n%02i:%02i", total / 60, total % 60, remaining / 60,
-                                  remaining % 60);
+            // Stima dell'intero programma sopra, conto alla rovescia dello step sotto
+            lv_label_set_text_fmt(data->lbl_time, "%02i:%02i\n%02i:%02i", (int)(total / 60), (int)(total % 60),
+                                  remaining / 60, remaining % 60);
             break;
 
         default:
@@ -492,6 +495,8 @@ static void open_page(pman_handle_t handle, void *state) {
     img = lv_img_create(lv_scr_act());
     lv_img_set_src(img, &img_temperature);
     lv_obj_align(img, LV_ALIGN_BOTTOM_LEFT, 305, -32);
+    lv_obj_add_flag(img, LV_OBJ_FLAG_CLICKABLE);
+    view_register_object_default_callback(img, TREND_IMG_ID);
     lv_obj_t *img_temp = img;
 
     lv_obj_t *lbl = lv_label_create(lv_scr_act());
@@ -501,6 +506,8 @@ static void open_page(pman_handle_t handle, void *state) {
     img = lv_img_create(lv_scr_act());
     lv_img_set_src(img, &img_drops);
     lv_obj_align(img, LV_ALIGN_TOP_LEFT, 250, 55);
+    lv_obj_add_flag(img, LV_OBJ_FLAG_CLICKABLE);
+    view_register_object_default_callback(img, TREND_IMG_ID);
 
     lbl = lv_label_create(lv_scr_act());
     lv_obj_align_to(lbl, img, LV_ALIGN_OUT_LEFT_MID, -10, -15);
@@ -707,6 +714,10 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                     update_alarm_popup(pmodel, data, 0);
                     break;
 
+                case VIEW_EVENT_CODE_PROGRAM_LOADED:
+                    update_program_data(pmodel, data);
+                    break;
+
                 case VIEW_EVENT_CODE_ALARM:
                     update_communication_popup(pmodel, data);
                     break;
@@ -792,6 +803,11 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                         }
                         break;
 
+                    case TREND_IMG_ID:
+                        msg.stack_msg.tag                 = PMAN_STACK_MSG_TAG_CHANGE_PAGE;
+                        msg.stack_msg.as.destination.page = (void *)&page_trend;
+                        break;
+
                     case LANGUAGE_IMG_ID: {
                         data->language = (data->language + 1) % NUM_LINGUE;
                         update_program_data(pmodel, data);
@@ -74,10 +74,12 @@ static void update_step_list(struct page_data *data, model_t *pmodel) {
         lv_obj_del(lv_obj_get_child(data->steplist, 0));
     }
 
-    int              lingua = model_get_language(pmodel);
-    dryer_program_t *p      = model_get_program(pmodel, data->num_prog);
+    // Finche' gli step non arrivano la lista resta vuota (vedi VIEW_EVENT_CODE_PROGRAM_LOADED)
+    int              lingua    = model_get_language(pmodel);
+    dryer_program_t *p         = model_get_program(pmodel, data->num_prog);
+    size_t           num_steps = p->steps_loaded ? p->num_steps : 0;
 
-    for (i = 0; i < p->num_steps; i++) {
+    for (i = 0; i < num_steps; i++) {
         char string[64] = {0};
         snprintf(string, sizeof(string), "%zu %s", i + 1, parameters_tipi_step[p->steps[i].type][lingua]);
         lv_obj_t *btn = lv_list_add_btn(data->steplist, NULL, string);
@@ -92,7 +94,9 @@ static void update_step_list(struct page_data *data, model_t *pmodel) {
         // lv_list_focus(focus, LV_ANIM_OFF);
     }
 
-    if (i < MAX_STEPS) {
+    if (!p->steps_loaded) {
+        lv_btnmatrix_set_btn_ctrl(data->btnmx, STEP_BTNMX_INSERT, LV_BTNMATRIX_CTRL_DISABLED);
+    } else if (i < MAX_STEPS) {
         lv_obj_t *btn =
             lv_list_add_btn(data->steplist, LV_SYMBOL_PLUS, view_intl_get_string(pmodel, STRINGS_NUOVO_PASSO));
         view_register_object_default_callback(btn, ADD_STEP_BTN_ID);
@@ -251,6 +255,15 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *arg, pman_event
     msg.user_msg    = &data->cmsg;
 
     switch (event.tag) {
+        case PMAN_EVENT_TAG_USER: {
+            view_event_t *user_event = event.as.user;
+
+            if (user_event->code == VIEW_EVENT_CODE_PROGRAM_LOADED) {
+                update_step_list(data, pmodel);
+            }
+            break;
+        }
+
         case PMAN_EVENT_TAG_LVGL: {
             lv_obj_t           *target  = lv_event_get_current_target(event.as.lvgl);
             view_object_data_t *objdata = lv_obj_get_user_data(target);
@@ -10,7 +10,7 @@
 #include "view/common.h"
 #include "utils/system_time.h"
 #include "config/app_conf.h"
-#include "log.h"
+#include "utils/async_log.h"
 
 
 #define PROG_BTNMX_UP      0
@@ -34,7 +34,6 @@ enum {
     PARAMETER_KB_ID,
     PARAMETER_SWITCH_ID,
     SAVE_ALL_IO_ID,
-    READ_LOG_IO_ID,
     PROGRAM_BTN_ID,
     PROGRAM_BTNMATRIX_ID,
     ADD_PROG_BTN_ID,
@@ -47,6 +46,7 @@ enum {
     PASSWORD_ID,
     PASSWORD_KEYBOARD_ID,
     STATS_BTN_ID,
+    EVENTS_BTN_ID,
     BLANKET_ID,
 };
 
@@ -358,6 +358,7 @@ static void create_tab_test(lv_obj_t *tab, model_t *pmodel, struct page_data *da
     lv_obj_set_size(btn, 240, 60);
     lbl = lv_label_create(btn);
     lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_EVENTI));
+    view_register_object_default_callback(btn, EVENTS_BTN_ID);
     lv_obj_align(lbl, LV_ALIGN_CENTER, 0, 0);
     lv_obj_align(btn, LV_ALIGN_BOTTOM_LEFT, 280, -10);
 
@@ -460,13 +461,6 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                         } else if (--data->waiting_io == 0) {
                             msg.stack_msg.tag = PMAN_STACK_MSG_TAG_BACK;
                         }
-                    } else if (user_event->io_op == READ_LOG_IO_ID) {
-                        if (user_event->error) {
-                            view_common_io_error_toast(pmodel);
-                        }
-                        msg.stack_msg.tag                  = PMAN_STACK_MSG_TAG_CHANGE_PAGE_EXTRA;
-                        msg.stack_msg.as.destination.extra = user_event->io_data;
-                        msg.stack_msg.as.destination.page  = (void *)&page_log;
                     }
                     break;
 
@@ -508,6 +502,11 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                         msg.stack_msg.as.destination.page = (void *)&page_stats;
                         break;
 
+                    case EVENTS_BTN_ID:
+                        msg.stack_msg.tag                 = PMAN_STACK_MSG_TAG_CHANGE_PAGE;
+                        msg.stack_msg.as.destination.page = (void *)&page_alarms;
+                        break;
+
                     case SETTINGS_BTN_ID:
                         msg.stack_msg.tag                 = PMAN_STACK_MSG_TAG_CHANGE_PAGE;
                         msg.stack_msg.as.destination.page = (void *)&page_tech_settings;
@@ -528,9 +527,8 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                         break;
 
                     case LOG_BTN_ID:
-                        data->cmsg.code       = VIEW_CONTROLLER_MESSAGE_CODE_READ_LOG_FILE;
-                        data->cmsg.disk_op_id = READ_LOG_IO_ID;
-                        data->blanket         = view_common_create_blanket(lv_scr_act());
+                        msg.stack_msg.tag                 = PMAN_STACK_MSG_TAG_CHANGE_PAGE;
+                        msg.stack_msg.as.destination.page = (void *)&page_log;
                         break;
 
                     case DRIVE_BTN_ID:
@@ -561,7 +559,8 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                     case BACK_BTN_ID: {
                         size_t tosave = num_of_io_operations_to_wait(pmodel, data);
                         if (tosave > 0) {
-                            data->waiting_io = tosave;
+                            // Il salvataggio viene eseguito come un'unica operazione su disco
+                            data->waiting_io = 1;
 
                             data->cmsg.code           = VIEW_CONTROLLER_MESSAGE_CODE_SAVE_ALL;
                             data->cmsg.parmac         = model_get_parmac_to_save(pmodel);
@@ -660,7 +659,7 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                                 if (data->prog.selected_prog >= 0) {
                                     data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_REMOVE_PROGRAM;
                                     strncpy(data->cmsg.name,
-                                            model_get_program(pmodel, data->prog.selected_prog)->filename,
+                                            model_get_program_filename(pmodel, data->prog.selected_prog),
                                             sizeof(data->cmsg.name));
                                     data->cmsg.name[sizeof(data->cmsg.name) - 1] = '\0';
 
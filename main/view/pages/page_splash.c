@@ -1,12 +1,24 @@
+#include <stdlib.h>
 #include "lvgl.h"
 #include "view/view.h"
 #include "gel/pagemanager/page_manager.h"
 
 
+struct page_data {
+    int timer_expired;
+};
+
+
+static pman_msg_t go_to_main(void);
+
+
 static void *create_page(pman_handle_t handle, void *extra) {
     (void)handle;
     (void)extra;
-    return NULL;
+
+    struct page_data *data = malloc(sizeof(struct page_data));
+    data->timer_expired    = 0;
+    return data;
 }
 
 
@@ -20,13 +32,28 @@ static void open_page(pman_handle_t handle, void *state) {
 
 
 static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_event_t event) {
-    pman_msg_t msg = PMAN_MSG_NULL;
+    pman_msg_t        msg  = PMAN_MSG_NULL;
+    struct page_data *data = state;
+
+    model_updater_t updater = pman_get_user_data(handle);
+    model_t        *pmodel  = (model_t *)model_updater_get(updater);
 
     switch (event.tag) {
         case PMAN_EVENT_TAG_TIMER:
-            msg.stack_msg.tag = PMAN_STACK_MSG_TAG_REBASE;
-            msg.stack_msg.as.destination.page = (void*)&page_main;
+            // La pagina principale ha bisogno di parametri e programmi: se non sono ancora pronti si aspetta
+            data->timer_expired = 1;
+            if (model_is_boot_complete(pmodel)) {
+                msg = go_to_main();
+            }
+            break;
+
+        case PMAN_EVENT_TAG_USER: {
+            view_event_t *user_event = event.as.user;
+            if (user_event->code == VIEW_EVENT_CODE_BOOT_COMPLETE && data->timer_expired) {
+                msg = go_to_main();
+            }
             break;
+        }
 
         default:
             break;
@@ -36,6 +63,13 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
 }
 
 
+static pman_msg_t go_to_main(void) {
+    pman_msg_t msg                    = PMAN_MSG_NULL;
+    msg.stack_msg.tag                 = PMAN_STACK_MSG_TAG_REBASE;
+    msg.stack_msg.as.destination.page = (void *)&page_main;
+    return msg;
+}
+
 
 const pman_page_t page_splash = {
     .close         = pman_close_all,
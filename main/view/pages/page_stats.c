@@ -25,6 +25,14 @@ static void *create_page(pman_handle_t handle, void *extra) {
 }
 
 
+static const stats_period_t columns[] = {
+    STATS_PERIOD_TODAY,
+    STATS_PERIOD_WEEK,
+    STATS_PERIOD_LAST_CYCLE,
+    STATS_PERIOD_LIFETIME,
+};
+
+
 static char *format_num(char *string, size_t len, uint32_t num) {
     memset(string, 0, len);
     snprintf(string, len, "%i", num);
@@ -34,20 +42,28 @@ static char *format_num(char *string, size_t len, uint32_t num) {
 
 static char *format_hms(char *string, size_t len, uint32_t seconds) {
     memset(string, 0, len);
-    snprintf(string, len, "%i h %i m %i s", seconds / 3600, (seconds % 3600) / 60, seconds % 60);
+    snprintf(string, len, "%i:%02i:%02i", seconds / 3600, (seconds % 3600) / 60, seconds % 60);
     return string;
 }
 
 
+// Gli aggregati sono gia' nel modello: la pagina non aspetta la lettura dalla macchina
 static void update_stats(model_t *pmodel, struct page_data *data) {
     char string[32] = {0};
-    lv_table_set_cell_value(data->table, 0, 1, format_num(string, sizeof(string), pmodel->statistics.complete_cycles));
-    lv_table_set_cell_value(data->table, 1, 1, format_num(string, sizeof(string), pmodel->statistics.partial_cycles));
-    lv_table_set_cell_value(data->table, 2, 1, format_hms(string, sizeof(string), pmodel->statistics.active_time));
-    lv_table_set_cell_value(data->table, 3, 1, format_hms(string, sizeof(string), pmodel->statistics.work_time));
-    lv_table_set_cell_value(data->table, 4, 1, format_hms(string, sizeof(string), pmodel->statistics.rotation_time));
-    lv_table_set_cell_value(data->table, 5, 1, format_hms(string, sizeof(string), pmodel->statistics.ventilation_time));
-    lv_table_set_cell_value(data->table, 6, 1, format_hms(string, sizeof(string), pmodel->statistics.heating_time));
+
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+        statistics_t stats;
+        model_get_statistics(pmodel, columns[i], &stats);
+
+        uint16_t col = i + 1;
+        lv_table_set_cell_value(data->table, 1, col, format_num(string, sizeof(string), stats.complete_cycles));
+        lv_table_set_cell_value(data->table, 2, col, format_num(string, sizeof(string), stats.partial_cycles));
+        lv_table_set_cell_value(data->table, 3, col, format_hms(string, sizeof(string), stats.active_time));
+        lv_table_set_cell_value(data->table, 4, col, format_hms(string, sizeof(string), stats.work_time));
+        lv_table_set_cell_value(data->table, 5, col, format_hms(string, sizeof(string), stats.rotation_time));
+        lv_table_set_cell_value(data->table, 6, col, format_hms(string, sizeof(string), stats.ventilation_time));
+        lv_table_set_cell_value(data->table, 7, col, format_hms(string, sizeof(string), stats.heating_time));
+    }
 }
 
 
@@ -66,18 +82,24 @@ static void open_page(pman_handle_t handle, void *state) {
     lv_obj_t *table = lv_table_create(page);
     lv_obj_align(table, LV_ALIGN_TOP_MID, 0, 0);
 
-    lv_table_set_col_cnt(table, 2);
-    lv_table_set_col_width(table, 0, 440);
-    lv_table_set_col_width(table, 1, 240);
+    lv_table_set_col_cnt(table, 5);
+    lv_table_set_col_width(table, 0, 232);
+    for (size_t i = 1; i < 5; i++) {
+        lv_table_set_col_width(table, i, 120);
+    }
     lv_obj_set_style_bg_color(table, lv_palette_main(LV_PALETTE_YELLOW), LV_STATE_DEFAULT | LV_PART_ITEMS);
 
-    lv_table_set_cell_value(table, 0, 0, view_intl_get_string(pmodel, STRINGS_CICLI_COMPLETI));
-    lv_table_set_cell_value(table, 1, 0, view_intl_get_string(pmodel, STRINGS_CICLI_PARZIALI));
-    lv_table_set_cell_value(table, 2, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_ACCESO));
-    lv_table_set_cell_value(table, 3, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_DI_LAVORO));
-    lv_table_set_cell_value(table, 4, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_IN_MOTO));
-    lv_table_set_cell_value(table, 5, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_DI_VENTILAZIONE));
-    lv_table_set_cell_value(table, 6, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_IN_RISCALDAMENTO));
+    lv_table_set_cell_value(table, 0, 1, view_intl_get_string(pmodel, STRINGS_OGGI));
+    lv_table_set_cell_value(table, 0, 2, view_intl_get_string(pmodel, STRINGS_ULTIMI_7_GIORNI));
+    lv_table_set_cell_value(table, 0, 3, view_intl_get_string(pmodel, STRINGS_ULTIMO_CICLO));
+    lv_table_set_cell_value(table, 0, 4, view_intl_get_string(pmodel, STRINGS_TOTALE));
+    lv_table_set_cell_value(table, 1, 0, view_intl_get_string(pmodel, STRINGS_CICLI_COMPLETI));
+    lv_table_set_cell_value(table, 2, 0, view_intl_get_string(pmodel, STRINGS_CICLI_PARZIALI));
+    lv_table_set_cell_value(table, 3, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_ACCESO));
+    lv_table_set_cell_value(table, 4, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_DI_LAVORO));
+    lv_table_set_cell_value(table, 5, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_IN_MOTO));
+    lv_table_set_cell_value(table, 6, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_DI_VENTILAZIONE));
+    lv_table_set_cell_value(table, 7, 0, view_intl_get_string(pmodel, STRINGS_TEMPO_IN_RISCALDAMENTO));
 
     data->table = table;
 
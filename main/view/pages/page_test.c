@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "lvgl.h"
 #include "view/view.h"
 #include "gel/pagemanager/page_manager.h"
@@ -21,9 +22,14 @@ enum {
     BTN_VENTILATION_ID,
     BTN_ROTATION_FORWARD_ID,
     BTN_ROTATION_BACKWARD_ID,
+    INPUT_REDRAW_TIMER_ID,
 };
 
 
+#define INPUT_REDRAW_PERIOD 200
+#define INPUT_LOG_LINES     8
+
+
 typedef enum {
     SPEED_TEST_NONE = 0,
     SPEED_TEST_VENTILATION,
@@ -69,8 +75,12 @@ struct page_data {
     } output;
 
     struct {
-        uint16_t  inputs;
-        lv_obj_t *leds[NUM_INPUTS];
+        uint16_t      inputs;
+        lv_obj_t     *leds[NUM_INPUTS];
+        lv_obj_t     *lbl_rate;
+        lv_obj_t     *lbl_edges;
+        pman_timer_t *timer;
+        int           to_redraw;
     } input;
 
     view_controller_message_t cmsg;
@@ -80,10 +90,15 @@ struct page_data {
 static void update_speed(struct page_data *pdata);
 
 
+static const char *input_labels[NUM_INTERNAL_INPUTS] = {"IN-V1", "IN-V4", "IN-V3", "IN-V2", "CESTO", "VENTOLA",
+                                                        "IN4",   "IN3",   "IN2",   "IN1",   "TERM",  "C-GAS"};
+
+
 static void *create_page(pman_handle_t handle, void *extra) {
-    (void)handle;
     (void)extra;
-    return (struct page_data *)malloc(sizeof(struct page_data));
+    struct page_data *data = malloc(sizeof(struct page_data));
+    data->input.timer      = PMAN_REGISTER_TIMER_ID(handle, INPUT_REDRAW_PERIOD, INPUT_REDRAW_TIMER_ID);
+    return data;
 }
 
 
@@ -92,20 +107,30 @@ static void create_tab_input(model_t *pmodel, lv_obj_t *tab, struct page_data *d
     lv_obj_set_layout(tab, LV_LAYOUT_FLEX);
     lv_obj_set_flex_flow(tab, LV_FLEX_FLOW_ROW_WRAP);
 
-    static const char *input_labels[NUM_INTERNAL_INPUTS] = {"IN-V1", "IN-V4", "IN-V3", "IN-V2", "CESTO", "VENTOLA",
-                                                            "IN4",   "IN3",   "IN2",   "IN1",   "TERM",  "C-GAS"};
-
     for (size_t i = 0; i < model_get_effective_inputs(pmodel); i++) {
         lv_obj_t *c = lv_obj_create(tab);
         lv_obj_set_scrollbar_mode(c, LV_SCROLLBAR_MODE_OFF);
         lv_obj_set_layout(c, LV_LAYOUT_FLEX);
         lv_obj_t *led   = lv_led_create(c);
         lv_obj_t *label = lv_label_create(c);
-        lv_label_set_text(label, input_labels[i]);
+        if (i < NUM_INTERNAL_INPUTS) {
+            lv_label_set_text(label, input_labels[i]);
+        } else {
+            lv_label_set_text_fmt(label, "IN%zu", i + 1);
+        }
         lv_obj_set_size(c, sizex, sizey);
         data->input.leds[i] = led;
         lv_led_off(led);
     }
+
+    lv_obj_t *lbl = lv_label_create(tab);
+    lv_obj_set_width(lbl, LV_PCT(100));
+    data->input.lbl_rate = lbl;
+
+    lbl = lv_label_create(tab);
+    lv_obj_set_width(lbl, LV_PCT(100));
+    lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
+    data->input.lbl_edges = lbl;
 }
 
 
@@ -296,6 +321,67 @@ static void update_input_leds(model_t *pmodel, struct page_data *data) {
 }
 
 
+static size_t format_changed_inputs(char *string, size_t len, uint16_t previous, uint16_t current) {
+    size_t written = 0;
+
+    for (size_t i = 0; i < 16 && written < len; i++) {
+        if (((previous ^ current) & (1 << i)) == 0) {
+            continue;
+        }
+
+        char name[16] = {0};
+        if (i < NUM_INTERNAL_INPUTS) {
+            snprintf(name, sizeof(name), "%s", input_labels[i]);
+        } else {
+            snprintf(name, sizeof(name), "IN%zu", i + 1);
+        }
+
+        written += snprintf(&string[written], len - written, "%s %s ", name, (current & (1 << i)) ? "ON" : "OFF");
+    }
+
+    return written;
+}
+
+
+static void update_input_log(model_t *pmodel, struct page_data *data) {
+    char   string[INPUT_LOG_LINES * 96] = {0};
+    size_t written                      = 0;
+    size_t num_edges                    = model_get_num_input_edges(pmodel);
+
+    lv_label_set_text_fmt(data->input.lbl_rate, "Letture: %i/s - Fronti: %zu", pmodel->test.samples_per_second,
+                          num_edges);
+
+    if (num_edges < 2) {
+        lv_label_set_text(data->input.lbl_edges, "");
+        return;
+    }
+
+    // Il primo fronte e' lo stato iniziale e fa da riferimento; mostro i piu' recenti in cima
+    input_edge_t *reference = model_get_input_edge(pmodel, 0);
+    for (size_t i = num_edges - 1; i > 0 && num_edges - i <= INPUT_LOG_LINES; i--) {
+        input_edge_t *edge     = model_get_input_edge(pmodel, i);
+        input_edge_t *previous = model_get_input_edge(pmodel, i - 1);
+
+        if (written >= sizeof(string)) {
+            break;
+        }
+        written += snprintf(&string[written], sizeof(string) - written, "%7lu ms  (+%lu ms)  ",
+                            (unsigned long)(edge->timestamp - reference->timestamp),
+                            (unsigned long)(edge->timestamp - previous->timestamp));
+        if (written >= sizeof(string)) {
+            break;
+        }
+        written += format_changed_inputs(&string[written], sizeof(string) - written, previous->inputs, edge->inputs);
+        if (written >= sizeof(string)) {
+            break;
+        }
+        written += snprintf(&string[written], sizeof(string) - written, "\n");
+    }
+
+    lv_label_set_text(data->input.lbl_edges, string);
+}
+
+
 static void update_output_leds(model_t *pmodel, struct page_data *data, int led_on) {
     for (size_t i = 0; i < NUM_INTERNAL_RELES; i++) {
         if (led_on == (int)i) {
@@ -327,6 +413,8 @@ static void open_page(pman_handle_t handle, void *state) {
     struct page_data *data = state;
     data->blanket          = NULL;
     data->speed.speed_test = SPEED_TEST_NONE;
+    data->input.inputs     = 0;
+    data->input.to_redraw  = 0;
 
     model_updater_t updater = pman_get_user_data(handle);
     model_t        *pmodel  = (model_t *)model_updater_get(updater);
@@ -352,10 +440,12 @@ static void open_page(pman_handle_t handle, void *state) {
     view_common_back_button(lv_scr_act(), BACK_BTN_ID);
 
     update_input_leds(pmodel, data);
+    update_input_log(pmodel, data);
     update_output_leds(pmodel, data, -1);
     update_output_state(pmodel, data);
     update_sensors(pmodel, data);
     update_speed(data);
+    pman_timer_resume(data->input.timer);
 }
 
 
@@ -370,11 +460,25 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
     msg.user_msg    = &data->cmsg;
 
     switch (event.tag) {
+        case PMAN_EVENT_TAG_OPEN:
+            data->cmsg.code = VIEW_CONTROLLER_MESSAGE_CODE_START_INPUT_STREAM;
+            break;
+
+        case PMAN_EVENT_TAG_TIMER:
+            // Le letture arrivano molto piu' spesso di quanto serva ridisegnare
+            if (data->input.to_redraw) {
+                update_input_leds(pmodel, data);
+                update_input_log(pmodel, data);
+                data->input.to_redraw = 0;
+            }
+            break;
+
         case PMAN_EVENT_TAG_USER: {
             view_event_t *user_event = event.as.user;
             switch (user_event->code) {
                 case VIEW_EVENT_CODE_STATE_CHANGED:
                     if (!model_is_in_test(pmodel)) {
+                        data->cmsg.code   = VIEW_CONTROLLER_MESSAGE_CODE_STOP_INPUT_STREAM;
                         msg.stack_msg.tag = PMAN_STACK_MSG_TAG_BACK;
                     } else {
                         update_output_state(pmodel, data);
@@ -386,8 +490,8 @@ static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_eve
                     break;
 
                 case VIEW_EVENT_CODE_TEST_INPUT_VALUES: {
-                    data->input.inputs = user_event->digital_inputs;
-                    update_input_leds(pmodel, data);
+                    data->input.inputs    = user_event->digital_inputs;
+                    data->input.to_redraw = 1;
                     break;
                 }
 
@@ -560,10 +664,24 @@ static void update_speed(struct page_data *pdata) {
 }
 
 
+static void destroy_page(void *state, void *extra) {
+    struct page_data *data = state;
+    pman_timer_delete(data->input.timer);
+    free(data);
+}
+
+
+static void close_page(void *state) {
+    struct page_data *data = state;
+    pman_timer_pause(data->input.timer);
+    lv_obj_clean(lv_scr_act());
+}
+
+
 const pman_page_t page_test = {
     .create        = create_page,
-    .close         = pman_close_all,
-    .destroy       = pman_destroy_all,
+    .close         = close_page,
+    .destroy       = destroy_page,
     .process_event = process_page_event,
     .open          = open_page,
 };
@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "lvgl.h"
+#include "view/view.h"
+#include "view/intl/intl.h"
+#include "view/common.h"
+#include "model/model.h"
+#include "model/timeseries.h"
+#include "utils/system_time.h"
+
+
+#define CHART_POINTS  240
+#define UPDATE_PERIOD 1000UL
+#define CYCLE_PERIOD  5000UL     // ms per colonna a inizio ciclo; raddoppia ogni volta che il grafico si riempie
+#define DAY_WINDOW    (24UL * 60UL * 60UL * 1000UL)
+#define DAY_PERIOD    (DAY_WINDOW / CHART_POINTS)
+#define DAY_LEVEL     TIMESERIES_LEVEL_1MIN
+
+
+enum {
+    BACK_BTN_ID,
+    CYCLE_BTN_ID,
+    DAY_BTN_ID,
+    UPDATE_TIMER_ID,
+};
+
+
+enum {
+    SOURCE_TEMPERATURE = 0,
+    SOURCE_SETPOINT,
+    SOURCE_HUMIDITY,
+    NUM_SOURCES,
+};
+
+
+enum {
+    SERIES_TEMPERATURE_MAX = 0,
+    SERIES_TEMPERATURE_MIN,
+    SERIES_SETPOINT,
+    SERIES_HUMIDITY_MAX,
+    SERIES_HUMIDITY_MIN,
+    NUM_SERIES,
+};
+
+
+struct page_data {
+    lv_obj_t          *chart;
+    lv_obj_t          *btn_cycle;
+    lv_obj_t          *btn_day;
+    lv_obj_t          *lspan;
+    lv_chart_series_t *series[NUM_SERIES];
+    pman_timer_t      *timer;
+
+    int           day;
+    uint64_t      origin;        // ms sull'orologio della serie, inizio della prima colonna
+    unsigned long period;        // ms per colonna
+    uint64_t      last;          // ms sull'orologio della serie, ultimo campione letto
+    size_t        columns;       // colonne inserite nel grafico
+    size_t        column;        // indice dell'ultima colonna a partire da `origin`
+    size_t        raw_count;
+
+    // Minimo e massimo di ogni colonna; nel ciclo permettono di dimezzare la risoluzione senza rileggere lo storico
+    int16_t min[NUM_SOURCES][CHART_POINTS];
+    int16_t max[NUM_SOURCES][CHART_POINTS];
+};
+
+
+static const timeseries_channel_t channels[NUM_SOURCES] = {
+    [SOURCE_TEMPERATURE] = TIMESERIES_CHANNEL_TEMPERATURE,
+    [SOURCE_SETPOINT]    = TIMESERIES_CHANNEL_TEMPERATURE_SETPOINT,
+    [SOURCE_HUMIDITY]    = TIMESERIES_CHANNEL_HUMIDITY,
+};
+
+
+static const struct {
+    int             source;
+    int             max;
+    lv_palette_t    color;
+    lv_chart_axis_t axis;
+} series_info[NUM_SERIES] = {
+    [SERIES_TEMPERATURE_MAX] = {SOURCE_TEMPERATURE, 1, LV_PALETTE_RED, LV_CHART_AXIS_PRIMARY_Y},
+    [SERIES_TEMPERATURE_MIN] = {SOURCE_TEMPERATURE, 0, LV_PALETTE_RED, LV_CHART_AXIS_PRIMARY_Y},
+    [SERIES_SETPOINT]        = {SOURCE_SETPOINT, 1, LV_PALETTE_ORANGE, LV_CHART_AXIS_PRIMARY_Y},
+    [SERIES_HUMIDITY_MAX]    = {SOURCE_HUMIDITY, 1, LV_PALETTE_BLUE, LV_CHART_AXIS_SECONDARY_Y},
+    [SERIES_HUMIDITY_MIN]    = {SOURCE_HUMIDITY, 0, LV_PALETTE_BLUE, LV_CHART_AXIS_SECONDARY_Y},
+};
+
+
+static void       reset_chart(struct page_data *data);
+static void       update_chart(model_t *pmodel, struct page_data *data);
+static void       update_cycle(model_t *pmodel, struct page_data *data);
+static void       update_day(model_t *pmodel, struct page_data *data);
+static void       add_rollups(const timeseries_t *ts, struct page_data *data, uint64_t from, uint64_t to);
+static void       update_mode(struct page_data *data);
+static void       add_sample(struct page_data *data, uint64_t timestamp, const int16_t *min, const int16_t *max);
+static void       append_column(struct page_data *data, const int16_t *min, const int16_t *max);
+static void       halve_resolution(struct page_data *data);
+static void       set_last_point(struct page_data *data, size_t slot);
+static lv_coord_t series_value(struct page_data *data, size_t series, size_t slot);
+static int16_t    merge_max(int16_t a, int16_t b);
+static lv_obj_t  *create_mode_button(lv_obj_t *parent, const char *text, int id);
+
+
+static void *create_page(pman_handle_t handle, void *extra) {
+    (void)extra;
+    struct page_data *data = (struct page_data *)malloc(sizeof(struct page_data));
+    data->timer            = PMAN_REGISTER_TIMER_ID(handle, UPDATE_PERIOD, UPDATE_TIMER_ID);
+    data->day              = 0;
+    return data;
+}
+
+
+static void open_page(pman_handle_t handle, void *state) {
+    struct page_data *data = state;
+
+    model_updater_t updater = pman_get_user_data(handle);
+    model_t        *pmodel  = (model_t *)model_updater_get(updater);
+
+    view_common_create_title(lv_scr_act(), view_intl_get_string(pmodel, STRINGS_ANDAMENTO), BACK_BTN_ID);
+
+    data->btn_cycle = create_mode_button(lv_scr_act(), view_intl_get_string(pmodel, STRINGS_CICLO_IN_CORSO),
+                                         CYCLE_BTN_ID);
+    lv_obj_align(data->btn_cycle, LV_ALIGN_TOP_LEFT, 8, 72);
+
+    data->btn_day = create_mode_button(lv_scr_act(), view_intl_get_string(pmodel, STRINGS_ULTIME_24_ORE), DAY_BTN_ID);
+    lv_obj_align_to(data->btn_day, data->btn_cycle, LV_ALIGN_OUT_RIGHT_MID, 8, 0);
+
+    data->lspan = lv_label_create(lv_scr_act());
+    lv_obj_set_style_text_font(data->lspan, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_obj_align(data->lspan, LV_ALIGN_TOP_RIGHT, -16, 88);
+
+    lv_obj_t *chart = lv_chart_create(lv_scr_act());
+    lv_obj_set_size(chart, LV_HOR_RES - 160, LV_VER_RES - 200);
+    lv_obj_align(chart, LV_ALIGN_TOP_MID, 0, 144);
+    lv_chart_set_type(chart, LV_CHART_TYPE_LINE);
+    lv_chart_set_update_mode(chart, LV_CHART_UPDATE_MODE_SHIFT);
+    lv_chart_set_point_count(chart, CHART_POINTS);
+    lv_chart_set_div_line_count(chart, 5, 8);
+    lv_chart_set_range(chart, LV_CHART_AXIS_PRIMARY_Y, 0, 100);
+    lv_chart_set_range(chart, LV_CHART_AXIS_SECONDARY_Y, 0, 100);
+    lv_chart_set_axis_tick(chart, LV_CHART_AXIS_PRIMARY_Y, 8, 4, 6, 2, 1, 50);
+    lv_chart_set_axis_tick(chart, LV_CHART_AXIS_SECONDARY_Y, 8, 4, 6, 2, 1, 50);
+    // Un punto ogni 2-3 pixel, disegnare i singoli punti e' inutile
+    lv_obj_set_style_size(chart, 0, LV_PART_INDICATOR);
+    for (size_t i = 0; i < NUM_SERIES; i++) {
+        data->series[i] = lv_chart_add_series(chart, lv_palette_main(series_info[i].color), series_info[i].axis);
+    }
+    data->chart = chart;
+
+    lv_obj_t *lbl = lv_label_create(lv_scr_act());
+    lv_obj_set_style_text_font(lbl, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_obj_set_style_text_color(lbl, lv_palette_main(LV_PALETTE_RED), LV_STATE_DEFAULT);
+    lv_label_set_text_fmt(lbl, "%s (C)", view_intl_get_string(pmodel, STRINGS_TEMPERATURA));
+    lv_obj_align_to(lbl, chart, LV_ALIGN_OUT_BOTTOM_LEFT, 0, 8);
+
+    lv_obj_t *prev = lbl;
+    lbl            = lv_label_create(lv_scr_act());
+    lv_obj_set_style_text_font(lbl, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_obj_set_style_text_color(lbl, lv_palette_main(LV_PALETTE_ORANGE), LV_STATE_DEFAULT);
+    lv_label_set_text(lbl, view_intl_get_string(pmodel, STRINGS_TEMPERATURA_IMPOSTATA));
+    lv_obj_align_to(lbl, prev, LV_ALIGN_OUT_RIGHT_MID, 32, 0);
+
+    prev = lbl;
+    lbl  = lv_label_create(lv_scr_act());
+    lv_obj_set_style_text_font(lbl, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_obj_set_style_text_color(lbl, lv_palette_main(LV_PALETTE_BLUE), LV_STATE_DEFAULT);
+    lv_label_set_text_fmt(lbl, "%s (%%)", view_intl_get_string(pmodel, STRINGS_UMIDITA));
+    lv_obj_align_to(lbl, prev, LV_ALIGN_OUT_RIGHT_MID, 32, 0);
+
+    update_mode(data);
+    reset_chart(data);
+    update_chart(pmodel, data);
+    pman_timer_resume(data->timer);
+}
+
+
+static pman_msg_t process_page_event(pman_handle_t handle, void *state, pman_event_t event) {
+    pman_msg_t        msg  = PMAN_MSG_NULL;
+    struct page_data *data = state;
+
+    model_updater_t updater = pman_get_user_data(handle);
+    model_t        *pmodel  = (model_t *)model_updater_get(updater);
+
+    switch (event.tag) {
+        case PMAN_EVENT_TAG_LVGL: {
+            lv_obj_t           *target  = lv_event_get_current_target(event.as.lvgl);
+            view_object_data_t *objdata = lv_obj_get_user_data(target);
+
+            if (lv_event_get_code(event.as.lvgl) == LV_EVENT_CLICKED) {
+                switch (objdata->id) {
+                    case BACK_BTN_ID:
+                        msg.stack_msg.tag = PMAN_STACK_MSG_TAG_BACK;
+                        break;
+
+                    case CYCLE_BTN_ID:
+                    case DAY_BTN_ID:
+                        data->day = objdata->id == DAY_BTN_ID;
+                        update_mode(data);
+                        reset_chart(data);
+                        update_chart(pmodel, data);
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+            break;
+        }
+
+        case PMAN_EVENT_TAG_TIMER: {
+            int timer_id = (int)(uintptr_t)pman_timer_get_user_data(event.as.timer);
+
+            switch (timer_id) {
+                case UPDATE_TIMER_ID:
+                    update_chart(pmodel, data);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return msg;
+}
+
+
+static void destroy_page(void *state, void *extra) {
+    (void)extra;
+    struct page_data *data = state;
+    pman_timer_delete(data->timer);
+    free(data);
+}
+
+
+static void close_page(void *state) {
+    struct page_data *data = state;
+    pman_timer_pause(data->timer);
+    lv_obj_clean(lv_scr_act());
+}
+
+
+/*
+ *  Static functions
+ */
+
+static void reset_chart(struct page_data *data) {
+    data->origin    = 0;
+    data->period    = data->day ? DAY_PERIOD : CYCLE_PERIOD;
+    data->last      = 0;
+    data->columns   = 0;
+    data->column    = 0;
+    data->raw_count = 0;
+
+    for (size_t i = 0; i < NUM_SERIES; i++) {
+        lv_chart_set_all_value(data->chart, data->series[i], LV_CHART_POINT_NONE);
+    }
+}
+
+
+/*
+ * Legge solo i campioni successivi all'ultimo gia' mostrato; il costo di ogni aggiornamento non dipende dalla
+ * lunghezza dello storico
+ */
+static void update_chart(model_t *pmodel, struct page_data *data) {
+    if (data->day) {
+        update_day(pmodel, data);
+        lv_label_set_text(data->lspan, "24 h");
+    } else {
+        update_cycle(pmodel, data);
+        lv_label_set_text_fmt(data->lspan, "%lu min", (CHART_POINTS * data->period) / 60000UL);
+    }
+}
+
+
+static void update_cycle(model_t *pmodel, struct page_data *data) {
+    const timeseries_t *ts    = model_get_timeseries(pmodel);
+    size_t              count = timeseries_raw_count(ts);
+
+    // I campioni grezzi vengono azzerati all'avvio di un nuovo ciclo
+    if (count < data->raw_count) {
+        reset_chart(data);
+    }
+    data->raw_count = count;
+
+    // Un ciclo piu' lungo dei campioni grezzi comincia dai riepiloghi
+    if (data->columns == 0 && count > 0 && !timeseries_raw_is_complete(ts)) {
+        add_rollups(ts, data, timeseries_raw_start(ts), timeseries_raw_timestamp(ts, 0));
+    }
+
+    size_t first = count;
+    while (first > 0 && (data->columns == 0 || timeseries_raw_timestamp(ts, first - 1) > data->last)) {
+        first--;
+    }
+
+    for (size_t i = first; i < count; i++) {
+        int16_t values[NUM_SOURCES];
+        for (size_t j = 0; j < NUM_SOURCES; j++) {
+            values[j] = timeseries_raw_value(ts, channels[j], i);
+        }
+        add_sample(data, timeseries_raw_timestamp(ts, i), values, values);
+    }
+}
+
+
+static void update_day(model_t *pmodel, struct page_data *data) {
+    const timeseries_t *ts    = model_get_timeseries(pmodel);
+    size_t              count = timeseries_rollup_count(ts, DAY_LEVEL);
+    uint64_t            now   = timeseries_time(ts, get_millis());
+
+    size_t first = count;
+    while (first > 0) {
+        uint64_t timestamp = timeseries_rollup_timestamp(ts, DAY_LEVEL, first - 1);
+        if ((data->columns > 0 && timestamp <= data->last) || now - timestamp > DAY_WINDOW) {
+            break;
+        }
+        first--;
+    }
+
+    for (size_t i = first; i < count; i++) {
+        int16_t min[NUM_SOURCES];
+        int16_t max[NUM_SOURCES];
+        for (size_t j = 0; j < NUM_SOURCES; j++) {
+            min[j] = timeseries_rollup_value(ts, DAY_LEVEL, TIMESERIES_MIN, channels[j], i);
+            max[j] = timeseries_rollup_value(ts, DAY_LEVEL, TIMESERIES_MAX, channels[j], i);
+        }
+        add_sample(data, timeseries_rollup_timestamp(ts, DAY_LEVEL, i), min, max);
+    }
+}
+
+
+/*
+ * Riepiloghi tra l'inizio del ciclo `from` e il primo campione grezzo `to`, dal livello piu' fine che arriva ancora
+ * a `from`; se nessuno ci arriva (cicli di oltre due settimane) si parte dal riepilogo piu' vecchio
+ */
+static void add_rollups(const timeseries_t *ts, struct page_data *data, uint64_t from, uint64_t to) {
+    timeseries_level_t level = TIMESERIES_LEVEL_10S;
+    while (level + 1 < TIMESERIES_NUM_LEVELS &&
+           (timeseries_rollup_count(ts, level) == 0 || timeseries_rollup_timestamp(ts, level, 0) > from)) {
+        level++;
+    }
+
+    size_t count = timeseries_rollup_count(ts, level);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t timestamp = timeseries_rollup_timestamp(ts, level, i);
+        if (timestamp >= to) {
+            break;
+        }
+        // Si parte dall'intervallo che contiene l'inizio del ciclo
+        if (i + 1 < count && timeseries_rollup_timestamp(ts, level, i + 1) <= from) {
+            continue;
+        }
+
+        int16_t min[NUM_SOURCES];
+        int16_t max[NUM_SOURCES];
+        for (size_t j = 0; j < NUM_SOURCES; j++) {
+            min[j] = timeseries_rollup_value(ts, level, TIMESERIES_MIN, channels[j], i);
+            max[j] = timeseries_rollup_value(ts, level, TIMESERIES_MAX, channels[j], i);
+        }
+        add_sample(data, timestamp, min, max);
+    }
+}
+
+
+static void update_mode(struct page_data *data) {
+    if (data->day) {
+        lv_obj_add_state(data->btn_day, LV_STATE_CHECKED);
+        lv_obj_clear_state(data->btn_cycle, LV_STATE_CHECKED);
+    } else {
+        lv_obj_add_state(data->btn_cycle, LV_STATE_CHECKED);
+        lv_obj_clear_state(data->btn_day, LV_STATE_CHECKED);
+    }
+}
+
+
+/*
+ * Ogni colonna del grafico conserva minimo e massimo dei campioni che ricadono nel suo intervallo: i picchi restano
+ * visibili a qualunque risoluzione
+ */
+static void add_sample(struct page_data *data, uint64_t timestamp, const int16_t *min, const int16_t *max) {
+    if (data->columns == 0 && !data->day) {
+        data->origin = timestamp;
+    }
+
+    size_t column = (timestamp - data->origin) / data->period;
+    // Il ciclo deve sempre stare tutto nel grafico
+    while (!data->day && column >= CHART_POINTS) {
+        halve_resolution(data);
+        column = (timestamp - data->origin) / data->period;
+    }
+
+    if (data->columns > 0 && column == data->column) {
+        size_t slot = (data->columns - 1) % CHART_POINTS;
+        for (size_t i = 0; i < NUM_SOURCES; i++) {
+            data->min[i][slot] = min[i] < data->min[i][slot] ? min[i] : data->min[i][slot];
+            data->max[i][slot] = merge_max(max[i], data->max[i][slot]);
+        }
+        set_last_point(data, slot);
+    } else {
+        // Colonne vuote per i periodi senza dati
+        size_t gap = data->columns > 0 ? column - data->column - 1 : 0;
+        gap        = gap < CHART_POINTS ? gap : CHART_POINTS;
+
+        int16_t none[NUM_SOURCES];
+        for (size_t i = 0; i < NUM_SOURCES; i++) {
+            none[i] = LV_CHART_POINT_NONE;
+        }
+        for (size_t i = 0; i < gap; i++) {
+            append_column(data, none, none);
+        }
+
+        append_column(data, min, max);
+        data->column = column;
+    }
+
+    data->last = timestamp;
+}
+
+
+static void append_column(struct page_data *data, const int16_t *min, const int16_t *max) {
+    size_t slot = data->columns % CHART_POINTS;
+    for (size_t i = 0; i < NUM_SOURCES; i++) {
+        data->min[i][slot] = min[i];
+        data->max[i][slot] = max[i];
+    }
+    data->columns++;
+
+    for (size_t i = 0; i < NUM_SERIES; i++) {
+        lv_chart_set_next_value(data->chart, data->series[i], series_value(data, i, slot));
+    }
+}
+
+
+/*
+ * Unisce le colonne a coppie; costa CHART_POINTS passi qualunque sia la durata del ciclo
+ */
+static void halve_resolution(struct page_data *data) {
+    size_t columns = (data->columns + 1) / 2;
+
+    for (size_t i = 0; i < columns; i++) {
+        for (size_t j = 0; j < NUM_SOURCES; j++) {
+            int16_t min = data->min[j][i * 2];
+            int16_t max = data->max[j][i * 2];
+            if (i * 2 + 1 < data->columns) {
+                min = data->min[j][i * 2 + 1] < min ? data->min[j][i * 2 + 1] : min;
+                max = merge_max(data->max[j][i * 2 + 1], max);
+            }
+            data->min[j][i] = min;
+            data->max[j][i] = max;
+        }
+    }
+
+    data->columns = columns;
+    data->column /= 2;
+    data->period *= 2;
+
+    for (size_t i = 0; i < NUM_SERIES; i++) {
+        lv_chart_set_all_value(data->chart, data->series[i], LV_CHART_POINT_NONE);
+        for (size_t j = 0; j < columns; j++) {
+            lv_chart_set_next_value(data->chart, data->series[i], series_value(data, i, j));
+        }
+    }
+}
+
+
+// In modalita' SHIFT l'ultimo punto inserito e' quello che precede il punto di partenza
+static void set_last_point(struct page_data *data, size_t slot) {
+    for (size_t i = 0; i < NUM_SERIES; i++) {
+        uint16_t id = (lv_chart_get_x_start_point(data->chart, data->series[i]) + CHART_POINTS - 1) % CHART_POINTS;
+        lv_chart_set_value_by_id(data->chart, data->series[i], id, series_value(data, i, slot));
+    }
+    lv_chart_refresh(data->chart);
+}
+
+
+static lv_coord_t series_value(struct page_data *data, size_t series, size_t slot) {
+    int     source = series_info[series].source;
+    int16_t value  = series_info[series].max ? data->max[source][slot] : data->min[source][slot];
+
+    // Senza programma in corso il setpoint e' nullo
+    if (source == SOURCE_SETPOINT && value == 0) {
+        return LV_CHART_POINT_NONE;
+    }
+    return value;
+}
+
+
+// LV_CHART_POINT_NONE e' il massimo di int16_t: nel minimo si scarta da solo, nel massimo va escluso
+static int16_t merge_max(int16_t a, int16_t b) {
+    if (a == LV_CHART_POINT_NONE) {
+        return b;
+    } else if (b == LV_CHART_POINT_NONE) {
+        return a;
+    } else {
+        return a > b ? a : b;
+    }
+}
+
+
+static lv_obj_t *create_mode_button(lv_obj_t *parent, const char *text, int id) {
+    lv_obj_t *btn = lv_btn_create(parent);
+    lv_obj_set_size(btn, 240, 56);
+    lv_obj_set_style_bg_color(btn, lv_palette_main(LV_PALETTE_GREY), LV_STATE_DEFAULT);
+    lv_obj_set_style_bg_color(btn, lv_palette_main(LV_PALETTE_BLUE), LV_STATE_CHECKED);
+
+    lv_obj_t *lbl = lv_label_create(btn);
+    lv_obj_set_style_text_font(lbl, &lv_font_montserrat_22, LV_STATE_DEFAULT);
+    lv_label_set_text(lbl, text);
+    lv_obj_center(lbl);
+
+    view_register_object_default_callback(btn, id);
+    return btn;
+}
+
+
+const pman_page_t page_trend = {
+    .create        = create_page,
+    .open          = open_page,
+    .close         = close_page,
+    .destroy       = destroy_page,
+    .process_event = process_page_event,
+};
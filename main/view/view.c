@@ -4,7 +4,7 @@
 #include "config/app_conf.h"
 #include "model/model.h"
 #include "view.h"
-#include "log.h"
+#include "utils/async_log.h"
 #include "theme/style.h"
 #include "theme/theme.h"
 #include "widgets/custom_tabview.h"
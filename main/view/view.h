@@ -22,6 +22,6 @@ void view_register_keyboard_plus_minus_callback(lv_obj_t *kb, int id);
 
 
 extern const pman_page_t page_drive, page_splash, page_main, page_network, page_settings, page_test, page_log,
-    page_tech_settings, page_stats, page_program, page_step;
+    page_tech_settings, page_stats, page_program, page_step, page_trend, page_alarms;
 
 #endif
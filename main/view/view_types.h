@@ -45,7 +45,9 @@ typedef enum {
     VIEW_EVENT_CODE_IO_DONE,
     VIEW_EVENT_CODE_DRIVE,
     VIEW_EVENT_CODE_WIFI,
-    VIEW_EVENT_CODE_LOG_FILE_READ,
+    VIEW_EVENT_CODE_BOOT_COMPLETE,
+    VIEW_EVENT_CODE_IO_PROGRESS,
+    VIEW_EVENT_CODE_PROGRAM_LOADED,
 } view_event_code_t;
 
 
@@ -65,7 +67,6 @@ typedef enum {
     VIEW_CONTROLLER_MESSAGE_CODE_WIFI_SCAN,
     VIEW_CONTROLLER_MESSAGE_CODE_CONNECT_TO_WIFI_NETWORK,
     VIEW_CONTROLLER_MESSAGE_CODE_SAVE_WIFI_CONFIG,
-    VIEW_CONTROLLER_MESSAGE_CODE_READ_LOG_FILE,
     VIEW_CONTROLLER_MESSAGE_CODE_CLEAR_ALARMS,
     VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_CURRENT_MACHINE,
     VIEW_CONTROLLER_MESSAGE_CODE_IMPORT_CURRENT_MACHINE,
@@ -75,6 +76,12 @@ typedef enum {
     VIEW_CONTROLLER_MESSAGE_CODE_CHANGE_SPEED,
     VIEW_CONTROLLER_MESSAGE_CODE_READ_STATISTICS,
     VIEW_CONTROLLER_MESSAGE_CODE_FIRMWARE_UPDATE,
+    VIEW_CONTROLLER_MESSAGE_CODE_START_INPUT_STREAM,
+    VIEW_CONTROLLER_MESSAGE_CODE_STOP_INPUT_STREAM,
+    VIEW_CONTROLLER_MESSAGE_CODE_CANCEL_IO,
+    VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_LOGS,
+    VIEW_CONTROLLER_MESSAGE_CODE_EXPORT_ALARMS,
+    VIEW_CONTROLLER_MESSAGE_CODE_READ_ALARM_HISTORY,
 } view_controller_message_code_t;
 
 
@@ -96,6 +103,11 @@ typedef struct {
             size_t pwm;
             int    speed;
         };
+        struct {
+            int      history_io_op;
+            uint32_t from;     // s dal 1970
+            uint32_t to;
+        };
         struct {
             size_t rele;
             int    value;
@@ -119,6 +131,7 @@ typedef struct {
             void *io_data;
             int   io_op;
             int   error;
+            int   io_progress;
         };
         int timer_code;
         struct {
@@ -0,0 +1,24 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+
+
+/*
+ *  Sostituisce utils/async_log.c: i messaggi vanno su stderr solo con DS2021_TEST_LOG impostata
+ */
+
+void log_log(int level, const char *file, int line, const char *fmt, ...) {
+    static const char *level_strings[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+    va_list            ap;
+
+    if (getenv("DS2021_TEST_LOG") == NULL) {
+        return;
+    }
+
+    fprintf(stderr, "%-5s %s:%i: ", level_strings[level], file, line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
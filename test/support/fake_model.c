@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "model/model.h"
+
+
+/*
+ *  Sostituisce la serializzazione dei parametri macchina per i test che usano storage.c senza il modello
+ */
+
+size_t model_serialize_parmac(uint8_t *buffer, parmac_t *parmac) {
+    (void)buffer;
+    (void)parmac;
+    return 0;
+}
+
+
+size_t model_deserialize_parmac(parmac_t *parmac, uint8_t *buffer) {
+    (void)parmac;
+    (void)buffer;
+    return 0;
+}
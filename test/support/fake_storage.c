@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "controller/storage/storage.h"
+
+
+/*
+ *  Transazioni di storage senza rimontaggi, per i moduli che le usano soltanto: i file vengono scritti accanto a
+ *  quello finale e rinominati al commit piu' esterno, come in storage.c
+ */
+
+#define MAX_FILES  8
+#define TMP_SUFFIX ".tmp"
+
+
+static struct {
+    size_t depth;
+    int    error;
+    size_t num_files;
+    char   paths[MAX_FILES][256];
+} transaction = {0};
+
+
+void storage_transaction_begin(void) {
+    if (transaction.depth++ == 0) {
+        transaction.error     = 0;
+        transaction.num_files = 0;
+    }
+}
+
+
+int storage_transaction_write(const char *path, const void *data, size_t len) {
+    char tmp_path[256 + sizeof(TMP_SUFFIX)];
+
+    if (transaction.num_files == MAX_FILES) {
+        transaction.error = 1;
+        return -1;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, TMP_SUFFIX);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL || fwrite(data, 1, len, f) != len || fclose(f) != 0) {
+        transaction.error = 1;
+        return -1;
+    }
+
+    snprintf(transaction.paths[transaction.num_files++], sizeof(transaction.paths[0]), "%s", path);
+    return 0;
+}
+
+
+int storage_transaction_commit(void) {
+    char tmp_path[256 + sizeof(TMP_SUFFIX)];
+
+    if (transaction.depth == 0 || --transaction.depth > 0) {
+        return transaction.error;
+    }
+
+    for (size_t i = 0; i < transaction.num_files; i++) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s%s", transaction.paths[i], TMP_SUFFIX);
+        if (transaction.error) {
+            unlink(tmp_path);
+        } else if (rename(tmp_path, transaction.paths[i]) < 0) {
+            transaction.error = 1;
+        }
+    }
+
+    transaction.num_files = 0;
+    return transaction.error;
+}
+
+
+int storage_pwrite_all(int fd, const uint8_t *buffer, size_t len, off_t offset) {
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t res = pwrite(fd, &buffer[written], len - written, offset + written);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += res;
+    }
+
+    return 0;
+}
+
+
+int storage_sync_dir(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return -1;
+    }
+    int res = fsync(fd);
+    close(fd);
+    return res;
+}
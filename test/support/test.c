@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "test.h"
+
+
+#define TEST_DIR "build-test/tmp"
+
+
+int test_failures = 0;
+int test_checks   = 0;
+
+
+void test_setup(void) {
+    static char root[256] = {0};
+
+    // Le cartelle sono relative a quella da cui e' stato lanciato il primo test
+    if (root[0] == '\0' && getcwd(root, sizeof(root)) == NULL) {
+        perror("getcwd");
+        exit(1);
+    }
+    if (chdir(root) < 0 || system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR) != 0 || chdir(TEST_DIR) < 0) {
+        perror(TEST_DIR);
+        exit(1);
+    }
+}
+
+
+int test_report(void) {
+    printf("%i verifiche, %i fallite\n", test_checks, test_failures);
+    return test_failures > 0;
+}
@@ -0,0 +1,51 @@
+#ifndef TEST_H_INCLUDED
+#define TEST_H_INCLUDED
+
+
+#include <stdio.h>
+
+
+/*
+ *  Verifiche minime per i test sull'host: ogni test e' un eseguibile che ritorna 0 se tutte le verifiche passano
+ */
+
+extern int test_failures;
+extern int test_checks;
+
+
+#define TEST_ASSERT(condition)                                                                                         \
+    do {                                                                                                               \
+        test_checks++;                                                                                                 \
+        if (!(condition)) {                                                                                            \
+            test_failures++;                                                                                           \
+            fprintf(stderr, "%s:%i: verifica fallita: %s\n", __FILE__, __LINE__, #condition);                          \
+        }                                                                                                              \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL(expected, actual)                                                                            \
+    do {                                                                                                               \
+        long long _expected = (long long)(expected);                                                                   \
+        long long _actual   = (long long)(actual);                                                                     \
+        test_checks++;                                                                                                 \
+        if (_expected != _actual) {                                                                                    \
+            test_failures++;                                                                                           \
+            fprintf(stderr, "%s:%i: %s: atteso %lli, ottenuto %lli\n", __FILE__, __LINE__, #actual, _expected,         \
+                    _actual);                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+#define RUN_TEST(test)                                                                                                 \
+    do {                                                                                                               \
+        int _failures = test_failures;                                                                                 \
+        test_setup();                                                                                                  \
+        test();                                                                                                        \
+        printf("%s %s\n", test_failures == _failures ? "OK    " : "ERRORE", #test);                                    \
+    } while (0)
+
+
+// Prepara una cartella vuota per i file del test e la rende quella corrente
+void test_setup(void);
+int  test_report(void);
+
+
+#endif
@@ -0,0 +1,237 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "controller/storage/alarm_history.h"
+#include "test.h"
+
+
+#define HISTORY_PATH "storico_allarmi.bin"
+#define MAX_EVENTS   4096
+#define EXPORT_NAME  "DS2021_allarmi_"
+
+
+static uint32_t first_timestamp = 0;
+
+
+static int append_events(size_t first, size_t count) {
+    alarm_event_t events[ALARM_EVENT_PENDING];
+
+    while (count > 0) {
+        size_t num = count < ALARM_EVENT_PENDING ? count : ALARM_EVENT_PENDING;
+        for (size_t i = 0; i < num; i++) {
+            events[i] = (alarm_event_t){
+                .timestamp      = first_timestamp + first + i,
+                .code           = (first + i) % 3,
+                .flags          = (first + i) % 2 == 0 ? ALARM_EVENT_FLAG_RAISED : 0,
+                .program_number = (first + i) % 4 == 0 ? ALARM_EVENT_NO_PROGRAM : 1,
+                .step           = 2,
+            };
+        }
+        if (alarm_history_append(HISTORY_PATH, events, num)) {
+            return -1;
+        }
+        first += num;
+        count -= num;
+    }
+    return 0;
+}
+
+
+static void corrupt_header(void) {
+    FILE *f = fopen(HISTORY_PATH, "r+b");
+    fwrite("XXXX", 1, 4, f);
+    fclose(f);
+}
+
+
+static int find_export(char *path, size_t size) {
+    int            found = 0;
+    DIR           *dir   = opendir(".");
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, EXPORT_NAME, strlen(EXPORT_NAME)) == 0) {
+            snprintf(path, size, "%s", entry->d_name);
+            found++;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+
+static int cancel_export(size_t done, size_t total, void *arg) {
+    (void)total;
+    (void)arg;
+    return done > 0;
+}
+
+
+static void test_missing_history(void) {
+    alarm_history_t history;
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+    TEST_ASSERT_EQUAL(0, history.counts[0]);
+}
+
+
+static void test_append_and_query(void) {
+    alarm_history_t history;
+
+    TEST_ASSERT_EQUAL(0, append_events(0, 10));
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(10, history.count);
+    TEST_ASSERT_EQUAL(first_timestamp + 9, history.events[0].timestamp);
+    TEST_ASSERT_EQUAL(0, history.events[0].code);
+    TEST_ASSERT_EQUAL(0, history.events[0].flags);
+    TEST_ASSERT_EQUAL(first_timestamp, history.events[9].timestamp);
+    TEST_ASSERT_EQUAL(ALARM_EVENT_NO_PROGRAM, history.events[9].program_number);
+
+    // Solo le attivazioni: 0, 2, 4, 6, 8
+    TEST_ASSERT_EQUAL(2, history.counts[0]);
+    TEST_ASSERT_EQUAL(1, history.counts[1]);
+    TEST_ASSERT_EQUAL(2, history.counts[2]);
+
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, first_timestamp + 2, first_timestamp + 4, &history));
+    TEST_ASSERT_EQUAL(3, history.count);
+    TEST_ASSERT_EQUAL(first_timestamp + 4, history.events[0].timestamp);
+}
+
+
+static void test_ring_wraps(void) {
+    alarm_history_t history;
+
+    TEST_ASSERT_EQUAL(0, append_events(0, MAX_EVENTS + 100));
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(ALARM_HISTORY_QUERY_MAX, history.count);
+    TEST_ASSERT_EQUAL(first_timestamp + MAX_EVENTS + 99, history.events[0].timestamp);
+
+    // I contatori giornalieri non dipendono dall'anello
+    TEST_ASSERT_EQUAL((MAX_EVENTS + 100) / 2, history.counts[0] + history.counts[1] + history.counts[2]);
+
+    // Gli eventi sovrascritti non ci sono piu'
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, first_timestamp + 99, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, first_timestamp + 100, &history));
+    TEST_ASSERT_EQUAL(1, history.count);
+}
+
+
+static void check_rebuilt_header(size_t total) {
+    alarm_history_t history;
+
+    append_events(0, total);
+    corrupt_header();
+
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(total < ALARM_HISTORY_QUERY_MAX ? total : ALARM_HISTORY_QUERY_MAX, history.count);
+    TEST_ASSERT_EQUAL(first_timestamp + total - 1, history.events[0].timestamp);
+
+    // Il prossimo evento va dopo il piu' recente e sovrascrive solo il piu' vecchio
+    TEST_ASSERT_EQUAL(0, append_events(total, 1));
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(first_timestamp + total, history.events[0].timestamp);
+    TEST_ASSERT_EQUAL(first_timestamp + total - 1, history.events[1].timestamp);
+
+    size_t kept = total + 1 < MAX_EVENTS ? total + 1 : MAX_EVENTS;
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, first_timestamp + total - kept, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, first_timestamp + total - kept + 1, &history));
+    TEST_ASSERT_EQUAL(1, history.count);
+}
+
+
+static void test_rebuild_partial_ring(void) {
+    check_rebuilt_header(100);
+}
+
+
+static void test_rebuild_full_ring(void) {
+    check_rebuilt_header(MAX_EVENTS);
+}
+
+
+static void test_rebuild_wrapped_ring(void) {
+    check_rebuilt_header(MAX_EVENTS + 904);
+}
+
+
+static void test_rebuild_short_header(void) {
+    alarm_history_t history;
+
+    append_events(0, 40);
+    TEST_ASSERT_EQUAL(0, truncate(HISTORY_PATH, 6));
+
+    // Senza anello non resta nulla, ma il file torna utilizzabile
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+    TEST_ASSERT_EQUAL(0, append_events(40, 2));
+    TEST_ASSERT_EQUAL(0, alarm_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(2, history.count);
+}
+
+
+static void test_export(void) {
+    char path[256], line[512];
+
+    append_events(0, 70);
+    TEST_ASSERT_EQUAL(0, alarm_history_export(HISTORY_PATH, ".", NULL, NULL));
+    TEST_ASSERT_EQUAL(1, find_export(path, sizeof(path)));
+
+    FILE  *f        = fopen(path, "r");
+    size_t events   = 0;
+    size_t days     = 0;
+    int    counters = 0;
+
+    TEST_ASSERT(fgets(line, sizeof(line), f) != NULL);
+    TEST_ASSERT(strcmp(line, "data;ora;codice;evento;programma;passo\n") == 0);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strcmp(line, "\n") == 0) {
+            counters = 1;
+        } else if (counters && strncmp(line, "giorno", 6) == 0) {
+            // Una colonna per ciascun codice
+            TEST_ASSERT(strstr(line, ";codice 16\n") != NULL);
+        } else if (counters) {
+            size_t columns = 0;
+            for (char *c = line; *c != '\0'; c++) {
+                columns += *c == ';';
+            }
+            TEST_ASSERT_EQUAL(ALARM_EVENT_CODES, columns);
+            days++;
+        } else {
+            events++;
+        }
+    }
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(70, events);
+    TEST_ASSERT(days >= 1 && days <= 2);
+}
+
+
+static void test_export_cancelled(void) {
+    char path[256];
+
+    append_events(0, 70);
+    TEST_ASSERT_EQUAL(-1, alarm_history_export(HISTORY_PATH, ".", cancel_export, NULL));
+    TEST_ASSERT_EQUAL(0, find_export(path, sizeof(path)));
+}
+
+
+int main(void) {
+    // Eventi recenti, perche' i contatori giornalieri coprono solo gli ultimi giorni
+    first_timestamp = (uint32_t)time(NULL) - 2 * MAX_EVENTS;
+
+    RUN_TEST(test_missing_history);
+    RUN_TEST(test_append_and_query);
+    RUN_TEST(test_ring_wraps);
+    RUN_TEST(test_rebuild_partial_ring);
+    RUN_TEST(test_rebuild_full_ring);
+    RUN_TEST(test_rebuild_wrapped_ring);
+    RUN_TEST(test_rebuild_short_header);
+    RUN_TEST(test_export);
+    RUN_TEST(test_export_cancelled);
+    return test_report();
+}
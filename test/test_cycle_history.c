@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "controller/storage/cycle_history.h"
+#include "test.h"
+
+
+#define HISTORY_PATH  "storico_cicli.bin"
+#define DATA_START    (16 + 8 * 64)
+#define RECORD_SIZE   128
+#define GROUP_RECORDS 32
+#define FIRST_START   1000
+
+
+static int append_cycles(size_t first, size_t count) {
+    for (size_t i = first; i < first + count; i++) {
+        cycle_record_t record = {0};
+        record.start           = FIRST_START + i;
+        record.end             = FIRST_START + i + 3600;
+        record.program_number  = i % 7;
+        record.stop_reason     = CYCLE_STOP_REASON_USER;
+        record.num_steps       = 2;
+        record.min_temperature = -5;
+        record.avg_humidity    = 40;
+
+        record.step_durations[1] = i;
+        snprintf(record.program_name, sizeof(name_t), "Programma %zu", i);
+
+        if (cycle_history_append(HISTORY_PATH, &record)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static size_t file_size(void) {
+    struct stat st;
+    return stat(HISTORY_PATH, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+
+static void write_at(long offset, const void *data, size_t len) {
+    FILE *f = fopen(HISTORY_PATH, "r+b");
+    fseek(f, offset, SEEK_SET);
+    fwrite(data, 1, len, f);
+    fclose(f);
+}
+
+
+static void test_missing_history(void) {
+    cycle_history_t history;
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+}
+
+
+static void test_append_and_query(void) {
+    cycle_history_t history;
+
+    TEST_ASSERT_EQUAL(0, append_cycles(0, 10));
+    TEST_ASSERT_EQUAL(DATA_START + 10 * RECORD_SIZE, file_size());
+
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(10, history.count);
+    TEST_ASSERT_EQUAL(FIRST_START + 9, history.records[0].start);
+    TEST_ASSERT_EQUAL(FIRST_START + 0, history.records[9].start);
+    TEST_ASSERT_EQUAL(FIRST_START + 9 + 3600, history.records[0].end);
+    TEST_ASSERT_EQUAL(2, history.records[0].program_number);
+    TEST_ASSERT_EQUAL(CYCLE_STOP_REASON_USER, history.records[0].stop_reason);
+    TEST_ASSERT_EQUAL(-5, history.records[0].min_temperature);
+    TEST_ASSERT_EQUAL(40, history.records[0].avg_humidity);
+    TEST_ASSERT_EQUAL(9, history.records[0].step_durations[1]);
+    TEST_ASSERT(strcmp(history.records[0].program_name, "Programma 9") == 0);
+
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, FIRST_START + 3, FIRST_START + 5, &history));
+    TEST_ASSERT_EQUAL(3, history.count);
+    TEST_ASSERT_EQUAL(FIRST_START + 5, history.records[0].start);
+}
+
+
+static void test_query_through_closed_groups(void) {
+    cycle_history_t history;
+
+    TEST_ASSERT_EQUAL(0, append_cycles(0, 5 * GROUP_RECORDS + 7));
+
+    // Solo gli ultimi CYCLE_HISTORY_QUERY_MAX
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(CYCLE_HISTORY_QUERY_MAX, history.count);
+    TEST_ASSERT_EQUAL(FIRST_START + 5 * GROUP_RECORDS + 6, history.records[0].start);
+
+    // Intervallo che cade a cavallo di due gruppi chiusi
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, FIRST_START + 30, FIRST_START + 33, &history));
+    TEST_ASSERT_EQUAL(4, history.count);
+    TEST_ASSERT_EQUAL(FIRST_START + 33, history.records[0].start);
+    TEST_ASSERT_EQUAL(FIRST_START + 30, history.records[3].start);
+}
+
+
+static void test_torn_record_is_overwritten(void) {
+    cycle_history_t history;
+
+    append_cycles(0, 10);
+    // Scrittura interrotta a meta' record
+    write_at(DATA_START + 10 * RECORD_SIZE, "interrotto", 10);
+
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(10, history.count);
+
+    TEST_ASSERT_EQUAL(0, append_cycles(10, 1));
+    TEST_ASSERT_EQUAL(DATA_START + 11 * RECORD_SIZE, file_size());
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(11, history.count);
+    TEST_ASSERT_EQUAL(FIRST_START + 10, history.records[0].start);
+}
+
+
+static void test_full_group_without_index(void) {
+    cycle_history_t history;
+    uint8_t         record[RECORD_SIZE];
+
+    // L'ultimo record del gruppo e' stato scritto ma l'indice non e' stato aggiornato
+    append_cycles(0, GROUP_RECORDS - 1);
+    FILE *f = fopen(HISTORY_PATH, "rb");
+    fseek(f, DATA_START + (GROUP_RECORDS - 2) * RECORD_SIZE, SEEK_SET);
+    TEST_ASSERT_EQUAL(RECORD_SIZE, fread(record, 1, RECORD_SIZE, f));
+    fclose(f);
+    write_at(DATA_START + (GROUP_RECORDS - 1) * RECORD_SIZE, record, RECORD_SIZE);
+
+    TEST_ASSERT_EQUAL(0, append_cycles(GROUP_RECORDS, 1));
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(GROUP_RECORDS + 1, history.count);
+    TEST_ASSERT_EQUAL(FIRST_START + GROUP_RECORDS, history.records[0].start);
+}
+
+
+static void test_corrupt_index_is_rebuilt(void) {
+    cycle_history_t history;
+    uint8_t         header[DATA_START];
+
+    append_cycles(0, 3 * GROUP_RECORDS + 4);
+    FILE *f = fopen(HISTORY_PATH, "rb");
+    TEST_ASSERT_EQUAL(DATA_START, fread(header, 1, DATA_START, f));
+    fclose(f);
+    write_at(0, "XXXX", 4);
+
+    // Nessun ciclo perso, nemmeno nei gruppi chiusi
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(CYCLE_HISTORY_QUERY_MAX, history.count);
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, FIRST_START, FIRST_START + 1, &history));
+    TEST_ASSERT_EQUAL(2, history.count);
+
+    // La prossima aggiunta riscrive lo stesso indice senza troncare il file
+    TEST_ASSERT_EQUAL(0, append_cycles(3 * GROUP_RECORDS + 4, 1));
+    TEST_ASSERT_EQUAL(DATA_START + (3 * GROUP_RECORDS + 5) * RECORD_SIZE, file_size());
+
+    uint8_t rebuilt[DATA_START];
+    f = fopen(HISTORY_PATH, "rb");
+    TEST_ASSERT_EQUAL(DATA_START, fread(rebuilt, 1, DATA_START, f));
+    fclose(f);
+    TEST_ASSERT(memcmp(header, rebuilt, DATA_START) == 0);
+}
+
+
+static void test_short_header_is_rebuilt(void) {
+    cycle_history_t history;
+
+    FILE *f = fopen(HISTORY_PATH, "wb");
+    fwrite("DSCH", 1, 4, f);
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+
+    TEST_ASSERT_EQUAL(0, append_cycles(0, 2));
+    TEST_ASSERT_EQUAL(DATA_START + 2 * RECORD_SIZE, file_size());
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(2, history.count);
+}
+
+
+static void test_compaction_keeps_newest_half(void) {
+    cycle_history_t history;
+    size_t          total = 64 * GROUP_RECORDS + 5;
+
+    TEST_ASSERT_EQUAL(0, append_cycles(0, total));
+    TEST_ASSERT_EQUAL(DATA_START + (32 * GROUP_RECORDS + 5) * RECORD_SIZE, file_size());
+    TEST_ASSERT(access(HISTORY_PATH ".tmp", F_OK) < 0);
+
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, FIRST_START + 32 * GROUP_RECORDS - 1, &history));
+    TEST_ASSERT_EQUAL(0, history.count);
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, FIRST_START + 32 * GROUP_RECORDS,
+                                             FIRST_START + 32 * GROUP_RECORDS + 2, &history));
+    TEST_ASSERT_EQUAL(3, history.count);
+    TEST_ASSERT_EQUAL(0, cycle_history_query(HISTORY_PATH, 0, UINT32_MAX, &history));
+    TEST_ASSERT_EQUAL(FIRST_START + total - 1, history.records[0].start);
+}
+
+
+int main(void) {
+    RUN_TEST(test_missing_history);
+    RUN_TEST(test_append_and_query);
+    RUN_TEST(test_query_through_closed_groups);
+    RUN_TEST(test_torn_record_is_overwritten);
+    RUN_TEST(test_full_group_without_index);
+    RUN_TEST(test_corrupt_index_is_rebuilt);
+    RUN_TEST(test_short_header_is_rebuilt);
+    RUN_TEST(test_compaction_keeps_newest_half);
+    return test_report();
+}
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gel/serializer/serializer.h"
+#include "controller/storage/storage.h"
+#include "utils/crc32.h"
+#include "test.h"
+
+
+#define PATCH_PATH    "firmware.delta"
+#define IMAGE_PATH    "firmware.img"
+#define FIRMWARE_PATH "firmware.bin"
+#define TMP_PATH      FIRMWARE_PATH ".tmp"
+#define BLOCK         4096
+#define EXTRA         "firmware nuovo"
+#define EXTRA_LEN     (sizeof(EXTRA) - 1)
+#define TARGET_SIZE   (2 * BLOCK + EXTRA_LEN)
+#define PATCH_SIZE    (8 + 4 * 4 + 2 * 3 * 4 + TARGET_SIZE)
+
+
+/*
+ * La patch si applica all'eseguibile in funzione, per cui viene calcolata sul test stesso: il firmware nuovo e' il
+ * primo blocco modificato, alcuni byte nuovi e il terzo blocco invariato
+ */
+static uint8_t *source      = NULL;
+static size_t   source_size = 0;
+static uint8_t  target[TARGET_SIZE];
+static uint8_t  patch[PATCH_SIZE];
+
+
+static void load_source(void) {
+    FILE *f = fopen("/proc/self/exe", "rb");
+    fseek(f, 0, SEEK_END);
+    source_size = ftell(f);
+    source      = malloc(source_size);
+    fseek(f, 0, SEEK_SET);
+    if (fread(source, 1, source_size, f) != source_size || source_size < 3 * BLOCK) {
+        fprintf(stderr, "Non riesco a leggere l'eseguibile del test\n");
+        exit(1);
+    }
+    fclose(f);
+
+    for (size_t i = 0; i < BLOCK; i++) {
+        target[i] = source[i] + (uint8_t)(i % 7);
+    }
+    memcpy(&target[BLOCK], EXTRA, EXTRA_LEN);
+    memcpy(&target[BLOCK + EXTRA_LEN], &source[2 * BLOCK], BLOCK);
+}
+
+
+// Patch valida: differenze del primo blocco, byte nuovi e salto del secondo blocco, differenze (nulle) del terzo
+static size_t build_patch(void) {
+    size_t i = 0;
+
+    memcpy(patch, "DSDELTA1", 8);
+    i += 8;
+    i += serialize_uint32_be(&patch[i], source_size);
+    i += serialize_uint32_be(&patch[i], crc32(source, source_size));
+    i += serialize_uint32_be(&patch[i], TARGET_SIZE);
+    i += serialize_uint32_be(&patch[i], crc32(target, TARGET_SIZE));
+
+    i += serialize_uint32_be(&patch[i], BLOCK);
+    i += serialize_uint32_be(&patch[i], EXTRA_LEN);
+    i += serialize_uint32_be(&patch[i], BLOCK);
+    for (size_t j = 0; j < BLOCK; j++) {
+        patch[i++] = target[j] - source[j];
+    }
+    memcpy(&patch[i], EXTRA, EXTRA_LEN);
+    i += EXTRA_LEN;
+
+    i += serialize_uint32_be(&patch[i], BLOCK);
+    i += serialize_uint32_be(&patch[i], 0);
+    i += serialize_uint32_be(&patch[i], 0);
+    memset(&patch[i], 0, BLOCK);
+    i += BLOCK;
+
+    return i;
+}
+
+
+static void write_patch(size_t len) {
+    FILE *f = fopen(PATCH_PATH, "wb");
+    fwrite(patch, 1, len, f);
+    fclose(f);
+}
+
+
+static int firmware_matches(void) {
+    uint8_t buffer[TARGET_SIZE + 1];
+    FILE   *f = fopen(FIRMWARE_PATH, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    size_t len = fread(buffer, 1, sizeof(buffer), f);
+    fclose(f);
+    return len == TARGET_SIZE && memcmp(buffer, target, TARGET_SIZE) == 0;
+}
+
+
+// Ogni patch rifiutata non lascia ne' il firmware ne' il file temporaneo
+static void check_rejected(size_t len) {
+    write_patch(len);
+    TEST_ASSERT_EQUAL(-1, storage_apply_firmware_delta(PATCH_PATH, FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(access(FIRMWARE_PATH, F_OK) < 0);
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+}
+
+
+static int count_progress(size_t done, size_t total, void *arg) {
+    size_t *calls = arg;
+    (*calls)++;
+    return done > total;
+}
+
+
+static int cancel_progress(size_t done, size_t total, void *arg) {
+    (void)total;
+    (void)arg;
+    return done > BLOCK;
+}
+
+
+static void test_apply(void) {
+    size_t calls = 0;
+
+    write_patch(build_patch());
+    TEST_ASSERT_EQUAL(0, storage_apply_firmware_delta(PATCH_PATH, FIRMWARE_PATH, count_progress, &calls));
+    TEST_ASSERT(firmware_matches());
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+    TEST_ASSERT(calls >= 3);
+}
+
+
+static void test_apply_compressed(void) {
+    write_patch(build_patch());
+    TEST_ASSERT_EQUAL(0, system("gzip -c " PATCH_PATH " > " PATCH_PATH ".gz"));
+    TEST_ASSERT_EQUAL(0, storage_apply_firmware_delta(PATCH_PATH ".gz", FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(firmware_matches());
+}
+
+
+static void test_missing_patch(void) {
+    TEST_ASSERT_EQUAL(-1, storage_apply_firmware_delta(PATCH_PATH, FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+}
+
+
+static void test_bad_header(void) {
+    size_t len = build_patch();
+    patch[7] = '2';
+    check_rejected(len);
+
+    // Intestazione incompleta
+    build_patch();
+    check_rejected(20);
+}
+
+
+static void test_wrong_source(void) {
+    size_t len = build_patch();
+    serialize_uint32_be(&patch[8], source_size + 1);
+    check_rejected(len);
+
+    build_patch();
+    serialize_uint32_be(&patch[12], crc32(source, source_size) ^ 1);
+    check_rejected(len);
+}
+
+
+static void test_truncated_patch(void) {
+    size_t len = build_patch();
+
+    // Dentro le differenze, dentro i byte nuovi, prima e dentro il secondo record di controllo
+    check_rejected(24 + 12 + 100);
+    check_rejected(24 + 12 + BLOCK + 3);
+    check_rejected(24 + 12 + BLOCK + EXTRA_LEN);
+    check_rejected(24 + 12 + BLOCK + EXTRA_LEN + 5);
+    check_rejected(len - 1);
+}
+
+
+static void test_corrupt_control(void) {
+    size_t len = build_patch();
+
+    // Piu' byte di quanti ne abbia il firmware
+    serialize_uint32_be(&patch[24 + 4], TARGET_SIZE);
+    check_rejected(len);
+
+    // Spostamento prima dell'inizio dell'eseguibile
+    build_patch();
+    serialize_uint32_be(&patch[24 + 8], (uint32_t)-(2 * BLOCK + 1));
+    check_rejected(len);
+
+    // Spostamento oltre la fine dell'eseguibile
+    build_patch();
+    serialize_uint32_be(&patch[24 + 8], source_size);
+    check_rejected(len);
+}
+
+
+static void test_wrong_target(void) {
+    size_t len = build_patch();
+
+    // Differenze alterate: il firmware ricostruito non corrisponde al CRC atteso
+    patch[24 + 12 + 10] ^= 0xFF;
+    check_rejected(len);
+
+    build_patch();
+    serialize_uint32_be(&patch[20], crc32(target, TARGET_SIZE) ^ 1);
+    check_rejected(len);
+}
+
+
+static void write_image(const char *manifest) {
+    FILE *f = fopen(IMAGE_PATH, "wb");
+    fwrite(target, 1, TARGET_SIZE, f);
+    fclose(f);
+
+    if (manifest != NULL) {
+        f = fopen(IMAGE_PATH ".manifest", "w");
+        fputs(manifest, f);
+        fclose(f);
+    }
+}
+
+
+static void test_full_image(void) {
+    char manifest[64];
+
+    snprintf(manifest, sizeof(manifest), "size=%zu\ncrc32=%08x\n", TARGET_SIZE, crc32(target, TARGET_SIZE));
+    write_image(manifest);
+    TEST_ASSERT_EQUAL(0, storage_update_temporary_firmware(IMAGE_PATH, FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(firmware_matches());
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+}
+
+
+static void test_full_image_without_manifest(void) {
+    // Verificato con quanto letto dalla chiavetta
+    write_image(NULL);
+    TEST_ASSERT_EQUAL(0, storage_update_temporary_firmware(IMAGE_PATH, FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(firmware_matches());
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+}
+
+
+static void test_full_image_wrong_manifest(void) {
+    char manifest[64];
+
+    snprintf(manifest, sizeof(manifest), "size=%zu\ncrc32=%08x\n", TARGET_SIZE, crc32(target, TARGET_SIZE) ^ 1);
+    write_image(manifest);
+    TEST_ASSERT_EQUAL(-1, storage_update_temporary_firmware(IMAGE_PATH, FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(access(FIRMWARE_PATH, F_OK) < 0);
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+
+    // Dimensione diversa: scartato prima di scrivere
+    snprintf(manifest, sizeof(manifest), "size=%zu\ncrc32=%08x\n", TARGET_SIZE + 1, crc32(target, TARGET_SIZE));
+    write_image(manifest);
+    TEST_ASSERT_EQUAL(-1, storage_update_temporary_firmware(IMAGE_PATH, FIRMWARE_PATH, NULL, NULL));
+    TEST_ASSERT(access(FIRMWARE_PATH, F_OK) < 0);
+}
+
+
+static void test_cancelled(void) {
+    write_patch(build_patch());
+    TEST_ASSERT_EQUAL(-1, storage_apply_firmware_delta(PATCH_PATH, FIRMWARE_PATH, cancel_progress, NULL));
+    TEST_ASSERT(access(FIRMWARE_PATH, F_OK) < 0);
+    TEST_ASSERT(access(TMP_PATH, F_OK) < 0);
+}
+
+
+int main(void) {
+    load_source();
+
+    RUN_TEST(test_apply);
+    RUN_TEST(test_apply_compressed);
+    RUN_TEST(test_missing_patch);
+    RUN_TEST(test_bad_header);
+    RUN_TEST(test_wrong_source);
+    RUN_TEST(test_truncated_patch);
+    RUN_TEST(test_corrupt_control);
+    RUN_TEST(test_wrong_target);
+    RUN_TEST(test_cancelled);
+    RUN_TEST(test_full_image);
+    RUN_TEST(test_full_image_without_manifest);
+    RUN_TEST(test_full_image_wrong_manifest);
+
+    free(source);
+    return test_report();
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "utils/log_index.h"
+#include "test.h"
+
+
+#define LOG_PATH  "log.txt"
+#define NUM_LINES 5000     // Abbastanza da raddoppiare stride dei checkpoint e dimensione dei blocchi
+
+
+static log_index_t test_index;
+
+
+/*
+ * Righe come quelle di async_log: una su cinque e' un errore, i moduli si alternano e una su mille contiene "guasto"
+ */
+static void write_lines(const char *mode, size_t first, size_t count) {
+    FILE *f = fopen(LOG_PATH, mode);
+    for (size_t i = first; i < first + count; i++) {
+        fprintf(f, "2026-10-19 10:00:00 %s [%s] riga %zu%s\n", i % 5 == 0 ? "ERROR" : "INFO ",
+                i % 2 == 0 ? "motore" : "porta", i, i % 1000 == 7 ? " guasto inverter" : "");
+    }
+    fclose(f);
+}
+
+
+static void index_all(size_t budget) {
+    do {
+        log_index_update(&test_index, budget);
+    } while (!log_index_is_complete(&test_index));
+}
+
+
+static size_t line_number(size_t line) {
+    char   buffer[128];
+    size_t number = SIZE_MAX;
+
+    log_index_read(&test_index, log_index_find(&test_index, line), buffer, sizeof(buffer));
+    sscanf(buffer, "%*s %*s %*s [%*[^]]] riga %zu", &number);
+    return number;
+}
+
+
+static int find_module(const char *name) {
+    for (size_t i = 0; i < log_index_num_modules(&test_index); i++) {
+        if (strcmp(log_index_module(&test_index, i), name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+
+static size_t search(uint8_t levels, int module, const char *text, log_index_results_t *results) {
+    log_index_filter_t filter = {.levels = levels, .module = module};
+    snprintf(filter.text, sizeof(filter.text), "%s", text);
+
+    log_index_search_reset(results);
+    log_index_search(&test_index, &filter, results);
+    return log_index_results_count(results);
+}
+
+
+static void test_lines(void) {
+    char buffer[128];
+
+    write_lines("w", 0, NUM_LINES);
+    log_index_init(&test_index, LOG_PATH);
+    TEST_ASSERT_EQUAL(LOG_INDEX_RESET, log_index_update(&test_index, 4096));
+    index_all(4096);
+
+    TEST_ASSERT_EQUAL(NUM_LINES, log_index_lines(&test_index));
+    TEST_ASSERT_EQUAL(0, line_number(0));
+    TEST_ASSERT_EQUAL(1, line_number(1));
+    TEST_ASSERT_EQUAL(1023, line_number(1023));
+    TEST_ASSERT_EQUAL(3777, line_number(3777));
+    TEST_ASSERT_EQUAL(NUM_LINES - 1, line_number(NUM_LINES - 1));
+
+    // Oltre l'ultima riga si legge una riga vuota
+    log_index_read(&test_index, log_index_find(&test_index, NUM_LINES), buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL(0, strlen(buffer));
+
+    // Il buffer limita la lettura
+    size_t next = log_index_read(&test_index, log_index_find(&test_index, 2), buffer, 11);
+    TEST_ASSERT(strcmp(buffer, "2026-10-19") == 0);
+    TEST_ASSERT_EQUAL(log_index_find(&test_index, 3), next);
+
+    log_index_deinit(&test_index);
+}
+
+
+static void test_partial_and_crlf_lines(void) {
+    char buffer[64];
+
+    FILE *f = fopen(LOG_PATH, "w");
+    fprintf(f, "prima\r\nseconda senza fine");
+    fclose(f);
+
+    log_index_init(&test_index, LOG_PATH);
+    index_all(1024);
+    TEST_ASSERT_EQUAL(1, log_index_lines(&test_index));
+    log_index_read(&test_index, log_index_find(&test_index, 0), buffer, sizeof(buffer));
+    TEST_ASSERT(strcmp(buffer, "prima") == 0);
+
+    f = fopen(LOG_PATH, "a");
+    fprintf(f, "\n");
+    fclose(f);
+    TEST_ASSERT_EQUAL(LOG_INDEX_GROWN, log_index_update(&test_index, 1024));
+    TEST_ASSERT_EQUAL(2, log_index_lines(&test_index));
+    log_index_read(&test_index, log_index_find(&test_index, 1), buffer, sizeof(buffer));
+    TEST_ASSERT(strcmp(buffer, "seconda senza fine") == 0);
+
+    TEST_ASSERT_EQUAL(LOG_INDEX_UNCHANGED, log_index_update(&test_index, 1024));
+    log_index_deinit(&test_index);
+}
+
+
+static void test_search(void) {
+    static log_index_results_t results;
+
+    write_lines("w", 0, NUM_LINES);
+    log_index_init(&test_index, LOG_PATH);
+    index_all(1 << 20);
+
+    TEST_ASSERT_EQUAL(2, log_index_num_modules(&test_index));
+    int motore = find_module("motore");
+    int porta  = find_module("porta");
+    TEST_ASSERT(motore >= 0 && porta >= 0);
+
+    TEST_ASSERT_EQUAL(NUM_LINES / 5, search(LOG_INDEX_LEVEL(4), -1, "", &results));
+    TEST_ASSERT_EQUAL(5, log_index_result(&results, 1));
+    search(0, porta, "", &results);
+    TEST_ASSERT_EQUAL(NUM_LINES / 2, results.count);
+    TEST_ASSERT_EQUAL(NUM_LINES - 1, log_index_result(&results, LOG_INDEX_RESULTS - 1));
+    TEST_ASSERT_EQUAL(NUM_LINES / 10, search(LOG_INDEX_LEVEL(4), motore, "", &results));
+
+    // Parole intere e prefissi, senza distinzione fra maiuscole e minuscole, anche dopo la fusione dei blocchi
+    TEST_ASSERT_EQUAL(NUM_LINES / 1000, search(0, -1, "guasto", &results));
+    TEST_ASSERT_EQUAL(4007, log_index_result(&results, 4));
+    TEST_ASSERT_EQUAL(NUM_LINES / 1000, search(0, -1, "GUA", &results));
+    TEST_ASSERT_EQUAL(NUM_LINES / 1000, search(0, -1, "guasto inv", &results));
+    TEST_ASSERT_EQUAL(0, search(0, -1, "guasto pompa", &results));
+    TEST_ASSERT_EQUAL(0, search(0, motore, "guasto", &results));
+    TEST_ASSERT_EQUAL(0, search(0, -1, "asto", &results));
+
+    // Le parole corte non scartano blocchi ma vengono verificate riga per riga
+    TEST_ASSERT_EQUAL(1, search(0, -1, "4321", &results));
+    TEST_ASSERT_EQUAL(4321, log_index_result(&results, 0));
+    TEST_ASSERT_EQUAL(111, search(0, -1, "12", &results));
+
+    log_index_deinit(&test_index);
+}
+
+
+static void test_incremental_search(void) {
+    static log_index_results_t results;
+    log_index_filter_t         filter = {.levels = LOG_INDEX_LEVEL(4), .module = -1};
+
+    TEST_ASSERT(log_index_filter_is_empty(&(log_index_filter_t){.module = -1, .text = " ,; "}));
+    TEST_ASSERT(!log_index_filter_is_empty(&filter));
+
+    write_lines("w", 0, 100);
+    log_index_init(&test_index, LOG_PATH);
+    index_all(1 << 20);
+
+    log_index_search_reset(&results);
+    log_index_search(&test_index, &filter, &results);
+    TEST_ASSERT_EQUAL(20, log_index_results_count(&results));
+
+    // Si esaminano solo le righe aggiunte
+    write_lines("a", 100, 10);
+    TEST_ASSERT_EQUAL(LOG_INDEX_GROWN, log_index_update(&test_index, 1 << 20));
+    log_index_search(&test_index, &filter, &results);
+    TEST_ASSERT_EQUAL(22, log_index_results_count(&results));
+    TEST_ASSERT_EQUAL(105, log_index_result(&results, 21));
+
+    log_index_deinit(&test_index);
+}
+
+
+static void test_results_keep_newest(void) {
+    static log_index_results_t results;
+
+    write_lines("w", 0, NUM_LINES);
+    log_index_init(&test_index, LOG_PATH);
+    index_all(1 << 20);
+
+    TEST_ASSERT_EQUAL(LOG_INDEX_RESULTS, search(0, -1, "riga", &results));
+    TEST_ASSERT_EQUAL(NUM_LINES - LOG_INDEX_RESULTS, log_index_result(&results, 0));
+    TEST_ASSERT_EQUAL(NUM_LINES - 1, log_index_result(&results, LOG_INDEX_RESULTS - 1));
+
+    log_index_deinit(&test_index);
+}
+
+
+static void test_rotation(void) {
+    write_lines("w", 0, 100);
+    log_index_init(&test_index, LOG_PATH);
+    index_all(1 << 20);
+
+    TEST_ASSERT_EQUAL(0, rename(LOG_PATH, LOG_PATH ".1"));
+    // Finche' il nuovo file non c'e' si continua con quello aperto
+    TEST_ASSERT_EQUAL(LOG_INDEX_UNCHANGED, log_index_update(&test_index, 1 << 20));
+    TEST_ASSERT_EQUAL(100, log_index_lines(&test_index));
+
+    write_lines("w", 500, 3);
+    TEST_ASSERT_EQUAL(LOG_INDEX_RESET, log_index_update(&test_index, 1 << 20));
+    TEST_ASSERT_EQUAL(3, log_index_lines(&test_index));
+    TEST_ASSERT_EQUAL(500, line_number(0));
+
+    log_index_deinit(&test_index);
+}
+
+
+static void test_truncation(void) {
+    write_lines("w", 0, 3000);
+    log_index_init(&test_index, LOG_PATH);
+    index_all(1 << 20);
+
+    // Le pagine oltre la nuova fine non devono piu' essere lette
+    TEST_ASSERT_EQUAL(0, truncate(LOG_PATH, 100));
+    TEST_ASSERT_EQUAL(LOG_INDEX_RESET, log_index_update(&test_index, 1 << 20));
+    TEST_ASSERT_EQUAL(2, log_index_lines(&test_index));
+    TEST_ASSERT_EQUAL(1, line_number(1));
+
+    TEST_ASSERT_EQUAL(0, truncate(LOG_PATH, 0));
+    TEST_ASSERT_EQUAL(LOG_INDEX_RESET, log_index_update(&test_index, 1 << 20));
+    TEST_ASSERT_EQUAL(0, log_index_lines(&test_index));
+    TEST_ASSERT(log_index_is_complete(&test_index));
+
+    write_lines("a", 7, 1);
+    TEST_ASSERT_EQUAL(LOG_INDEX_GROWN, log_index_update(&test_index, 1 << 20));
+    TEST_ASSERT_EQUAL(7, line_number(0));
+
+    log_index_deinit(&test_index);
+}
+
+
+int main(void) {
+    RUN_TEST(test_lines);
+    RUN_TEST(test_partial_and_crlf_lines);
+    RUN_TEST(test_search);
+    RUN_TEST(test_incremental_search);
+    RUN_TEST(test_results_keep_newest);
+    RUN_TEST(test_rotation);
+    RUN_TEST(test_truncation);
+    return test_report();
+}
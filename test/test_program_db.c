@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "controller/storage/program_db.h"
+#include "test.h"
+
+
+#define DB_PATH      "programmi.db"
+#define CORRUPT_PATH DB_PATH ".corrupt"
+#define DATA_START   (16 + 48 * MAX_PROGRAMS)
+
+
+static void make_program(dryer_program_t *p, const char *filename, size_t num_steps, uint16_t duration) {
+    memset(p, 0, sizeof(dryer_program_t));
+    snprintf(p->filename, sizeof(name_t), "%s", filename);
+    snprintf(p->nomi[LINGUA_ITALIANO], sizeof(name_t), "Programma %s", filename);
+    snprintf(p->nomi[LINGUA_INGLESE], sizeof(name_t), "Program %s", filename);
+    p->num_steps    = num_steps;
+    p->steps_loaded = 1;
+    for (size_t i = 0; i < num_steps; i++) {
+        p->steps[i].type                 = DRYER_PROGRAM_STEP_TYPE_DRYING;
+        p->steps[i].drying.duration      = duration;
+        p->steps[i].drying.temperature   = 60 + i;
+        p->steps[i].drying.rotation_time = 30;
+    }
+}
+
+
+static int save_three(void) {
+    dryer_program_t programs[3];
+    make_program(&programs[0], "1.bin", 2, 300);
+    make_program(&programs[1], "2.bin", 5, 120);
+    make_program(&programs[2], "3.bin", 0, 0);
+    return program_db_save(DB_PATH, 0, NULL, 0, programs, 3);
+}
+
+
+static size_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+
+static void flip_byte(const char *path, long offset) {
+    FILE *f = fopen(path, "r+b");
+    fseek(f, offset, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, offset, SEEK_SET);
+    fputc(c ^ 0xFF, f);
+    fclose(f);
+}
+
+
+static void test_missing_database(void) {
+    storage_program_list_t list;
+    TEST_ASSERT_EQUAL(-1, program_db_load(DB_PATH, &list, 0));
+    TEST_ASSERT_EQUAL(0, list.num_programs);
+}
+
+
+static void test_save_and_load(void) {
+    storage_program_list_t list;
+
+    TEST_ASSERT_EQUAL(0, save_three());
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 0));
+    TEST_ASSERT_EQUAL(3, list.num_programs);
+    TEST_ASSERT(strcmp(list.programs[1].filename, "2.bin") == 0);
+    TEST_ASSERT(strcmp(list.programs[1].nomi[LINGUA_INGLESE], "Program 2.bin") == 0);
+    TEST_ASSERT_EQUAL(5, list.programs[1].num_steps);
+    TEST_ASSERT_EQUAL(64, list.programs[1].steps[4].drying.temperature);
+    TEST_ASSERT_EQUAL(600, list.programs[1].total_time);
+
+    // Solo le intestazioni: gli step restano da caricare, la durata arriva dall'indice
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 1));
+    TEST_ASSERT_EQUAL(3, list.num_programs);
+    TEST_ASSERT_EQUAL(0, list.programs[0].steps_loaded);
+    TEST_ASSERT_EQUAL(2, list.programs[0].num_steps);
+    TEST_ASSERT_EQUAL(600, list.programs[0].total_time);
+
+    dryer_program_t p;
+    TEST_ASSERT_EQUAL(0, program_db_load_program(DB_PATH, "1.bin", &p));
+    TEST_ASSERT_EQUAL(300, p.steps[1].drying.duration);
+    TEST_ASSERT_EQUAL(-1, program_db_load_program(DB_PATH, "4.bin", &p));
+
+    // Nessun file temporaneo lasciato dalla transazione
+    TEST_ASSERT(access(DB_PATH ".tmp", F_OK) < 0);
+}
+
+
+static void test_update_moves_grown_record(void) {
+    storage_program_list_t list;
+    dryer_program_t        p;
+
+    save_three();
+    make_program(&p, "3.bin", MAX_STEPS, 60);
+    TEST_ASSERT_EQUAL(0, program_db_save(DB_PATH, 0, NULL, 0, &p, 1));
+
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 0));
+    TEST_ASSERT_EQUAL(3, list.num_programs);
+    TEST_ASSERT_EQUAL(MAX_STEPS, list.programs[2].num_steps);
+    TEST_ASSERT_EQUAL(5, list.programs[1].num_steps);
+}
+
+
+static void test_index_order_and_remove(void) {
+    storage_program_list_t list;
+    name_t                 names[] = {"3.bin", "1.bin", "", "2.bin"};
+
+    save_three();
+    TEST_ASSERT_EQUAL(0, program_db_save(DB_PATH, 1, names, 4, NULL, 0));
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 1));
+    TEST_ASSERT_EQUAL(3, list.num_programs);
+    TEST_ASSERT(strcmp(list.programs[0].filename, "3.bin") == 0);
+    TEST_ASSERT(strcmp(list.programs[2].filename, "2.bin") == 0);
+
+    TEST_ASSERT_EQUAL(0, program_db_remove(DB_PATH, "1.bin"));
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 1));
+    TEST_ASSERT_EQUAL(2, list.num_programs);
+    TEST_ASSERT(strcmp(list.programs[1].filename, "2.bin") == 0);
+}
+
+
+static void test_refuses_unloaded_steps(void) {
+    storage_program_list_t list;
+    dryer_program_t        p;
+
+    save_three();
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 1));
+
+    // Un programma con i soli nomi non deve cancellare gli step in archivio
+    p = list.programs[1];
+    snprintf(p.nomi[LINGUA_ITALIANO], sizeof(name_t), "Rinominato");
+    TEST_ASSERT(program_db_save(DB_PATH, 0, NULL, 0, &p, 1) != 0);
+
+    TEST_ASSERT_EQUAL(0, program_db_load_program(DB_PATH, "2.bin", &p));
+    TEST_ASSERT_EQUAL(5, p.num_steps);
+    TEST_ASSERT(strcmp(p.nomi[LINGUA_ITALIANO], "Programma 2.bin") == 0);
+}
+
+
+static void test_corrupt_index_is_set_aside(void) {
+    storage_program_list_t list;
+    dryer_program_t        p;
+
+    save_three();
+    size_t size = file_size(DB_PATH);
+    flip_byte(DB_PATH, 16 + 40);
+
+    TEST_ASSERT_EQUAL(1, program_db_load(DB_PATH, &list, 0));
+    TEST_ASSERT_EQUAL(0, list.num_programs);
+    TEST_ASSERT(access(DB_PATH, F_OK) < 0);
+    TEST_ASSERT_EQUAL(size, file_size(CORRUPT_PATH));
+    TEST_ASSERT_EQUAL(1, program_db_load_program(CORRUPT_PATH, "1.bin", &p));
+
+    // Un salvataggio su un archivio corrotto fallisce senza riscriverlo
+    save_three();
+    flip_byte(DB_PATH, 0);
+    make_program(&p, "4.bin", 1, 10);
+    TEST_ASSERT(program_db_save(DB_PATH, 0, NULL, 0, &p, 1) != 0);
+    TEST_ASSERT(access(DB_PATH, F_OK) < 0);
+    TEST_ASSERT_EQUAL(size, file_size(CORRUPT_PATH));
+}
+
+
+static void test_truncated_database_is_set_aside(void) {
+    storage_program_list_t list;
+
+    save_three();
+    TEST_ASSERT_EQUAL(0, truncate(DB_PATH, DATA_START - 1));
+    TEST_ASSERT_EQUAL(1, program_db_load(DB_PATH, &list, 1));
+    TEST_ASSERT(access(DB_PATH, F_OK) < 0);
+    TEST_ASSERT_EQUAL(DATA_START - 1, file_size(CORRUPT_PATH));
+
+    // Record troncati: l'indice e' integro ma punta oltre la fine del file
+    save_three();
+    TEST_ASSERT_EQUAL(0, truncate(DB_PATH, DATA_START + 8));
+    TEST_ASSERT_EQUAL(1, program_db_load(DB_PATH, &list, 0));
+}
+
+
+static void test_corrupt_record_is_skipped(void) {
+    storage_program_list_t list;
+    dryer_program_t        p;
+
+    save_three();
+    // Il primo record inizia subito dopo l'indice
+    flip_byte(DB_PATH, DATA_START + 4);
+
+    TEST_ASSERT_EQUAL(0, program_db_load(DB_PATH, &list, 0));
+    TEST_ASSERT_EQUAL(2, list.num_programs);
+    TEST_ASSERT(strcmp(list.programs[0].filename, "2.bin") == 0);
+    TEST_ASSERT_EQUAL(1, program_db_load_program(DB_PATH, "1.bin", &p));
+    TEST_ASSERT_EQUAL(0, program_db_load_program(DB_PATH, "2.bin", &p));
+}
+
+
+static void test_validate_image(void) {
+    uint8_t image[8192];
+
+    save_three();
+    FILE  *f    = fopen(DB_PATH, "rb");
+    size_t size = fread(image, 1, sizeof(image), f);
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(3, program_db_validate(image, size));
+    image[DATA_START + 4] ^= 0xFF;
+    TEST_ASSERT_EQUAL(-1, program_db_validate(image, size));
+    TEST_ASSERT_EQUAL(-1, program_db_validate(image, DATA_START - 1));
+}
+
+
+static void test_parse_program_bounds(void) {
+    uint8_t         buffer[MAX_PROGRAM_SIZE];
+    dryer_program_t p;
+
+    make_program(&p, "1.bin", 3, 100);
+    size_t len = program_serialize(buffer, &p);
+
+    TEST_ASSERT_EQUAL(0, program_db_parse_program(buffer, len, &p));
+    TEST_ASSERT_EQUAL(3, p.num_steps);
+    TEST_ASSERT_EQUAL(-1, program_db_parse_program(buffer, len - 1, &p));
+    TEST_ASSERT_EQUAL(-1, program_db_parse_program(buffer, 10, &p));
+}
+
+
+int main(void) {
+    RUN_TEST(test_missing_database);
+    RUN_TEST(test_save_and_load);
+    RUN_TEST(test_update_moves_grown_record);
+    RUN_TEST(test_index_order_and_remove);
+    RUN_TEST(test_refuses_unloaded_steps);
+    RUN_TEST(test_corrupt_index_is_set_aside);
+    RUN_TEST(test_truncated_database_is_set_aside);
+    RUN_TEST(test_corrupt_record_is_skipped);
+    RUN_TEST(test_validate_image);
+    RUN_TEST(test_parse_program_bounds);
+    return test_report();
+}
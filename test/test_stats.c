@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "controller/storage/stats_store.h"
+#include "model/stats_tracker.h"
+#include "test.h"
+
+
+#define STATS_PATH "statistiche.bin"
+#define NUM_SLOTS  16
+#define SLOT_SIZE  512
+#define TODAY      20000
+
+
+static size_t file_size(void) {
+    struct stat st;
+    return stat(STATS_PATH, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+
+static void flip_byte(long offset) {
+    FILE *f = fopen(STATS_PATH, "r+b");
+    fseek(f, offset, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, offset, SEEK_SET);
+    fputc(c ^ 0xFF, f);
+    fclose(f);
+}
+
+
+// Salva `count` volte, con il totale dei cicli completi che conta i salvataggi
+static int save_many(size_t count) {
+    stats_tracker_t tracker;
+    stats_tracker_init(&tracker);
+
+    for (size_t i = 1; i <= count; i++) {
+        statistics_t sample = {.complete_cycles = i, .work_time = 60 * i};
+        stats_tracker_update(&tracker, &sample, TODAY);
+        if (stats_store_save(STATS_PATH, &tracker)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static void test_missing_store(void) {
+    stats_tracker_t tracker;
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &tracker));
+    TEST_ASSERT_EQUAL(0, tracker.valid);
+}
+
+
+static void test_save_and_load(void) {
+    stats_tracker_t tracker, loaded;
+    statistics_t    stats;
+
+    stats_tracker_init(&tracker);
+    statistics_t first = {.complete_cycles = 10, .partial_cycles = 2, .active_time = 1000, .heating_time = 300};
+    stats_tracker_update(&tracker, &first, TODAY - 1);
+    stats_tracker_cycle_begin(&tracker);
+    stats_tracker_update(&tracker, &first, TODAY);
+    statistics_t second = {.complete_cycles = 11, .partial_cycles = 2, .active_time = 1600, .heating_time = 400};
+    stats_tracker_update(&tracker, &second, TODAY);
+    stats_tracker_cycle_end(&tracker);
+    stats_tracker_update(&tracker, &second, TODAY);
+
+    TEST_ASSERT_EQUAL(0, stats_store_save(STATS_PATH, &tracker));
+    TEST_ASSERT_EQUAL(SLOT_SIZE, file_size());
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &loaded));
+    TEST_ASSERT_EQUAL(1, loaded.valid);
+
+    stats_tracker_get(&loaded, STATS_PERIOD_LIFETIME, TODAY, &stats);
+    TEST_ASSERT_EQUAL(11, stats.complete_cycles);
+    TEST_ASSERT_EQUAL(1600, stats.active_time);
+    stats_tracker_get(&loaded, STATS_PERIOD_TODAY, TODAY, &stats);
+    TEST_ASSERT_EQUAL(1, stats.complete_cycles);
+    TEST_ASSERT_EQUAL(100, stats.heating_time);
+    stats_tracker_get(&loaded, STATS_PERIOD_LAST_CYCLE, TODAY, &stats);
+    TEST_ASSERT_EQUAL(1, stats.complete_cycles);
+    TEST_ASSERT_EQUAL(600, stats.active_time);
+}
+
+
+static void test_slots_rotate(void) {
+    stats_tracker_t tracker;
+    statistics_t    stats;
+
+    TEST_ASSERT_EQUAL(0, save_many(NUM_SLOTS + 3));
+    // Le scritture si distribuiscono su tutte le copie senza far crescere il file
+    TEST_ASSERT_EQUAL(NUM_SLOTS * SLOT_SIZE, file_size());
+
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &tracker));
+    stats_tracker_get(&tracker, STATS_PERIOD_LIFETIME, TODAY, &stats);
+    TEST_ASSERT_EQUAL(NUM_SLOTS + 3, stats.complete_cycles);
+}
+
+
+static void test_corrupt_slot_falls_back(void) {
+    stats_tracker_t tracker;
+    statistics_t    stats;
+
+    save_many(NUM_SLOTS + 3);
+    // La copia piu' recente e' la terza: una scrittura interrotta lascia valida la precedente
+    flip_byte(2 * SLOT_SIZE + 20);
+
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &tracker));
+    stats_tracker_get(&tracker, STATS_PERIOD_LIFETIME, TODAY, &stats);
+    TEST_ASSERT_EQUAL(NUM_SLOTS + 2, stats.complete_cycles);
+
+    // Il salvataggio successivo riprende dopo la copia valida piu' recente
+    TEST_ASSERT_EQUAL(0, save_many(NUM_SLOTS + 4));
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &tracker));
+    stats_tracker_get(&tracker, STATS_PERIOD_LIFETIME, TODAY, &stats);
+    TEST_ASSERT_EQUAL(NUM_SLOTS + 4, stats.complete_cycles);
+}
+
+
+static void test_all_slots_corrupt(void) {
+    stats_tracker_t tracker;
+
+    save_many(2);
+    flip_byte(0);
+    flip_byte(SLOT_SIZE + SLOT_SIZE - 1);
+
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &tracker));
+    TEST_ASSERT_EQUAL(0, tracker.valid);
+
+    // Un file troncato a meta' copia non e' letto oltre la fine
+    save_many(1);
+    TEST_ASSERT_EQUAL(0, truncate(STATS_PATH, SLOT_SIZE / 2));
+    TEST_ASSERT_EQUAL(0, stats_store_load(STATS_PATH, &tracker));
+    TEST_ASSERT_EQUAL(0, tracker.valid);
+}
+
+
+static void test_restore_before_reading(void) {
+    stats_tracker_t tracker, saved;
+    statistics_t    stats;
+
+    stats_tracker_init(&saved);
+    statistics_t before = {.complete_cycles = 3, .work_time = 500};
+    stats_tracker_update(&saved, &before, TODAY - 1);
+    before.complete_cycles = 5;
+    stats_tracker_update(&saved, &before, TODAY - 1);
+
+    // Nessuna lettura ancora: la prossima attribuisce a oggi quanto fatto da spento
+    stats_tracker_init(&tracker);
+    stats_tracker_restore(&tracker, &saved, TODAY);
+    statistics_t sample = {.complete_cycles = 6, .work_time = 800};
+    stats_tracker_update(&tracker, &sample, TODAY);
+
+    stats_tracker_get(&tracker, STATS_PERIOD_TODAY, TODAY, &stats);
+    TEST_ASSERT_EQUAL(1, stats.complete_cycles);
+    TEST_ASSERT_EQUAL(300, stats.work_time);
+    stats_tracker_get(&tracker, STATS_PERIOD_WEEK, TODAY, &stats);
+    TEST_ASSERT_EQUAL(3, stats.complete_cycles);
+}
+
+
+static void test_restore_after_reading(void) {
+    stats_tracker_t tracker, saved;
+    statistics_t    stats;
+
+    stats_tracker_init(&saved);
+    statistics_t before = {.complete_cycles = 3, .work_time = 500};
+    stats_tracker_update(&saved, &before, TODAY - 1);
+    before.complete_cycles = 5;
+    stats_tracker_update(&saved, &before, TODAY - 1);
+    saved.last_cycle.complete_cycles = 1;
+
+    // Le letture arrivano prima del salvataggio: contano solo i loro totali
+    stats_tracker_init(&tracker);
+    statistics_t sample = {.complete_cycles = 8, .work_time = 1000};
+    stats_tracker_update(&tracker, &sample, TODAY);
+    stats_tracker_cycle_begin(&tracker);
+    sample.complete_cycles = 9;
+    sample.work_time       = 1100;
+    stats_tracker_update(&tracker, &sample, TODAY);
+
+    stats_tracker_restore(&tracker, &saved, TODAY);
+
+    stats_tracker_get(&tracker, STATS_PERIOD_LIFETIME, TODAY, &stats);
+    TEST_ASSERT_EQUAL(9, stats.complete_cycles);
+    stats_tracker_get(&tracker, STATS_PERIOD_TODAY, TODAY, &stats);
+    TEST_ASSERT_EQUAL(4, stats.complete_cycles);
+    TEST_ASSERT_EQUAL(600, stats.work_time);
+    stats_tracker_get(&tracker, STATS_PERIOD_WEEK, TODAY, &stats);
+    TEST_ASSERT_EQUAL(6, stats.complete_cycles);
+    stats_tracker_get(&tracker, STATS_PERIOD_LAST_CYCLE, TODAY, &stats);
+    TEST_ASSERT_EQUAL(1, stats.complete_cycles);
+
+    // Il ciclo in corso resta quello delle letture
+    TEST_ASSERT_EQUAL(STATS_CYCLE_RUNNING, tracker.cycle_state);
+
+    // Un salvataggio non valido non tocca nulla
+    stats_tracker_init(&saved);
+    stats_tracker_restore(&tracker, &saved, TODAY);
+    stats_tracker_get(&tracker, STATS_PERIOD_TODAY, TODAY, &stats);
+    TEST_ASSERT_EQUAL(4, stats.complete_cycles);
+}
+
+
+int main(void) {
+    RUN_TEST(test_missing_store);
+    RUN_TEST(test_save_and_load);
+    RUN_TEST(test_slots_rotate);
+    RUN_TEST(test_corrupt_slot_falls_back);
+    RUN_TEST(test_all_slots_corrupt);
+    RUN_TEST(test_restore_before_reading);
+    RUN_TEST(test_restore_after_reading);
+    return test_report();
+}
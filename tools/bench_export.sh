@@ -0,0 +1,33 @@
+#!/bin/sh
+# Misura i tempi di esportazione dell'archivio macchina con le varie compressioni.
+# Richiede i permessi di root per montare tmpfs e l'immagine vfat in loop.
+# Uso: sudo tools/bench_export.sh [tmpfs|vfat]
+set -e
+
+MEDIA=${1:-tmpfs}
+MOUNT=$(mktemp -d)
+
+cleanup() {
+    umount "$MOUNT" 2>/dev/null || true
+    rmdir "$MOUNT"
+    [ -n "$IMAGE" ] && rm -f "$IMAGE"
+}
+trap cleanup EXIT
+
+case "$MEDIA" in
+    tmpfs)
+        mount -t tmpfs -o size=64m tmpfs "$MOUNT"
+        ;;
+    vfat)
+        IMAGE=$(mktemp)
+        dd if=/dev/zero of="$IMAGE" bs=1M count=64 status=none
+        mkfs.vfat "$IMAGE" >/dev/null
+        mount -o loop "$IMAGE" "$MOUNT"
+        ;;
+    *)
+        echo "Supporto sconosciuto: $MEDIA" >&2
+        exit 1
+        ;;
+esac
+
+DS2021_BENCHMARK_EXPORT="$MOUNT" ./simulated
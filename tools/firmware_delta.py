@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# Genera una patch per l'aggiornamento firmware differenziale (DS2021.delta).
+# Uso: firmware_delta.py vecchio/DS2021.bin nuovo/DS2021.bin DS2021.delta
+#
+# Formato (interi a 32 bit big endian), compresso con gzip:
+#   "DSDELTA1" | dimensione origine | CRC origine | dimensione destinazione | CRC destinazione
+#   record: byte da sommare all'origine | byte nuovi | spostamento con segno nell'origine
+#           seguiti dalle differenze e dai byte nuovi
+# Come in bsdiff le zone corrispondenti sono salvate come differenze, quasi tutte nulle
+# quando cambiano solo gli indirizzi, e quindi molto comprimibili.
+import gzip
+import struct
+import sys
+import zlib
+
+MAGIC = b"DSDELTA1"
+BLOCK = 16
+STRIDE = 4
+MAX_STALL = 256
+
+
+def build_index(old):
+    index = {}
+    for i in range(0, len(old) - BLOCK + 1, STRIDE):
+        index.setdefault(old[i:i + BLOCK], i)
+    return index
+
+
+def extend_forward(old, new, old_pos, new_pos):
+    # Estensione approssimata: si tiene la lunghezza con il miglior rapporto tra byte uguali e diversi
+    score, best_score, best_len, i = 0, 0, 0, 0
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    while i < limit and i - best_len < MAX_STALL:
+        if old[old_pos + i] == new[new_pos + i]:
+            score += 1
+        i += 1
+        if score * 2 - i > best_score * 2 - best_len:
+            best_score, best_len = score, i
+    return best_len
+
+
+def find_matches(old, new):
+    index = build_index(old)
+    matches = []
+    pos, last_end = 0, 0
+    while pos <= len(new) - BLOCK:
+        old_pos = index.get(new[pos:pos + BLOCK])
+        if old_pos is None:
+            pos += 1
+            continue
+
+        new_start, old_start = pos, old_pos
+        while new_start > last_end and old_start > 0 and new[new_start - 1] == old[old_start - 1]:
+            new_start -= 1
+            old_start -= 1
+
+        length = extend_forward(old, new, old_start, new_start)
+        if length == 0:
+            pos += 1
+            continue
+
+        matches.append((new_start, old_start, length))
+        pos = last_end = new_start + length
+    return matches
+
+
+def make_patch(old, new):
+    matches = find_matches(old, new)
+    out = bytearray(MAGIC)
+    out += struct.pack(">IIII", len(old), zlib.crc32(old) & 0xFFFFFFFF, len(new), zlib.crc32(new) & 0xFFFFFFFF)
+
+    # Primo record: solo byte nuovi fino alla prima corrispondenza
+    first_new = matches[0][0] if matches else len(new)
+    first_old = matches[0][1] if matches else 0
+    out += struct.pack(">IIi", 0, first_new, first_old)
+    out += new[:first_new]
+
+    for k, (new_start, old_start, length) in enumerate(matches):
+        next_new, next_old = (matches[k + 1][0], matches[k + 1][1]) if k + 1 < len(matches) else (len(new), old_start + length)
+        extra = new[new_start + length:next_new]
+        out += struct.pack(">IIi", length, len(extra), next_old - (old_start + length))
+        out += bytes((new[new_start + i] - old[old_start + i]) & 0xFF for i in range(length))
+        out += extra
+    return bytes(out)
+
+
+def apply_patch(old, patch):
+    # Stesso algoritmo di storage_apply_firmware_delta, usato per verificare la patch generata
+    _, old_size, old_crc, new_size, new_crc = struct.unpack(">8sIIII", patch[:24])
+    assert old_size == len(old) and old_crc == zlib.crc32(old) & 0xFFFFFFFF
+    new, pos, old_pos = bytearray(), 24, 0
+    while len(new) < new_size:
+        diff_len, extra_len, seek = struct.unpack(">IIi", patch[pos:pos + 12])
+        pos += 12
+        new += bytes((patch[pos + i] + old[old_pos + i]) & 0xFF for i in range(diff_len))
+        pos += diff_len
+        old_pos += diff_len
+        new += patch[pos:pos + extra_len]
+        pos += extra_len
+        old_pos += seek
+    assert len(new) == new_size and zlib.crc32(new) & 0xFFFFFFFF == new_crc
+    return bytes(new)
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(f"Uso: {sys.argv[0]} vecchio.bin nuovo.bin patch.delta")
+        sys.exit(1)
+
+    with open(sys.argv[1], "rb") as f:
+        old = f.read()
+    with open(sys.argv[2], "rb") as f:
+        new = f.read()
+
+    patch = make_patch(old, new)
+    assert apply_patch(old, patch) == new
+
+    compressed = gzip.compress(patch, 9)
+    with open(sys.argv[3], "wb") as f:
+        f.write(compressed)
+
+    print(f"Origine {len(old)} byte, destinazione {len(new)} byte, patch {len(compressed)} byte "
+          f"({100 * len(compressed) / max(len(new), 1):.1f}%)")
+
+
+if __name__ == "__main__":
+    main()
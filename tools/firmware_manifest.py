@@ -0,0 +1,28 @@
+#!/usr/bin/env python3
+# Genera il manifest letto dall'aggiornamento firmware (DS2021.bin -> DS2021.bin.manifest)
+import os
+import sys
+import zlib
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(f"Uso: {sys.argv[0]} DS2021.bin")
+        sys.exit(1)
+
+    path = sys.argv[1]
+    crc = 0
+    with open(path, "rb") as f:
+        while True:
+            block = f.read(128 * 1024)
+            if not block:
+                break
+            crc = zlib.crc32(block, crc)
+
+    with open(path + ".manifest", "w") as f:
+        f.write(f"size={os.path.getsize(path)}\n")
+        f.write(f"crc32={crc & 0xFFFFFFFF:08X}\n")
+
+
+if __name__ == "__main__":
+    main()